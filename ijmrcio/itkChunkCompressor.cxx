@@ -0,0 +1,324 @@
+#include "itkChunkCompressor.h"
+#include "itk_zlib.h"
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+typedef itk::Local::ChunkCompressor::SizeType SizeType;
+
+// The LZ codec is a sequence of a token byte, whose high 4 bits are
+// the number of literals and low 4 bits the length of the match less
+// the minimum, the literals, and the 16-bit little endian offset
+// back to the match. A length of 15 in the token is continued in the
+// following bytes, each adding up to 255. The last sequence has only
+// literals.
+const unsigned int lzMinimumMatch = 4;
+const unsigned int lzHashBits = 14;
+const SizeType lzMaximumOffset = 65535;
+
+inline unsigned int LZRead32( const unsigned char *p )
+{
+  unsigned int v;
+  memcpy( &v, p, 4 );
+  return v;
+}
+
+inline unsigned int LZHash( unsigned int v )
+{
+  return ( v * 2654435761U ) >> ( 32 - lzHashBits );
+}
+
+// writes the continuation bytes of a length, returns false if the
+// output is full
+inline bool LZWriteLength( unsigned char *&op, const unsigned char *oend, SizeType length )
+{
+  for ( ; length >= 255; length -= 255 )
+    {
+    if ( op >= oend )
+      {
+      return false;
+      }
+    *op++ = 255;
+    }
+  if ( op >= oend )
+    {
+    return false;
+    }
+  *op++ = static_cast<unsigned char>( length );
+  return true;
+}
+
+// reads the continuation bytes of a length, returns false at the end
+// of the input
+inline bool LZReadLength( const unsigned char *&ip, const unsigned char *iend, SizeType &length )
+{
+  unsigned char b;
+  do
+    {
+    if ( ip >= iend )
+      {
+      return false;
+      }
+    b = *ip++;
+    length += b;
+    }
+  while ( b == 255 );
+  return true;
+}
+
+// writes a sequence of the literals [anchor,anchor+numberOfLiterals)
+// and a match, without a match if matchLength is zero
+bool LZWriteSequence( unsigned char *&op, const unsigned char *oend,
+                      const unsigned char *anchor, SizeType numberOfLiterals,
+                      SizeType offset, SizeType matchLength )
+{
+  if ( op >= oend )
+    {
+    return false;
+    }
+  unsigned char *token = op++;
+  const SizeType matchCode = matchLength ? matchLength - lzMinimumMatch : 0;
+  *token = static_cast<unsigned char>( ( ( numberOfLiterals < 15 ? numberOfLiterals : 15 ) << 4 ) |
+                                       ( matchCode < 15 ? matchCode : 15 ) );
+
+  if ( numberOfLiterals >= 15 && !LZWriteLength( op, oend, numberOfLiterals - 15 ) )
+    {
+    return false;
+    }
+  if ( oend - op < static_cast<std::ptrdiff_t>( numberOfLiterals ) )
+    {
+    return false;
+    }
+  memcpy( op, anchor, static_cast<size_t>( numberOfLiterals ) );
+  op += numberOfLiterals;
+
+  if ( matchLength )
+    {
+    if ( oend - op < 2 )
+      {
+      return false;
+      }
+    *op++ = static_cast<unsigned char>( offset & 0xff );
+    *op++ = static_cast<unsigned char>( offset >> 8 );
+    if ( matchCode >= 15 && !LZWriteLength( op, oend, matchCode - 15 ) )
+      {
+      return false;
+      }
+    }
+  return true;
+}
+
+
+SizeType LZCompress( const unsigned char *source, SizeType size,
+                     unsigned char *destination, SizeType destinationSize )
+{
+  // the positions plus one of the last occurrence of each hashed four
+  // bytes, zero is empty
+  std::vector<SizeType> table( 1 << lzHashBits, 0 );
+
+  unsigned char *op = destination;
+  const unsigned char *oend = destination + destinationSize;
+
+  SizeType anchor = 0;
+  SizeType ip = 0;
+  while ( ip + lzMinimumMatch <= size )
+    {
+    const unsigned int sequence = LZRead32( source + ip );
+    SizeType &entry = table[ LZHash( sequence ) ];
+    const SizeType candidate = entry;
+    entry = ip + 1;
+
+    if ( candidate == 0 || ip - ( candidate - 1 ) > lzMaximumOffset ||
+         LZRead32( source + candidate - 1 ) != sequence )
+      {
+      ++ip;
+      continue;
+      }
+
+    const SizeType match = candidate - 1;
+    SizeType matchLength = lzMinimumMatch;
+    while ( ip + matchLength < size && source[match + matchLength] == source[ip + matchLength] )
+      {
+      ++matchLength;
+      }
+
+    if ( !LZWriteSequence( op, oend, source + anchor, ip - anchor, ip - match, matchLength ) )
+      {
+      return 0;
+      }
+    ip += matchLength;
+    anchor = ip;
+    }
+
+  if ( !LZWriteSequence( op, oend, source + anchor, size - anchor, 0, 0 ) )
+    {
+    return 0;
+    }
+  return op - destination;
+}
+
+
+bool LZDecompress( const unsigned char *source, SizeType size,
+                   unsigned char *destination, SizeType destinationSize )
+{
+  const unsigned char *ip = source;
+  const unsigned char *iend = source + size;
+  unsigned char *op = destination;
+  unsigned char *oend = destination + destinationSize;
+
+  while ( ip < iend )
+    {
+    const unsigned char token = *ip++;
+
+    SizeType numberOfLiterals = token >> 4;
+    if ( numberOfLiterals == 15 && !LZReadLength( ip, iend, numberOfLiterals ) )
+      {
+      return false;
+      }
+    if ( iend - ip < static_cast<std::ptrdiff_t>( numberOfLiterals ) ||
+         oend - op < static_cast<std::ptrdiff_t>( numberOfLiterals ) )
+      {
+      return false;
+      }
+    memcpy( op, ip, static_cast<size_t>( numberOfLiterals ) );
+    ip += numberOfLiterals;
+    op += numberOfLiterals;
+
+    if ( ip == iend )
+      {
+      // the last sequence, which has no match
+      return op == oend;
+      }
+
+    if ( iend - ip < 2 )
+      {
+      return false;
+      }
+    const SizeType offset = ip[0] | ( ip[1] << 8 );
+    ip += 2;
+
+    SizeType matchLength = token & 15;
+    if ( matchLength == 15 && !LZReadLength( ip, iend, matchLength ) )
+      {
+      return false;
+      }
+    matchLength += lzMinimumMatch;
+
+    if ( offset == 0 || offset > static_cast<SizeType>( op - destination ) ||
+         oend - op < static_cast<std::ptrdiff_t>( matchLength ) )
+      {
+      return false;
+      }
+
+    // the match may overlap the bytes being written
+    const unsigned char *match = op - offset;
+    for ( SizeType i = 0; i < matchLength; ++i )
+      {
+      op[i] = match[i];
+      }
+    op += matchLength;
+    }
+
+  // the input ended without the last sequence
+  return false;
+}
+
+}
+
+namespace itk
+{
+namespace Local
+{
+
+bool ChunkCompressor::IsCodecSupported( int codec )
+{
+  return codec == NoCompression || codec == ZlibCompression || codec == LZCompression;
+}
+
+
+const char *ChunkCompressor::GetCodecName( int codec )
+{
+  switch ( codec )
+    {
+    case NoCompression:
+      return "None";
+    case ZlibCompression:
+      return "Zlib";
+    case LZCompression:
+      return "LZ";
+    default:
+      return "Unknown";
+    }
+}
+
+
+ChunkCompressor::SizeType ChunkCompressor::GetCompressBound( CodecType codec, SizeType size )
+{
+  switch ( codec )
+    {
+    case ZlibCompression:
+      return static_cast<SizeType>( compressBound( static_cast<uLong>( size ) ) );
+    case LZCompression:
+      return size + size / 255 + 16;
+    default:
+      return size;
+    }
+}
+
+
+ChunkCompressor::SizeType ChunkCompressor::Compress( CodecType codec, const void *source, SizeType size,
+                                                     void *destination, SizeType destinationSize )
+{
+  SizeType compressedSize = 0;
+  switch ( codec )
+    {
+    case ZlibCompression:
+      {
+      uLongf length = static_cast<uLongf>( destinationSize );
+      if ( compress2( static_cast<Bytef *>( destination ), &length,
+                      static_cast<const Bytef *>( source ), static_cast<uLong>( size ),
+                      Z_DEFAULT_COMPRESSION ) == Z_OK )
+        {
+        compressedSize = length;
+        }
+      break;
+      }
+    case LZCompression:
+      compressedSize = LZCompress( static_cast<const unsigned char *>( source ), size,
+                                   static_cast<unsigned char *>( destination ), destinationSize );
+      break;
+    default:
+      break;
+    }
+
+  // the chunk is stored as it is when compression does not help
+  return ( compressedSize < size ) ? compressedSize : 0;
+}
+
+
+bool ChunkCompressor::Decompress( CodecType codec, const void *source, SizeType size,
+                                  void *destination, SizeType destinationSize )
+{
+  switch ( codec )
+    {
+    case ZlibCompression:
+      {
+      uLongf length = static_cast<uLongf>( destinationSize );
+      return uncompress( static_cast<Bytef *>( destination ), &length,
+                         static_cast<const Bytef *>( source ), static_cast<uLong>( size ) ) == Z_OK &&
+        static_cast<SizeType>( length ) == destinationSize;
+      }
+    case LZCompression:
+      return LZDecompress( static_cast<const unsigned char *>( source ), size,
+                           static_cast<unsigned char *>( destination ), destinationSize );
+    default:
+      return false;
+    }
+}
+
+} // end namespace Local
+} // end namespace itk
@@ -0,0 +1,67 @@
+#ifndef __itkChunkCompressor_h
+#define __itkChunkCompressor_h
+
+#include "itkImageIOBase.h"
+
+namespace itk
+{
+namespace Local
+{
+
+/** \class ChunkCompressor
+ *
+ * \brief Compresses and decompresses independent chunks of image
+ * data
+ *
+ * Each chunk is compressed on its own, so that any chunk of a file
+ * can be decompressed without the others, and chunks can be
+ * compressed by several threads at once. The codecs are the deflate
+ * of zlib, and a fast LZ77 codec in the manner of LZ4, which trades
+ * compression for speed. Multi-byte components compress much better
+ * after a SIMDByteShuffler shuffle. All methods are thread safe.
+ *
+ * \sa SIMDByteShuffler
+ */
+class ITK_EXPORT ChunkCompressor
+{
+public:
+  typedef ImageIOBase::SizeType SizeType;
+
+  /** the compression methods, the values are stored in files */
+  typedef enum { NoCompression = 0, ZlibCompression = 1, LZCompression = 2 } CodecType;
+
+  /** \brief Returns true if codec is a known compression method */
+  static bool IsCodecSupported( int codec );
+
+  /** \brief Returns the name of the codec */
+  static const char *GetCodecName( int codec );
+
+  /** \brief Returns the number of bytes of output buffer needed to
+   * compress size bytes */
+  static SizeType GetCompressBound( CodecType codec, SizeType size );
+
+  /** \brief Compresses size bytes of source into destination
+   *
+   * Returns the number of compressed bytes, or zero if they would be
+   * no smaller than size, where the chunk should be stored
+   * uncompressed. The destination must hold GetCompressBound bytes.
+   */
+  static SizeType Compress( CodecType codec, const void *source, SizeType size,
+                            void *destination, SizeType destinationSize );
+
+  /** \brief Decompresses size bytes of source into exactly
+   * destinationSize bytes of destination
+   *
+   * Returns false if the data is corrupt or is not of that size.
+   */
+  static bool Decompress( CodecType codec, const void *source, SizeType size,
+                          void *destination, SizeType destinationSize );
+
+private:
+  ChunkCompressor(); //purposely not implemented
+};
+
+} // end namespace Local
+} // end namespace itk
+
+#endif // __itkChunkCompressor_h
@@ -0,0 +1,165 @@
+#include "itkIORegionChunkSequence.h"
+
+namespace itk
+{
+namespace Local
+{
+
+IORegionChunkSequence::IORegionChunkSequence()
+  : m_IsListed( true ),
+    m_NumberOfChunks( 0 ),
+    m_LargestChunkSize( 0 ),
+    m_SizeOfRegion( 0 ),
+    m_FirstPosition( 0 )
+{
+}
+
+
+IORegionChunkSequence::IORegionChunkSequence( const ChunkContainer &chunks )
+  : m_IsListed( true ),
+    m_NumberOfChunks( 0 ),
+    m_LargestChunkSize( 0 ),
+    m_SizeOfRegion( 0 ),
+    m_FirstPosition( 0 )
+{
+  ChunkContainer copy( chunks );
+  this->SetChunks( copy );
+}
+
+
+void IORegionChunkSequence::SetImageLayout( const ImageIOBase *io, const ImageIORegion &region,
+                                            SizeType dataPosition, SizeType pixelSize )
+{
+  m_IsListed = false;
+  m_Chunks.clear();
+  m_OuterSizes.clear();
+  m_OuterStrides.clear();
+
+  const unsigned int dimension = region.GetImageDimension();
+
+  // the position of the index of the region, and the stride of each
+  // dimension in the file
+  std::vector<SizeType> strides( dimension );
+  SizeType stride = pixelSize;
+  m_FirstPosition = dataPosition;
+  for ( unsigned int i = 0; i < dimension; ++i )
+    {
+    strides[i] = stride;
+    m_FirstPosition += stride * region.GetIndex( i );
+    stride *= io->GetDimensions( i );
+    }
+
+  // compute the number of continuous bytes in the file
+  SizeType sizeOfChunk = 1;
+  unsigned int movingDirection = 0;
+  do
+    {
+    sizeOfChunk *= ( movingDirection < dimension ) ? region.GetSize( movingDirection ) : 1;
+    ++movingDirection;
+    }
+  while ( movingDirection < dimension &&
+          region.GetSize( movingDirection-1 ) == io->GetDimensions( movingDirection-1 ) );
+  sizeOfChunk *= pixelSize;
+
+  m_NumberOfChunks = ( sizeOfChunk > 0 ) ? 1 : 0;
+  for ( unsigned int i = movingDirection; i < dimension; ++i )
+    {
+    m_OuterSizes.push_back( region.GetSize( i ) );
+    m_OuterStrides.push_back( strides[i] );
+    m_NumberOfChunks *= region.GetSize( i );
+    }
+
+  m_LargestChunkSize = ( m_NumberOfChunks > 0 ) ? sizeOfChunk : 0;
+  m_SizeOfRegion = m_NumberOfChunks * m_LargestChunkSize;
+}
+
+
+void IORegionChunkSequence::SetChunks( ChunkContainer &chunks )
+{
+  m_IsListed = true;
+  m_Chunks.swap( chunks );
+  chunks.clear();
+  m_OuterSizes.clear();
+  m_OuterStrides.clear();
+  m_FirstPosition = 0;
+
+  m_NumberOfChunks = static_cast<SizeType>( m_Chunks.size() );
+  m_LargestChunkSize = 0;
+  m_SizeOfRegion = 0;
+  for ( ChunkContainer::const_iterator chunk = m_Chunks.begin(); chunk != m_Chunks.end(); ++chunk )
+    {
+    m_LargestChunkSize = vnl_math_max( m_LargestChunkSize, chunk->size );
+    m_SizeOfRegion += chunk->size;
+    }
+}
+
+
+IORegionChunkSequence::Chunk IORegionChunkSequence::GetChunk( SizeType n ) const
+{
+  if ( m_IsListed )
+    {
+    return m_Chunks[ static_cast< ::size_t >( n ) ];
+    }
+
+  // the number is split into an index for each dimension above the
+  // chunk, the lowest varying fastest
+  Chunk chunk;
+  chunk.filePosition = m_FirstPosition;
+  chunk.bufferOffset = n * m_LargestChunkSize;
+  chunk.size = m_LargestChunkSize;
+  for ( ::size_t i = 0; i < m_OuterSizes.size(); ++i )
+    {
+    chunk.filePosition += ( n % m_OuterSizes[i] ) * m_OuterStrides[i];
+    n /= m_OuterSizes[i];
+    }
+  return chunk;
+}
+
+
+IORegionChunkSequence::ConstIterator IORegionChunkSequence::Begin( void ) const
+{
+  return this->Begin( 0, m_SizeOfRegion );
+}
+
+
+IORegionChunkSequence::ConstIterator IORegionChunkSequence::Begin( SizeType bufferBegin, SizeType bufferEnd ) const
+{
+  ConstIterator it;
+  it.m_Sequence = this;
+  it.m_BufferBegin = bufferBegin;
+  it.m_BufferEnd = bufferEnd;
+  it.m_EndNumber = m_NumberOfChunks;
+
+  // the chunks of the image layout are in the order of the buffer, so
+  // only those in the range are visited
+  if ( !m_IsListed && m_LargestChunkSize > 0 )
+    {
+    it.m_Number = vnl_math_min( bufferBegin / m_LargestChunkSize, m_NumberOfChunks );
+    it.m_EndNumber = vnl_math_min( ( bufferEnd + m_LargestChunkSize - 1 ) / m_LargestChunkSize, m_NumberOfChunks );
+    }
+
+  it.Update();
+  return it;
+}
+
+
+void IORegionChunkSequence::ConstIterator::Update( void )
+{
+  for ( ; m_Number < m_EndNumber; ++m_Number )
+    {
+    m_Chunk = m_Sequence->GetChunk( m_Number );
+
+    const SizeType begin = vnl_math_max( m_Chunk.bufferOffset, m_BufferBegin );
+    const SizeType end = vnl_math_min( m_Chunk.bufferOffset + m_Chunk.size, m_BufferEnd );
+    if ( begin < end )
+      {
+      m_Chunk.filePosition += begin - m_Chunk.bufferOffset;
+      m_Chunk.bufferOffset = begin;
+      m_Chunk.size = end - begin;
+      return;
+      }
+    }
+}
+
+} // end namespace Local
+} // end namespace itk
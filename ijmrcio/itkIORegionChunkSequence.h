@@ -0,0 +1,136 @@
+#ifndef __itkIORegionChunkSequence_h
+#define __itkIORegionChunkSequence_h
+
+#include "itkImageIOBase.h"
+#include "itkImageIORegion.h"
+
+#include <vector>
+
+namespace itk
+{
+namespace Local
+{
+
+/** \class IORegionChunkSequence
+ *
+ * \brief The continuous runs of bytes in a file which make up an
+ * IORegion, in increasing order of file position
+ *
+ * For a file with the layout of the image, the runs are computed
+ * from their number as they are iterated, so a region of many short
+ * rows, such as a slice across the rows, takes no memory for them. A
+ * file with another layout sets the list of its runs, whose buffer
+ * offsets need not then be increasing.
+ *
+ * The iterators may be limited to a range of the buffer of the
+ * region, the runs are then cut to the range. Each range can be
+ * transferred by a different thread.
+ *
+ * \sa StreamingImageIOBase::ComputeIORegionChunks
+ */
+class ITK_EXPORT IORegionChunkSequence
+{
+public:
+  typedef ImageIOBase::SizeType SizeType;
+
+  /** \brief A continuous run of bytes of the IORegion in the file */
+  struct Chunk
+  {
+    SizeType filePosition;  ///< byte offset from the beginning of the file
+    SizeType bufferOffset;  ///< byte offset into the IORegion's buffer
+    SizeType size;          ///< number of bytes
+  };
+  typedef std::vector<Chunk> ChunkContainer;
+
+  /** \brief Iterates over the chunks of the sequence which are in a
+   * range of the buffer
+   *
+   * The iterator does not allocate, and may be copied to go over the
+   * chunks again. The sequence must outlive it.
+   */
+  class ConstIterator
+  {
+  public:
+    ConstIterator() : m_Sequence( 0 ), m_Number( 0 ), m_EndNumber( 0 ), m_BufferBegin( 0 ), m_BufferEnd( 0 ) {}
+
+    bool IsAtEnd( void ) const { return m_Number >= m_EndNumber; }
+
+    const Chunk &operator*( void ) const { return m_Chunk; }
+    const Chunk *operator->( void ) const { return &m_Chunk; }
+
+    ConstIterator &operator++( void ) { ++m_Number; this->Update(); return *this; }
+
+    bool operator==( const ConstIterator &other ) const
+      { return m_Sequence == other.m_Sequence && m_Number == other.m_Number; }
+    bool operator!=( const ConstIterator &other ) const { return !( *this == other ); }
+
+  private:
+    friend class IORegionChunkSequence;
+
+    // sets m_Chunk to the part of the current chunk in the range,
+    // skipping the chunks outside of it
+    void Update( void );
+
+    const IORegionChunkSequence *m_Sequence;
+    SizeType                     m_Number;
+    SizeType                     m_EndNumber;
+    SizeType                     m_BufferBegin;
+    SizeType                     m_BufferEnd;
+    Chunk                        m_Chunk;
+  };
+
+  /** \brief An empty sequence */
+  IORegionChunkSequence();
+
+  /** \brief The sequence of a list of chunks */
+  explicit IORegionChunkSequence( const ChunkContainer &chunks );
+
+  /** \brief Sets the chunks of region in a file with the layout of
+   * the image of io, whose data begins at dataPosition */
+  void SetImageLayout( const ImageIOBase *io, const ImageIORegion &region,
+                       SizeType dataPosition, SizeType pixelSize );
+
+  /** \brief Sets the list of chunks of a file with another layout,
+   * the contents of chunks are taken and it is left empty */
+  void SetChunks( ChunkContainer &chunks );
+
+  /** \brief Returns an iterator over all the chunks */
+  ConstIterator Begin( void ) const;
+
+  /** \brief Returns an iterator over the parts of the chunks in the
+   * bytes of the buffer from bufferBegin up to bufferEnd */
+  ConstIterator Begin( SizeType bufferBegin, SizeType bufferEnd ) const;
+
+  /** \brief Returns the number of chunks */
+  SizeType GetNumberOfChunks( void ) const { return m_NumberOfChunks; }
+
+  /** \brief Returns the chunk with number n */
+  Chunk GetChunk( SizeType n ) const;
+
+  /** \brief Returns the number of bytes of the largest chunk */
+  SizeType GetLargestChunkSize( void ) const { return m_LargestChunkSize; }
+
+  /** \brief Returns the number of bytes of all the chunks */
+  SizeType GetSizeOfRegion( void ) const { return m_SizeOfRegion; }
+
+private:
+  // a list set, otherwise the layout of the image
+  bool                  m_IsListed;
+  ChunkContainer        m_Chunks;
+
+  SizeType              m_NumberOfChunks;
+  SizeType              m_LargestChunkSize;
+  SizeType              m_SizeOfRegion;
+
+  // the chunks of the image layout are of equal size, the position
+  // of the first one is advanced by the strides of the dimensions
+  // above those of a chunk for each index of its number
+  SizeType              m_FirstPosition;
+  std::vector<SizeType> m_OuterSizes;
+  std::vector<SizeType> m_OuterStrides;
+};
+
+} // end namespace Local
+} // end namespace itk
+
+#endif // __itkIORegionChunkSequence_h
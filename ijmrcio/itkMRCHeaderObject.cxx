@@ -1,34 +1,63 @@
 #include "itkMRCHeaderObject.h"
+#include "itkIJMRCIOConfigure.h"
+
+#include <algorithm>
+#include <fstream>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 namespace itk
 {
 namespace Local
 {
+
+namespace
+{
+// the bytes of the items of a section of a SerialEM extended header
+// for each bit of the flags in nreal
+const size_t SerialEMItemSizes[] = {2, 6, 4, 2, 2, 4, 2, 4, 2, 4, 2};
+const unsigned int SerialEMNumberOfItems = sizeof(SerialEMItemSizes)/sizeof(SerialEMItemSizes[0]);
+
+// holds the lock of the extended header for its scope
+class ExtendedHeaderLock
+{
+public:
+  ExtendedHeaderLock(SimpleFastMutexLock &mutex) : m_Mutex(mutex) { m_Mutex.Lock(); }
+  ~ExtendedHeaderLock() { m_Mutex.Unlock(); }
+private:
+  SimpleFastMutexLock &m_Mutex;
+};
+}
   
 void MRCHeaderObject::DeepCopy(ConstPointer h) 
 {
   memcpy(&this->header, &h->header, sizeof(Header));
   
+  this->ClearExtendedHeader();
   this->extendedHeaderSize = h->extendedHeaderSize;
-  if (this->extendedHeaderSize)
+
+  // an extended header not yet read is shared as its file, otherwise
+  // the bytes are copied
+  ExtendedHeaderLock lock(h->extendedHeaderLock);
+  if (this->extendedHeaderSize && h->extendedHeader)
     {
-    
-    if (this->extendedHeader)       
-      {
-      delete [] static_cast<char*>(this->extendedHeader);
-      }
-  
     this->extendedHeader = new char[this->extendedHeaderSize];
     memcpy(this->extendedHeader, h->extendedHeader, this->extendedHeaderSize);
+    this->extendedHeaderLoaded = true;
+    }
+  else 
+    {
+    this->extendedHeaderFileName = h->extendedHeaderFileName;
+    this->extendedHeaderPosition = h->extendedHeaderPosition;
+    this->extendedHeaderFileIdentity = h->extendedHeaderFileIdentity;
+    this->extendedHeaderLoaded = h->extendedHeaderLoaded;
     }
 
   this->bigEndianHeader = h->bigEndianHeader;
-  
-  if (h->extendedFeiHeader)
-    this->extendedFeiHeader = static_cast<FeiExtendedHeader*>(this->extendedHeader);
-  else 
-    this->extendedFeiHeader = 0;
-  
 }
 
 bool MRCHeaderObject::SetHeader(const Header *buffer) 
@@ -88,39 +117,11 @@ bool MRCHeaderObject::SetHeader(const Header *buffer)
     
   
   // clean up
-  if (this->extendedHeader)       
-    delete [] static_cast<char*>(this->extendedHeader);
-
-  this->extendedHeader = 0;
-  this->extendedFeiHeader = 0;
-
-  size_t extendedHeaderBytes = 0;
-  if (this->header.nreal & 1   ) extendedHeaderBytes += 2;
-  if (this->header.nreal & 2   ) extendedHeaderBytes += 6;
-  if (this->header.nreal & 4   ) extendedHeaderBytes += 3;
-  if (this->header.nreal & 8   ) extendedHeaderBytes += 2;
-  if (this->header.nreal & 16  ) extendedHeaderBytes += 2;
-  if (this->header.nreal & 32  ) extendedHeaderBytes += 4;
-  if (this->header.nreal & 64  ) extendedHeaderBytes += 2;
-  if (this->header.nreal & 128 ) extendedHeaderBytes += 4;
-  if (this->header.nreal & 256 ) extendedHeaderBytes += 2;
-  if (this->header.nreal & 512 ) extendedHeaderBytes += 4;
-  if (this->header.nreal & 1024) extendedHeaderBytes += 2;
-  
-  if (extendedHeaderBytes != size_t(this->header.nint)) 
-    {
-    // FEI/Agard format
+  this->ClearExtendedHeader();
 
-    // let up hope that this is the correct value or 0
-    this->extendedHeaderSize = this->header.next;
-    }
-  else
-    {
-    // Serial EM format
-    
-    // let up hope that this is the correct value or 0
-    this->extendedHeaderSize = this->header.next;
-    }
+  // let up hope that this is the correct value or 0, the format is
+  // determined by GetExtendedHeaderFormat
+  this->extendedHeaderSize = this->header.next > 0 ? size_t(this->header.next) : 0;
 
 
   // check to make sure the data makes sense
@@ -158,49 +159,413 @@ bool MRCHeaderObject::SetExtendedHeader(const void *buffer)
 {
   if (!this->extendedHeaderSize) 
     return false;
-  
-  if (this->extendedHeader)       
-    {
-    delete [] static_cast<char*>(this->extendedHeader);
-    }
+
+  const size_t size = this->extendedHeaderSize;
+  this->ClearExtendedHeader();
+  this->extendedHeaderSize = size;
   
   this->extendedHeader = new char[this->extendedHeaderSize];
   memcpy(this->extendedHeader, buffer, this->extendedHeaderSize);
+  this->extendedHeaderLoaded = true;
   
-  this->extendedFeiHeader = 0;
-  if (this->extendedHeaderSize == 128*1024 && this->header.nint == 0 && this->header.nreal == 32) 
+  return true;
+}
+
+
+void MRCHeaderObject::SetExtendedHeaderFile(const std::string &fileName, size_t position)
+{
+  const size_t size = this->extendedHeaderSize;
+  this->ClearExtendedHeader();
+  this->extendedHeaderSize = size;
+
+  this->extendedHeaderFileName = fileName;
+  this->extendedHeaderPosition = position;
+  if (!GetFileIdentity(fileName, this->extendedHeaderFileIdentity))
+    {
+    // the file will not match when it is accessed
+    memset(&this->extendedHeaderFileIdentity, 0, sizeof(FileIdentity));
+    }
+}
+
+
+bool MRCHeaderObject::GetFileIdentity(const std::string &fileName, FileIdentity &identity)
+{
+  struct stat fileStat;
+  if (::stat(fileName.c_str(), &fileStat) != 0)
+    {
+    return false;
+    }
+  identity.inode = static_cast<unsigned long>(fileStat.st_ino);
+  identity.length = static_cast<size_t>(fileStat.st_size);
+  identity.modifiedTime = static_cast<long>(fileStat.st_mtime);
+#if defined(IJMRCIO_HAVE_STAT_MTIM)
+  identity.modifiedTimeNanoseconds = static_cast<long>(fileStat.st_mtim.tv_nsec);
+#else
+  identity.modifiedTimeNanoseconds = 0;
+#endif
+  return true;
+}
+
+
+const void *MRCHeaderObject::GetExtendedHeader(void) const
+{
+  ExtendedHeaderLock lock(this->extendedHeaderLock);
+  if (!this->extendedHeaderLoaded)
     {
-    this->extendedFeiHeader = static_cast<FeiExtendedHeader*>(this->extendedHeader);
+    this->LoadExtendedHeader();
+    }
+  return this->extendedHeader;
+}
+
+
+void MRCHeaderObject::LoadExtendedHeader(void) const
+{
+  // whether or not the extended header can be read it is tried once
+  this->extendedHeaderLoaded = true;
+
+  if (!this->extendedHeaderSize || this->extendedHeaderFileName.empty())
+    {
+    return;
+    }
+
+  std::ifstream file(this->extendedHeaderFileName.c_str(), std::ios::in | std::ios::binary);
+  if (!file)
+    {
+    itkWarningMacro(<<"The extended header could not be read from \"" << this->extendedHeaderFileName << "\"");
+    return;
+    }
+
+  // the file is checked after it is opened, so a file replaced since
+  // is not read
+  const FileIdentity &expected = this->extendedHeaderFileIdentity;
+  FileIdentity identity;
+  if (!GetFileIdentity(this->extendedHeaderFileName, identity) ||
+      identity.inode != expected.inode ||
+      identity.length != expected.length ||
+      identity.modifiedTime != expected.modifiedTime ||
+      identity.modifiedTimeNanoseconds != expected.modifiedTimeNanoseconds ||
+      identity.length < this->extendedHeaderPosition + this->extendedHeaderSize)
+    {
+    itkWarningMacro(<<"The extended header was not read, \"" << this->extendedHeaderFileName 
+                    << "\" has changed since its header was read");
+    return;
+    }
   
+  char *buffer = new char[this->extendedHeaderSize];
+  file.seekg(this->extendedHeaderPosition, std::ios::beg);
+  if (!file.read(buffer, this->extendedHeaderSize))
+    {
+    delete [] buffer;
+    itkWarningMacro(<<"The extended header could not be read from \"" << this->extendedHeaderFileName << "\"");
+    return;
+    }
+  this->extendedHeader = buffer;
+}
+
+
+void MRCHeaderObject::ClearExtendedHeader(void)
+{
+  ExtendedHeaderLock lock(this->extendedHeaderLock);
+  delete [] this->extendedHeader;
+  this->extendedHeader = 0;
+
+  this->extendedHeaderLoaded = false;
+  this->extendedHeaderFileName = "";
+  this->extendedHeaderPosition = 0;
+  memset(&this->extendedHeaderFileIdentity, 0, sizeof(FileIdentity));
+  this->extendedHeaderSize = 0;
+}
+
+
+size_t MRCHeaderObject::GetSerialEMSectionSize(int16_t flags)
+{
+  size_t bytes = 0;
+  for (unsigned int i = 0; i < SerialEMNumberOfItems; ++i)
+    {
+    if (flags & (1 << i))
+      {
+      bytes += SerialEMItemSizes[i];
+      }
+    }
+  return bytes;
+}
+
+
+MRCHeaderObject::ExtendedHeaderFormat MRCHeaderObject::GetExtendedHeaderFormat(void) const
+{
+  if (!this->extendedHeaderSize)
+    {
+    return MRCHEADER_EXTENDED_NONE;
+    }
+  // FEI writes 1024 entries, but some files have only the entries of
+  // their sections
+  if (this->header.nint == 0 && this->header.nreal == 32 && 
+      this->extendedHeaderSize % sizeof(FeiExtendedHeader) == 0)
+    {
+    return MRCHEADER_EXTENDED_FEI;
+    }
+  if (this->header.nint > 0 && this->header.nreal > 0 &&
+      GetSerialEMSectionSize(this->header.nreal) == size_t(this->header.nint))
+    {
+    return MRCHEADER_EXTENDED_SERIALEM;
+    }
+  if (this->header.nint >= 0 && this->header.nreal >= 0 &&
+      this->header.nint + this->header.nreal > 0)
+    {
+    return MRCHEADER_EXTENDED_AGARD;
+    }
+  return MRCHEADER_EXTENDED_OTHER;
+}
+
+
+unsigned int MRCHeaderObject::GetNumberOfExtendedHeaderSections(void) const
+{
+  size_t entrySize = 0;
+  switch (this->GetExtendedHeaderFormat())
+    {
+    case MRCHEADER_EXTENDED_FEI:
+      entrySize = sizeof(FeiExtendedHeader);
+      break;
+    case MRCHEADER_EXTENDED_SERIALEM:
+      entrySize = this->header.nint;
+      break;
+    case MRCHEADER_EXTENDED_AGARD:
+      entrySize = 4*size_t(this->header.nint + this->header.nreal);
+      break;
+    default:
+      return 0;
+    }
+  const size_t sections = this->extendedHeaderSize / entrySize;
+  return static_cast<unsigned int>(std::min(sections, size_t(this->header.nz)));
+}
+
+
+bool MRCHeaderObject::CopyExtendedHeaderEntry(unsigned int section, size_t entrySize, void *entry) const
+{
+  if (section >= this->GetNumberOfExtendedHeaderSections())
+    {
+    return false;
+    }
+
+  // the entry is copied with the lock held, so that the extended
+  // header can not be released meanwhile
+  ExtendedHeaderLock lock(this->extendedHeaderLock);
+  if (!this->extendedHeaderLoaded)
+    {
+    this->LoadExtendedHeader();
+    }
+  if (!this->extendedHeader)
+    {
+    return false;
+    }
+  memcpy(entry, this->extendedHeader + section*entrySize, entrySize);
+  return true;
+}
+
+
+bool MRCHeaderObject::GetFeiExtendedHeader(unsigned int section, FeiExtendedHeader &entry) const
+{
+  if (this->GetExtendedHeaderFormat() != MRCHEADER_EXTENDED_FEI)
+    {
+    return false;
+    }
+  if (!this->CopyExtendedHeaderEntry(section, sizeof(FeiExtendedHeader), &entry))
+    {
+    return false;
+    }
+  
+  // only the 13 floats preceding the unused bytes
+  const unsigned int numberOfFloats = 13;
+  if (this->bigEndianHeader) 
+    {
+    ByteSwapper<float>::SwapRangeFromSystemToBigEndian(&entry.atilt, numberOfFloats);
+    } 
+  else 
+    {	
+    ByteSwapper<float>::SwapRangeFromSystemToLittleEndian(&entry.atilt, numberOfFloats);
+    }  
+  return true;
+}
+
+
+#if !defined(ITK_LEGACY_REMOVE)
+MRCHeaderObject::FeiExtendedHeader 
+MRCHeaderObject::ExtendedFeiHeaderAccessor::operator[](unsigned int section) const
+{
+  FeiExtendedHeader entry;
+  if (!this->m_Header->GetFeiExtendedHeader(section, entry))
+    {
+    memset(&entry, 0, sizeof(FeiExtendedHeader));
+    }
+  return entry;
+}
+
+
+MRCHeaderObject::ExtendedFeiHeaderAccessor::operator const void *(void) const
+{
+  if (this->m_Header->GetExtendedHeaderFormat() != MRCHEADER_EXTENDED_FEI)
+    {
+    return 0;
+    }
+  return this->m_Header;
+}
+#endif
+
+
+bool MRCHeaderObject::GetAgardExtendedHeader(unsigned int section, 
+                                             std::vector<int32_t> &integers,
+                                             std::vector<float> &reals) const
+{
+  if (this->GetExtendedHeaderFormat() != MRCHEADER_EXTENDED_AGARD)
+    {
+    return false;
+    }
+  const size_t numberOfIntegers = this->header.nint;
+  const size_t numberOfReals = this->header.nreal;
+  std::vector<char> bytes(4*(numberOfIntegers + numberOfReals));
+  if (!this->CopyExtendedHeaderEntry(section, bytes.size(), &bytes[0]))
+    {
+    return false;
+    }
+
+  integers.resize(numberOfIntegers);
+  reals.resize(numberOfReals);
+  if (numberOfIntegers)
+    {
+    memcpy(&integers[0], &bytes[0], 4*numberOfIntegers);
+    }
+  if (numberOfReals)
+    {
+    memcpy(&reals[0], &bytes[4*numberOfIntegers], 4*numberOfReals);
+    }
+
+  for (size_t i = 0; i < numberOfIntegers; ++i)
+    {
+    if (this->bigEndianHeader) 
+      ByteSwapper<int32_t>::SwapFromSystemToBigEndian(&integers[i]);
+    else
+      ByteSwapper<int32_t>::SwapFromSystemToLittleEndian(&integers[i]);
+    }
+  for (size_t i = 0; i < numberOfReals; ++i)
+    {
     if (this->bigEndianHeader) 
+      ByteSwapper<float>::SwapFromSystemToBigEndian(&reals[i]);
+    else
+      ByteSwapper<float>::SwapFromSystemToLittleEndian(&reals[i]);
+    }
+  return true;
+}
+
+
+bool MRCHeaderObject::GetSerialEMExtendedHeader(unsigned int section, SerialEMExtendedHeader &entry) const
+{
+  if (this->GetExtendedHeaderFormat() != MRCHEADER_EXTENDED_SERIALEM)
+    {
+    return false;
+    }
+  std::vector<char> entryBytes(this->header.nint);
+  if (!this->CopyExtendedHeaderEntry(section, entryBytes.size(), &entryBytes[0]))
+    {
+    return false;
+    }
+  const char *bytes = &entryBytes[0];
+
+  memset(&entry, 0, sizeof(SerialEMExtendedHeader));
+  entry.flags = this->header.nreal;
+
+  // the items are shorts, present in the order of their flags
+  int16_t values[3];
+  for (unsigned int i = 0; i < SerialEMNumberOfItems; ++i)
+    {
+    if (!(entry.flags & (1 << i)))
+      {
+      continue;
+      }
+    const size_t itemSize = SerialEMItemSizes[i];
+    memcpy(values, bytes, std::min(itemSize, sizeof(values)));
+    bytes += itemSize;
+
+    if (this->bigEndianHeader) 
+      {
+      ByteSwapper<int16_t>::SwapRangeFromSystemToBigEndian(values, itemSize/2);
+      }
+    else
+      {
+      ByteSwapper<int16_t>::SwapRangeFromSystemToLittleEndian(values, itemSize/2);
+      }
+
+    switch (1 << i)
       {
-      ByteSwapper<float>::SwapRangeFromSystemToBigEndian((float *)this->extendedHeader, this->extendedHeaderSize );
-      } 
-    else 
-      {	
-      ByteSwapper<float>::SwapRangeFromSystemToLittleEndian((float *)this->extendedHeader, this->extendedHeaderSize );
-      }  
-  }
+      case 1:
+        entry.tiltAngle = values[0] / 100.0f;
+        break;
+      case 2:
+        entry.pieceCoordinates[0] = values[0];
+        entry.pieceCoordinates[1] = values[1];
+        entry.pieceCoordinates[2] = values[2];
+        break;
+      case 4:
+        entry.xstage = values[0] / 25.0f;
+        entry.ystage = values[1] / 25.0f;
+        break;
+      case 8:
+        entry.magnification = values[0] * 100.0f;
+        break;
+      case 16:
+        entry.intensity = values[0] / 25000.0f;
+        break;
+      case 32:
+        {
+        // a float packed in two shorts, the mantissa with its sign in
+        // the first and the low byte of the second, the power of two
+        // with its sign in the high byte of the second
+        const int mantissa = abs(int(values[0]))*256 + abs(int(values[1])) % 256;
+        const int exponent = abs(int(values[1])) / 256;
+        const double value = ldexp(double(mantissa), values[1] < 0 ? -exponent : exponent);
+        entry.exposureDose = static_cast<float>(values[0] < 0 ? -value : value);
+        break;
+        }
+      default:
+        // the remaining items are skipped
+        break;
+      }
+    }
   return true;
 }
 
+void MRCHeaderObject::GetHeader(Header *buffer) const
+{
+  // the header is in the system's byte order, swapping to the
+  // original order is the same as the swap in SetHeader
+  MRCHeaderObject::Pointer original = MRCHeaderObject::New();
+  memcpy(&original->header, &this->header, sizeof(Header));
+  original->swapHeader(this->bigEndianHeader);
+
+  // the stamp is set to the system's by swapHeader
+  original->header.stamp[0] = this->bigEndianHeader ? 17 : 68;
+  
+  memcpy(buffer, &original->header, sizeof(Header));
+}
+
 bool MRCHeaderObject::IsOriginalHeaderBigEndian(void) const 
 {
   return this->bigEndianHeader;
 }
 
-MRCHeaderObject::MRCHeaderObject(void) : extendedHeaderSize(0), extendedHeader(0), extendedFeiHeader(0) 
+MRCHeaderObject::MRCHeaderObject(void) : extendedHeaderSize(0), extendedHeader(0), 
+                                         extendedHeaderLoaded(false), extendedHeaderPosition(0)
+#if !defined(ITK_LEGACY_REMOVE)
+                                         , extendedFeiHeader(this)
+#endif
 {    
   memset(&this->header, 0, sizeof(Header));
+  memset(&this->extendedHeaderFileIdentity, 0, sizeof(FileIdentity));
   this->bigEndianHeader = ByteSwapper<void*>::SystemIsBE();
 }
   
 MRCHeaderObject::~MRCHeaderObject(void) 
 {
-  if (this->extendedHeader) 
-    {
-    delete [] static_cast<char*>(this->extendedHeader);
-    }
+  this->ClearExtendedHeader();
 }
 
 
@@ -393,26 +758,44 @@ void MRCHeaderObject::PrintSelf(std::ostream& os, Indent indent) const
     os << indent << std::endl;
     }
   
-  if (this->extendedFeiHeader) 
+  if (this->GetExtendedHeaderFormat() == MRCHEADER_EXTENDED_FEI) 
     {
     os << indent << "Extended Header: " << std::endl;
     os << indent << "( atilt, btilt, xstage, ystage, zstage, xshift, yshift, defocus, exptime, meanint, tiltaxis, pixelsize, magnification)" << std::endl;
-    for (int32_t z = 0; z < this->header.nz && z < 1024 ; ++z) 
+    FeiExtendedHeader entry;
+    for (unsigned int z = 0; this->GetFeiExtendedHeader(z, entry); ++z) 
+      {
+      os << indent << "(" 
+         << entry.atilt << ", "
+         << entry.btilt << ", "
+         << entry.xstage << ", "
+         << entry.ystage << ", "
+         << entry.zstage << ", "
+         << entry.xshift << ", "
+         << entry.yshift << ", "
+         << entry.defocus << ", "
+         << entry.exptime << ", "
+         << entry.meanint << ", "
+         << entry.tiltaxis << ", "
+         << entry.pixelsize << ", "
+         << entry.magnification << ")" << std::endl;
+      }
+    }
+  else if (this->GetExtendedHeaderFormat() == MRCHEADER_EXTENDED_SERIALEM) 
+    {
+    os << indent << "SerialEM Extended Header: " << std::endl;
+    os << indent << "( tilt, piece, xstage, ystage, magnification, intensity, dose)" << std::endl;
+    SerialEMExtendedHeader entry;
+    for (unsigned int z = 0; this->GetSerialEMExtendedHeader(z, entry); ++z) 
       {
       os << indent << "(" 
-         << this->extendedFeiHeader[z].atilt << ", "
-         << this->extendedFeiHeader[z].btilt << ", "
-         << this->extendedFeiHeader[z].xstage << ", "
-         << this->extendedFeiHeader[z].ystage << ", "
-         << this->extendedFeiHeader[z].zstage << ", "
-         << this->extendedFeiHeader[z].xshift << ", "
-         << this->extendedFeiHeader[z].yshift << ", "
-         << this->extendedFeiHeader[z].defocus << ", "
-         << this->extendedFeiHeader[z].exptime << ", "
-         << this->extendedFeiHeader[z].meanint << ", "
-         << this->extendedFeiHeader[z].tiltaxis << ", "
-         << this->extendedFeiHeader[z].pixelsize << ", "
-         << this->extendedFeiHeader[z].magnification << ")" << std::endl;
+         << entry.tiltAngle << ", "
+         << entry.pieceCoordinates[0] << " " << entry.pieceCoordinates[1] << " " << entry.pieceCoordinates[2] << ", "
+         << entry.xstage << ", "
+         << entry.ystage << ", "
+         << entry.magnification << ", "
+         << entry.intensity << ", "
+         << entry.exposureDose << ")" << std::endl;
       }
     }
 
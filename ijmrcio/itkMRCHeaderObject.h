@@ -5,6 +5,10 @@
 #include "itkLightObject.h"
 #include "itkByteSwapper.h"
 #include "itkIntTypes.h"
+#include "itkSimpleFastMutexLock.h"
+
+#include <string>
+#include <vector>
 
 namespace itk
 {
@@ -25,6 +29,13 @@ const char * const magicMAP = "MAP ";
  *
  * The POD structures a publicly avaible without access methods.
  *
+ * The extended header is not read with the header. When it is set
+ * with SetExtendedHeaderFile it is copied from the file when it is
+ * first accessed, if the file has not changed since, and it is kept
+ * in the byte order of the file. The entry of one section in the FEI, Agard or SerialEM
+ * formats is decoded by its accessor, so that a stack of many
+ * sections costs nothing until its entries are used.
+ *
  * \sa MetaDataDictionary
  */
 class ITK_EXPORT MRCHeaderObject :
@@ -185,6 +196,52 @@ public:
     char  notused[76];  ///< fill up 128 bytes
   };
 
+  /** The items of a section of a SerialEM extended header, those
+   * whose flag is not set in flags are zero */
+  struct SerialEMExtendedHeader
+  {
+    int16_t flags;               ///< the nreal flags of the section
+    float   tiltAngle;           ///< in degrees
+    int16_t pieceCoordinates[3]; ///< of the piece of a montage
+    float   xstage;              ///< stage x position
+    float   ystage;              ///< stage y position
+    float   magnification;       ///< 
+    float   intensity;           ///< 
+    float   exposureDose;        ///< in e-/A2
+  };
+
+#if !defined(ITK_LEGACY_REMOVE)
+  /** \brief Stands in for the former pointer to the decoded FEI
+   * extended header
+   *
+   * It is true only if the extended header is in the FEI format, and
+   * indexed by a section it returns a copy of the entry of the
+   * section, which is zero if the section has none.
+   *
+   * \deprecated The extended header is no longer kept decoded, use
+   * GetFeiExtendedHeader instead.
+   */
+  class ExtendedFeiHeaderAccessor
+  {
+  public:
+    explicit ExtendedFeiHeaderAccessor(const MRCHeaderObject *header) : m_Header(header) {}
+
+    FeiExtendedHeader operator[](unsigned int section) const;
+
+    operator const void *(void) const;
+
+  private:
+    const MRCHeaderObject *m_Header;
+  };
+#endif
+
+  /** extended header format enumeration */
+  enum ExtendedHeaderFormat {MRCHEADER_EXTENDED_NONE = 0,
+                             MRCHEADER_EXTENDED_FEI = 1,
+                             MRCHEADER_EXTENDED_AGARD = 2,
+                             MRCHEADER_EXTENDED_SERIALEM = 3,
+                             MRCHEADER_EXTENDED_OTHER = 4};
+
   /** pixel type enumeration */
   enum {MRCHEADER_MODE_UINT8 = 0,
         MRCHEADER_MODE_IN16 = 1,
@@ -192,7 +249,9 @@ public:
         MRCHEADER_MODE_COMPLEX_INT16 = 3,
         MRCHEADER_MODE_COMPLEX_FLOAT = 4,
         MRCHEADER_MODE_UINT16 = 6,
-        MRCHEADER_MODE_RGB_BYTE = 16};
+        MRCHEADER_MODE_HALF = 12,
+        MRCHEADER_MODE_RGB_BYTE = 16,
+        MRCHEADER_MODE_UINT4 = 101};
 
   /** map enumeration */
   enum {MRCHEADER_MAP_X = 1,
@@ -201,7 +260,27 @@ public:
   
 private:
   size_t extendedHeaderSize;  
-  void *extendedHeader;
+
+  // the extended header set by SetExtendedHeader or read from the
+  // file
+  mutable char  *extendedHeader;
+  mutable bool   extendedHeaderLoaded;
+
+  // the file of the extended header as it was when it was set, the
+  // extended header is not read from a file which has changed
+  struct FileIdentity
+  {
+    unsigned long inode;
+    size_t        length;
+    long          modifiedTime;
+    long          modifiedTimeNanoseconds;
+  };
+
+  std::string  extendedHeaderFileName;
+  size_t       extendedHeaderPosition;
+  FileIdentity extendedHeaderFileIdentity;
+
+  mutable SimpleFastMutexLock extendedHeaderLock;
 
   bool bigEndianHeader;
 public:
@@ -228,10 +307,19 @@ public:
    * performed.
    */
   bool SetHeader(const Header *buffer);
+
+  /** \param buffer is assumed to point to a 1024 block of memory
+   *
+   * The header is copied into buffer in the byte order of the
+   * original header, so that it can be written back into the file it
+   * was read from.
+   */
+  void GetHeader(Header *buffer) const;
   
   /** After SetHeader is called GetExtendedHeaderSize contains the
    * extected size of the buffer argument. This buffer is expected to
-   * be the bytes which follow the header in the file.
+   * be the bytes which follow the header in the file, in the byte
+   * order of the file.
    *
    * The return value indicates if the extended header buffer is valid
    * and known. If false is returned then extended header information
@@ -239,6 +327,52 @@ public:
    */
   bool SetExtendedHeader(const void *buffer);
 
+  /** After SetHeader is called, sets the file whose extended header
+   * begins at position. It is not read until it is accessed. The
+   * inode, length and modification time of the file are recorded, and
+   * if any has changed when it is accessed the extended header is not
+   * read.
+   */
+  void SetExtendedHeaderFile(const std::string &fileName, size_t position);
+
+  /** Returns the bytes of the extended header in the byte order of
+   * the file, or 0 if there is none or it could not be read. The
+   * first call reads the extended header of SetExtendedHeaderFile.
+   *
+   * The bytes belong to this object. They are valid until the header
+   * or extended header is set again, or the object is deleted, and
+   * must not be used while another thread does so. The accessors of
+   * the entries of the sections copy them while the lock is held.
+   */
+  const void *GetExtendedHeader(void) const;
+
+  /** Returns the format of the extended header, as implied by the
+   * nint and nreal fields of the header */
+  ExtendedHeaderFormat GetExtendedHeaderFormat(void) const;
+
+  /** Returns the number of sections with an entry in the extended
+   * header, no more than the number of sections of the image */
+  unsigned int GetNumberOfExtendedHeaderSections(void) const;
+
+  /** Decodes the entry of section of an extended header in the FEI
+   * format into entry. Returns false if the format is not FEI or
+   * section has no entry. */
+  bool GetFeiExtendedHeader(unsigned int section, FeiExtendedHeader &entry) const;
+
+  /** Decodes the nint integers and nreal reals of section of an
+   * extended header in the Agard format. */
+  bool GetAgardExtendedHeader(unsigned int section, 
+                              std::vector<int32_t> &integers,
+                              std::vector<float> &reals) const;
+
+  /** Decodes the items of section of an extended header in the
+   * SerialEM format, which are flagged by nreal, into their values. */
+  bool GetSerialEMExtendedHeader(unsigned int section, SerialEMExtendedHeader &entry) const;
+
+  /** Returns the number of bytes of the items flagged of a section of
+   * a SerialEM extended header */
+  static size_t GetSerialEMSectionSize(int16_t flags);
+
 
   /** the expected number of bytes in the extended header, this is only
    * valid after a successful call to SetHeader.
@@ -255,7 +389,11 @@ public:
 
   /** Public avaiable data */
   Header header;  
-  FeiExtendedHeader *extendedFeiHeader;
+
+#if !defined(ITK_LEGACY_REMOVE)
+  /** \deprecated Use GetFeiExtendedHeader */
+  ExtendedFeiHeaderAccessor extendedFeiHeader;
+#endif
 
 protected:
 
@@ -265,6 +403,21 @@ protected:
   /** Methods to fix the order of a set header */
   void swapHeader(bool bigEndian);
 
+  /** Releases the extended header and its file */
+  void ClearExtendedHeader(void);
+
+  /** Reads the extended header of the file, if it is unchanged,
+   * called with the lock held */
+  void LoadExtendedHeader(void) const;
+
+  /** Copies the entry of section, of entrySize bytes, of the
+   * extended header into entry. Returns false if there is none. */
+  bool CopyExtendedHeaderEntry(unsigned int section, size_t entrySize, void *entry) const;
+
+  /** Gets the identity of the file, returns false if it does not
+   * exist */
+  static bool GetFileIdentity(const std::string &fileName, FileIdentity &identity);
+
   /** Prints loads of information from the header */
   void PrintSelf(std::ostream& os, Indent indent) const;
 
@@ -5,15 +5,59 @@
 
 #include "itkMetaDataObject.h"
 #include "itkIOCommon.h"
-#include "itkGenericUtilities.h"
+#include "itkMultiThreader.h"
+#include "itkSlabCache.h"
+#include "itkSIMDByteSwapper.h"
+#include "itkSIMDByteShuffler.h"
+#include "itkSIMDPixelConverter.h"
 
 
 #include <numeric>
 #include <algorithm>
 #include <fstream>
+#include <vector>
+#include <cmath>
 
 #include <itksys/SystemTools.hxx>
 
+namespace
+{
+
+// The extended header of a bricked file begins with this tag, the
+// size of the bricks and the number of bricks in each dimension as
+// 32-bit integers and the compression as an integer, followed by the
+// 64-bit position and size of each brick. It is in the byte order of
+// the file. The compression is the codec in the low byte, and this
+// flag if the bytes are shuffled.
+const char brickTableTag[4] = { 'B', 'R', 'C', 'K' };
+const unsigned int brickTableHeaderSize = 32;
+const unsigned int brickTableEntrySize = 16;
+const int brickTableByteShuffleFlag = 0x100;
+
+// The MRC-2014 exttyp field, bytes 104 to 107 of the header, and the
+// nversion field, bytes 108 to 111, are in notused1 which begins at
+// byte 98
+const unsigned int exttypOffset = 6;
+const unsigned int nversionOffset = 10;
+const int32_t mrc2014Version = 20140;
+
+// swaps a value between the byte order of the file and the system's
+template <typename T>
+T SwapFileValue( T value, bool bigEndian )
+{
+  if ( bigEndian )
+    {
+    itk::ByteSwapper<T>::SwapFromSystemToBigEndian( &value );
+    }
+  else
+    {
+    itk::ByteSwapper<T>::SwapFromSystemToLittleEndian( &value );
+    }
+  return value;
+}
+
+}
+
 namespace itk 
 {
 namespace Local 
@@ -24,8 +68,27 @@ namespace Local
 const char *MRCImageIO::MetaDataHeaderName = "MRCHeader";
 
 MRCImageIO::MRCImageIO() 
-  : StreamingImageIOBase()
+  : StreamingImageIOBase(),
+    m_UpdateStatisticsWhenPasting(false),
+    m_BrickSize(0),
+    m_BricksArePacked(false),
+    m_CompressionCodec(ChunkCompressor::ZlibCompression),
+    m_UseByteShuffle(true),
+    m_FileCompressionCodec(ChunkCompressor::NoCompression),
+    m_FileByteShuffle(false),
+    m_NumberOfPyramidLevels(0),
+    m_UseHalfFloat(false),
+    m_LevelOfDetail(0)
 {
+  for ( unsigned int i = 0; i < 3; ++i )
+    {
+    m_FileBrickSize[i] = m_NumberOfBricks[i] = 0;
+    }
+
+  m_WrittenStatistics.minimum = m_WrittenStatistics.maximum = 0.0;
+  m_WrittenStatistics.mean = m_WrittenStatistics.sumOfSquaredDeviations = 0.0;
+  m_WrittenStatistics.count = 0;
+
   this->SetNumberOfComponents(1);
   this->SetNumberOfDimensions(3);
   this->SetFileTypeToBinary();
@@ -40,6 +103,19 @@ MRCImageIO::MRCImageIO()
 void MRCImageIO::PrintSelf(std::ostream& os, Indent indent) const
 {
   Superclass::PrintSelf(os, indent);
+  os << indent << "UpdateStatisticsWhenPasting: " << m_UpdateStatisticsWhenPasting << std::endl;
+  os << indent << "BrickSize: " << m_BrickSize << std::endl;
+  os << indent << "CompressionCodec: " << ChunkCompressor::GetCodecName( m_CompressionCodec ) << std::endl;
+  os << indent << "UseByteShuffle: " << m_UseByteShuffle << std::endl;
+  os << indent << "NumberOfPyramidLevels: " << m_NumberOfPyramidLevels << std::endl;
+  os << indent << "UseHalfFloat: " << m_UseHalfFloat << std::endl;
+  os << indent << "LevelOfDetail: " << m_LevelOfDetail << std::endl;
+  if ( this->IsBricked() )
+    {
+    os << indent << "File Brick Size: " << m_FileBrickSize[0] << " " << m_FileBrickSize[1] << " " << m_FileBrickSize[2] << std::endl;
+    os << indent << "Number Of Bricks: " << m_BrickTable.size() << std::endl;
+    os << indent << "File Compression: " << ChunkCompressor::GetCodecName( m_FileCompressionCodec ) << std::endl;
+    }
 }
 
 bool MRCImageIO::CanReadFile(const char* filename) 
@@ -88,6 +164,38 @@ bool MRCImageIO::CanReadFile(const char* filename)
 
 }
 
+std::string MRCImageIO::GetDataFileName( void ) const
+{
+  if ( m_LevelOfDetail == 0 )
+    {
+    return m_FileName;
+    }
+  return MRCPyramidBuilder::GetLevelFileName( m_FileName, m_LevelOfDetail );
+}
+
+
+void MRCImageIO::CheckLevelOfDetailFile( void ) const
+{
+  const std::string levelFileName = this->GetDataFileName();
+  if ( m_LevelOfDetail != 0 && !itksys::SystemTools::FileExists( levelFileName.c_str() ) )
+    {
+    itkExceptionMacro(<< "Level of detail " << m_LevelOfDetail << " of " << m_FileName 
+                      << " does not exist: " << levelFileName );
+    }
+}
+
+
+unsigned int MRCImageIO::GetNumberOfPyramidLevelsOfFile( const std::string &fileName )
+{
+  unsigned int numberOfLevels = 0;
+  while ( itksys::SystemTools::FileExists( MRCPyramidBuilder::GetLevelFileName( fileName, numberOfLevels + 1 ).c_str() ) )
+    {
+    ++numberOfLevels;
+    }
+  return numberOfLevels;
+}
+
+
 MRCImageIO::SizeType MRCImageIO::GetHeaderSize( void ) const
 {
   if ( m_MRCHeader.IsNull() )
@@ -101,8 +209,9 @@ MRCImageIO::SizeType MRCImageIO::GetHeaderSize( void ) const
 void MRCImageIO::ReadImageInformation( void ) {
   std::ifstream file;
 
+  this->CheckLevelOfDetailFile();
   
-  this->InternalReadImageInformation( file );
+  this->InternalReadImageInformation( file, this->GetDataFileName() );
 
   if ( m_MRCHeader->IsOriginalHeaderBigEndian() ) 
     {
@@ -156,9 +265,26 @@ void MRCImageIO::ReadImageInformation( void ) {
       this->SetNumberOfComponents( 3 );
       this->SetPixelType( RGB );
       break;
+    case MRCHeaderObject::MRCHEADER_MODE_HALF:
+      // the half precision values are converted as they are read
+      this->SetComponentType( FLOAT );
+      this->SetNumberOfComponents( 1 );
+      this->SetPixelType( SCALAR );
+      break;
+    case MRCHeaderObject::MRCHEADER_MODE_UINT4:
+      // the 4-bit values are unpacked as they are read
+      this->SetComponentType( UCHAR );
+      this->SetNumberOfComponents( 1 );
+      this->SetPixelType( SCALAR );
+      break;
     default:
       itkExceptionMacro(<< "Unrecognized mode");
     }
+
+  if ( this->HasPackedMode() && this->IsBricked() )
+    {
+    itkExceptionMacro(<< "Bricked files of mode " << m_MRCHeader->header.mode << " are not supported: " << m_FileName );
+    }
   
 
   
@@ -198,12 +324,14 @@ void MRCImageIO::ReadImageInformation( void ) {
   EncapsulateMetaData<std::string>( thisDic, ITK_InputFilterName, classname );
   EncapsulateMetaData<MRCHeaderObject::ConstPointer>( thisDic, MetaDataHeaderName, MRCHeaderObject::ConstPointer(m_MRCHeader) );
 
+  this->BinImageInformation();
+  this->ConvertImageInformation();
 
   return;
 }
 
 // methods to load the data into the MRCHeader member variable
-void MRCImageIO::InternalReadImageInformation(std::ifstream &file) {
+void MRCImageIO::InternalReadImageInformation(std::ifstream &file, const std::string &fileName) {
   char *buffer = 0;
   
   try 
@@ -212,7 +340,7 @@ void MRCImageIO::InternalReadImageInformation(std::ifstream &file) {
     
     itkDebugMacro(<< "Reading Information ");
     
-    this->OpenFileForReading(file, this->m_FileName.c_str());
+    this->OpenFileForReading(file, fileName.c_str());
     
     buffer = new char[m_MRCHeader->GetHeaderSize()];
     if( !this->ReadBufferAsBinary( file, static_cast<void*>(buffer), m_MRCHeader->GetHeaderSize()) ) 
@@ -231,15 +359,28 @@ void MRCImageIO::InternalReadImageInformation(std::ifstream &file) {
     
     delete [] buffer;
     buffer = 0;
-    
-    buffer = new char[m_MRCHeader->GetExtendedHeaderSize()];
-    if( !this->ReadBufferAsBinary( file, static_cast<void*>(buffer),  m_MRCHeader->GetExtendedHeaderSize()) ) 
-      {    
-      itkExceptionMacro(<<"Extended Header Read failed.");
+
+    // only the brick table is needed to read the image, the extended
+    // header of the sections is read when it is accessed
+    if ( m_MRCHeader->GetExtendedHeaderSize() != 0 &&
+         memcmp( m_MRCHeader->header.notused1 + exttypOffset, brickTableTag, 4 ) == 0 )
+      {
+      buffer = new char[m_MRCHeader->GetExtendedHeaderSize()];
+      if( !this->ReadBufferAsBinary( file, static_cast<void*>(buffer),  m_MRCHeader->GetExtendedHeaderSize()) ) 
+        {    
+        itkExceptionMacro(<<"Extended Header Read failed.");
+        }
+      
+      m_MRCHeader->SetExtendedHeader(buffer);
+      
+      this->ReadBrickTable( buffer, m_MRCHeader->GetExtendedHeaderSize() );
+      }
+    else
+      {
+      m_MRCHeader->SetExtendedHeaderFile( fileName, m_MRCHeader->GetHeaderSize() );
+
+      this->ReadBrickTable( 0, 0 );
       }
-    
-    
-    m_MRCHeader->SetExtendedHeader(buffer);
     }
   catch (...)
     {
@@ -251,6 +392,9 @@ void MRCImageIO::InternalReadImageInformation(std::ifstream &file) {
     }
   
   delete [] buffer;
+
+  // the header of a level is not current for FileName
+  this->UpdateHeaderCache( fileName );
  }
 
 
@@ -260,304 +404,1807 @@ void MRCImageIO
 {
   std::ifstream file;
 
-  if( this->RequestedToStream( ) )
+  this->CheckLevelOfDetailFile();
+
+  // the bytes are swapped to the system byte order as they are read
+  if ( this->IsReadBinned() )
+    {
+    // the sections of the file are averaged into the buffer
+    this->BinnedStreamReadBufferAsBinary( this->OpenCachedFileForReading( file ), buffer );
+    }
+  else if ( this->IsReadConverted() )
+    {
+    // the pieces of the file are converted into the buffer
+    this->ConvertedStreamReadBufferAsBinary( this->OpenCachedFileForReading( file ), buffer );
+    }
+  else if( this->RequestedToStream( ) || this->IsBricked() || this->HasPackedMode() )
     {
     // open and stream read
-    this->OpenFileForReading(file, this->m_FileName.c_str());
+    this->StreamReadBufferAsBinary( this->OpenCachedFileForReading( file ), buffer );
     
-    this->StreamReadBufferAsBinary(file, buffer);
+    }
+  else if ( this->GetUseDirectIO() && 
+            this->DirectReadBufferAsBinary( this->GetHeaderSize(), buffer, this->GetImageSizeInBytes() ) )
+    {
+    // the image was read past the header, without the page cache
+    }
+  else if ( this->GetUseMemoryMappedReading() && this->MapFileForReading() )
+    {
     
+    // copy the image from the mapping, past the header
+    if ( !this->ReadAndSwapMappedBufferAsBinary( this->GetHeaderSize(), buffer, this->GetImageSizeInBytes() ) )
+      {
+      itkExceptionMacro(<<"Data not read completely from mapping of file: " << this->GetDataFileName());
+      }
     }
-
   else 
     { 
     
     // open the file
-    this->OpenFileForReading(file, this->m_FileName.c_str());
+    std::ifstream &in = this->OpenCachedFileForReading( file );
     
     // seek base the header
     std::streampos dataPos = static_cast<std::streampos>( this->GetHeaderSize() );
-    file.seekg( dataPos, std::ios::beg );
+    in.seekg( dataPos, std::ios::beg );
     
-    if ( file.fail() )
+    if ( in.fail() )
       {
       itkExceptionMacro(<<"Failed seeking to data position");
       }
 
     
     // read the image
-    this->ReadBufferAsBinary( file, buffer, this->GetImageSizeInBytes() );
-    }
-  
-  int size = this->GetComponentSize();
-  switch( size )
-    {
-    case 1:
-      break;
-    case 2:
-      this->GetByteOrder() == BigEndian ?
-        ByteSwapper<uint16_t>::SwapRangeFromSystemToBigEndian((uint16_t *)buffer, this->GetImageSizeInComponents() ) :
-        ByteSwapper<uint16_t>::SwapRangeFromSystemToLittleEndian((uint16_t *)buffer, this->GetImageSizeInComponents() );
-      break;
-    case 4:
-      this->GetByteOrder() == BigEndian ?
-        ByteSwapper<uint32_t>::SwapRangeFromSystemToBigEndian((uint32_t *)buffer, this->GetImageSizeInComponents() ) :
-        ByteSwapper<uint32_t>::SwapRangeFromSystemToLittleEndian((uint32_t *)buffer, this->GetImageSizeInComponents() );
-      break;
-    default:
-      itkExceptionMacro(<< "Unknown component size");
+    if ( !this->ReadAndSwapBufferAsBinary( in, buffer, this->GetImageSizeInBytes() ) )
+      {
+      itkExceptionMacro(<<"Data not read completely from file: " << this->GetDataFileName());
+      }
     }
 }
 
 
+bool MRCImageIO::HasPackedMode( void ) const
+{
+  return m_MRCHeader.IsNotNull() && 
+    ( m_MRCHeader->header.mode == MRCHeaderObject::MRCHEADER_MODE_HALF ||
+      m_MRCHeader->header.mode == MRCHeaderObject::MRCHEADER_MODE_UINT4 );
+}
 
-bool MRCImageIO::CanWriteFile(const char* fname)
-{  
-  std::string filename = fname;
-  if ( filename.length() > 4 &&
-       (filename.find(".mrc") == filename.length() - 4 ||
-        filename.find(".rec") == filename.length() - 4 ) )
+
+MRCImageIO::ByteOrder MRCImageIO::GetFileByteOrder( void ) const
+{
+  // the header records the byte order of the file, when writing a
+  // new file it is the system's
+  if ( m_MRCHeader.IsNotNull() )
     {
-    return true;
+    return m_MRCHeader->IsOriginalHeaderBigEndian() ? BigEndian : LittleEndian;
     }
-  return false;
+  return this->GetByteOrder();
 }
 
-void MRCImageIO::UpdateHeaderFromImageIO( void ) 
+
+
+void MRCImageIO::UpdateBrickTableFromImageIO( void )
 {
+  m_BrickTable.clear();
+  m_BricksArePacked = false;
+  m_FileCompressionCodec = ChunkCompressor::NoCompression;
+  m_FileByteShuffle = false;
 
-  MRCHeaderObject::Header header;
-  memset(&header, 0, sizeof(MRCHeaderObject::Header));
-  
-  itkAssertOrThrowMacro ( this->GetNumberOfDimensions() != 0, "Invalid Dimension for Writting" );
-  if ( this->GetNumberOfDimensions() > 3 )
+  if ( m_BrickSize == 0 && !this->GetUseCompression() )
     {
-    itkExceptionMacro(<<"MRC Writer can not write more than 3-dimensional images");
+    return;
     }
-  
-  // magic number
-  strncpy(header.cmap, magicMAP, 4);
-  
-  if (ByteSwapper<void*>::SystemIsBigEndian())   
-    header.stamp[0] = 17;
-  else
-    header.stamp[0] = 68;
 
-  
-  header.alpha = 90;
-  header.beta = 90;
-  header.gamma = 90;
-  
-  header.mapc = MRCHeaderObject::MRCHEADER_MAP_X;
-  header.mapr = MRCHeaderObject::MRCHEADER_MAP_Y;
-  header.maps = MRCHeaderObject::MRCHEADER_MAP_Z;
+  if ( this->GetUseCompression() )
+    {
+    if ( m_CompressionCodec == ChunkCompressor::NoCompression || 
+         !ChunkCompressor::IsCodecSupported( m_CompressionCodec ) )
+      {
+      itkExceptionMacro(<< "Unsupported compression codec: " << m_CompressionCodec);
+      }
+    m_FileCompressionCodec = m_CompressionCodec;
+    m_FileByteShuffle = m_UseByteShuffle;
+    }
 
-  header.mx = header.nx = m_Dimensions[0];
-  header.my = header.ny = (  this->GetNumberOfDimensions() >= 2 ) ? m_Dimensions[1] : 1;
-  header.mz = header.nz = (  this->GetNumberOfDimensions() >= 3 ) ? m_Dimensions[2] : 1;
+  // the bricks are no larger than the image, so that a 2D image has
+  // flat bricks. Without a brick size the compressed bricks are the
+  // sections.
+  SizeType numberOfBricks = 1;
+  for ( unsigned int i = 0; i < 3; ++i )
+    {
+    const SizeType dimension = ( i < this->GetNumberOfDimensions() ) ? this->GetDimensions( i ) : 1;
+    const SizeType brickSize = ( m_BrickSize != 0 ) ? m_BrickSize : ( ( i < 2 ) ? dimension : 1 );
+    m_FileBrickSize[i] = vnl_math_min( brickSize, dimension );
+    m_NumberOfBricks[i] = ( dimension + m_FileBrickSize[i] - 1 ) / m_FileBrickSize[i];
+    numberOfBricks *= m_NumberOfBricks[i];
+    }
+
+  const SizeType extendedHeaderSize = brickTableHeaderSize + numberOfBricks * brickTableEntrySize;
+  if ( extendedHeaderSize > 0x7fffffff )
+    {
+    itkExceptionMacro(<< "The brick table of " << numberOfBricks << " bricks is too large for the extended header");
+    }
   
-  header.mode = -1;
-  if (this->GetPixelType() == SCALAR) 
+  m_BrickTable.resize( static_cast< ::size_t >( numberOfBricks ) );
+  if ( this->IsCompressed() )
     {
-    if (this->GetComponentType() == UCHAR) 
-      {
-      header.mode = MRCHeaderObject::MRCHEADER_MODE_UINT8;
-      } 
-    else if (this->GetComponentType() == SHORT) 
-      {
-      header.mode = MRCHeaderObject::MRCHEADER_MODE_IN16;
-      } 
-    else if (this->GetComponentType() == FLOAT) 
-      {
-      header.mode = MRCHeaderObject::MRCHEADER_MODE_FLOAT;
-      } 
-    else if (this->GetComponentType() == USHORT) 
+    // the positions and sizes are known as the bricks are written
+    for ( ::size_t i = 0; i < m_BrickTable.size(); ++i )
       {
-      header.mode = MRCHeaderObject::MRCHEADER_MODE_UINT16;
+      m_BrickTable[i].position = m_BrickTable[i].size = 0;
       }
-    } 
-  else if (this->GetPixelType() == COMPLEX) 
+    return;
+    }
+  
+  // the bricks are packed after the table, in order
+  const SizeType brickBytes = this->GetBrickSizeInBytes();
+  const SizeType dataPos = sizeof( MRCHeaderObject::Header ) + extendedHeaderSize;
+  for ( ::size_t i = 0; i < m_BrickTable.size(); ++i )
     {
-    // ITK does not support short complex well
-    // but if we have gotten this far, it's done
-    if (this->GetComponentType() == SHORT) 
-      {
-      header.mode = MRCHeaderObject::MRCHEADER_MODE_COMPLEX_INT16;
-      } 
-    else 
-      if (this->GetComponentType() == FLOAT) 
-        {
-        header.mode = MRCHeaderObject::MRCHEADER_MODE_COMPLEX_FLOAT;
-        }
-    } 
-  else if (this->GetPixelType() == RGB 
-           && this->GetComponentType() == UCHAR) 
+    m_BrickTable[i].position = dataPos + static_cast<SizeType>( i ) * brickBytes;
+    m_BrickTable[i].size = brickBytes;
+    }
+  m_BricksArePacked = true;
+}
+
+
+MRCImageIO::SizeType MRCImageIO::GetBrickSizeInBytes( void ) const
+{
+  return m_FileBrickSize[0] * m_FileBrickSize[1] * m_FileBrickSize[2] * this->GetPixelSize();
+}
+
+
+void MRCImageIO::GetBrickTable( std::vector<char> &extendedHeader ) const
+{
+  extendedHeader.assign( brickTableHeaderSize + m_BrickTable.size() * brickTableEntrySize, 0 );
+  char *p = &extendedHeader[0];
+
+  memcpy( p, brickTableTag, 4 );
+  for ( unsigned int i = 0; i < 3; ++i )
     {
-    header.mode = MRCHeaderObject::MRCHEADER_MODE_RGB_BYTE;
-    } 
+    const int32_t brickSize = static_cast<int32_t>( m_FileBrickSize[i] );
+    const int32_t numberOfBricks = static_cast<int32_t>( m_NumberOfBricks[i] );
+    memcpy( p + 4 + 4*i, &brickSize, 4 );
+    memcpy( p + 16 + 4*i, &numberOfBricks, 4 );
+    }
+  const int32_t compression = m_FileCompressionCodec | ( m_FileByteShuffle ? brickTableByteShuffleFlag : 0 );
+  memcpy( p + 28, &compression, 4 );
 
-  if (header.mode == -1) 
+  p += brickTableHeaderSize;
+  for ( ::size_t i = 0; i < m_BrickTable.size(); ++i, p += brickTableEntrySize )
     {
-    itkExceptionMacro(<< "Unsupported pixel type: " << this->GetPixelTypeAsString( this->GetPixelType()) 
-                      << " " << this->GetComponentTypeAsString(this->GetComponentType()) 
-                      << std::endl 
-                      << "Supported pixel types include unsigned byte, unsigned short, signed short, float, rgb unsigned char, float complex"                    
-      );    
+    const int64_t position = static_cast<int64_t>( m_BrickTable[i].position );
+    const int64_t size = static_cast<int64_t>( m_BrickTable[i].size );
+    memcpy( p, &position, 8 );
+    memcpy( p + 8, &size, 8 );
     }
+}
 
 
-  header.nxstart = 0;
-  header.nystart = 0;
-  header.nzstart = 0;
+void MRCImageIO::ReadBrickTable( const char *extendedHeader, SizeType extendedHeaderSize )
+{
+  m_BrickTable.clear();
+  m_BricksArePacked = false;
+  m_FileCompressionCodec = ChunkCompressor::NoCompression;
+  m_FileByteShuffle = false;
   
-  header.xlen = m_Spacing[0]*float(header.mx);
-  header.ylen = m_Spacing[1]*float(header.my);
-  header.zlen = m_Spacing[2]*float(header.mz);
+  if ( extendedHeader == 0 || extendedHeaderSize < brickTableHeaderSize || 
+       memcmp( extendedHeader, brickTableTag, 4 ) != 0 )
+    {
+    // the standard layout
+    return;
+    }
 
+  const bool bigEndian = m_MRCHeader->IsOriginalHeaderBigEndian();
+  const SizeType dimensions[3] = { static_cast<SizeType>( m_MRCHeader->header.nx ),
+                                   static_cast<SizeType>( m_MRCHeader->header.ny ),
+                                   static_cast<SizeType>( m_MRCHeader->header.nz ) };
   
-  header.xorg = m_Origin[0];
-  header.yorg = m_Origin[1];
-  header.zorg = m_Origin[2];
-  
+  SizeType numberOfBricks = 1;
+  for ( unsigned int i = 0; i < 3; ++i )
+    {
+    int32_t brickSize;
+    int32_t numberOfBricksInDimension;
+    memcpy( &brickSize, extendedHeader + 4 + 4*i, 4 );
+    memcpy( &numberOfBricksInDimension, extendedHeader + 16 + 4*i, 4 );
+    brickSize = SwapFileValue( brickSize, bigEndian );
+    numberOfBricksInDimension = SwapFileValue( numberOfBricksInDimension, bigEndian );
+    
+    if ( brickSize <= 0 || 
+         static_cast<SizeType>( numberOfBricksInDimension ) != ( dimensions[i] + brickSize - 1 ) / brickSize )
+      {
+      itkExceptionMacro(<< "The brick table does not match the dimensions of file: " << m_FileName);
+      }
+    m_FileBrickSize[i] = brickSize;
+    m_NumberOfBricks[i] = numberOfBricksInDimension;
+    numberOfBricks *= m_NumberOfBricks[i];
+    }
 
-  // the SetHeader method is used to set the all the internal variable
-  // of the header object correctly, and the data is verified
-  m_MRCHeader = MRCHeaderObject::New();
-  if (!m_MRCHeader->SetHeader(&header))
-    {    
-    itkExceptionMacro(<< "Unexpected error setting header");
+  if ( extendedHeaderSize < brickTableHeaderSize + numberOfBricks * brickTableEntrySize )
+    {
+    itkExceptionMacro(<< "The brick table is truncated in file: " << m_FileName);
     }
-}
 
-void MRCImageIO::WriteImageInformation( const void * buffer ) 
-{  
-  
-  this->UpdateHeaderFromImageIO();
-  
-  this->UpdateHeaderWithMinMaxMean( buffer );
+  int32_t compression;
+  memcpy( &compression, extendedHeader + 28, 4 );
+  compression = SwapFileValue( compression, bigEndian );
+  if ( !ChunkCompressor::IsCodecSupported( compression & 0xff ) )
+    {
+    itkExceptionMacro(<< "Unsupported compression " << ( compression & 0xff ) << " of file: " << m_FileName);
+    }
+  m_FileCompressionCodec = compression & 0xff;
+  m_FileByteShuffle = ( compression & brickTableByteShuffleFlag ) != 0;
 
-  std::ofstream file;
+  // the pixel type is not yet known, so the bricks are packed if
+  // they are of one size and follow each other from the data position
+  const SizeType dataPos = sizeof( MRCHeaderObject::Header ) + extendedHeaderSize;
 
-  this->OpenFileForWriting(file, this->m_FileName.c_str(), true);
-  
-  // write the header
-  file.write(static_cast<const char*>((void*)&(m_MRCHeader->header)), 1024);
-  
- 
+  m_BrickTable.resize( static_cast< ::size_t >( numberOfBricks ) );
+  m_BricksArePacked = true;
+  const char *p = extendedHeader + brickTableHeaderSize;
+  for ( ::size_t i = 0; i < m_BrickTable.size(); ++i, p += brickTableEntrySize )
+    {
+    int64_t position;
+    int64_t size;
+    memcpy( &position, p, 8 );
+    memcpy( &size, p + 8, 8 );
+    m_BrickTable[i].position = static_cast<SizeType>( SwapFileValue( position, bigEndian ) );
+    m_BrickTable[i].size = static_cast<SizeType>( SwapFileValue( size, bigEndian ) );
+    
+    if ( this->IsCompressed() ||
+         m_BrickTable[i].size != m_BrickTable[0].size || 
+         m_BrickTable[i].position != dataPos + static_cast<SizeType>( i ) * m_BrickTable[0].size )
+      {
+      m_BricksArePacked = false;
+      }
+    }
 }
 
 
-template<typename TPixelType>
-void MRCImageIO::UpdateHeaderWithMinMaxMean( const TPixelType * bufferBegin)
+MRCImageIO::SizeType MRCImageIO::GetDataSizeInFile( void ) const
 {
-  typedef TPixelType         PixelType;
-  typedef TPixelType*        PixelPointer;
-  typedef const PixelType    ConstPixelType;
-  typedef const TPixelType*  ConstPixelPointer;
-  
-
-  
-  ConstPixelPointer bufferEnd = bufferBegin + m_IORegion.GetNumberOfPixels();
+  if ( this->HasPackedMode() )
+    {
+    // the rows of 4-bit values are padded to whole bytes
+    const SizeType numberOfPixels = this->GetImageSizeInPixels();
+    if ( m_MRCHeader->header.mode == MRCHeaderObject::MRCHEADER_MODE_HALF )
+      {
+      return numberOfPixels * sizeof( unsigned short );
+      }
+    return numberOfPixels / this->GetDimensions( 0 ) * ( ( this->GetDimensions( 0 ) + 1 ) / 2 );
+    }
   
-  // this could be replaced with std::min_element and
-  // std::max_element, but that is slighlty less efficient
-  std::pair<ConstPixelPointer, ConstPixelPointer> mm = min_max_element(bufferBegin, bufferEnd);
+  if ( !this->IsBricked() )
+    {
+    return this->GetImageSizeInBytes();
+    }
 
-  double mean = std::accumulate( bufferBegin, bufferEnd, double(0.0) ) / std::distance( bufferBegin, bufferEnd );
-  
-  m_MRCHeader->header.amin = float(*mm.first);
-  m_MRCHeader->header.amax = float(*mm.second);
-  m_MRCHeader->header.amean = float(mean);
-} 
+  SizeType end = this->GetHeaderSize();
+  for ( ::size_t i = 0; i < m_BrickTable.size(); ++i )
+    {
+    end = vnl_math_max( end, m_BrickTable[i].position + m_BrickTable[i].size );
+    }
+  return end - this->GetHeaderSize();
+}
 
 
-void MRCImageIO
-::UpdateHeaderWithMinMaxMean( const void * bufferBegin )
+void MRCImageIO::AllocateDataInFile( std::ofstream &file )
 {
+  const SizeType size = this->GetDataSizeInFile() + this->GetHeaderSize();
+  this->AllocateFile( file, size );
 
-// fixed types defined by header
-  switch  (m_MRCHeader->header.mode ) 
+  // the padding of the bricks at the edges of the image is never
+  // written, so the length of a bricked file is set even when the
+  // allocation keeps it
+  if ( this->IsBricked() && this->GetFileAllocationPolicy() == KeepSizeAllocation && size > 0 )
     {
-    case 0:
-      // scalar unsigned char
-      this->UpdateHeaderWithMinMaxMean(static_cast<const unsigned char*>(bufferBegin));
-      break;
-    case 1:
-      // scalar short      
-      this->UpdateHeaderWithMinMaxMean(static_cast<const short*>(bufferBegin));
-      break;
-    case 2:
-      // scalar float
-      this->UpdateHeaderWithMinMaxMean(static_cast<const float*>(bufferBegin));
-      break;
-     case 3:
-       // complex short       
-              
-      // What is the best way to map complex to float?
-      // just set resonable values
-       m_MRCHeader->header.amin = -1.0f;
-       m_MRCHeader->header.amax = 1.0f;
-       m_MRCHeader->header.amean = 0.0f;
-       break;
-    case 4:
-      // complex float
-      
-      // What is the best way to map complex to float?
-      // just set resonable values
-      m_MRCHeader->header.amin = -1.0f;
-      m_MRCHeader->header.amax = 1.0f;
-      m_MRCHeader->header.amean = 0.0f;
-      break;
-    case 6:
-      // scalar unsigned short
-      this->UpdateHeaderWithMinMaxMean(static_cast<const unsigned short*>(bufferBegin));
-      break;
-    case 16:
-      // RGB of unsigned char
-
-      // just set resonable values
-      m_MRCHeader->header.amin = 0.0f;
-      m_MRCHeader->header.amax = 255.0f;
-      m_MRCHeader->header.amean = 127.5f;
-      break;
-    default:
-      itkExceptionMacro(<< "Unrecognized mode");
+    file.seekp( static_cast<std::streampos>( size - 1 ), std::ios::beg );
+    file.write( "\0", 1 );
+    file.seekp( 0 );
     }
 }
 
+
+namespace
+{
+template <typename TChunk>
+bool ChunkFilePositionLess( const TChunk &a, const TChunk &b )
+{
+  return a.filePosition < b.filePosition;
+}
+}
+
+
+void MRCImageIO
+::ComputeIORegionChunks( const ImageIORegion &region, IORegionChunkSequence &sequence ) const
+{
+  if ( !this->IsBricked() )
+    {
+    StreamingImageIOBase::ComputeIORegionChunks( region, sequence );
+    return;
+    }
+
+  // the rows of the bricks are listed, an empty region has no chunks
+  IORegionChunkContainer chunks;
+  sequence.SetChunks( chunks );
+
+  // the region padded to three dimensions
+  SizeType begin[3];
+  SizeType end[3];
+  SizeType size[3];
+  for ( unsigned int i = 0; i < 3; ++i )
+    {
+    begin[i] = ( i < region.GetImageDimension() ) ? region.GetIndex( i ) : 0;
+    size[i] = ( i < region.GetImageDimension() ) ? region.GetSize( i ) : 1;
+    end[i] = begin[i] + size[i];
+    if ( size[i] == 0 )
+      {
+      return;
+      }
+    }
+
+  const SizeType pixelSize = this->GetPixelSize();
+  const SizeType *brickSize = m_FileBrickSize;
+  
+  // each row of the region in a brick is a chunk, the bricks are
+  // visited in the order of the table
+  bool sorted = true;
+  for ( SizeType bz = begin[2] / brickSize[2]; bz * brickSize[2] < end[2]; ++bz )
+    {
+    const SizeType z0 = vnl_math_max( begin[2], bz * brickSize[2] );
+    const SizeType z1 = vnl_math_min( end[2], ( bz + 1 ) * brickSize[2] );
+    for ( SizeType by = begin[1] / brickSize[1]; by * brickSize[1] < end[1]; ++by )
+      {
+      const SizeType y0 = vnl_math_max( begin[1], by * brickSize[1] );
+      const SizeType y1 = vnl_math_min( end[1], ( by + 1 ) * brickSize[1] );
+      for ( SizeType bx = begin[0] / brickSize[0]; bx * brickSize[0] < end[0]; ++bx )
+        {
+        const SizeType x0 = vnl_math_max( begin[0], bx * brickSize[0] );
+        const SizeType x1 = vnl_math_min( end[0], ( bx + 1 ) * brickSize[0] );
+        
+        const BrickTableEntry &brick = 
+          m_BrickTable[ static_cast< ::size_t >( ( bz * m_NumberOfBricks[1] + by ) * m_NumberOfBricks[0] + bx ) ];
+        
+        for ( SizeType z = z0; z < z1; ++z )
+          {
+          for ( SizeType y = y0; y < y1; ++y )
+            {
+            IORegionChunk chunk;
+            chunk.filePosition = brick.position + 
+              ( ( ( z - bz * brickSize[2] ) * brickSize[1] + ( y - by * brickSize[1] ) ) * brickSize[0] 
+                + ( x0 - bx * brickSize[0] ) ) * pixelSize;
+            chunk.bufferOffset = 
+              ( ( ( z - begin[2] ) * size[1] + ( y - begin[1] ) ) * size[0] + ( x0 - begin[0] ) ) * pixelSize;
+            chunk.size = ( x1 - x0 ) * pixelSize;
+
+            if ( !chunks.empty() )
+              {
+              // rows continuous in both the file and the buffer are
+              // one chunk
+              IORegionChunk &last = chunks.back();
+              if ( last.filePosition + last.size == chunk.filePosition &&
+                   last.bufferOffset + last.size == chunk.bufferOffset )
+                {
+                last.size += chunk.size;
+                continue;
+                }
+              if ( chunk.filePosition < last.filePosition )
+                {
+                sorted = false;
+                }
+              }
+            chunks.push_back( chunk );
+            }
+          }
+        }
+      }
+    }
+
+  // the table of another writer may not be in order
+  if ( !sorted )
+    {
+    std::sort( chunks.begin(), chunks.end(), ChunkFilePositionLess<IORegionChunk> );
+    }
+  sequence.SetChunks( chunks );
+}
+
+
+MRCImageIO::SizeType MRCImageIO::GetCacheSlabSize( void ) const
+{
+  if ( !this->IsBricked() )
+    {
+    return StreamingImageIOBase::GetCacheSlabSize();
+    }
+  
+  // the slabs are the bricks when they are whole and evenly spaced
+  // from the data position
+  const SizeType brickBytes = this->GetBrickSizeInBytes();
+  if ( !m_BricksArePacked || m_BrickTable[0].size != brickBytes )
+    {
+    return 0;
+    }
+  return brickBytes;
+}
+
+
+MRCImageIO::SizeType MRCImageIO::EstimateReadCost( const ImageIORegion &region ) const
+{
+  if ( !this->IsBricked() )
+    {
+    return StreamingImageIOBase::EstimateReadCost( region );
+    }
+
+  const SizeType numberOfPixels = static_cast<SizeType>( region.GetNumberOfPixels() );
+  if ( numberOfPixels == 0 )
+    {
+    return 0;
+    }
+  
+  // each row of the region is a run in each brick it crosses
+  const SizeType begin = region.GetIndex( 0 );
+  const SizeType end = begin + region.GetSize( 0 );
+  const SizeType bricksPerRow = ( end - 1 ) / m_FileBrickSize[0] - begin / m_FileBrickSize[0] + 1;
+  const SizeType numberOfRuns = numberOfPixels / region.GetSize( 0 ) * bricksPerRow;
+  
+  return numberOfRuns * this->GetSeekCostInBytes() + numberOfPixels * this->GetPixelSize();
+}
+
+
+void MRCImageIO::CopyBrickRegion( ::size_t brick, const ImageIORegion &region,
+                                  char *brickBuffer, char *regionBuffer, bool toBrick ) const
+{
+  const SizeType pixelSize = this->GetPixelSize();
+  const SizeType *brickSize = m_FileBrickSize;
+  const SizeType b = static_cast<SizeType>( brick );
+  const SizeType brickIndex[3] = { b % m_NumberOfBricks[0],
+                                   ( b / m_NumberOfBricks[0] ) % m_NumberOfBricks[1],
+                                   b / ( m_NumberOfBricks[0] * m_NumberOfBricks[1] ) };
+
+  // the part of the region, padded to three dimensions, in the brick
+  SizeType begin[3];
+  SizeType size[3];
+  SizeType lower[3];
+  SizeType upper[3];
+  for ( unsigned int i = 0; i < 3; ++i )
+    {
+    begin[i] = ( i < region.GetImageDimension() ) ? region.GetIndex( i ) : 0;
+    size[i] = ( i < region.GetImageDimension() ) ? region.GetSize( i ) : 1;
+    lower[i] = vnl_math_max( begin[i], brickIndex[i] * brickSize[i] );
+    upper[i] = vnl_math_min( begin[i] + size[i], ( brickIndex[i] + 1 ) * brickSize[i] );
+    if ( lower[i] >= upper[i] )
+      {
+      return;
+      }
+    }
+
+  const ::size_t rowSize = static_cast< ::size_t >( ( upper[0] - lower[0] ) * pixelSize );
+  for ( SizeType z = lower[2]; z < upper[2]; ++z )
+    {
+    for ( SizeType y = lower[1]; y < upper[1]; ++y )
+      {
+      char *brickRow = brickBuffer + 
+        ( ( ( z - brickIndex[2] * brickSize[2] ) * brickSize[1] + ( y - brickIndex[1] * brickSize[1] ) ) * brickSize[0] 
+          + ( lower[0] - brickIndex[0] * brickSize[0] ) ) * pixelSize;
+      char *regionRow = regionBuffer + 
+        ( ( ( z - begin[2] ) * size[1] + ( y - begin[1] ) ) * size[0] + ( lower[0] - begin[0] ) ) * pixelSize;
+      if ( toBrick )
+        {
+        memcpy( brickRow, regionRow, rowSize );
+        }
+      else
+        {
+        memcpy( regionRow, brickRow, rowSize );
+        }
+      }
+    }
+}
+
+
+// the bricks compressed or decompressed by the threads of a batch
+struct MRCImageIO::BrickCodingStruct
+{
+  MRCImageIO                                  *IO;
+  char                                        *Buffer;
+  std::vector< ::size_t >                      Bricks;
+  std::vector< std::vector<char> >             Data;
+  std::vector< SlabCache::Slab::ConstPointer > Cached;
+  bool                                         UseSlabCache;
+  SlabCache::KeyType                           Key;
+  bool                                         Failed;
+};
+
+
+ITK_THREAD_RETURN_TYPE MRCImageIO::CompressBricksCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  BrickCodingStruct *str = static_cast<BrickCodingStruct *>( info->UserData );
+  const MRCImageIO *io = str->IO;
+
+  const SizeType brickBytes = io->GetBrickSizeInBytes();
+  const unsigned int componentSize = io->GetComponentSize();
+  const CompressionCodecType codec = static_cast<CompressionCodecType>( io->m_FileCompressionCodec );
+  const bool shuffle = io->m_FileByteShuffle && componentSize > 1;
+
+  std::vector<char> brick( static_cast< ::size_t >( brickBytes ) );
+  std::vector<char> shuffled( shuffle ? brick.size() : 0 );
+  
+  for ( ::size_t k = info->ThreadID; k < str->Bricks.size(); k += info->NumberOfThreads )
+    {
+    // the padding of the bricks at the edges of the image is zero
+    std::fill( brick.begin(), brick.end(), 0 );
+    io->CopyBrickRegion( str->Bricks[k], io->m_IORegion, &brick[0], str->Buffer, true );
+
+    const char *data = &brick[0];
+    if ( shuffle )
+      {
+      SIMDByteShuffler::Shuffle( &brick[0], &shuffled[0], brick.size() / componentSize, componentSize );
+      data = &shuffled[0];
+      }
+
+    std::vector<char> &compressed = str->Data[k];
+    compressed.resize( static_cast< ::size_t >( ChunkCompressor::GetCompressBound( codec, brickBytes ) ) );
+    const SizeType compressedSize = ChunkCompressor::Compress( codec, data, brickBytes, 
+                                                               &compressed[0], compressed.size() );
+    if ( compressedSize == 0 )
+      {
+      // stored as it is, which is known by its size
+      compressed.assign( data, data + brick.size() );
+      }
+    else
+      {
+      compressed.resize( static_cast< ::size_t >( compressedSize ) );
+      }
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+ITK_THREAD_RETURN_TYPE MRCImageIO::DecompressBricksCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  BrickCodingStruct *str = static_cast<BrickCodingStruct *>( info->UserData );
+  const MRCImageIO *io = str->IO;
+
+  const SizeType brickBytes = io->GetBrickSizeInBytes();
+  const unsigned int componentSize = io->GetComponentSize();
+  const unsigned int swapSize = io->GetFileByteSwapSize();
+  const CompressionCodecType codec = static_cast<CompressionCodecType>( io->m_FileCompressionCodec );
+  const bool shuffle = io->m_FileByteShuffle && componentSize > 1;
+
+  std::vector<char> decompressed( static_cast< ::size_t >( brickBytes ) );
+  std::vector<char> unshuffled( shuffle ? decompressed.size() : 0 );
+  SlabCache::KeyType key = str->Key;
+
+  for ( ::size_t k = info->ThreadID; k < str->Bricks.size(); k += info->NumberOfThreads )
+    {
+    const ::size_t brick = str->Bricks[k];
+    if ( str->Cached[k].IsNotNull() )
+      {
+      io->CopyBrickRegion( brick, io->m_IORegion, const_cast<char *>( str->Cached[k]->GetBuffer() ), 
+                           str->Buffer, false );
+      continue;
+      }
+
+    // a brick of the uncompressed size is stored as it is
+    std::vector<char> &data = str->Data[k];
+    char *source = &data[0];
+    if ( data.size() != decompressed.size() )
+      {
+      if ( !ChunkCompressor::Decompress( codec, &data[0], data.size(), &decompressed[0], brickBytes ) )
+        {
+        str->Failed = true;
+        continue;
+        }
+      source = &decompressed[0];
+      }
+
+    SlabCache::Slab::Pointer slab;
+    if ( str->UseSlabCache )
+      {
+      slab = SlabCache::Slab::New();
+      slab->Allocate( brickBytes );
+      }
+
+    // the bytes are unshuffled and swapped to the system order in one
+    // pass where possible
+    const ::size_t count = static_cast< ::size_t >( brickBytes / componentSize );
+    char *pixels = source;
+    bool swapped = false;
+    if ( shuffle )
+      {
+      pixels = slab.IsNotNull() ? slab->GetBuffer() : &unshuffled[0];
+      if ( swapSize == componentSize )
+        {
+        SIMDByteShuffler::UnshuffleAndSwap( source, pixels, count, componentSize );
+        swapped = true;
+        }
+      else
+        {
+        SIMDByteShuffler::Unshuffle( source, pixels, count, componentSize );
+        }
+      }
+    else if ( slab.IsNotNull() && swapSize > 1 )
+      {
+      pixels = slab->GetBuffer();
+      SIMDByteSwapper::SwapRangeCopy( source, pixels, static_cast< ::size_t >( brickBytes / swapSize ), swapSize );
+      swapped = true;
+      }
+    else if ( slab.IsNotNull() )
+      {
+      pixels = slab->GetBuffer();
+      memcpy( pixels, source, static_cast< ::size_t >( brickBytes ) );
+      }
+
+    if ( swapSize > 1 && !swapped )
+      {
+      SIMDByteSwapper::SwapRange( pixels, static_cast< ::size_t >( brickBytes / swapSize ), swapSize );
+      }
+
+    io->CopyBrickRegion( brick, io->m_IORegion, pixels, str->Buffer, false );
+
+    if ( slab.IsNotNull() )
+      {
+      key.Position = io->m_BrickTable[brick].position;
+      SlabCache::Insert( key, slab );
+      }
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+void MRCImageIO::WriteCompressedBricks( const void *buffer )
+{
+  MultiThreader::Pointer threader = MultiThreader::New();
+  const ::size_t numberOfThreads = threader->GetNumberOfThreads();
+
+  // the bricks are compressed in batches of a few for each thread,
+  // and written in order
+  const ::size_t batchSize = 4 * numberOfThreads;
+
+  BrickCodingStruct str;
+  str.IO = this;
+  str.Buffer = const_cast<char *>( static_cast<const char *>( buffer ) );
+  str.UseSlabCache = false;
+  str.Failed = false;
+
+  std::ofstream file;
+  this->OpenFileForWriting( file, m_FileName.c_str(), false );
+
+  SizeType position = this->GetHeaderSize();
+  file.seekp( static_cast<std::streampos>( position ), std::ios::beg );
+
+  for ( ::size_t first = 0; first < m_BrickTable.size(); first += batchSize )
+    {
+    str.Bricks.clear();
+    for ( ::size_t i = first; i < first + batchSize && i < m_BrickTable.size(); ++i )
+      {
+      str.Bricks.push_back( i );
+      }
+    str.Data.resize( str.Bricks.size() );
+    
+    threader->SetNumberOfThreads( static_cast<int>( vnl_math_min( numberOfThreads, str.Bricks.size() ) ) );
+    threader->SetSingleMethod( CompressBricksCallback, &str );
+    threader->SingleMethodExecute();
+    
+    for ( ::size_t k = 0; k < str.Bricks.size(); ++k )
+      {
+      BrickTableEntry &entry = m_BrickTable[ str.Bricks[k] ];
+      entry.position = position;
+      entry.size = str.Data[k].size();
+      if ( !this->WriteBufferAsBinary( file, &str.Data[k][0], entry.size ) )
+        {
+        itkExceptionMacro(<< "Could not write file: " << m_FileName);
+        }
+      this->AddNumberOfIOCalls( 1 );
+      position += entry.size;
+      }
+    }
+
+  itkDebugMacro(<< "Compressed " << this->GetImageSizeInBytes() << " bytes into " 
+                << position - this->GetHeaderSize() << " bytes with " 
+                << ChunkCompressor::GetCodecName( m_FileCompressionCodec ) );
+
+  // the table with the positions and sizes of the written bricks
+  std::vector<char> brickTable;
+  this->GetBrickTable( brickTable );
+  file.seekp( static_cast<std::streampos>( sizeof( MRCHeaderObject::Header ) ), std::ios::beg );
+  if ( !this->WriteBufferAsBinary( file, &brickTable[0], brickTable.size() ) )
+    {
+    itkExceptionMacro(<< "Could not write the brick table of file: " << m_FileName);
+    }
+  m_MRCHeader->SetExtendedHeader( &brickTable[0] );
+}
+
+
+namespace
+{
+// orders bricks by their position in the file
+template <typename TBrickTable>
+struct BrickPositionLess
+{
+  BrickPositionLess( const TBrickTable &table ) : Table( table ) {}
+  bool operator()( ::size_t a, ::size_t b ) const { return Table[a].position < Table[b].position; }
+  const TBrickTable &Table;
+};
+}
+
+
+void MRCImageIO::ReadCompressedBricks( std::istream &file, char *buffer )
+{
+  const ImageIORegion &region = m_IORegion;
+  
+  // the bricks of the region, in the order of the file
+  SizeType first[3];
+  SizeType last[3];
+  for ( unsigned int i = 0; i < 3; ++i )
+    {
+    const SizeType begin = ( i < region.GetImageDimension() ) ? region.GetIndex( i ) : 0;
+    const SizeType size = ( i < region.GetImageDimension() ) ? region.GetSize( i ) : 1;
+    if ( size == 0 )
+      {
+      return;
+      }
+    first[i] = begin / m_FileBrickSize[i];
+    last[i] = ( begin + size - 1 ) / m_FileBrickSize[i];
+    }
+
+  std::vector< ::size_t > bricks;
+  for ( SizeType bz = first[2]; bz <= last[2]; ++bz )
+    {
+    for ( SizeType by = first[1]; by <= last[1]; ++by )
+      {
+      for ( SizeType bx = first[0]; bx <= last[0]; ++bx )
+        {
+        bricks.push_back( static_cast< ::size_t >( ( bz * m_NumberOfBricks[1] + by ) * m_NumberOfBricks[0] + bx ) );
+        }
+      }
+    }
+  std::sort( bricks.begin(), bricks.end(), BrickPositionLess< std::vector<BrickTableEntry> >( m_BrickTable ) );
+
+  MultiThreader::Pointer threader = MultiThreader::New();
+  const ::size_t numberOfThreads = threader->GetNumberOfThreads();
+  const ::size_t batchSize = 4 * numberOfThreads;
+
+  BrickCodingStruct str;
+  str.IO = this;
+  str.Buffer = buffer;
+  str.Failed = false;
+
+  // the decompressed bricks are the slabs of the cache
+  FileIdentity identity;
+  str.UseSlabCache = this->GetUseSlabCache() && 
+    this->GetBrickSizeInBytes() <= SlabCache::GetMaximumSize() &&
+    GetFileIdentity( this->GetDataFileName(), identity );
+  str.Key.FileName = m_FileName;
+  str.Key.Inode = identity.inode;
+  str.Key.FileLength = identity.length;
+  str.Key.ModifiedTime = identity.modifiedTime;
+  str.Key.ModifiedTimeNanoseconds = identity.modifiedTimeNanoseconds;
+
+  for ( ::size_t batch = 0; batch < bricks.size(); batch += batchSize )
+    {
+    str.Bricks.assign( bricks.begin() + batch, bricks.begin() + vnl_math_min( batch + batchSize, bricks.size() ) );
+    str.Data.resize( str.Bricks.size() );
+    str.Cached.assign( str.Bricks.size(), SlabCache::Slab::ConstPointer() );
+
+    for ( ::size_t k = 0; k < str.Bricks.size(); ++k )
+      {
+      const BrickTableEntry &entry = m_BrickTable[ str.Bricks[k] ];
+      if ( str.UseSlabCache )
+        {
+        str.Key.Position = entry.position;
+        str.Cached[k] = SlabCache::Find( str.Key );
+        if ( str.Cached[k].IsNotNull() && str.Cached[k]->GetSize() == this->GetBrickSizeInBytes() )
+          {
+          continue;
+          }
+        str.Cached[k] = 0;
+        }
+      
+      str.Data[k].resize( static_cast< ::size_t >( entry.size ) );
+      file.seekg( static_cast<std::streampos>( entry.position ), std::ios::beg );
+      if ( entry.size == 0 || !this->ReadBufferAsBinary( file, &str.Data[k][0], entry.size ) )
+        {
+        itkExceptionMacro(<< "Could not read brick " << str.Bricks[k] << " of file: " << m_FileName);
+        }
+      this->AddNumberOfIOCalls( 2 );
+      }
+
+    threader->SetNumberOfThreads( static_cast<int>( vnl_math_min( numberOfThreads, str.Bricks.size() ) ) );
+    threader->SetSingleMethod( DecompressBricksCallback, &str );
+    threader->SingleMethodExecute();
+
+    if ( str.Failed )
+      {
+      itkExceptionMacro(<< "Corrupt compressed brick in file: " << m_FileName);
+      }
+    }
+}
+
+
+bool MRCImageIO::StreamReadBufferAsBinary( std::istream &file, void *buffer )
+{
+  if ( this->HasPackedMode() )
+    {
+    this->ReadPackedBuffer( file, static_cast<char *>( buffer ) );
+    return true;
+    }
+  
+  if ( !this->IsCompressed() )
+    {
+    return StreamingImageIOBase::StreamReadBufferAsBinary( file, buffer );
+    }
+
+  this->ReadCompressedBricks( file, static_cast<char *>( buffer ) );
+  return true;
+}
+
+
+void MRCImageIO::ReadPackedBuffer( std::istream &file, char *buffer )
+{
+  const bool isHalf = m_MRCHeader->header.mode == MRCHeaderObject::MRCHEADER_MODE_HALF;
+  const IOComponentType componentType = this->GetComponentType();
+  const SizeType dimension0 = this->GetDimensions( 0 );
+  const ImageIORegion ioRegion = m_IORegion;
+  const unsigned int numberOfDimensions = ioRegion.GetImageDimension();
+
+  // the region in the file's geometry, of 16-bit values or of the
+  // bytes of the 4-bit values, whose rows may begin at a high nibble
+  const IOComponentType fileComponentType = isHalf ? USHORT : UCHAR;
+  const SizeType rowSize = ioRegion.GetSize( 0 );
+  const unsigned int firstNibble = static_cast<unsigned int>( ioRegion.GetIndex( 0 ) % 2 );
+  ImageIORegion fileRegion = ioRegion;
+  if ( !isHalf )
+    {
+    fileRegion.SetIndex( 0, ioRegion.GetIndex( 0 ) / 2 );
+    fileRegion.SetSize( 0, ( ioRegion.GetIndex( 0 ) + rowSize + 1 ) / 2 - ioRegion.GetIndex( 0 ) / 2 );
+    }
+  const SizeType fileRowBytes = fileRegion.GetSize( 0 ) * ( isHalf ? 2 : 1 );
+
+  // the region is read in slabs of whole sections which fit in the
+  // staging buffer
+  const unsigned int splitDimension = vnl_math_max( numberOfDimensions, 2u ) - 1;
+  const SizeType splitSize = ( splitDimension < numberOfDimensions ) ? ioRegion.GetSize( splitDimension ) : 1;
+  SizeType rowsPerSection = 1;
+  for ( unsigned int i = 1; i < splitDimension; ++i )
+    {
+    rowsPerSection *= ioRegion.GetSize( i );
+    }
+  const SizeType sectionBytes = vnl_math_max( rowsPerSection * fileRowBytes, SizeType(1) );
+  const SizeType sectionsPerSlab = vnl_math_max( SizeType(1), 
+                                                 vnl_math_min( splitSize, this->GetStagingBufferSize() / sectionBytes ) );
+  std::vector<char> staging( static_cast< ::size_t >( sectionsPerSlab * sectionBytes ) );
+
+  itkDebugMacro(<< "Reading " << ioRegion << " unpacked from mode " << m_MRCHeader->header.mode 
+                << " in pieces of " << staging.size() << " bytes for " << m_FileName );
+
+  this->SetComponentType( fileComponentType );
+  if ( !isHalf )
+    {
+    this->SetDimensions( 0, ( dimension0 + 1 ) / 2 );
+    }
+  
+  try
+    {
+    char *out = buffer;
+    for ( SizeType section = 0; section < splitSize; section += sectionsPerSlab )
+      {
+      const SizeType numberOfSections = vnl_math_min( sectionsPerSlab, splitSize - section );
+      m_IORegion = fileRegion;
+      if ( splitDimension < numberOfDimensions )
+        {
+        m_IORegion.SetIndex( splitDimension, ioRegion.GetIndex( splitDimension ) + section );
+        m_IORegion.SetSize( splitDimension, numberOfSections );
+        }
+      if ( !StreamingImageIOBase::StreamReadBufferAsBinary( file, &staging[0] ) )
+        {
+        itkExceptionMacro(<< "Fail reading");
+        }
+
+      const SizeType numberOfRows = numberOfSections * rowsPerSection;
+      if ( isHalf )
+        {
+        SIMDPixelConverter::HalfToFloat( reinterpret_cast<const unsigned short *>( &staging[0] ),
+                                         reinterpret_cast<float *>( out ), numberOfRows * rowSize );
+        out += numberOfRows * rowSize * sizeof(float);
+        }
+      else
+        {
+        for ( SizeType row = 0; row < numberOfRows; ++row, out += rowSize )
+          {
+          SIMDPixelConverter::UnpackNibbles( reinterpret_cast<const unsigned char *>( &staging[0] ) + row * fileRowBytes, 
+                                             firstNibble, reinterpret_cast<unsigned char *>( out ), rowSize );
+          }
+        }
+      }
+    }
+  catch (...)
+    {
+    m_IORegion = ioRegion;
+    this->SetComponentType( componentType );
+    this->SetDimensions( 0, dimension0 );
+    throw;
+    }
+
+  m_IORegion = ioRegion;
+  this->SetComponentType( componentType );
+  this->SetDimensions( 0, dimension0 );
+}
+
+
+bool MRCImageIO::StreamWriteBufferAsBinary( std::ostream &file, const void *buffer )
+{
+  if ( !this->HasPackedMode() )
+    {
+    return StreamingImageIOBase::StreamWriteBufferAsBinary( file, buffer );
+    }
+
+  if ( m_MRCHeader->header.mode != MRCHeaderObject::MRCHEADER_MODE_HALF || 
+       this->GetComponentType() != FLOAT || this->GetNumberOfComponents() != 1 )
+    {
+    itkExceptionMacro(<< "Only float scalar images can be written into the file of mode " 
+                      << m_MRCHeader->header.mode << ": " << m_FileName );
+    }
+
+  // the IORegion is rounded to halves, which are written as 16-bit
+  // values
+  const SizeType numberOfPixels = static_cast<SizeType>( m_IORegion.GetNumberOfPixels() );
+  std::vector<unsigned short> halves( static_cast< ::size_t >( numberOfPixels ) );
+  SIMDPixelConverter::FloatToHalf( static_cast<const float *>( buffer ), 
+                                   halves.empty() ? 0 : &halves[0], halves.size() );
+  
+  this->SetComponentType( USHORT );
+  try
+    {
+    StreamingImageIOBase::StreamWriteBufferAsBinary( file, halves.empty() ? 0 : &halves[0] );
+    }
+  catch (...)
+    {
+    this->SetComponentType( FLOAT );
+    throw;
+    }
+  this->SetComponentType( FLOAT );
+  
+  return true;
+}
+
+
+unsigned int MRCImageIO::GetActualNumberOfSplitsForWriting( unsigned int numberOfRequestedSplits,
+                                                            const ImageIORegion &pasteRegion,
+                                                            const ImageIORegion &largestPossibleRegion )
+{
+  if ( !this->GetUseCompression() )
+    {
+    return StreamingImageIOBase::GetActualNumberOfSplitsForWriting( numberOfRequestedSplits, 
+                                                                    pasteRegion, largestPossibleRegion );
+    }
+  
+  if ( pasteRegion != largestPossibleRegion )
+    {
+    itkExceptionMacro(<< "Can not paste into a compressed file: " << m_FileName);
+    }
+
+  // the whole image is compressed at once
+  return 1;
+}
+
+
+bool MRCImageIO::CanWriteFile(const char* fname)
+{  
+  std::string filename = fname;
+  if ( filename.length() > 4 &&
+       (filename.find(".mrc") == filename.length() - 4 ||
+        filename.find(".rec") == filename.length() - 4 ) )
+    {
+    return true;
+    }
+  return false;
+}
+
+void MRCImageIO::UpdateHeaderFromImageIO( void ) 
+{
+
+  MRCHeaderObject::Header header;
+  memset(&header, 0, sizeof(MRCHeaderObject::Header));
+  
+  itkAssertOrThrowMacro ( this->GetNumberOfDimensions() != 0, "Invalid Dimension for Writting" );
+  if ( this->GetNumberOfDimensions() > 3 )
+    {
+    itkExceptionMacro(<<"MRC Writer can not write more than 3-dimensional images");
+    }
+  
+  // magic number
+  strncpy(header.cmap, magicMAP, 4);
+  
+  if (ByteSwapper<void*>::SystemIsBigEndian())   
+    header.stamp[0] = 17;
+  else
+    header.stamp[0] = 68;
+
+  
+  header.alpha = 90;
+  header.beta = 90;
+  header.gamma = 90;
+  
+  header.mapc = MRCHeaderObject::MRCHEADER_MAP_X;
+  header.mapr = MRCHeaderObject::MRCHEADER_MAP_Y;
+  header.maps = MRCHeaderObject::MRCHEADER_MAP_Z;
+
+  header.mx = header.nx = m_Dimensions[0];
+  header.my = header.ny = (  this->GetNumberOfDimensions() >= 2 ) ? m_Dimensions[1] : 1;
+  header.mz = header.nz = (  this->GetNumberOfDimensions() >= 3 ) ? m_Dimensions[2] : 1;
+  
+  header.mode = -1;
+  if (this->GetPixelType() == SCALAR) 
+    {
+    if (this->GetComponentType() == UCHAR) 
+      {
+      header.mode = MRCHeaderObject::MRCHEADER_MODE_UINT8;
+      } 
+    else if (this->GetComponentType() == SHORT) 
+      {
+      header.mode = MRCHeaderObject::MRCHEADER_MODE_IN16;
+      } 
+    else if (this->GetComponentType() == FLOAT) 
+      {
+      header.mode = m_UseHalfFloat ? MRCHeaderObject::MRCHEADER_MODE_HALF : MRCHeaderObject::MRCHEADER_MODE_FLOAT;
+      } 
+    else if (this->GetComponentType() == USHORT) 
+      {
+      header.mode = MRCHeaderObject::MRCHEADER_MODE_UINT16;
+      }
+    } 
+  else if (this->GetPixelType() == COMPLEX) 
+    {
+    // ITK does not support short complex well
+    // but if we have gotten this far, it's done
+    if (this->GetComponentType() == SHORT) 
+      {
+      header.mode = MRCHeaderObject::MRCHEADER_MODE_COMPLEX_INT16;
+      } 
+    else 
+      if (this->GetComponentType() == FLOAT) 
+        {
+        header.mode = MRCHeaderObject::MRCHEADER_MODE_COMPLEX_FLOAT;
+        }
+    } 
+  else if (this->GetPixelType() == RGB 
+           && this->GetComponentType() == UCHAR) 
+    {
+    header.mode = MRCHeaderObject::MRCHEADER_MODE_RGB_BYTE;
+    } 
+
+  if (header.mode == -1) 
+    {
+    itkExceptionMacro(<< "Unsupported pixel type: " << this->GetPixelTypeAsString( this->GetPixelType()) 
+                      << " " << this->GetComponentTypeAsString(this->GetComponentType()) 
+                      << std::endl 
+                      << "Supported pixel types include unsigned byte, unsigned short, signed short, float, rgb unsigned char, float complex"                    
+      );    
+    }
+
+  if ( header.mode == MRCHeaderObject::MRCHEADER_MODE_HALF &&
+       ( m_BrickSize != 0 || this->GetUseCompression() ) )
+    {
+    itkExceptionMacro(<< "Files of half precision values can not be bricked or compressed");
+    }
+
+
+  header.nxstart = 0;
+  header.nystart = 0;
+  header.nzstart = 0;
+  
+  header.xlen = m_Spacing[0]*float(header.mx);
+  header.ylen = m_Spacing[1]*float(header.my);
+  header.zlen = m_Spacing[2]*float(header.mz);
+
+  
+  header.xorg = m_Origin[0];
+  header.yorg = m_Origin[1];
+  header.zorg = m_Origin[2];
+  
+  // the header is in the MRC-2014 format
+  const int32_t nversion = mrc2014Version;
+  memcpy( header.notused1 + nversionOffset, &nversion, 4 );
+
+  // the brick table is the extended header, the type of which is
+  // recorded in the exttyp field
+  this->UpdateBrickTableFromImageIO();
+  std::vector<char> brickTable;
+  if ( this->IsBricked() )
+    {
+    this->GetBrickTable( brickTable );
+    header.next = static_cast<int32_t>( brickTable.size() );
+    memcpy( header.notused1 + exttypOffset, brickTableTag, 4 );
+    }
+
+  // the SetHeader method is used to set the all the internal variable
+  // of the header object correctly, and the data is verified
+  m_MRCHeader = MRCHeaderObject::New();
+  if (!m_MRCHeader->SetHeader(&header))
+    {    
+    itkExceptionMacro(<< "Unexpected error setting header");
+    }
+
+  if ( !brickTable.empty() )
+    {
+    m_MRCHeader->SetExtendedHeader( &brickTable[0] );
+    }
+}
+
+void MRCImageIO::WriteImageInformation( const void * buffer ) 
+{  
+  
+  this->UpdateHeaderFromImageIO();
+  
+  this->UpdateHeaderWithMinMaxMean( buffer );
+
+  std::ofstream file;
+
+  this->OpenFileForWriting(file, this->m_FileName.c_str(), true);
+  
+  // write the header
+  file.write(static_cast<const char*>((void*)&(m_MRCHeader->header)), 1024);
+  
+  if ( this->IsBricked() )
+    {
+    std::vector<char> brickTable;
+    this->GetBrickTable( brickTable );
+    file.write( &brickTable[0], brickTable.size() );
+    }
+
+  if ( file.fail() )
+    {
+    itkExceptionMacro(<< "Could not write header of file: " << m_FileName);
+    }
+}
+
+
+namespace
+{
+
+// adds the statistics of a block of count values, with its mean and
+// sum of squared deviations from that mean, to statistics. The
+// deviations are combined with the difference of the means, as
+// proposed by Chan, Golub and LeVeque, so the sum of squares of the
+// values, which cancels with the square of the mean, is never formed.
+template <typename TStatistics>
+void MergeStatistics( TStatistics &statistics,
+                      double minimum, double maximum,
+                      double mean, double sumOfSquaredDeviations,
+                      size_t count )
+{
+  if ( count == 0 )
+    {
+    return;
+    }
+  if ( statistics.count == 0 )
+    {
+    statistics.minimum = minimum;
+    statistics.maximum = maximum;
+    statistics.mean = mean;
+    statistics.sumOfSquaredDeviations = sumOfSquaredDeviations;
+    statistics.count = count;
+    return;
+    }
+
+  statistics.minimum = ( minimum < statistics.minimum ) ? minimum : statistics.minimum;
+  statistics.maximum = ( maximum > statistics.maximum ) ? maximum : statistics.maximum;
+
+  const double n1 = static_cast<double>( statistics.count );
+  const double n2 = static_cast<double>( count );
+  const double n = n1 + n2;
+  const double delta = mean - statistics.mean;
+  statistics.mean += delta * ( n2 / n );
+  statistics.sumOfSquaredDeviations += sumOfSquaredDeviations + delta * delta * ( n1 * n2 / n );
+  statistics.count += count;
+}
+
+
+// removes the statistics of a subset of the values from statistics,
+// the inverse of MergeStatistics. The minimum and maximum are not
+// changed.
+template <typename TStatistics>
+void RemoveStatistics( TStatistics &statistics, const TStatistics &subset )
+{
+  if ( subset.count == 0 )
+    {
+    return;
+    }
+  if ( subset.count >= statistics.count )
+    {
+    statistics.mean = statistics.sumOfSquaredDeviations = 0.0;
+    statistics.count = 0;
+    return;
+    }
+
+  const double n = static_cast<double>( statistics.count );
+  const double n2 = static_cast<double>( subset.count );
+  const double n1 = n - n2;
+  const double mean = ( n * statistics.mean - n2 * subset.mean ) / n1;
+  const double delta = subset.mean - mean;
+  const double sumOfSquaredDeviations = statistics.sumOfSquaredDeviations - subset.sumOfSquaredDeviations
+    - delta * delta * ( n1 * n2 / n );
+
+  statistics.mean = mean;
+  statistics.sumOfSquaredDeviations = ( sumOfSquaredDeviations > 0.0 ) ? sumOfSquaredDeviations : 0.0;
+  statistics.count -= subset.count;
+}
+
+
+// The integer values are summed exactly, in blocks small enough
+// that the 64-bit sums, and the square of the sum multiplied by the
+// count, of 16-bit values can not overflow. The sum of squared
+// deviations of a block is then exact before its conversion to
+// double. The inner loop has no branches or floating point
+// reductions, so that the compiler can auto-vectorize it.
+template <typename TValue, typename TStatistics>
+void AccumulateIntegerStatistics( const TValue *values, size_t count,
+                                  TStatistics &statistics )
+{
+  const size_t blockSize = 16*1024;
+
+  for ( size_t begin = 0; begin < count; begin += blockSize )
+    {
+    const size_t end = ( count - begin < blockSize ) ? count : begin + blockSize;
+
+    TValue minimum = values[begin];
+    TValue maximum = values[begin];
+    itk::int64_t sum = 0;
+    itk::int64_t sumOfSquares = 0;
+    for ( size_t i = begin; i < end; ++i )
+      {
+      const TValue v = values[i];
+      minimum = ( v < minimum ) ? v : minimum;
+      maximum = ( v > maximum ) ? v : maximum;
+      sum += v;
+      sumOfSquares += static_cast<itk::int64_t>( v ) * v;
+      }
+
+    const itk::int64_t n = static_cast<itk::int64_t>( end - begin );
+    MergeStatistics( statistics, minimum, maximum,
+                     static_cast<double>( sum ) / n,
+                     static_cast<double>( n * sumOfSquares - sum * sum ) / n,
+                     end - begin );
+    }
+}
+
+
+// The floating point values are accumulated in blocks which stay in
+// the cache, in two passes: the first for the mean of the block, and
+// the second for the squared deviations from it, corrected by the
+// rounding error of the mean. The blocks are then merged. Each pass
+// uses independent partial sums so that the compiler can
+// auto-vectorize the additions without reordering them.
+template <typename TValue, typename TStatistics>
+void AccumulateRealStatistics( const TValue *values, size_t count,
+                               TStatistics &statistics )
+{
+  const unsigned int numberOfLanes = 4;
+  const size_t blockSize = 2*1024;
+
+  for ( size_t begin = 0; begin < count; begin += blockSize )
+    {
+    const TValue *block = values + begin;
+    const size_t n = ( count - begin < blockSize ) ? count - begin : blockSize;
+
+    double minimum[numberOfLanes];
+    double maximum[numberOfLanes];
+    double sum[numberOfLanes];
+    for ( unsigned int k = 0; k < numberOfLanes; ++k )
+      {
+      minimum[k] = maximum[k] = block[0];
+      sum[k] = 0.0;
+      }
+
+    size_t i = 0;
+    for ( ; i + numberOfLanes <= n; i += numberOfLanes )
+      {
+      for ( unsigned int k = 0; k < numberOfLanes; ++k )
+        {
+        const double v = block[i+k];
+        minimum[k] = ( v < minimum[k] ) ? v : minimum[k];
+        maximum[k] = ( v > maximum[k] ) ? v : maximum[k];
+        sum[k] += v;
+        }
+      }
+    for ( ; i < n; ++i )
+      {
+      const double v = block[i];
+      minimum[0] = ( v < minimum[0] ) ? v : minimum[0];
+      maximum[0] = ( v > maximum[0] ) ? v : maximum[0];
+      sum[0] += v;
+      }
+    for ( unsigned int k = 1; k < numberOfLanes; ++k )
+      {
+      minimum[0] = ( minimum[k] < minimum[0] ) ? minimum[k] : minimum[0];
+      maximum[0] = ( maximum[k] > maximum[0] ) ? maximum[k] : maximum[0];
+      sum[0] += sum[k];
+      }
+    const double mean = sum[0] / n;
+
+    double deviation[numberOfLanes];
+    double squaredDeviation[numberOfLanes];
+    for ( unsigned int k = 0; k < numberOfLanes; ++k )
+      {
+      deviation[k] = squaredDeviation[k] = 0.0;
+      }
+    for ( i = 0; i + numberOfLanes <= n; i += numberOfLanes )
+      {
+      for ( unsigned int k = 0; k < numberOfLanes; ++k )
+        {
+        const double d = block[i+k] - mean;
+        deviation[k] += d;
+        squaredDeviation[k] += d*d;
+        }
+      }
+    for ( ; i < n; ++i )
+      {
+      const double d = block[i] - mean;
+      deviation[0] += d;
+      squaredDeviation[0] += d*d;
+      }
+    for ( unsigned int k = 1; k < numberOfLanes; ++k )
+      {
+      deviation[0] += deviation[k];
+      squaredDeviation[0] += squaredDeviation[k];
+      }
+
+    MergeStatistics( statistics, minimum[0], maximum[0],
+                     mean + deviation[0] / n,
+                     squaredDeviation[0] - deviation[0] * deviation[0] / n,
+                     n );
+    }
+}
+
+
+// The magnitudes of the complex values are computed into a small
+// buffer, which stays in the cache while its statistics are
+// accumulated.
+template <typename TComponent, typename TStatistics>
+void AccumulateComplexStatistics( const TComponent *values, size_t count,
+                                  TStatistics &statistics )
+{
+  const size_t blockSize = 4*1024;
+  double magnitude[blockSize];
+
+  for ( size_t begin = 0; begin < count; begin += blockSize )
+    {
+    const size_t n = ( count - begin < blockSize ) ? count - begin : blockSize;
+    const TComponent *v = values + 2*begin;
+    for ( size_t i = 0; i < n; ++i )
+      {
+      const double re = v[2*i];
+      const double im = v[2*i+1];
+      magnitude[i] = std::sqrt( re*re + im*im );
+      }
+    AccumulateRealStatistics( magnitude, n, statistics );
+    }
+}
+
+
+// The floats are rounded to half precision and back in a small
+// buffer, so that the statistics are those of the values in the
+// file. The floats read from a file are unchanged by the rounding.
+template <typename TStatistics>
+void AccumulateHalfStatistics( const float *values, size_t count,
+                               TStatistics &statistics )
+{
+  const size_t blockSize = 4*1024;
+  unsigned short half[blockSize];
+  float rounded[blockSize];
+
+  for ( size_t begin = 0; begin < count; begin += blockSize )
+    {
+    const size_t n = ( count - begin < blockSize ) ? count - begin : blockSize;
+    SIMDPixelConverter::FloatToHalf( values + begin, half, n );
+    SIMDPixelConverter::HalfToFloat( half, rounded, n );
+    AccumulateRealStatistics( rounded, n, statistics );
+    }
+}
+
+}
+
+
+void MRCImageIO
+::AccumulatePixelStatistics( int mode, const void *buffer,
+                             SizeType begin, SizeType end,
+                             PixelStatistics &statistics )
+{
+  const SizeType count = end - begin;
+
+  // fixed types defined by header
+  switch ( mode )
+    {
+    case MRCHeaderObject::MRCHEADER_MODE_UINT8:
+      AccumulateIntegerStatistics( static_cast<const unsigned char*>(buffer) + begin, count, statistics );
+      break;
+    case MRCHeaderObject::MRCHEADER_MODE_IN16:
+      AccumulateIntegerStatistics( static_cast<const short*>(buffer) + begin, count, statistics );
+      break;
+    case MRCHeaderObject::MRCHEADER_MODE_FLOAT:
+      AccumulateRealStatistics( static_cast<const float*>(buffer) + begin, count, statistics );
+      break;
+    case MRCHeaderObject::MRCHEADER_MODE_COMPLEX_INT16:
+      AccumulateComplexStatistics( static_cast<const short*>(buffer) + 2*begin, count, statistics );
+      break;
+    case MRCHeaderObject::MRCHEADER_MODE_COMPLEX_FLOAT:
+      AccumulateComplexStatistics( static_cast<const float*>(buffer) + 2*begin, count, statistics );
+      break;
+    case MRCHeaderObject::MRCHEADER_MODE_UINT16:
+      AccumulateIntegerStatistics( static_cast<const unsigned short*>(buffer) + begin, count, statistics );
+      break;
+    case MRCHeaderObject::MRCHEADER_MODE_RGB_BYTE:
+      // each component of the pixel is a value
+      AccumulateIntegerStatistics( static_cast<const unsigned char*>(buffer) + 3*begin, 3*count, statistics );
+      break;
+    case MRCHeaderObject::MRCHEADER_MODE_HALF:
+      // the packed modes are in the buffer as the values read, or as
+      // the floats written, which are rounded
+      AccumulateHalfStatistics( static_cast<const float*>(buffer) + begin, count, statistics );
+      break;
+    case MRCHeaderObject::MRCHEADER_MODE_UINT4:
+      AccumulateIntegerStatistics( static_cast<const unsigned char*>(buffer) + begin, count, statistics );
+      break;
+    default:
+      break;
+    }
+}
+
+
+struct MRCImageIO::PixelStatisticsStruct
+{
+  int                          Mode;
+  const void                  *Buffer;
+  SizeType                     NumberOfPixels;
+  std::vector<PixelStatistics> Statistics;
+};
+
+
+ITK_THREAD_RETURN_TYPE MRCImageIO::PixelStatisticsCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  PixelStatisticsStruct *str = static_cast<PixelStatisticsStruct *>( info->UserData );
+
+  // each thread reduces a contiguous range of the buffer
+  const SizeType numberOfThreads = info->NumberOfThreads;
+  const SizeType threadId = info->ThreadID;
+  const SizeType begin = str->NumberOfPixels * threadId / numberOfThreads;
+  const SizeType end = str->NumberOfPixels * ( threadId + 1 ) / numberOfThreads;
+
+  AccumulatePixelStatistics( str->Mode, str->Buffer, begin, end, str->Statistics[threadId] );
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+void MRCImageIO
+::ComputePixelStatistics( const void *buffer, SizeType numberOfPixels,
+                          PixelStatistics &statistics ) const
+{
+  // don't split the buffer into ranges smaller then this
+  const SizeType minimumPixelsPerThread = 256*1024;
+
+  PixelStatistics empty;
+  empty.minimum = empty.maximum = 0.0;
+  empty.mean = empty.sumOfSquaredDeviations = 0.0;
+  empty.count = 0;
+
+  MultiThreader::Pointer threader = MultiThreader::New();
+  const SizeType numberOfThreads = vnl_math_min( static_cast<SizeType>( threader->GetNumberOfThreads() ),
+                                                 numberOfPixels / minimumPixelsPerThread );
+  threader->SetNumberOfThreads( static_cast<int>( vnl_math_max( numberOfThreads, SizeType(1) ) ) );
+
+  PixelStatisticsStruct str;
+  str.Mode = m_MRCHeader->header.mode;
+  str.Buffer = buffer;
+  str.NumberOfPixels = numberOfPixels;
+  str.Statistics.resize( threader->GetNumberOfThreads(), empty );
+
+  if ( threader->GetNumberOfThreads() == 1 )
+    {
+    AccumulatePixelStatistics( str.Mode, buffer, 0, numberOfPixels, str.Statistics[0] );
+    }
+  else
+    {
+    threader->SetSingleMethod( PixelStatisticsCallback, &str );
+    threader->SingleMethodExecute();
+    }
+
+  statistics = empty;
+  for ( unsigned int i = 0; i < str.Statistics.size(); ++i )
+    {
+    const PixelStatistics &s = str.Statistics[i];
+    MergeStatistics( statistics, s.minimum, s.maximum, s.mean, s.sumOfSquaredDeviations, s.count );
+    }
+}
+
+
+void MRCImageIO
+::UpdateHeaderWithStatistics( const PixelStatistics &statistics )
+{
+  if ( statistics.count == 0 )
+    {
+    return;
+    }
+
+  // the rms is the deviation from the mean
+  const double variance = statistics.sumOfSquaredDeviations / statistics.count;
+
+  m_MRCHeader->header.amin = float(statistics.minimum);
+  m_MRCHeader->header.amax = float(statistics.maximum);
+  m_MRCHeader->header.amean = float(statistics.mean);
+  m_MRCHeader->header.rms = float( variance > 0.0 ? std::sqrt( variance ) : 0.0 );
+}
+
+
+void MRCImageIO
+::UpdateHeaderWithMinMaxMean( const void * bufferBegin )
+{
+  switch ( m_MRCHeader->header.mode )
+    {
+    case MRCHeaderObject::MRCHEADER_MODE_UINT8:
+    case MRCHeaderObject::MRCHEADER_MODE_IN16:
+    case MRCHeaderObject::MRCHEADER_MODE_FLOAT:
+    case MRCHeaderObject::MRCHEADER_MODE_COMPLEX_INT16:
+    case MRCHeaderObject::MRCHEADER_MODE_COMPLEX_FLOAT:
+    case MRCHeaderObject::MRCHEADER_MODE_UINT16:
+    case MRCHeaderObject::MRCHEADER_MODE_RGB_BYTE:
+    case MRCHeaderObject::MRCHEADER_MODE_HALF:
+      break;
+    default:
+      itkExceptionMacro(<< "Unrecognized mode");
+    }
+
+  // the first region of a streamed file begins the accumulated
+  // statistics
+  this->ComputePixelStatistics( bufferBegin, m_IORegion.GetNumberOfPixels(), m_WrittenStatistics );
+  m_WrittenStatisticsFileName = m_FileName;
+  this->UpdateHeaderWithStatistics( m_WrittenStatistics );
+}
+
+
+MRCImageIO::SizeType MRCImageIO
+::GetNumberOfStatisticsValues( void ) const
+{
+  if ( m_MRCHeader->header.mode == MRCHeaderObject::MRCHEADER_MODE_RGB_BYTE )
+    {
+    return 3 * this->GetImageSizeInPixels();
+    }
+  return this->GetImageSizeInPixels();
+}
+
+
+void MRCImageIO
+::GetHeaderStatistics( PixelStatistics &statistics ) const
+{
+  const double mean = m_MRCHeader->header.amean;
+  const double rms = m_MRCHeader->header.rms;
+
+  statistics.count = this->GetNumberOfStatisticsValues();
+  statistics.minimum = m_MRCHeader->header.amin;
+  statistics.maximum = m_MRCHeader->header.amax;
+  statistics.mean = mean;
+  statistics.sumOfSquaredDeviations = rms*rms * statistics.count;
+}
+
+
+void MRCImageIO
+::ReadPixelStatistics( PixelStatistics &statistics )
+{
+  // only the IORegion is read, as the buffer being pasted
+  std::vector<char> buffer( m_IORegion.GetNumberOfPixels() * this->GetPixelSize() );
+
+  std::ifstream file;
+  this->OpenFileForReading( file, m_FileName.c_str() );
+  if ( !this->StreamReadBufferAsBinary( file, buffer.empty() ? 0 : &buffer[0] ) )
+    {
+    itkExceptionMacro(<< "Could not read the region to be pasted from: " << m_FileName);
+    }
+
+  this->ComputePixelStatistics( buffer.empty() ? 0 : &buffer[0], 
+                                m_IORegion.GetNumberOfPixels(), statistics );
+}
+
+
+void MRCImageIO
+::CommitHeaderStatistics( void )
+{
+  // read the header, and the image information
+  this->ReadImageInformation();
+
+  const ImageIORegion previousIORegion = m_IORegion;
+  
+  // the file is read in slabs of the slowest dimension of about this
+  // size
+  const SizeType slabSize = 64*1024*1024;
+
+  const unsigned int last = this->GetNumberOfDimensions() - 1;
+  const SizeType numberOfSlices = this->GetDimensions( last );
+  const SizeType sliceSize = this->GetImageSizeInBytes() / numberOfSlices;
+  const SizeType slicesPerSlab = vnl_math_min( vnl_math_max( slabSize / sliceSize, SizeType(1) ), 
+                                               numberOfSlices );
+
+  ImageIORegion slab( this->GetNumberOfDimensions() );
+  for ( unsigned int i = 0; i < this->GetNumberOfDimensions(); ++i )
+    {
+    slab.SetIndex( i, 0 );
+    slab.SetSize( i, this->GetDimensions( i ) );
+    }
+
+  std::vector<char> buffer( slicesPerSlab * sliceSize );
+  
+  PixelStatistics total;
+  total.minimum = total.maximum = 0.0;
+  total.mean = total.sumOfSquaredDeviations = 0.0;
+  total.count = 0;
+
+  std::ifstream file;
+  this->OpenFileForReading( file, m_FileName.c_str() );
+  for ( SizeType slice = 0; slice < numberOfSlices; slice += slicesPerSlab )
+    {
+    slab.SetIndex( last, slice );
+    slab.SetSize( last, vnl_math_min( slicesPerSlab, numberOfSlices - slice ) );
+    m_IORegion = slab;
+    
+    if ( !this->StreamReadBufferAsBinary( file, &buffer[0] ) )
+      {
+      m_IORegion = previousIORegion;
+      itkExceptionMacro(<< "Could not read file: " << m_FileName);
+      }
+    
+    PixelStatistics statistics;
+    this->ComputePixelStatistics( &buffer[0], slab.GetNumberOfPixels(), statistics );
+    MergeStatistics( total, statistics.minimum, statistics.maximum,
+                     statistics.mean, statistics.sumOfSquaredDeviations, statistics.count );
+    }
+  m_IORegion = previousIORegion;
+
+  this->UpdateHeaderWithStatistics( total );
+
+  MRCHeaderObject::Header header;
+  m_MRCHeader->GetHeader( &header );
+
+  IORegionChunkContainer chunks( 1 );
+  chunks[0].filePosition = 0;
+  chunks[0].bufferOffset = 0;
+  chunks[0].size = m_MRCHeader->GetHeaderSize();
+  this->ConcurrentWriteChunks( reinterpret_cast<const char*>( &header ), IORegionChunkSequence( chunks ), 0 );
+}
+
+
+void MRCImageIO
+::RewriteHeader( std::ostream &os )
+{
+  MRCHeaderObject::Header header;
+  m_MRCHeader->GetHeader( &header );
+
+  os.seekp( 0, std::ios::beg );
+  os.write( reinterpret_cast<const char*>( &header ), m_MRCHeader->GetHeaderSize() );
+  
+  if ( os.fail() )
+    {
+    itkExceptionMacro(<< "Could not rewrite header of file: " << m_FileName);
+    }
+}
+
+void MRCImageIO
+::UpdatePyramidLevels( const void *buffer, bool newFile )
+{
+  if ( m_NumberOfPyramidLevels == 0 )
+    {
+    m_PyramidBuilder = 0;
+    return;
+    }
+
+  if ( newFile )
+    {
+    m_PyramidBuilder = MRCPyramidBuilder::New();
+    m_PyramidBuilder->Initialize( this, m_FileName, m_NumberOfPyramidLevels );
+    }
+
+  // the region must be whole sections, following those already added
+  const unsigned int dimension = m_IORegion.GetImageDimension();
+  bool wholeSections = m_PyramidBuilder.IsNotNull();
+  for ( unsigned int i = 0; i < 2 && i < dimension && wholeSections; ++i )
+    {
+    wholeSections = m_IORegion.GetIndex( i ) == 0 && 
+      m_IORegion.GetSize( i ) == static_cast<SizeType>( this->GetDimensions( i ) );
+    }
+  const SizeType firstSection = ( dimension > 2 ) ? m_IORegion.GetIndex( 2 ) : 0;
+  if ( !wholeSections || firstSection != m_PyramidBuilder->GetNextSection() )
+    {
+    m_PyramidBuilder = 0;
+    itkExceptionMacro(<< "The pyramid levels of " << m_FileName 
+                      << " can only be built while writing whole sections in order");
+    }
+
+  m_PyramidBuilder->AddSections( buffer, ( dimension > 2 ) ? m_IORegion.GetSize( 2 ) : 1 );
+  if ( m_PyramidBuilder->IsComplete() )
+    {
+    m_PyramidBuilder = 0;
+    }
+}
+
+
 void MRCImageIO
 ::Write(const void* buffer)
 {
+  // the cached slabs of the file will be out of date, including
+  // those read while it is written
+  const SlabCache::RemoveFileScope removeCachedSlabs( m_FileName );
+
+  // a region at the beginning of the file starts a new file or
+  // stream, and the statistics accumulated of an earlier stream,
+  // which may not have been completed, or of another file, no longer
+  // describe the file
+  bool startOfFile = true;
+  for ( unsigned int i = 0; i < m_IORegion.GetImageDimension(); ++i )
+    {
+    startOfFile = startOfFile && m_IORegion.GetIndex( i ) == 0;
+    }
+  if ( startOfFile || m_WrittenStatisticsFileName != m_FileName )
+    {
+    m_WrittenStatistics.count = 0;
+    }
+
+  if( this->RequestedToStream() && 
+      this->GetUseConcurrentPasting() && 
+      itksys::SystemTools::FileExists( m_FileName.c_str() ) )
+    {
+    // other writers may be pasting into the file, so the header is
+    // only read when the file is opened, and it is not rewritten
+    if ( m_MRCHeader.IsNull() || !this->IsConcurrentFileCurrent() )
+      {
+      std::ifstream file;
+      this->InternalReadImageInformation( file, m_FileName );
+      }
+    if ( this->IsCompressed() )
+      {
+      itkExceptionMacro(<< "Can not paste into the compressed file: " << m_FileName);
+      }
+    if ( this->HasPackedMode() )
+      {
+      itkExceptionMacro(<< "Can not concurrently paste into the file of mode " << m_MRCHeader->header.mode 
+                        << ": " << m_FileName);
+      }
+    this->UpdatePyramidLevels( buffer, false );
+    
+    this->ConcurrentWriteBufferAsBinary( buffer );
+    }
 
-  if( this->RequestedToStream() )
+  else if( this->RequestedToStream() )
     {
+    if ( this->GetUseCompression() )
+      {
+      itkExceptionMacro(<< "A compressed file can not be streamed or pasted: " << m_FileName);
+      }
 
+    // set when the statistics in the header have changed
+    bool rewriteHeader = false;
     
     // we assume that GetActualNumberOfSplitsForWriting is called before
     // this methods and it will remove the file if a new header needs to
     // be written
-    if (!itksys::SystemTools::FileExists( m_FileName.c_str() ))
+    const bool newFile = !itksys::SystemTools::FileExists( m_FileName.c_str() );
+    if ( newFile )
       {
       this->WriteImageInformation( buffer );
 
       
       std::ofstream file;
-      // open and stream write
+      // open and allocate the file
       this->OpenFileForWriting(file, this->m_FileName.c_str(), false);
-      
-      // write one byte at the end of the file to allocate (this is a
-      // nifty trick which should not write the entire size of the file
-      // just allocate it, if the system supports sparse files)
-      std::streampos seekPos = this->GetImageSizeInBytes() + this->GetHeaderSize() - 1;
-      file.seekp( seekPos, std::ios::cur );
-      file.write("\0", 1);
-      file.seekp( 0 );
+      this->AllocateDataInFile( file );
 
       }
     else
       {
       
-      if ( m_MRCHeader.IsNull() ) 
+      if ( m_MRCHeader.IsNull() || 
+           ( this->GetUseFileCache() && !this->IsHeaderCacheValid() ) ) 
         {
         // need to determin the size of the header in the file by
         // reading the header into m_MRCHeader
@@ -568,22 +2215,70 @@ void MRCImageIO
         // the internal m_MRCHeader variable
         
         std::ifstream file;
-        this->InternalReadImageInformation( file );
+        this->InternalReadImageInformation( file, m_FileName );
         
         }
+
+      if ( this->IsCompressed() )
+        {
+        itkExceptionMacro(<< "Can not paste into the compressed file: " << m_FileName);
+        }
+      
       
-      // TODO:
-      // how are we suppose to update min, max mean? we could be
-      // overwriting data, and we don't know what's already there if
-      // we were pasting
+      PixelStatistics statistics;
+      if ( m_WrittenStatistics.count != 0 &&
+           m_WrittenStatistics.count < this->GetNumberOfStatisticsValues() )
+        {
+        // streaming into the file we created, so the statistics of
+        // this region are added to those of the previous regions
+        this->ComputePixelStatistics( buffer, m_IORegion.GetNumberOfPixels(), statistics );
+        MergeStatistics( m_WrittenStatistics, statistics.minimum, statistics.maximum,
+                         statistics.mean, statistics.sumOfSquaredDeviations, statistics.count );
+        
+        // after the last region the header is rewritten
+        if ( m_WrittenStatistics.count == this->GetNumberOfStatisticsValues() )
+          {
+          this->UpdateHeaderWithStatistics( m_WrittenStatistics );
+          m_WrittenStatistics.count = 0;
+          rewriteHeader = true;
+          }
+        }
+      else if ( m_UpdateStatisticsWhenPasting )
+        {
+        // pasting, the values being overwritten are replaced in the
+        // statistics stored in the header
+        PixelStatistics previous;
+        this->ReadPixelStatistics( previous );
+        this->ComputePixelStatistics( buffer, m_IORegion.GetNumberOfPixels(), statistics );
+
+        PixelStatistics total;
+        this->GetHeaderStatistics( total );
+        const double minimum = vnl_math_min( total.minimum, statistics.minimum );
+        const double maximum = vnl_math_max( total.maximum, statistics.maximum );
+        RemoveStatistics( total, previous );
+        MergeStatistics( total, minimum, maximum,
+                         statistics.mean, statistics.sumOfSquaredDeviations, statistics.count );
+        
+        this->UpdateHeaderWithStatistics( total );
+        rewriteHeader = true;
+        }
       }
 
+    this->UpdatePyramidLevels( buffer, newFile );
+
     std::ofstream file;
     // open and stream write
-    this->OpenFileForWriting(file, this->m_FileName.c_str(), false);
+    std::ofstream &out = this->OpenCachedFileForWriting( file );
     
-    this->StreamWriteBufferAsBinary(file, buffer);
+    this->StreamWriteBufferAsBinary( out, buffer );
+
+    if ( rewriteHeader )
+      {
+      this->RewriteHeader( out );
+      }
     
+    out.flush();
+    this->UpdateHeaderCache();
     }
 
   else 
@@ -592,6 +2287,32 @@ void MRCImageIO
     // this will truncate file and write header
     this->WriteImageInformation( buffer );
 
+    this->UpdatePyramidLevels( buffer, true );
+
+    if ( this->IsCompressed() )
+      {
+      this->WriteCompressedBricks( buffer );
+      return;
+      }
+
+    if ( this->IsBricked() || this->HasPackedMode() )
+      {
+      // the whole image is written as the rows of the bricks, or
+      // packed, into the file allocated with its size in the file
+      std::ofstream file;
+      this->OpenFileForWriting( file, this->m_FileName.c_str(), false );
+      this->AllocateDataInFile( file );
+      this->StreamWriteBufferAsBinary( file, buffer );
+      return;
+      }
+
+    // write the image past the header without the page cache
+    if ( this->GetUseDirectIO() && 
+         this->DirectWriteBufferAsBinary( this->GetHeaderSize(), buffer, this->GetImageSizeInBytes() ) )
+      {
+      return;
+      }
+
     std::ofstream file;
     // open the file
     this->OpenFileForWriting(file, this->m_FileName.c_str(), false);
@@ -3,6 +3,8 @@
 
 #include "itkStreamingImageIOBase.h"
 #include "itkMRCHeaderObject.h"
+#include "itkChunkCompressor.h"
+#include "itkMRCPyramidBuilder.h"
 
 namespace itk
 {
@@ -26,6 +28,34 @@ namespace Local
  * This implementation is designed to support IO Streaming of
  * arbitrary regions.
  *
+ * A file may also be stored in a bricked layout, where the image is
+ * divided into cubic bricks which are each stored continuously. The
+ * position of each brick is in a table in the extended header, so
+ * the header remains a valid MRC header. Orthogonal slices in any
+ * direction then cost about the same to read, where the standard
+ * layout reads a YZ slice one pixel at a time. Bricked files are read
+ * and pasted into transparently, a new file is bricked when
+ * BrickSize is set.
+ *
+ * With UseCompression a new file is written with each brick, or each
+ * section when BrickSize is zero, compressed independently, and the
+ * compressed size of each in the brick table. The bricks are
+ * compressed and decompressed by several threads, and a streamed
+ * read decompresses only the bricks of its region. A compressed file
+ * can not be pasted into.
+ *
+ * With NumberOfPyramidLevels a new file is written with binned
+ * levels of detail in sibling files, built in the same pass as the
+ * sections are written. Setting LevelOfDetail then reads a level in
+ * place of the file, so a read binned by 4 reads 1/64th of the bytes.
+ * \sa MRCPyramidBuilder
+ *
+ * The packed modes of MRC-2014 are read as the type of their values,
+ * mode 12 of half precision values as float, and mode 101 of 4-bit
+ * values as unsigned char. Their pixels are unpacked as they are
+ * read, so they stream like the other modes. Float images are written
+ * in mode 12 with UseHalfFloat.
+ *
  * As with all ImageIOs this class is designed to work with
  * ImageFileReader and ImageFileWriter, so its direct use is
  * discouraged.
@@ -76,6 +106,117 @@ public:
   // see super class for documentation
   virtual void Write(const void* buffer);
 
+  /** \brief Set/Get if the statistics in the header are updated when
+   * pasting into an existing file
+   *
+   * When streaming a new file, the min, max, mean and rms in the
+   * header are accumulated over all the written regions, and the
+   * header is rewritten after the last. When pasting, the pixels of
+   * the region are read before they are overwritten, so that they can
+   * be replaced in the mean and rms stored in the header. The min and
+   * max can only be extended, as the stored extremes may have been in
+   * the region. Off by default, where the header is unchanged by
+   * pasting.
+   */
+  itkSetMacro(UpdateStatisticsWhenPasting, bool);
+  itkGetConstMacro(UpdateStatisticsWhenPasting, bool);
+  itkBooleanMacro(UpdateStatisticsWhenPasting);
+
+  /** \brief Recomputes the min, max, mean and rms of the pixels in
+   * the file, and rewrites the header
+   *
+   * This is the single update of the header after concurrent pasting,
+   * as the concurrent writers do not change it. The file is read in
+   * slabs, and the header is written while its bytes are locked.
+   * \sa SetUseConcurrentPasting
+   */
+  void CommitHeaderStatistics( void );
+
+  /** \brief Set/Get the edge length in pixels of the bricks of a new
+   * file
+   *
+   * When not zero, a new file is written in the bricked layout with
+   * bricks of this size, the bricks at the far edges of the image are
+   * padded to the whole size. Zero, the default, writes the standard
+   * layout. Existing files are read and pasted into in their own
+   * layout, whatever the value.
+   */
+  itkSetMacro(BrickSize, unsigned int);
+  itkGetConstMacro(BrickSize, unsigned int);
+
+  /** \brief Returns true if the file whose information was last read
+   * or written has the bricked layout */
+  bool IsBricked( void ) const { return !m_BrickTable.empty(); }
+
+  typedef ChunkCompressor::CodecType CompressionCodecType;
+
+  /** \brief Set/Get the compression method of a new file written with
+   * UseCompression
+   *
+   * The default is ZlibCompression, LZCompression is several times
+   * faster but compresses less.
+   */
+  itkSetMacro(CompressionCodec, CompressionCodecType);
+  itkGetConstMacro(CompressionCodec, CompressionCodecType);
+
+  /** \brief Set/Get if the bytes of the components are shuffled into
+   * planes before a new file is compressed, on by default */
+  itkSetMacro(UseByteShuffle, bool);
+  itkGetConstMacro(UseByteShuffle, bool);
+  itkBooleanMacro(UseByteShuffle);
+
+  /** \brief Returns true if the file whose information was last read
+   * or written has compressed bricks */
+  bool IsCompressed( void ) const { return m_FileCompressionCodec != ChunkCompressor::NoCompression; }
+
+  /** \brief A compressed file is written in one piece */
+  virtual bool CanStreamWrite( void ) { return !this->GetUseCompression(); }
+
+  /** \brief Overloaded to write a compressed file in one piece */
+  virtual unsigned int GetActualNumberOfSplitsForWriting( unsigned int numberOfRequestedSplits,
+                                                          const ImageIORegion &pasteRegion,
+                                                          const ImageIORegion &largestPossibleRegion );
+
+  /** \brief Set/Get the number of binned levels written with a new
+   * file
+   *
+   * Level l, binned by 2^l in each direction, is written to the
+   * sibling file named by MRCPyramidBuilder::GetLevelFileName. The
+   * levels are built as the sections are written, which must be the
+   * whole image or streamed whole sections in order. Zero, the
+   * default, writes no levels.
+   */
+  itkSetMacro(NumberOfPyramidLevels, unsigned int);
+  itkGetConstMacro(NumberOfPyramidLevels, unsigned int);
+
+  /** \brief Set/Get the level of detail which is read
+   *
+   * When not zero, ReadImageInformation and Read use the file of that
+   * level of the pyramid of FileName, which is not changed. The
+   * spacing and origin are those of the binned pixels. Zero, the
+   * default, reads the file itself.
+   */
+  itkSetMacro(LevelOfDetail, unsigned int);
+  itkGetConstMacro(LevelOfDetail, unsigned int);
+
+  /** \brief Returns the number of levels of the pyramid of fileName
+   * which exist */
+  static unsigned int GetNumberOfPyramidLevelsOfFile( const std::string &fileName );
+
+  /** \brief Set/Get if float scalar images are written in mode 12
+   *
+   * The values are rounded to the nearest half precision value, which
+   * halves the size of the file. Mode 12 files can not be bricked or
+   * compressed. Off by default.
+   */
+  itkSetMacro(UseHalfFloat, bool);
+  itkGetConstMacro(UseHalfFloat, bool);
+  itkBooleanMacro(UseHalfFloat);
+
+  /** \brief Returns true if the file whose information was last read
+   * or written has packed pixels, in mode 12 or 101 */
+  bool HasPackedMode( void ) const;
+
   /** \todo Move to itkIOCommon with the other MetaDataDictionary
    * keys, likely rename the symbol to something like
    * ITK_MRCHHeader. (remember to fix class doc too)
@@ -93,28 +234,182 @@ protected:
    */
   virtual SizeType GetHeaderSize( void ) const;
 
+  /** Overloaded to return the byte order recorded in the header. */
+  virtual ByteOrder GetFileByteOrder( void ) const;
+
+  /** Overloaded to list the rows of the bricks of a bricked file,
+   * in increasing order of file position. */
+  virtual void ComputeIORegionChunks( const ImageIORegion &region, IORegionChunkSequence &sequence ) const;
+  using StreamingImageIOBase::ComputeIORegionChunks;
+
+  /** Overloaded so that the slabs of a bricked file are bricks. */
+  virtual SizeType GetCacheSlabSize( void ) const;
+
+  /** Overloaded to count the brick rows of a bricked file as the
+   * runs. */
+  virtual SizeType EstimateReadCost( const ImageIORegion &region ) const;
+
+  /** Overloaded to decompress the bricks of the IORegion of a
+   * compressed file, and to unpack the pixels of a packed mode. */
+  virtual bool StreamReadBufferAsBinary( std::istream &file, void *buffer );
+
+  /** Overloaded to pack the pixels of a mode 12 file. */
+  virtual bool StreamWriteBufferAsBinary( std::ostream &file, const void *buffer );
+
 private:
 
   MRCImageIO(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
   
-  // internal methods to update the min and max in the header based on
-  // the data, in the image buffer to be written
-  template<typename TPixelType>
-    void UpdateHeaderWithMinMaxMean( const TPixelType * bufferBegin );
+  // the statistics of the pixel values from which the min, max, mean
+  // and rms of the header are computed, with the sum of squared
+  // deviations from the mean so that the rms does not lose its
+  // precision when the mean is large. For the complex modes the
+  // magnitude is used, and for RGB each component is a value.
+  struct PixelStatistics
+    {
+    double   minimum;
+    double   maximum;
+    double   mean;
+    double   sumOfSquaredDeviations;
+    SizeType count;
+    };
+
+  // accumulates the statistics of pixels [begin,end) of buffer, in
+  // the format of the mode, into statistics
+  static void AccumulatePixelStatistics( int mode, const void *buffer,
+                                         SizeType begin, SizeType end,
+                                         PixelStatistics &statistics );
+
+  // computes the statistics of the pixels in the buffer in a single
+  // pass divided among threads
+  void ComputePixelStatistics( const void *buffer, SizeType numberOfPixels,
+                               PixelStatistics &statistics ) const;
+
+  struct PixelStatisticsStruct;
+  static ITK_THREAD_RETURN_TYPE PixelStatisticsCallback( void *arg );
+
+  // internal methods to update the min, max, mean and rms in the
+  // header based on the data, in the image buffer to be written
   void UpdateHeaderWithMinMaxMean( const void *buffer );
+  void UpdateHeaderWithStatistics( const PixelStatistics &statistics );
+
+  // the number of values in the image, which are accumulated in the
+  // statistics
+  SizeType GetNumberOfStatisticsValues( void ) const;
+
+  // the statistics of the whole file, as stored in the header
+  void GetHeaderStatistics( PixelStatistics &statistics ) const;
+
+  // computes the statistics of the pixels of the IORegion in the file
+  void ReadPixelStatistics( PixelStatistics &statistics );
+
+  // writes the header over the header in the file, in the file's
+  // byte order
+  void RewriteHeader( std::ostream &os );
 
   // internal methods to update the header object from the ImageIO's
   // set member variables
   void UpdateHeaderFromImageIO( void );
+
+  // the position and number of bytes of a brick in the file
+  struct BrickTableEntry
+    {
+    SizeType position;
+    SizeType size;
+    };
+
+  // computes the layout of a new file with bricks of m_BrickSize
+  void UpdateBrickTableFromImageIO( void );
+
+  // sets the layout from the extended header, or the standard layout
+  // if it has no brick table
+  void ReadBrickTable( const char *extendedHeader, SizeType extendedHeaderSize );
+
+  // the extended header of a new bricked file, in the system's byte
+  // order
+  void GetBrickTable( std::vector<char> &extendedHeader ) const;
+
+  // the number of bytes of the image data in the file, including the
+  // padding of the bricks
+  SizeType GetDataSizeInFile( void ) const;
+
+  // allocates the header and data of a new file, open for writing as
+  // file
+  void AllocateDataInFile( std::ofstream &file );
+
+  // the number of bytes of a brick, uncompressed
+  SizeType GetBrickSizeInBytes( void ) const;
+
+  // copies the part of region in brick between the buffer of the
+  // brick and the buffer of the region
+  void CopyBrickRegion( ::size_t brick, const ImageIORegion &region,
+                        char *brickBuffer, char *regionBuffer, bool toBrick ) const;
+
+  // compresses the bricks of the whole image in buffer after the
+  // header, and rewrites the brick table
+  void WriteCompressedBricks( const void *buffer );
+
+  // reads and decompresses the bricks of the IORegion into buffer
+  void ReadCompressedBricks( std::istream &file, char *buffer );
+
+  struct BrickCodingStruct;
+  static ITK_THREAD_RETURN_TYPE CompressBricksCallback( void *arg );
+  static ITK_THREAD_RETURN_TYPE DecompressBricksCallback( void *arg );
+  
+  // reads the IORegion of a file of a packed mode, in pieces of
+  // sections in the file's geometry, which are unpacked into buffer
+  void ReadPackedBuffer( std::istream &file, char *buffer );
+
+  // the file of the LevelOfDetail, the data of which is read
+  virtual std::string GetDataFileName( void ) const;
+
+  // throws an exception if the file of the LevelOfDetail does not
+  // exist
+  void CheckLevelOfDetailFile( void ) const;
+
+  // adds the sections of the IORegion in buffer to the pyramid
+  // levels, which are started for a new file
+  void UpdatePyramidLevels( const void *buffer, bool newFile );
   
-  // reimplemented
-  void InternalReadImageInformation(std::ifstream& is);
+  // reimplemented, reads the header of fileName
+  void InternalReadImageInformation(std::ifstream& is, const std::string &fileName);
  
   virtual void WriteImageInformation( const void * bufferBegin );
 
 
   MRCHeaderObject::Pointer m_MRCHeader;
+
+  bool m_UpdateStatisticsWhenPasting;
+
+  // the statistics of the regions streamed into a new file so far,
+  // and the file they describe
+  PixelStatistics m_WrittenStatistics;
+  std::string     m_WrittenStatisticsFileName;
+
+  unsigned int m_BrickSize;
+
+  // the bricked layout of the file, the table is empty for the
+  // standard layout. Bricks are numbered with X fastest.
+  SizeType                     m_FileBrickSize[3];
+  SizeType                     m_NumberOfBricks[3];
+  std::vector<BrickTableEntry> m_BrickTable;
+  bool                         m_BricksArePacked;
+
+  CompressionCodecType m_CompressionCodec;
+  bool                 m_UseByteShuffle;
+
+  // the compression of the bricks of the file
+  int  m_FileCompressionCodec;
+  bool m_FileByteShuffle;
+
+  unsigned int               m_NumberOfPyramidLevels;
+  MRCPyramidBuilder::Pointer m_PyramidBuilder;
+
+  bool m_UseHalfFloat;
+
+  // the level of the pyramid of FileName which is read
+  unsigned int m_LevelOfDetail;
 };
 
 
@@ -0,0 +1,300 @@
+#include "itkMRCPyramidBuilder.h"
+#include "itkMRCImageIO.h"
+#include "itkNumericTraits.h"
+
+#include <itksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+namespace
+{
+
+typedef itk::Local::MRCPyramidBuilder::SizeType SizeType;
+
+template <typename T>
+void ConvertToValues( const void *buffer, SizeType count, double *values )
+{
+  const T *p = static_cast<const T *>( buffer );
+  for ( SizeType i = 0; i < count; ++i )
+    {
+    values[i] = static_cast<double>( p[i] );
+    }
+}
+
+// the means are rounded and clamped to integer types
+template <typename T>
+void ConvertFromValues( const double *values, SizeType count, void *buffer )
+{
+  T *p = static_cast<T *>( buffer );
+  if ( !itk::NumericTraits<T>::is_integer )
+    {
+    for ( SizeType i = 0; i < count; ++i )
+      {
+      p[i] = static_cast<T>( values[i] );
+      }
+    return;
+    }
+
+  const double minimum = static_cast<double>( itk::NumericTraits<T>::NonpositiveMin() );
+  const double maximum = static_cast<double>( itk::NumericTraits<T>::max() );
+  for ( SizeType i = 0; i < count; ++i )
+    {
+    const double v = std::floor( values[i] + 0.5 );
+    p[i] = static_cast<T>( ( v < minimum ) ? minimum : ( ( v > maximum ) ? maximum : v ) );
+    }
+}
+
+}
+
+namespace itk
+{
+namespace Local
+{
+
+MRCPyramidBuilder::MRCPyramidBuilder()
+  : m_NumberOfDimensions( 0 ),
+    m_ComponentType( ImageIOBase::UNKNOWNCOMPONENTTYPE ),
+    m_ComponentSize( 0 ),
+    m_NextSection( 0 )
+{
+  for ( unsigned int i = 0; i < 3; ++i )
+    {
+    m_Dimensions[i] = 0;
+    }
+}
+
+
+void MRCPyramidBuilder::PrintSelf(std::ostream& os, Indent indent) const
+{
+  Superclass::PrintSelf( os, indent );
+  os << indent << "NumberOfLevels: " << m_Levels.size() << std::endl;
+  os << indent << "NextSection: " << m_NextSection << std::endl;
+}
+
+
+std::string MRCPyramidBuilder::GetLevelFileName( const std::string &fileName, unsigned int level )
+{
+  std::ostringstream suffix;
+  suffix << "_bin" << ( 1u << level );
+
+  // the suffix is placed before the extension
+  const std::string::size_type slash = fileName.find_last_of( "/\\" );
+  const std::string::size_type dot = fileName.find_last_of( '.' );
+  if ( dot == std::string::npos || ( slash != std::string::npos && dot < slash ) )
+    {
+    return fileName + suffix.str();
+    }
+  return fileName.substr( 0, dot ) + suffix.str() + fileName.substr( dot );
+}
+
+
+void MRCPyramidBuilder::Initialize( const ImageIOBase *io, const std::string &fileName, unsigned int numberOfLevels )
+{
+  if ( io->GetNumberOfComponents() != 1 )
+    {
+    itkExceptionMacro(<< "Pyramid levels can only be built for scalar images");
+    }
+
+  switch ( io->GetComponentType() )
+    {
+    case ImageIOBase::UCHAR:
+    case ImageIOBase::CHAR:
+    case ImageIOBase::SHORT:
+    case ImageIOBase::USHORT:
+    case ImageIOBase::FLOAT:
+      break;
+    default:
+      itkExceptionMacro(<< "Pyramid levels can not be built for component type: "
+                        << io->GetComponentTypeAsString( io->GetComponentType() ) );
+    }
+
+  m_ComponentType = io->GetComponentType();
+  m_ComponentSize = io->GetComponentSize();
+  m_NumberOfDimensions = io->GetNumberOfDimensions();
+  for ( unsigned int i = 0; i < 3; ++i )
+    {
+    m_Dimensions[i] = ( i < m_NumberOfDimensions ) ? io->GetDimensions( i ) : 1;
+    }
+  m_NextSection = 0;
+  m_Section.resize( m_Dimensions[0] * m_Dimensions[1] );
+
+  // m_Levels[0] is level 1, binned by 2
+  m_Levels.resize( numberOfLevels );
+  for ( unsigned int l = 0; l < numberOfLevels; ++l )
+    {
+    Level &level = m_Levels[l];
+    const SizeType *input = ( l == 0 ) ? m_Dimensions : m_Levels[l-1].Dimensions;
+    for ( unsigned int i = 0; i < 3; ++i )
+      {
+      level.Dimensions[i] = ( input[i] + 1 ) / 2;
+      }
+    level.Sum.assign( level.Dimensions[0] * level.Dimensions[1], 0.0 );
+    level.Mean.resize( level.Sum.size() );
+    level.NumberOfSectionsInSum = 0;
+    level.NextSection = 0;
+
+    // the origin is the center of the first bin
+    const double factor = static_cast<double>( 2u << l );
+    MRCImageIO::Pointer levelIO = MRCImageIO::New();
+    levelIO->SetNumberOfDimensions( m_NumberOfDimensions );
+    for ( unsigned int i = 0; i < m_NumberOfDimensions; ++i )
+      {
+      levelIO->SetDimensions( i, level.Dimensions[i] );
+      levelIO->SetSpacing( i, io->GetSpacing( i ) * factor );
+      levelIO->SetOrigin( i, io->GetOrigin( i ) + io->GetSpacing( i ) * ( factor - 1.0 ) / 2.0 );
+      }
+    levelIO->SetComponentType( m_ComponentType );
+    levelIO->SetPixelType( ImageIOBase::SCALAR );
+    levelIO->SetNumberOfComponents( 1 );
+
+    const std::string levelFileName = GetLevelFileName( fileName, l + 1 );
+    levelIO->SetFileName( levelFileName.c_str() );
+    itksys::SystemTools::RemoveFile( levelFileName.c_str() );
+
+    level.IO = levelIO.GetPointer();
+    }
+}
+
+
+void MRCPyramidBuilder::AddSections( const void *buffer, SizeType numberOfSections )
+{
+  if ( m_NextSection + numberOfSections > m_Dimensions[2] )
+    {
+    itkExceptionMacro(<< "More sections added than in the image");
+    }
+
+  const SizeType sectionSize = m_Dimensions[0] * m_Dimensions[1];
+  const char *p = static_cast<const char *>( buffer );
+  for ( SizeType s = 0; s < numberOfSections; ++s, p += sectionSize * m_ComponentSize )
+    {
+    switch ( m_ComponentType )
+      {
+      case ImageIOBase::UCHAR:
+        ConvertToValues<unsigned char>( p, sectionSize, &m_Section[0] );
+        break;
+      case ImageIOBase::CHAR:
+        ConvertToValues<char>( p, sectionSize, &m_Section[0] );
+        break;
+      case ImageIOBase::SHORT:
+        ConvertToValues<short>( p, sectionSize, &m_Section[0] );
+        break;
+      case ImageIOBase::USHORT:
+        ConvertToValues<unsigned short>( p, sectionSize, &m_Section[0] );
+        break;
+      case ImageIOBase::FLOAT:
+        ConvertToValues<float>( p, sectionSize, &m_Section[0] );
+        break;
+      default:
+        break;
+      }
+
+    ++m_NextSection;
+    if ( !m_Levels.empty() )
+      {
+      this->AddSection( 0, &m_Section[0] );
+      }
+    }
+}
+
+
+void MRCPyramidBuilder::AddSection( unsigned int l, const double *section )
+{
+  Level &level = m_Levels[l];
+  const SizeType *input = ( l == 0 ) ? m_Dimensions : m_Levels[l-1].Dimensions;
+
+  // pairs of pixels are added into each bin of the row
+  for ( SizeType y = 0; y < input[1]; ++y )
+    {
+    const double *in = section + y * input[0];
+    double *row = &level.Sum[ ( y / 2 ) * level.Dimensions[0] ];
+    SizeType x = 0;
+    for ( ; x + 1 < input[0]; x += 2 )
+      {
+      row[x/2] += in[x] + in[x+1];
+      }
+    if ( x < input[0] )
+      {
+      row[x/2] += in[x];
+      }
+    }
+  ++level.NumberOfSectionsInSum;
+
+  // the bin is complete with two sections, or the last section of the
+  // previous level
+  if ( level.NumberOfSectionsInSum == 2 ||
+       2 * level.NextSection + level.NumberOfSectionsInSum == input[2] )
+    {
+    this->FlushSection( l );
+    }
+}
+
+
+void MRCPyramidBuilder::FlushSection( unsigned int l )
+{
+  Level &level = m_Levels[l];
+  const SizeType *input = ( l == 0 ) ? m_Dimensions : m_Levels[l-1].Dimensions;
+
+  // the bins at the far edges have fewer pixels
+  for ( SizeType y = 0; y < level.Dimensions[1]; ++y )
+    {
+    const SizeType ny = vnl_math_min( SizeType(2), input[1] - 2 * y );
+    for ( SizeType x = 0; x < level.Dimensions[0]; ++x )
+      {
+      const SizeType nx = vnl_math_min( SizeType(2), input[0] - 2 * x );
+      const SizeType i = y * level.Dimensions[0] + x;
+      level.Mean[i] = level.Sum[i] / static_cast<double>( nx * ny * level.NumberOfSectionsInSum );
+      }
+    }
+
+  const SizeType sectionSize = level.Mean.size();
+  m_Buffer.resize( sectionSize * m_ComponentSize );
+  switch ( m_ComponentType )
+    {
+    case ImageIOBase::UCHAR:
+      ConvertFromValues<unsigned char>( &level.Mean[0], sectionSize, &m_Buffer[0] );
+      break;
+    case ImageIOBase::CHAR:
+      ConvertFromValues<char>( &level.Mean[0], sectionSize, &m_Buffer[0] );
+      break;
+    case ImageIOBase::SHORT:
+      ConvertFromValues<short>( &level.Mean[0], sectionSize, &m_Buffer[0] );
+      break;
+    case ImageIOBase::USHORT:
+      ConvertFromValues<unsigned short>( &level.Mean[0], sectionSize, &m_Buffer[0] );
+      break;
+    case ImageIOBase::FLOAT:
+      ConvertFromValues<float>( &level.Mean[0], sectionSize, &m_Buffer[0] );
+      break;
+    default:
+      break;
+    }
+
+  // the section is streamed into the file of the level
+  ImageIORegion region( m_NumberOfDimensions );
+  for ( unsigned int i = 0; i < m_NumberOfDimensions; ++i )
+    {
+    region.SetIndex( i, 0 );
+    region.SetSize( i, level.Dimensions[i] );
+    }
+  if ( m_NumberOfDimensions > 2 )
+    {
+    region.SetIndex( 2, level.NextSection );
+    region.SetSize( 2, 1 );
+    }
+  level.IO->SetIORegion( region );
+  level.IO->Write( &m_Buffer[0] );
+
+  ++level.NextSection;
+  std::fill( level.Sum.begin(), level.Sum.end(), 0.0 );
+  level.NumberOfSectionsInSum = 0;
+
+  if ( l + 1 < m_Levels.size() )
+    {
+    this->AddSection( l + 1, &level.Mean[0] );
+    }
+}
+
+} // end namespace Local
+} // end namespace itk
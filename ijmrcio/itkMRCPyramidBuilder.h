@@ -0,0 +1,121 @@
+#ifndef __itkMRCPyramidBuilder_h
+#define __itkMRCPyramidBuilder_h
+
+#include "itkImageIOBase.h"
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+#include <string>
+#include <vector>
+
+namespace itk
+{
+namespace Local
+{
+
+/** \class MRCPyramidBuilder
+ *
+ * \brief Builds the binned levels of an MRC file from its sections as
+ * they are written
+ *
+ * Each level of the pyramid is a sibling MRC file, named by
+ * GetLevelFileName, in which each pixel is the mean of a 2x2x2 block
+ * of pixels of the previous level. Level 1 is binned by 2, level 2 by
+ * 4 and so on. The blocks at the far edges of an odd sized image are
+ * the mean of the pixels present.
+ *
+ * The sections of the image are added in order, and each level only
+ * holds the sum of one of its sections. When two sections of a level
+ * have been added, the binned section is written to its file and
+ * added to the next level, so the levels are built in one pass over
+ * the image with little memory.
+ *
+ * Only scalar images are supported. This class is used by MRCImageIO
+ * when NumberOfPyramidLevels is set.
+ *
+ * \sa MRCImageIO
+ */
+class ITK_EXPORT MRCPyramidBuilder
+  : public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef MRCPyramidBuilder        Self;
+  typedef Object                   Superclass;
+  typedef SmartPointer<Self>       Pointer;
+  typedef SmartPointer<const Self> ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(MRCPyramidBuilder, Object);
+
+  typedef ImageIOBase::SizeType SizeType;
+
+  /** \brief Returns the file name of a level of the pyramid of
+   * fileName, such as "tomogram_bin4.mrc" for level 2 of
+   * "tomogram.mrc" */
+  static std::string GetLevelFileName( const std::string &fileName, unsigned int level );
+
+  /** \brief Starts building numberOfLevels levels of the image
+   * described by io, written to fileName
+   *
+   * The files of the levels are replaced.
+   */
+  void Initialize( const ImageIOBase *io, const std::string &fileName, unsigned int numberOfLevels );
+
+  /** \brief Adds numberOfSections whole sections of the image, in the
+   * system's byte order, which follow the sections already added */
+  void AddSections( const void *buffer, SizeType numberOfSections );
+
+  /** \brief Get the index of the next section of the image to be
+   * added */
+  itkGetConstMacro(NextSection, SizeType);
+
+  /** \brief Returns true when all the sections of the image have been
+   * added, and the levels are written */
+  bool IsComplete( void ) const { return m_NextSection == m_Dimensions[2]; }
+
+protected:
+  MRCPyramidBuilder();
+  void PrintSelf(std::ostream& os, Indent indent) const;
+
+private:
+  MRCPyramidBuilder(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+
+  // a level with the sum of its current section
+  struct Level
+    {
+    SizeType             Dimensions[3];
+    std::vector<double>  Sum;
+    std::vector<double>  Mean;
+    SizeType             NumberOfSectionsInSum;
+    SizeType             NextSection;
+    ImageIOBase::Pointer IO;
+    };
+
+  // adds a section of the previous level to level
+  void AddSection( unsigned int level, const double *section );
+
+  // writes the mean of the sum of level, and adds it to the next
+  // level
+  void FlushSection( unsigned int level );
+
+  unsigned int                   m_NumberOfDimensions;
+  SizeType                       m_Dimensions[3];
+  ImageIOBase::IOComponentType   m_ComponentType;
+  unsigned int                   m_ComponentSize;
+  std::vector<Level>             m_Levels;
+  SizeType                       m_NextSection;
+
+  // the buffers of a section as values, and in the component type
+  std::vector<double>            m_Section;
+  std::vector<char>              m_Buffer;
+};
+
+} // end namespace Local
+} // end namespace itk
+
+#endif // __itkMRCPyramidBuilder_h
@@ -0,0 +1,274 @@
+#include "itkSIMDByteShuffler.h"
+
+#include <string.h>
+
+#if defined(IJMRCIO_HAVE_X86_SIMD_TARGETS)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+// the kernels transpose count components from source to destination,
+// the unshuffle kernel takes the planes in reverse order when swap is
+// true
+typedef void (*ShuffleKernelType)( const char *source, char *destination,
+                                   size_t count, unsigned int componentSize );
+typedef void (*UnshuffleKernelType)( const char *source, char *destination,
+                                     size_t count, unsigned int componentSize, bool swap );
+
+// transposes the components from begin to count
+void ShuffleScalar( const char *source, char *destination,
+                    size_t begin, size_t count, unsigned int componentSize )
+{
+  for ( unsigned int b = 0; b < componentSize; ++b )
+    {
+    char *plane = destination + b*count;
+    for ( size_t i = begin; i < count; ++i )
+      {
+      plane[i] = source[i*componentSize + b];
+      }
+    }
+}
+
+void UnshuffleScalar( const char *source, char *destination,
+                      size_t begin, size_t count, unsigned int componentSize, bool swap )
+{
+  for ( unsigned int b = 0; b < componentSize; ++b )
+    {
+    const char *plane = source + ( swap ? componentSize - 1 - b : b )*count;
+    for ( size_t i = begin; i < count; ++i )
+      {
+      destination[i*componentSize + b] = plane[i];
+      }
+    }
+}
+
+void ShuffleKernelScalar( const char *source, char *destination,
+                          size_t count, unsigned int componentSize )
+{
+  ShuffleScalar( source, destination, 0, count, componentSize );
+}
+
+void UnshuffleKernelScalar( const char *source, char *destination,
+                            size_t count, unsigned int componentSize, bool swap )
+{
+  UnshuffleScalar( source, destination, 0, count, componentSize, swap );
+}
+
+#if defined(IJMRCIO_HAVE_X86_SIMD_TARGETS)
+
+// Blocks of 16 components are transposed in registers. Separating
+// the even and the odd bytes of a stream of bytes once for each bit
+// of the component size gives the planes, and interleaving them back
+// the other way gives the components.
+
+// separates the even and odd bytes of n vectors
+__attribute__((target("sse2")))
+inline void Deinterleave( const __m128i *in, unsigned int n, __m128i *even, __m128i *odd )
+{
+  const __m128i mask = _mm_set1_epi16( 0x00ff );
+  for ( unsigned int j = 0; j < n; j += 2 )
+    {
+    even[j/2] = _mm_packus_epi16( _mm_and_si128( in[j], mask ), _mm_and_si128( in[j+1], mask ) );
+    odd[j/2] = _mm_packus_epi16( _mm_srli_epi16( in[j], 8 ), _mm_srli_epi16( in[j+1], 8 ) );
+    }
+}
+
+// interleaves the bytes of the n vectors of even and odd
+__attribute__((target("sse2")))
+inline void Interleave( const __m128i *even, const __m128i *odd, unsigned int n, __m128i *out )
+{
+  for ( unsigned int j = 0; j < n; ++j )
+    {
+    out[2*j] = _mm_unpacklo_epi8( even[j], odd[j] );
+    out[2*j+1] = _mm_unpackhi_epi8( even[j], odd[j] );
+    }
+}
+
+__attribute__((target("sse2")))
+void ShuffleKernelSSE2( const char *source, char *destination,
+                        size_t count, unsigned int componentSize )
+{
+  if ( componentSize != 2 && componentSize != 4 && componentSize != 8 )
+    {
+    ShuffleScalar( source, destination, 0, count, componentSize );
+    return;
+    }
+
+  size_t i = 0;
+  for ( ; i + 16 <= count; i += 16 )
+    {
+    __m128i a[8];
+    __m128i b[8];
+    for ( unsigned int j = 0; j < componentSize; ++j )
+      {
+      a[j] = _mm_loadu_si128( reinterpret_cast<const __m128i *>( source + i*componentSize + 16*j ) );
+      }
+
+    // each stream is split into its even bytes, which keep the place
+    // of the stream, and its odd bytes, which follow all the streams
+    __m128i *in = a;
+    __m128i *out = b;
+    for ( unsigned int streams = 1; streams < componentSize; streams *= 2 )
+      {
+      const unsigned int length = componentSize / streams;
+      for ( unsigned int m = 0; m < streams; ++m )
+        {
+        Deinterleave( in + m*length, length, out + m*length/2, out + ( m + streams )*length/2 );
+        }
+      __m128i *t = in;
+      in = out;
+      out = t;
+      }
+
+    for ( unsigned int j = 0; j < componentSize; ++j )
+      {
+      _mm_storeu_si128( reinterpret_cast<__m128i *>( destination + j*count + i ), in[j] );
+      }
+    }
+
+  ShuffleScalar( source, destination, i, count, componentSize );
+}
+
+__attribute__((target("sse2")))
+void UnshuffleKernelSSE2( const char *source, char *destination,
+                          size_t count, unsigned int componentSize, bool swap )
+{
+  if ( componentSize != 2 && componentSize != 4 && componentSize != 8 )
+    {
+    UnshuffleScalar( source, destination, 0, count, componentSize, swap );
+    return;
+    }
+
+  size_t i = 0;
+  for ( ; i + 16 <= count; i += 16 )
+    {
+    __m128i a[8];
+    __m128i b[8];
+    for ( unsigned int j = 0; j < componentSize; ++j )
+      {
+      const unsigned int plane = swap ? componentSize - 1 - j : j;
+      a[j] = _mm_loadu_si128( reinterpret_cast<const __m128i *>( source + plane*count + i ) );
+      }
+
+    // the inverse of the rounds of the shuffle
+    __m128i *in = a;
+    __m128i *out = b;
+    for ( unsigned int streams = componentSize/2; streams >= 1; streams /= 2 )
+      {
+      const unsigned int length = componentSize / ( 2*streams );
+      for ( unsigned int m = 0; m < streams; ++m )
+        {
+        Interleave( in + m*length, in + ( m + streams )*length, length, out + 2*m*length );
+        }
+      __m128i *t = in;
+      in = out;
+      out = t;
+      }
+
+    for ( unsigned int j = 0; j < componentSize; ++j )
+      {
+      _mm_storeu_si128( reinterpret_cast<__m128i *>( destination + i*componentSize + 16*j ), in[j] );
+      }
+    }
+
+  UnshuffleScalar( source, destination, i, count, componentSize, swap );
+}
+
+#endif
+
+struct ShuffleKernel
+{
+  ShuffleKernelType   shuffle;
+  UnshuffleKernelType unshuffle;
+  const char         *name;
+};
+
+// selects the kernel for this processor, the result is the same on
+// each call so no locking is needed
+ShuffleKernel SelectShuffleKernel( void )
+{
+  ShuffleKernel kernel;
+  kernel.shuffle = ShuffleKernelScalar;
+  kernel.unshuffle = UnshuffleKernelScalar;
+  kernel.name = "Scalar";
+
+#if defined(IJMRCIO_HAVE_X86_SIMD_TARGETS)
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports( "sse2" ) )
+    {
+    kernel.shuffle = ShuffleKernelSSE2;
+    kernel.unshuffle = UnshuffleKernelSSE2;
+    kernel.name = "SSE2";
+    }
+#endif
+
+  return kernel;
+}
+
+const ShuffleKernel &GetShuffleKernel( void )
+{
+  static const ShuffleKernel kernel = SelectShuffleKernel();
+  return kernel;
+}
+
+}
+
+namespace itk
+{
+namespace Local
+{
+
+void SIMDByteShuffler::Shuffle( const void *source, void *destination,
+                                size_t count, unsigned int componentSize )
+{
+  if ( componentSize <= 1 )
+    {
+    memcpy( destination, source, count*componentSize );
+    return;
+    }
+
+  GetShuffleKernel().shuffle( static_cast<const char *>( source ),
+                              static_cast<char *>( destination ),
+                              count, componentSize );
+}
+
+
+void SIMDByteShuffler::Unshuffle( const void *source, void *destination,
+                                  size_t count, unsigned int componentSize )
+{
+  if ( componentSize <= 1 )
+    {
+    memcpy( destination, source, count*componentSize );
+    return;
+    }
+
+  GetShuffleKernel().unshuffle( static_cast<const char *>( source ),
+                                static_cast<char *>( destination ),
+                                count, componentSize, false );
+}
+
+
+void SIMDByteShuffler::UnshuffleAndSwap( const void *source, void *destination,
+                                         size_t count, unsigned int componentSize )
+{
+  if ( componentSize <= 1 )
+    {
+    memcpy( destination, source, count*componentSize );
+    return;
+    }
+
+  GetShuffleKernel().unshuffle( static_cast<const char *>( source ),
+                                static_cast<char *>( destination ),
+                                count, componentSize, true );
+}
+
+
+const char *SIMDByteShuffler::GetKernelName( void )
+{
+  return GetShuffleKernel().name;
+}
+
+} // end namespace Local
+} // end namespace itk
@@ -0,0 +1,62 @@
+#ifndef __itkSIMDByteShuffler_h
+#define __itkSIMDByteShuffler_h
+
+#include "itkIJMRCIOConfigure.h"
+#include "itkMacro.h"
+
+#include <stddef.h>
+
+namespace itk
+{
+namespace Local
+{
+
+/** \class SIMDByteShuffler
+ *
+ * \brief Transposes ranges of multi-byte components into byte planes
+ * and back
+ *
+ * The shuffle stores the first byte of all components, then the
+ * second bytes and so on. The slowly changing high bytes of
+ * neighboring values of an image are then next to each other, which
+ * compresses much better. Shuffling is done before compressing and
+ * unshuffling after decompressing.
+ *
+ * The unshuffle can reverse the byte order of the components at the
+ * same time, so that data in the byte order of the file is converted
+ * to the system in one pass.
+ *
+ * On x86 processors the SSE2 kernel is selected at run time for 2, 4
+ * and 8 byte components, otherwise a scalar loop is used. The
+ * buffers must not overlap.
+ */
+class ITK_EXPORT SIMDByteShuffler
+{
+public:
+
+  /** \brief Transposes count components of componentSize bytes from
+   * source into componentSize planes of count bytes in destination */
+  static void Shuffle( const void *source, void *destination,
+                       size_t count, unsigned int componentSize );
+
+  /** \brief The inverse of Shuffle */
+  static void Unshuffle( const void *source, void *destination,
+                         size_t count, unsigned int componentSize );
+
+  /** \brief The inverse of Shuffle, also reversing the bytes of each
+   * component */
+  static void UnshuffleAndSwap( const void *source, void *destination,
+                                size_t count, unsigned int componentSize );
+
+  /** \brief Returns the name of the kernel selected for this
+   * processor: "SSE2" or "Scalar" */
+  static const char *GetKernelName( void );
+
+private:
+  SIMDByteShuffler(); //purposely not implemented
+};
+
+} // end namespace Local
+} // end namespace itk
+
+#endif // __itkSIMDByteShuffler_h
@@ -0,0 +1,203 @@
+#include "itkSIMDByteSwapper.h"
+#include "itkIntTypes.h"
+
+#include <string.h>
+
+#if defined(IJMRCIO_HAVE_X86_SIMD_TARGETS)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+// the kernels swap count components from source to destination,
+// which may be the same buffer
+typedef void (*SwapKernelType)( const char *source, char *destination,
+                                size_t count, unsigned int componentSize );
+
+template <typename T>
+inline T SwapScalar( T v );
+
+template <>
+inline itk::uint16_t SwapScalar( itk::uint16_t v )
+{
+  return static_cast<itk::uint16_t>( ( v >> 8 ) | ( v << 8 ) );
+}
+
+template <>
+inline itk::uint32_t SwapScalar( itk::uint32_t v )
+{
+  return ( ( v >> 24 ) |
+           ( ( v >> 8 ) & 0x0000ff00U ) |
+           ( ( v << 8 ) & 0x00ff0000U ) |
+           ( v << 24 ) );
+}
+
+template <>
+inline itk::uint64_t SwapScalar( itk::uint64_t v )
+{
+  return ( static_cast<itk::uint64_t>( SwapScalar( static_cast<itk::uint32_t>( v ) ) ) << 32 ) |
+    SwapScalar( static_cast<itk::uint32_t>( v >> 32 ) );
+}
+
+template <typename T>
+void SwapCopyScalar( const char *source, char *destination, size_t count )
+{
+  // memcpy is used since the buffers may not be aligned
+  for ( size_t i = 0; i < count; ++i )
+    {
+    T v;
+    memcpy( &v, source + i*sizeof(T), sizeof(T) );
+    v = SwapScalar( v );
+    memcpy( destination + i*sizeof(T), &v, sizeof(T) );
+    }
+}
+
+void SwapKernelScalar( const char *source, char *destination,
+                       size_t count, unsigned int componentSize )
+{
+  switch ( componentSize )
+    {
+    case 2:
+      SwapCopyScalar<itk::uint16_t>( source, destination, count );
+      break;
+    case 4:
+      SwapCopyScalar<itk::uint32_t>( source, destination, count );
+      break;
+    case 8:
+      SwapCopyScalar<itk::uint64_t>( source, destination, count );
+      break;
+    default:
+      break;
+    }
+}
+
+#if defined(IJMRCIO_HAVE_X86_SIMD_TARGETS)
+
+__attribute__((target("ssse3")))
+__m128i ShuffleMask128( unsigned int componentSize )
+{
+  switch ( componentSize )
+    {
+    case 2:
+      return _mm_setr_epi8( 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 );
+    case 4:
+      return _mm_setr_epi8( 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 );
+    default:
+      return _mm_setr_epi8( 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 );
+    }
+}
+
+__attribute__((target("ssse3")))
+void SwapKernelSSSE3( const char *source, char *destination,
+                      size_t count, unsigned int componentSize )
+{
+  const __m128i mask = ShuffleMask128( componentSize );
+  const size_t numberOfBytes = count*componentSize;
+
+  size_t i = 0;
+  for ( ; i + 16 <= numberOfBytes; i += 16 )
+    {
+    __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( source + i ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( destination + i ), _mm_shuffle_epi8( v, mask ) );
+    }
+
+  SwapKernelScalar( source + i, destination + i, ( numberOfBytes - i ) / componentSize, componentSize );
+}
+
+__attribute__((target("avx2")))
+void SwapKernelAVX2( const char *source, char *destination,
+                     size_t count, unsigned int componentSize )
+{
+  // the shuffle is within each 128-bit lane, so the mask is repeated
+  const __m128i mask128 = ShuffleMask128( componentSize );
+  const __m256i mask = _mm256_broadcastsi128_si256( mask128 );
+  const size_t numberOfBytes = count*componentSize;
+
+  size_t i = 0;
+  for ( ; i + 32 <= numberOfBytes; i += 32 )
+    {
+    __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( source + i ) );
+    _mm256_storeu_si256( reinterpret_cast<__m256i *>( destination + i ), _mm256_shuffle_epi8( v, mask ) );
+    }
+
+  SwapKernelSSSE3( source + i, destination + i, ( numberOfBytes - i ) / componentSize, componentSize );
+}
+
+#endif
+
+struct SwapKernel
+{
+  SwapKernelType function;
+  const char    *name;
+};
+
+// selects the kernel for this processor, the result is the same on
+// each call so no locking is needed
+SwapKernel SelectSwapKernel( void )
+{
+  SwapKernel kernel;
+  kernel.function = SwapKernelScalar;
+  kernel.name = "Scalar";
+
+#if defined(IJMRCIO_HAVE_X86_SIMD_TARGETS)
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports( "avx2" ) )
+    {
+    kernel.function = SwapKernelAVX2;
+    kernel.name = "AVX2";
+    }
+  else if ( __builtin_cpu_supports( "ssse3" ) )
+    {
+    kernel.function = SwapKernelSSSE3;
+    kernel.name = "SSSE3";
+    }
+#endif
+
+  return kernel;
+}
+
+const SwapKernel &GetSwapKernel( void )
+{
+  static const SwapKernel kernel = SelectSwapKernel();
+  return kernel;
+}
+
+}
+
+namespace itk
+{
+namespace Local
+{
+
+void SIMDByteSwapper::SwapRange( void *buffer, size_t count, unsigned int componentSize )
+{
+  SwapRangeCopy( buffer, buffer, count, componentSize );
+}
+
+
+void SIMDByteSwapper::SwapRangeCopy( const void *source, void *destination,
+                                     size_t count, unsigned int componentSize )
+{
+  if ( componentSize != 2 && componentSize != 4 && componentSize != 8 )
+    {
+    if ( source != destination )
+      {
+      memcpy( destination, source, count*componentSize );
+      }
+    return;
+    }
+
+  GetSwapKernel().function( static_cast<const char *>( source ),
+                            static_cast<char *>( destination ),
+                            count, componentSize );
+}
+
+
+const char *SIMDByteSwapper::GetKernelName( void )
+{
+  return GetSwapKernel().name;
+}
+
+} // end namespace Local
+} // end namespace itk
@@ -0,0 +1,58 @@
+#ifndef __itkSIMDByteSwapper_h
+#define __itkSIMDByteSwapper_h
+
+#include "itkIJMRCIOConfigure.h"
+#include "itkMacro.h"
+
+#include <stddef.h>
+
+namespace itk
+{
+namespace Local
+{
+
+/** \class SIMDByteSwapper
+ *
+ * \brief Reverses the byte order of ranges of 2, 4 or 8 byte
+ * components
+ *
+ * Unlike ByteSwapper, the swap is unconditional, and the caller
+ * determines if the byte order of the file differs from the
+ * system. On x86 processors the AVX2 or SSSE3 shuffle kernel is
+ * selected at run time when the processor supports it, otherwise a
+ * scalar loop is used.
+ *
+ * The copying variant swaps while copying from a source buffer, so
+ * that data is only passed through the cache once.
+ */
+class ITK_EXPORT SIMDByteSwapper
+{
+public:
+
+  /** \brief Swaps the bytes of count components of componentSize
+   * bytes in buffer
+   *
+   * Component sizes other than 2, 4 or 8 are left unchanged.
+   */
+  static void SwapRange( void *buffer, size_t count, unsigned int componentSize );
+
+  /** \brief Copies count components from source to destination
+   * swapping the bytes of each
+   *
+   * The buffers must not partially overlap, but may be the same.
+   */
+  static void SwapRangeCopy( const void *source, void *destination,
+                             size_t count, unsigned int componentSize );
+
+  /** \brief Returns the name of the kernel selected for this
+   * processor: "AVX2", "SSSE3" or "Scalar" */
+  static const char *GetKernelName( void );
+
+private:
+  SIMDByteSwapper(); //purposely not implemented
+};
+
+} // end namespace Local
+} // end namespace itk
+
+#endif // __itkSIMDByteSwapper_h
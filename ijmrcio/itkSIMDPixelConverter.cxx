@@ -0,0 +1,663 @@
+#include "itkSIMDPixelConverter.h"
+
+#include <string.h>
+
+#if defined(IJMRCIO_HAVE_X86_SIMD_TARGETS)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+typedef itk::ImageIOBase ImageIOBase;
+
+// the kernels widen count integers, or floats, from source into
+// destination
+typedef void (*ToFloatKernelType)( const void *source, float *destination, size_t count );
+typedef void (*ToDoubleKernelType)( const float *source, double *destination, size_t count );
+
+// the kernels of the packed modes of MRC files, the nibbles are
+// unpacked from the low nibble of the first byte
+typedef void (*HalfToFloatKernelType)( const unsigned short *source, float *destination, size_t count );
+typedef void (*FloatToHalfKernelType)( const float *source, unsigned short *destination, size_t count );
+typedef void (*UnpackNibblesKernelType)( const unsigned char *source, unsigned char *destination, size_t count );
+
+template <typename TIn, typename TOut>
+void ConvertScalar( const void *source, void *destination, size_t count )
+{
+  const TIn *in = static_cast<const TIn *>( source );
+  TOut *out = static_cast<TOut *>( destination );
+  for ( size_t i = 0; i < count; ++i )
+    {
+    out[i] = static_cast<TOut>( in[i] );
+    }
+}
+
+template <typename TIn>
+void ConvertScalarTo( const void *source, void *destination,
+                      ImageIOBase::IOComponentType destinationType, size_t count )
+{
+  switch ( destinationType )
+    {
+    case ImageIOBase::UCHAR:
+      ConvertScalar<TIn, unsigned char>( source, destination, count );
+      break;
+    case ImageIOBase::CHAR:
+      ConvertScalar<TIn, char>( source, destination, count );
+      break;
+    case ImageIOBase::USHORT:
+      ConvertScalar<TIn, unsigned short>( source, destination, count );
+      break;
+    case ImageIOBase::SHORT:
+      ConvertScalar<TIn, short>( source, destination, count );
+      break;
+    case ImageIOBase::UINT:
+      ConvertScalar<TIn, unsigned int>( source, destination, count );
+      break;
+    case ImageIOBase::INT:
+      ConvertScalar<TIn, int>( source, destination, count );
+      break;
+    case ImageIOBase::ULONG:
+      ConvertScalar<TIn, unsigned long>( source, destination, count );
+      break;
+    case ImageIOBase::LONG:
+      ConvertScalar<TIn, long>( source, destination, count );
+      break;
+    case ImageIOBase::FLOAT:
+      ConvertScalar<TIn, float>( source, destination, count );
+      break;
+    case ImageIOBase::DOUBLE:
+      ConvertScalar<TIn, double>( source, destination, count );
+      break;
+    default:
+      break;
+    }
+}
+
+void ConvertKernelScalar( const void *source, ImageIOBase::IOComponentType sourceType,
+                          void *destination, ImageIOBase::IOComponentType destinationType,
+                          size_t count )
+{
+  switch ( sourceType )
+    {
+    case ImageIOBase::UCHAR:
+      ConvertScalarTo<unsigned char>( source, destination, destinationType, count );
+      break;
+    case ImageIOBase::CHAR:
+      ConvertScalarTo<char>( source, destination, destinationType, count );
+      break;
+    case ImageIOBase::USHORT:
+      ConvertScalarTo<unsigned short>( source, destination, destinationType, count );
+      break;
+    case ImageIOBase::SHORT:
+      ConvertScalarTo<short>( source, destination, destinationType, count );
+      break;
+    case ImageIOBase::UINT:
+      ConvertScalarTo<unsigned int>( source, destination, destinationType, count );
+      break;
+    case ImageIOBase::INT:
+      ConvertScalarTo<int>( source, destination, destinationType, count );
+      break;
+    case ImageIOBase::ULONG:
+      ConvertScalarTo<unsigned long>( source, destination, destinationType, count );
+      break;
+    case ImageIOBase::LONG:
+      ConvertScalarTo<long>( source, destination, destinationType, count );
+      break;
+    case ImageIOBase::FLOAT:
+      ConvertScalarTo<float>( source, destination, destinationType, count );
+      break;
+    case ImageIOBase::DOUBLE:
+      ConvertScalarTo<double>( source, destination, destinationType, count );
+      break;
+    default:
+      break;
+    }
+}
+
+template <typename TIn>
+void ToFloatKernelScalar( const void *source, float *destination, size_t count )
+{
+  ConvertScalar<TIn, float>( source, destination, count );
+}
+
+void ToDoubleKernelScalar( const float *source, double *destination, size_t count )
+{
+  ConvertScalar<float, double>( source, destination, count );
+}
+
+float HalfToFloatValue( unsigned short h )
+{
+  const unsigned int sign = static_cast<unsigned int>( h & 0x8000u ) << 16;
+  unsigned int exponent = ( h >> 10 ) & 0x1fu;
+  unsigned int mantissa = h & 0x3ffu;
+
+  unsigned int bits;
+  if ( exponent == 0x1fu )
+    {
+    // infinity or NaN, which becomes a quiet NaN as with F16C
+    bits = sign | 0x7f800000u | ( mantissa << 13 ) | ( mantissa != 0 ? 0x400000u : 0u );
+    }
+  else if ( exponent != 0 )
+    {
+    bits = sign | ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 );
+    }
+  else if ( mantissa == 0 )
+    {
+    bits = sign;
+    }
+  else
+    {
+    // a subnormal half is a normal float
+    exponent = 113;
+    while ( ( mantissa & 0x400u ) == 0 )
+      {
+      mantissa <<= 1;
+      --exponent;
+      }
+    bits = sign | ( exponent << 23 ) | ( ( mantissa & 0x3ffu ) << 13 );
+    }
+
+  float value;
+  memcpy( &value, &bits, sizeof(value) );
+  return value;
+}
+
+unsigned short FloatToHalfValue( float value )
+{
+  unsigned int bits;
+  memcpy( &bits, &value, sizeof(bits) );
+  const unsigned int sign = ( bits >> 16 ) & 0x8000u;
+  const unsigned int magnitude = bits & 0x7fffffffu;
+
+  if ( magnitude > 0x7f800000u )
+    {
+    // NaN stays quiet NaN
+    return static_cast<unsigned short>( sign | 0x7e00u | ( ( magnitude >> 13 ) & 0x3ffu ) );
+    }
+  if ( magnitude >= 0x477ff000u )
+    {
+    // 65520 and above round to infinity
+    return static_cast<unsigned short>( sign | 0x7c00u );
+    }
+
+  unsigned int half;
+  unsigned int remainder;
+  unsigned int halfway;
+  if ( magnitude >= 0x38800000u )
+    {
+    // a normal half, the rounding may carry into the exponent
+    half = ( magnitude >> 13 ) - ( 112u << 10 );
+    remainder = magnitude & 0x1fffu;
+    halfway = 0x1000u;
+    }
+  else if ( magnitude > 0x33000000u )
+    {
+    // a subnormal half, in units of 2^-24
+    const unsigned int mantissa = ( magnitude & 0x7fffffu ) | 0x800000u;
+    const unsigned int shift = 126 - ( magnitude >> 23 );
+    half = mantissa >> shift;
+    remainder = mantissa & ( ( 1u << shift ) - 1 );
+    halfway = 1u << ( shift - 1 );
+    }
+  else
+    {
+    // rounds to zero
+    return static_cast<unsigned short>( sign );
+    }
+
+  if ( remainder > halfway || ( remainder == halfway && ( half & 1u ) ) )
+    {
+    ++half;
+    }
+  return static_cast<unsigned short>( sign | half );
+}
+
+void HalfToFloatKernelScalar( const unsigned short *source, float *destination, size_t count )
+{
+  for ( size_t i = 0; i < count; ++i )
+    {
+    destination[i] = HalfToFloatValue( source[i] );
+    }
+}
+
+void FloatToHalfKernelScalar( const float *source, unsigned short *destination, size_t count )
+{
+  for ( size_t i = 0; i < count; ++i )
+    {
+    destination[i] = FloatToHalfValue( source[i] );
+    }
+}
+
+void UnpackNibblesKernelScalar( const unsigned char *source, unsigned char *destination, size_t count )
+{
+  size_t i = 0;
+  for ( ; i + 2 <= count; i += 2 )
+    {
+    destination[i] = source[i/2] & 0x0f;
+    destination[i+1] = source[i/2] >> 4;
+    }
+  if ( i < count )
+    {
+    destination[i] = source[i/2] & 0x0f;
+    }
+}
+
+#if defined(IJMRCIO_HAVE_X86_SIMD_TARGETS)
+
+// The SSE2 kernels widen with unpacks, against zero for unsigned
+// integers, and against themselves followed by an arithmetic shift
+// for signed integers.
+
+__attribute__((target("sse2")))
+inline void StoreWidened32( __m128i lo, __m128i hi, float *destination )
+{
+  _mm_storeu_ps( destination, _mm_cvtepi32_ps( lo ) );
+  _mm_storeu_ps( destination + 4, _mm_cvtepi32_ps( hi ) );
+}
+
+__attribute__((target("sse2")))
+void UInt8ToFloatSSE2( const void *source, float *destination, size_t count )
+{
+  const unsigned char *in = static_cast<const unsigned char *>( source );
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for ( ; i + 16 <= count; i += 16 )
+    {
+    const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( in + i ) );
+    const __m128i lo = _mm_unpacklo_epi8( v, zero );
+    const __m128i hi = _mm_unpackhi_epi8( v, zero );
+    StoreWidened32( _mm_unpacklo_epi16( lo, zero ), _mm_unpackhi_epi16( lo, zero ), destination + i );
+    StoreWidened32( _mm_unpacklo_epi16( hi, zero ), _mm_unpackhi_epi16( hi, zero ), destination + i + 8 );
+    }
+  ConvertScalar<unsigned char, float>( in + i, destination + i, count - i );
+}
+
+__attribute__((target("sse2")))
+void Int8ToFloatSSE2( const void *source, float *destination, size_t count )
+{
+  const signed char *in = static_cast<const signed char *>( source );
+  size_t i = 0;
+  for ( ; i + 16 <= count; i += 16 )
+    {
+    const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( in + i ) );
+    const __m128i lo = _mm_srai_epi16( _mm_unpacklo_epi8( v, v ), 8 );
+    const __m128i hi = _mm_srai_epi16( _mm_unpackhi_epi8( v, v ), 8 );
+    StoreWidened32( _mm_srai_epi32( _mm_unpacklo_epi16( lo, lo ), 16 ),
+                    _mm_srai_epi32( _mm_unpackhi_epi16( lo, lo ), 16 ), destination + i );
+    StoreWidened32( _mm_srai_epi32( _mm_unpacklo_epi16( hi, hi ), 16 ),
+                    _mm_srai_epi32( _mm_unpackhi_epi16( hi, hi ), 16 ), destination + i + 8 );
+    }
+  ConvertScalar<signed char, float>( in + i, destination + i, count - i );
+}
+
+__attribute__((target("sse2")))
+void UInt16ToFloatSSE2( const void *source, float *destination, size_t count )
+{
+  const unsigned short *in = static_cast<const unsigned short *>( source );
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for ( ; i + 8 <= count; i += 8 )
+    {
+    const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( in + i ) );
+    StoreWidened32( _mm_unpacklo_epi16( v, zero ), _mm_unpackhi_epi16( v, zero ), destination + i );
+    }
+  ConvertScalar<unsigned short, float>( in + i, destination + i, count - i );
+}
+
+__attribute__((target("sse2")))
+void Int16ToFloatSSE2( const void *source, float *destination, size_t count )
+{
+  const short *in = static_cast<const short *>( source );
+  size_t i = 0;
+  for ( ; i + 8 <= count; i += 8 )
+    {
+    const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( in + i ) );
+    StoreWidened32( _mm_srai_epi32( _mm_unpacklo_epi16( v, v ), 16 ),
+                    _mm_srai_epi32( _mm_unpackhi_epi16( v, v ), 16 ), destination + i );
+    }
+  ConvertScalar<short, float>( in + i, destination + i, count - i );
+}
+
+__attribute__((target("sse2")))
+void FloatToDoubleSSE2( const float *source, double *destination, size_t count )
+{
+  size_t i = 0;
+  for ( ; i + 4 <= count; i += 4 )
+    {
+    const __m128 v = _mm_loadu_ps( source + i );
+    _mm_storeu_pd( destination + i, _mm_cvtps_pd( v ) );
+    _mm_storeu_pd( destination + i + 2, _mm_cvtps_pd( _mm_movehl_ps( v, v ) ) );
+    }
+  ConvertScalar<float, double>( source + i, destination + i, count - i );
+}
+
+// The nibbles of 16 bytes are masked into two vectors, which are
+// interleaved into 32 bytes.
+
+__attribute__((target("sse2")))
+void UnpackNibblesSSE2( const unsigned char *source, unsigned char *destination, size_t count )
+{
+  const __m128i mask = _mm_set1_epi8( 0x0f );
+  size_t i = 0;
+  for ( ; i + 32 <= count; i += 32 )
+    {
+    const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( source + i/2 ) );
+    const __m128i lo = _mm_and_si128( v, mask );
+    const __m128i hi = _mm_and_si128( _mm_srli_epi16( v, 4 ), mask );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( destination + i ), _mm_unpacklo_epi8( lo, hi ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( destination + i + 16 ), _mm_unpackhi_epi8( lo, hi ) );
+    }
+  UnpackNibblesKernelScalar( source + i/2, destination + i, count - i );
+}
+
+// The AVX2 kernels widen 8 components at a time with the sign or
+// zero extending moves.
+
+__attribute__((target("avx2")))
+void UInt8ToFloatAVX2( const void *source, float *destination, size_t count )
+{
+  const unsigned char *in = static_cast<const unsigned char *>( source );
+  size_t i = 0;
+  for ( ; i + 16 <= count; i += 16 )
+    {
+    const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( in + i ) );
+    _mm256_storeu_ps( destination + i, _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( v ) ) );
+    _mm256_storeu_ps( destination + i + 8, _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( _mm_srli_si128( v, 8 ) ) ) );
+    }
+  UInt8ToFloatSSE2( in + i, destination + i, count - i );
+}
+
+__attribute__((target("avx2")))
+void Int8ToFloatAVX2( const void *source, float *destination, size_t count )
+{
+  const signed char *in = static_cast<const signed char *>( source );
+  size_t i = 0;
+  for ( ; i + 16 <= count; i += 16 )
+    {
+    const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( in + i ) );
+    _mm256_storeu_ps( destination + i, _mm256_cvtepi32_ps( _mm256_cvtepi8_epi32( v ) ) );
+    _mm256_storeu_ps( destination + i + 8, _mm256_cvtepi32_ps( _mm256_cvtepi8_epi32( _mm_srli_si128( v, 8 ) ) ) );
+    }
+  Int8ToFloatSSE2( in + i, destination + i, count - i );
+}
+
+__attribute__((target("avx2")))
+void UInt16ToFloatAVX2( const void *source, float *destination, size_t count )
+{
+  const unsigned short *in = static_cast<const unsigned short *>( source );
+  size_t i = 0;
+  for ( ; i + 8 <= count; i += 8 )
+    {
+    const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( in + i ) );
+    _mm256_storeu_ps( destination + i, _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32( v ) ) );
+    }
+  ConvertScalar<unsigned short, float>( in + i, destination + i, count - i );
+}
+
+__attribute__((target("avx2")))
+void Int16ToFloatAVX2( const void *source, float *destination, size_t count )
+{
+  const short *in = static_cast<const short *>( source );
+  size_t i = 0;
+  for ( ; i + 8 <= count; i += 8 )
+    {
+    const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( in + i ) );
+    _mm256_storeu_ps( destination + i, _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( v ) ) );
+    }
+  ConvertScalar<short, float>( in + i, destination + i, count - i );
+}
+
+__attribute__((target("avx2")))
+void FloatToDoubleAVX2( const float *source, double *destination, size_t count )
+{
+  size_t i = 0;
+  for ( ; i + 4 <= count; i += 4 )
+    {
+    _mm256_storeu_pd( destination + i, _mm256_cvtps_pd( _mm_loadu_ps( source + i ) ) );
+    }
+  ConvertScalar<float, double>( source + i, destination + i, count - i );
+}
+
+__attribute__((target("avx2")))
+void UnpackNibblesAVX2( const unsigned char *source, unsigned char *destination, size_t count )
+{
+  const __m256i mask = _mm256_set1_epi8( 0x0f );
+  size_t i = 0;
+  for ( ; i + 64 <= count; i += 64 )
+    {
+    const __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( source + i/2 ) );
+    const __m256i lo = _mm256_and_si256( v, mask );
+    const __m256i hi = _mm256_and_si256( _mm256_srli_epi16( v, 4 ), mask );
+    // the unpacks interleave within each 128-bit lane
+    const __m256i a = _mm256_unpacklo_epi8( lo, hi );
+    const __m256i b = _mm256_unpackhi_epi8( lo, hi );
+    _mm256_storeu_si256( reinterpret_cast<__m256i *>( destination + i ), _mm256_permute2x128_si256( a, b, 0x20 ) );
+    _mm256_storeu_si256( reinterpret_cast<__m256i *>( destination + i + 32 ), _mm256_permute2x128_si256( a, b, 0x31 ) );
+    }
+  UnpackNibblesSSE2( source + i/2, destination + i, count - i );
+}
+
+// The F16C kernels convert 8 values at a time, rounding to the
+// nearest even.
+
+__attribute__((target("avx,f16c")))
+void HalfToFloatF16C( const unsigned short *source, float *destination, size_t count )
+{
+  size_t i = 0;
+  for ( ; i + 8 <= count; i += 8 )
+    {
+    const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( source + i ) );
+    _mm256_storeu_ps( destination + i, _mm256_cvtph_ps( v ) );
+    }
+  HalfToFloatKernelScalar( source + i, destination + i, count - i );
+}
+
+__attribute__((target("avx,f16c")))
+void FloatToHalfF16C( const float *source, unsigned short *destination, size_t count )
+{
+  size_t i = 0;
+  for ( ; i + 8 <= count; i += 8 )
+    {
+    const __m128i v = _mm256_cvtps_ph( _mm256_loadu_ps( source + i ), _MM_FROUND_TO_NEAREST_INT );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( destination + i ), v );
+    }
+  FloatToHalfKernelScalar( source + i, destination + i, count - i );
+}
+
+bool ProcessorHasF16C( void )
+{
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid( 1, &eax, &ebx, &ecx, &edx ) && ( ecx & bit_F16C ) != 0;
+}
+
+#endif
+
+struct ConvertKernel
+{
+  // indexed by UCHAR, CHAR, USHORT and SHORT less UCHAR
+  ToFloatKernelType  toFloat[4];
+  ToDoubleKernelType toDouble;
+  const char        *name;
+
+  HalfToFloatKernelType   halfToFloat;
+  FloatToHalfKernelType   floatToHalf;
+  UnpackNibblesKernelType unpackNibbles;
+};
+
+// selects the kernel for this processor, the result is the same on
+// each call so no locking is needed
+ConvertKernel SelectConvertKernel( void )
+{
+  ConvertKernel kernel;
+  kernel.toFloat[0] = ToFloatKernelScalar<unsigned char>;
+  kernel.toFloat[1] = ToFloatKernelScalar<char>;
+  kernel.toFloat[2] = ToFloatKernelScalar<unsigned short>;
+  kernel.toFloat[3] = ToFloatKernelScalar<short>;
+  kernel.toDouble = ToDoubleKernelScalar;
+  kernel.name = "Scalar";
+  kernel.halfToFloat = HalfToFloatKernelScalar;
+  kernel.floatToHalf = FloatToHalfKernelScalar;
+  kernel.unpackNibbles = UnpackNibblesKernelScalar;
+
+#if defined(IJMRCIO_HAVE_X86_SIMD_TARGETS)
+  // the signed kernel is only used where char is signed
+  const bool charIsSigned = static_cast<char>( -1 ) < 0;
+
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports( "avx2" ) )
+    {
+    kernel.toFloat[0] = UInt8ToFloatAVX2;
+    kernel.toFloat[1] = charIsSigned ? Int8ToFloatAVX2 : kernel.toFloat[1];
+    kernel.toFloat[2] = UInt16ToFloatAVX2;
+    kernel.toFloat[3] = Int16ToFloatAVX2;
+    kernel.toDouble = FloatToDoubleAVX2;
+    kernel.name = "AVX2";
+    kernel.unpackNibbles = UnpackNibblesAVX2;
+    if ( ProcessorHasF16C() )
+      {
+      kernel.halfToFloat = HalfToFloatF16C;
+      kernel.floatToHalf = FloatToHalfF16C;
+      }
+    }
+  else if ( __builtin_cpu_supports( "sse2" ) )
+    {
+    kernel.toFloat[0] = UInt8ToFloatSSE2;
+    kernel.toFloat[1] = charIsSigned ? Int8ToFloatSSE2 : kernel.toFloat[1];
+    kernel.toFloat[2] = UInt16ToFloatSSE2;
+    kernel.toFloat[3] = Int16ToFloatSSE2;
+    kernel.toDouble = FloatToDoubleSSE2;
+    kernel.name = "SSE2";
+    kernel.unpackNibbles = UnpackNibblesSSE2;
+    }
+#endif
+
+  return kernel;
+}
+
+const ConvertKernel &GetConvertKernel( void )
+{
+  static const ConvertKernel kernel = SelectConvertKernel();
+  return kernel;
+}
+
+bool IsKnownComponentType( ImageIOBase::IOComponentType type )
+{
+  return type >= ImageIOBase::UCHAR && type <= ImageIOBase::DOUBLE;
+}
+
+bool IsSmallInteger( ImageIOBase::IOComponentType type )
+{
+  return type >= ImageIOBase::UCHAR && type <= ImageIOBase::SHORT;
+}
+
+unsigned int GetComponentSize( ImageIOBase::IOComponentType type )
+{
+  switch ( type )
+    {
+    case ImageIOBase::UCHAR:  return sizeof(unsigned char);
+    case ImageIOBase::CHAR:   return sizeof(char);
+    case ImageIOBase::USHORT: return sizeof(unsigned short);
+    case ImageIOBase::SHORT:  return sizeof(short);
+    case ImageIOBase::UINT:   return sizeof(unsigned int);
+    case ImageIOBase::INT:    return sizeof(int);
+    case ImageIOBase::ULONG:  return sizeof(unsigned long);
+    case ImageIOBase::LONG:   return sizeof(long);
+    case ImageIOBase::FLOAT:  return sizeof(float);
+    case ImageIOBase::DOUBLE: return sizeof(double);
+    default:                  return 0;
+    }
+}
+
+}
+
+namespace itk
+{
+namespace Local
+{
+
+bool SIMDPixelConverter::CanConvert( ComponentType sourceType, ComponentType destinationType )
+{
+  return IsKnownComponentType( sourceType ) && IsKnownComponentType( destinationType );
+}
+
+
+void SIMDPixelConverter::Convert( const void *source, ComponentType sourceType,
+                                  void *destination, ComponentType destinationType,
+                                  size_t count )
+{
+  if ( !CanConvert( sourceType, destinationType ) )
+    {
+    return;
+    }
+
+  if ( sourceType == destinationType )
+    {
+    memcpy( destination, source, count*GetComponentSize( sourceType ) );
+    return;
+    }
+
+  const ConvertKernel &kernel = GetConvertKernel();
+  if ( IsSmallInteger( sourceType ) && destinationType == ImageIOBase::FLOAT )
+    {
+    kernel.toFloat[sourceType - ImageIOBase::UCHAR]( source, static_cast<float *>( destination ), count );
+    }
+  else if ( sourceType == ImageIOBase::FLOAT && destinationType == ImageIOBase::DOUBLE )
+    {
+    kernel.toDouble( static_cast<const float *>( source ), static_cast<double *>( destination ), count );
+    }
+  else if ( IsSmallInteger( sourceType ) && destinationType == ImageIOBase::DOUBLE )
+    {
+    // widened through a block of floats in the cache
+    const size_t blockSize = 1024;
+    float block[blockSize];
+    const char *in = static_cast<const char *>( source );
+    double *out = static_cast<double *>( destination );
+    const unsigned int sourceSize = GetComponentSize( sourceType );
+    for ( size_t i = 0; i < count; i += blockSize )
+      {
+      const size_t n = ( count - i < blockSize ) ? count - i : blockSize;
+      kernel.toFloat[sourceType - ImageIOBase::UCHAR]( in + i*sourceSize, block, n );
+      kernel.toDouble( block, out + i, n );
+      }
+    }
+  else
+    {
+    ConvertKernelScalar( source, sourceType, destination, destinationType, count );
+    }
+}
+
+
+void SIMDPixelConverter::HalfToFloat( const unsigned short *source, float *destination, size_t count )
+{
+  GetConvertKernel().halfToFloat( source, destination, count );
+}
+
+
+void SIMDPixelConverter::FloatToHalf( const float *source, unsigned short *destination, size_t count )
+{
+  GetConvertKernel().floatToHalf( source, destination, count );
+}
+
+
+void SIMDPixelConverter::UnpackNibbles( const unsigned char *source, unsigned int firstNibble,
+                                        unsigned char *destination, size_t count )
+{
+  // a value in the high nibble begins the bytes of the kernel
+  if ( firstNibble != 0 && count != 0 )
+    {
+    *destination++ = *source++ >> 4;
+    --count;
+    }
+  GetConvertKernel().unpackNibbles( source, destination, count );
+}
+
+
+const char *SIMDPixelConverter::GetKernelName( void )
+{
+  return GetConvertKernel().name;
+}
+
+} // end namespace Local
+} // end namespace itk
@@ -0,0 +1,87 @@
+#ifndef __itkSIMDPixelConverter_h
+#define __itkSIMDPixelConverter_h
+
+#include "itkIJMRCIOConfigure.h"
+#include "itkImageIOBase.h"
+
+#include <stddef.h>
+
+namespace itk
+{
+namespace Local
+{
+
+/** \class SIMDPixelConverter
+ *
+ * \brief Converts ranges of components between the component types of
+ * ImageIOBase
+ *
+ * The values are converted with static_cast, as by the
+ * ConvertPixelBuffer of the ImageFileReader. Widening 8 and 16-bit
+ * integers to float or double, and float to double, are the common
+ * conversions of reading microscopy data, for which the AVX2 or SSE2
+ * kernel is selected at run time on x86 processors. Integers are
+ * widened to double through float, which is exact for them. The other
+ * conversions use a scalar loop.
+ *
+ * The half precision values of mode 12 of MRC files are converted to
+ * and from float with the F16C instructions where the processor has
+ * them, and the 4-bit values of mode 101 are unpacked with the SSE2 or
+ * AVX2 kernel.
+ *
+ * The buffers must not overlap.
+ */
+class ITK_EXPORT SIMDPixelConverter
+{
+public:
+
+  typedef ImageIOBase::IOComponentType ComponentType;
+
+  /** \brief Returns true if both types are known component types */
+  static bool CanConvert( ComponentType sourceType, ComponentType destinationType );
+
+  /** \brief Converts count components of sourceType from source into
+   * destinationType in destination
+   *
+   * Nothing is done if either type is unknown.
+   */
+  static void Convert( const void *source, ComponentType sourceType,
+                       void *destination, ComponentType destinationType,
+                       size_t count );
+
+  /** \brief Converts count IEEE 754 half precision values to float
+   *
+   * The conversion is exact, including for subnormals and
+   * infinities. A NaN keeps its payload and becomes a quiet NaN.
+   */
+  static void HalfToFloat( const unsigned short *source, float *destination, size_t count );
+
+  /** \brief Converts count floats to IEEE 754 half precision values,
+   * rounded to the nearest even
+   *
+   * Values beyond the range of half precision become infinite.
+   */
+  static void FloatToHalf( const float *source, unsigned short *destination, size_t count );
+
+  /** \brief Unpacks count 4-bit values into bytes
+   *
+   * The first value of each byte of source is in its low 4 bits, as in
+   * mode 101 of MRC files. The values begin at the low nibble of the
+   * first byte when firstNibble is 0, and at its high nibble when it is
+   * 1.
+   */
+  static void UnpackNibbles( const unsigned char *source, unsigned int firstNibble,
+                             unsigned char *destination, size_t count );
+
+  /** \brief Returns the name of the kernel selected for this
+   * processor: "AVX2", "SSE2" or "Scalar" */
+  static const char *GetKernelName( void );
+
+private:
+  SIMDPixelConverter(); //purposely not implemented
+};
+
+} // end namespace Local
+} // end namespace itk
+
+#endif // __itkSIMDPixelConverter_h
@@ -0,0 +1,234 @@
+#include "itkSlabCache.h"
+#include "itkSimpleFastMutexLock.h"
+
+#include <list>
+#include <map>
+
+namespace
+{
+
+typedef itk::Local::SlabCache::KeyType  KeyType;
+typedef itk::Local::SlabCache::SizeType SizeType;
+typedef itk::Local::SlabCache::Slab     Slab;
+
+// the slabs in order of use, the most recent first, with an index by
+// key into the list
+struct SlabCacheEntry
+{
+  KeyType            Key;
+  Slab::ConstPointer Data;
+};
+typedef std::list<SlabCacheEntry>                         EntryListType;
+typedef std::map<KeyType, EntryListType::iterator>        EntryMapType;
+
+struct SlabCacheState
+{
+  SlabCacheState()
+    : MaximumSize( 256*1024*1024 ),
+      Size( 0 ),
+      NumberOfHits( 0 ),
+      NumberOfMisses( 0 ),
+      NumberOfEvictions( 0 )
+    {}
+
+  itk::SimpleFastMutexLock Mutex;
+  EntryListType            Entries;
+  EntryMapType             Index;
+  SizeType                 MaximumSize;
+  SizeType                 Size;
+  unsigned long            NumberOfHits;
+  unsigned long            NumberOfMisses;
+  unsigned long            NumberOfEvictions;
+};
+
+SlabCacheState &GetState( void )
+{
+  static SlabCacheState state;
+  return state;
+}
+
+// holds the lock of the cache while in scope
+class StateLock
+{
+public:
+  StateLock() : m_State( GetState() ) { m_State.Mutex.Lock(); }
+  ~StateLock() { m_State.Mutex.Unlock(); }
+  SlabCacheState &operator*( void ) { return m_State; }
+  SlabCacheState *operator->( void ) { return &m_State; }
+private:
+  SlabCacheState &m_State;
+};
+
+// the state must be locked
+void Erase( SlabCacheState &state, EntryListType::iterator entry )
+{
+  state.Size -= entry->Data->GetSize();
+  state.Index.erase( entry->Key );
+  state.Entries.erase( entry );
+}
+
+// evicts least recently used slabs until size bytes fit, the state
+// must be locked
+void MakeRoom( SlabCacheState &state, SizeType size )
+{
+  while ( !state.Entries.empty() && state.Size + size > state.MaximumSize )
+    {
+    Erase( state, --state.Entries.end() );
+    ++state.NumberOfEvictions;
+    }
+}
+
+}
+
+namespace itk
+{
+namespace Local
+{
+
+bool SlabCache::KeyType::operator<( const KeyType &other ) const
+{
+  // ordered by file name first, so the slabs of a file are together
+  if ( FileName != other.FileName )
+    {
+    return FileName < other.FileName;
+    }
+  if ( Inode != other.Inode )
+    {
+    return Inode < other.Inode;
+    }
+  if ( FileLength != other.FileLength )
+    {
+    return FileLength < other.FileLength;
+    }
+  if ( ModifiedTime != other.ModifiedTime )
+    {
+    return ModifiedTime < other.ModifiedTime;
+    }
+  if ( ModifiedTimeNanoseconds != other.ModifiedTimeNanoseconds )
+    {
+    return ModifiedTimeNanoseconds < other.ModifiedTimeNanoseconds;
+    }
+  return Position < other.Position;
+}
+
+
+SlabCache::Slab::ConstPointer SlabCache::Find( const KeyType &key )
+{
+  StateLock state;
+
+  EntryMapType::iterator found = state->Index.find( key );
+  if ( found == state->Index.end() )
+    {
+    ++state->NumberOfMisses;
+    return 0;
+    }
+
+  ++state->NumberOfHits;
+  state->Entries.splice( state->Entries.begin(), state->Entries, found->second );
+  return found->second->Data;
+}
+
+
+void SlabCache::Insert( const KeyType &key, const Slab *slab )
+{
+  StateLock state;
+
+  EntryMapType::iterator found = state->Index.find( key );
+  if ( found != state->Index.end() )
+    {
+    Erase( *state, found->second );
+    }
+
+  if ( slab == 0 || slab->GetSize() > state->MaximumSize )
+    {
+    return;
+    }
+
+  MakeRoom( *state, slab->GetSize() );
+
+  SlabCacheEntry entry;
+  entry.Key = key;
+  entry.Data = slab;
+  state->Entries.push_front( entry );
+  state->Index[key] = state->Entries.begin();
+  state->Size += slab->GetSize();
+}
+
+
+void SlabCache::RemoveFile( const std::string &fileName )
+{
+  StateLock state;
+
+  KeyType first;
+  first.FileName = fileName;
+  EntryMapType::iterator i = state->Index.lower_bound( first );
+  while ( i != state->Index.end() && i->first.FileName == fileName )
+    {
+    EntryListType::iterator entry = ( i++ )->second;
+    Erase( *state, entry );
+    }
+}
+
+
+void SlabCache::Clear( void )
+{
+  StateLock state;
+  state->Entries.clear();
+  state->Index.clear();
+  state->Size = 0;
+}
+
+
+void SlabCache::SetMaximumSize( SizeType size )
+{
+  StateLock state;
+  state->MaximumSize = size;
+  MakeRoom( *state, 0 );
+}
+
+
+SlabCache::SizeType SlabCache::GetMaximumSize( void )
+{
+  StateLock state;
+  return state->MaximumSize;
+}
+
+
+SlabCache::SizeType SlabCache::GetSize( void )
+{
+  StateLock state;
+  return state->Size;
+}
+
+
+unsigned long SlabCache::GetNumberOfHits( void )
+{
+  StateLock state;
+  return state->NumberOfHits;
+}
+
+
+unsigned long SlabCache::GetNumberOfMisses( void )
+{
+  StateLock state;
+  return state->NumberOfMisses;
+}
+
+
+unsigned long SlabCache::GetNumberOfEvictions( void )
+{
+  StateLock state;
+  return state->NumberOfEvictions;
+}
+
+
+void SlabCache::ResetCounters( void )
+{
+  StateLock state;
+  state->NumberOfHits = 0;
+  state->NumberOfMisses = 0;
+  state->NumberOfEvictions = 0;
+}
+
+} // end namespace Local
+} // end namespace itk
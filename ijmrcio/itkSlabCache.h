@@ -0,0 +1,145 @@
+#ifndef __itkSlabCache_h
+#define __itkSlabCache_h
+
+#include "itkImageIOBase.h"
+#include "itkLightObject.h"
+
+#include <string>
+#include <vector>
+
+namespace itk
+{
+namespace Local
+{
+
+/** \class SlabCache
+ *
+ * \brief A process wide cache of slabs of image files, with a least
+ * recently used eviction policy
+ *
+ * A slab is a continuous block of the data of a file, such as a
+ * section of the highest dimension, held in the system byte order.
+ * The slabs are keyed by the identity of the file when it was read,
+ * so a replaced or modified file does not match them. The total size
+ * of the cached slabs is bounded by MaximumSize, when a slab is
+ * inserted the least recently used ones are evicted.
+ *
+ * The slabs are reference counted, so a slab which is evicted while
+ * it is being copied from remains valid. All methods are thread
+ * safe.
+ *
+ * \sa StreamingImageIOBase::SetUseSlabCache
+ */
+class ITK_EXPORT SlabCache
+{
+public:
+  typedef ImageIOBase::SizeType SizeType;
+
+  /** \brief The data of one slab of a file */
+  class Slab : public LightObject
+  {
+  public:
+    typedef Slab                     Self;
+    typedef LightObject              Superclass;
+    typedef SmartPointer<Self>       Pointer;
+    typedef SmartPointer<const Self> ConstPointer;
+
+    itkNewMacro(Self);
+    itkTypeMacro(Slab, LightObject);
+
+    void Allocate( SizeType size ) { m_Data.resize( static_cast< ::size_t >( size ) ); }
+    SizeType GetSize( void ) const { return static_cast<SizeType>( m_Data.size() ); }
+    char *GetBuffer( void ) { return m_Data.empty() ? 0 : &m_Data[0]; }
+    const char *GetBuffer( void ) const { return m_Data.empty() ? 0 : &m_Data[0]; }
+
+  protected:
+    Slab() {}
+
+  private:
+    Slab(const Self&); //purposely not implemented
+    void operator=(const Self&); //purposely not implemented
+
+    std::vector<char> m_Data;
+  };
+
+  /** \brief Identifies a slab by the file and its position in it */
+  struct KeyType
+  {
+    KeyType() : Inode( 0 ), FileLength( 0 ), ModifiedTime( 0 ), ModifiedTimeNanoseconds( 0 ), Position( 0 ) {}
+    bool operator<( const KeyType &other ) const;
+
+    std::string   FileName;
+    unsigned long Inode;
+    SizeType      FileLength;
+    long          ModifiedTime;
+    long          ModifiedTimeNanoseconds;
+    SizeType      Position;
+  };
+
+  /** \brief Returns the cached slab, or a null pointer
+   *
+   * A found slab becomes the most recently used. Each call counts as
+   * a hit or a miss.
+   */
+  static Slab::ConstPointer Find( const KeyType &key );
+
+  /** \brief Inserts a slab into the cache, replacing one with the
+   * same key
+   *
+   * Least recently used slabs are evicted until the slab fits. A slab
+   * larger than MaximumSize is not cached.
+   */
+  static void Insert( const KeyType &key, const Slab *slab );
+
+  /** \brief Removes the slabs of a file, of any identity, as when it
+   * is written */
+  static void RemoveFile( const std::string &fileName );
+
+  /** \brief Removes the slabs of a file when constructed and again
+   * when destroyed, around writing the file
+   *
+   * Slabs read by other threads while the file is being written may
+   * have the identity of the file after it is written, within the
+   * resolution of its modification time, so they are removed after
+   * the writing too.
+   */
+  class RemoveFileScope
+  {
+  public:
+    RemoveFileScope( const std::string &fileName ) : m_FileName( fileName ) { RemoveFile( m_FileName ); }
+    ~RemoveFileScope() { RemoveFile( m_FileName ); }
+  private:
+    RemoveFileScope(const RemoveFileScope&); //purposely not implemented
+    void operator=(const RemoveFileScope&); //purposely not implemented
+
+    std::string m_FileName;
+  };
+
+  /** \brief Removes all the slabs */
+  static void Clear( void );
+
+  /** \brief Set/Get the maximum number of bytes of the cached slabs,
+   * the default is 256MB */
+  static void SetMaximumSize( SizeType size );
+  static SizeType GetMaximumSize( void );
+
+  /** \brief Returns the number of bytes of the cached slabs */
+  static SizeType GetSize( void );
+
+  /** \brief Get the number of lookups which found a slab, did not
+   * find one, and the number of slabs evicted to make room */
+  static unsigned long GetNumberOfHits( void );
+  static unsigned long GetNumberOfMisses( void );
+  static unsigned long GetNumberOfEvictions( void );
+
+  /** \brief Resets the hit, miss and eviction counters */
+  static void ResetCounters( void );
+
+private:
+  SlabCache(); //purposely not implemented
+};
+
+} // end namespace Local
+} // end namespace itk
+
+#endif // __itkSlabCache_h
@@ -17,22 +17,619 @@
 #include "itkStreamingImageIOBase.h"
 
 
+#include "itkMultiThreader.h"
+#include "itkSIMDByteSwapper.h"
+#include "itkSIMDPixelConverter.h"
+#include "itkSlabCache.h"
+#include "itkByteSwapper.h"
+#include "itkNumericTraits.h"
+
 #include <itksys/SystemTools.hxx>
 
+#include <cmath>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(IJMRCIO_HAVE_SYS_MMAN_H) && defined(IJMRCIO_HAVE_MMAP)
+#define IJMRCIO_USE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#if defined(IJMRCIO_HAVE_SYS_UIO_H) && defined(IJMRCIO_HAVE_PREADV) && defined(IJMRCIO_HAVE_PWRITEV)
+#define IJMRCIO_USE_VECTORED_IO
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#if defined(IJMRCIO_HAVE_LINUX_IO_URING_H) && defined(IJMRCIO_HAVE_SYS_MMAN_H) && defined(IJMRCIO_HAVE_SYS_UIO_H) && defined(__GNUC__)
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define IJMRCIO_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+#endif
+
+#if defined(IJMRCIO_HAVE_POSIX_FADVISE)
+#define IJMRCIO_USE_READ_AHEAD
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(IJMRCIO_HAVE_POSIX_FALLOCATE) || defined(IJMRCIO_HAVE_FALLOCATE_KEEP_SIZE)
+#define IJMRCIO_USE_FALLOCATE
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(IJMRCIO_HAVE_PWRITE) && defined(IJMRCIO_HAVE_FCNTL)
+#define IJMRCIO_USE_LOCKED_POSITIONAL_IO
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#if defined(IJMRCIO_HAVE_O_DIRECT)
+#define IJMRCIO_USE_DIRECT_IO
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#if defined(IJMRCIO_HAVE_LINUX_FIEMAP_H)
+#define IJMRCIO_USE_FIEMAP
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if defined(IJMRCIO_USE_VECTORED_IO) || defined(IJMRCIO_USE_IO_URING)
+
+// closes the file descriptor when going out of scope
+class FileDescriptorGuard
+{
+public:
+  explicit FileDescriptorGuard( int fd ) : m_FileDescriptor( fd ) {}
+  ~FileDescriptorGuard() 
+    { 
+      if ( m_FileDescriptor != -1 )
+        {
+        close( m_FileDescriptor );
+        }
+    }
+  int Get( void ) const { return m_FileDescriptor; }
+private:
+  FileDescriptorGuard(const FileDescriptorGuard&); //purposely not implemented
+  void operator=(const FileDescriptorGuard&); //purposely not implemented
+  
+  int m_FileDescriptor;
+};
+
+#endif
+
+#if defined(IJMRCIO_USE_VECTORED_IO)
+
+// Transfers all the bytes described by the io vectors at offset in
+// the file, issuing additional calls after a partial transfer. The
+// number of bytes transferred is returned, which is less then
+// requested only on an error or the end of the file.
+itk::ImageIOBase::SizeType CompletePositionalVectoredIO( bool write, int fd, 
+                                                         struct iovec *iov, ::size_t iovcnt, 
+                                                         itk::ImageIOBase::SizeType offset, 
+                                                         unsigned long &numberOfCalls )
+{
+  itk::ImageIOBase::SizeType total = 0;
+  while ( iovcnt > 0 )
+    {
+    ssize_t n = write ? 
+      pwritev( fd, iov, static_cast<int>( iovcnt ), static_cast<off_t>( offset ) ) : 
+      preadv( fd, iov, static_cast<int>( iovcnt ), static_cast<off_t>( offset ) );
+    ++numberOfCalls;
+
+    if ( n < 0 && errno == EINTR )
+      {
+      continue;
+      }
+    if ( n <= 0 )
+      {
+      break;
+      }
+
+    total += n;
+    offset += n;
+
+    // skip the vectors which have been completely transferred
+    ::size_t remaining = static_cast< ::size_t >( n );
+    while ( iovcnt > 0 && remaining >= iov->iov_len )
+      {
+      remaining -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+      }
+    if ( iovcnt > 0 )
+      {
+      iov->iov_base = static_cast<char *>( iov->iov_base ) + remaining;
+      iov->iov_len -= remaining;
+      }
+    }
+  return total;
+}
+
+#endif
+
+#if defined(IJMRCIO_USE_IO_URING)
+
+// A minimal submission and completion queue on the Linux io_uring
+// interface. The system calls are used directly so that there is no
+// dependency on liburing.
+class IOURingQueue
+{
+public:
+  IOURingQueue() 
+    : m_RingFileDescriptor( -1 ),
+      m_NumberOfEntries( 0 ),
+      m_NumberToSubmit( 0 ),
+      m_SQRing( 0 ),
+      m_SQRingSize( 0 ),
+      m_CQRing( 0 ),
+      m_CQRingSize( 0 ),
+      m_SQEntries( 0 ),
+      m_SQEntriesSize( 0 )
+    {}
+  ~IOURingQueue() { this->Release(); }
+
+  // Creates a ring with at least entries submission entries, false is
+  // returned if the kernel does not support io_uring
+  bool Initialize( unsigned int entries )
+    {
+      struct io_uring_params params;
+      memset( &params, 0, sizeof(params) );
+      
+      m_RingFileDescriptor = static_cast<int>( syscall( __NR_io_uring_setup, entries, &params ) );
+      if ( m_RingFileDescriptor < 0 )
+        {
+        m_RingFileDescriptor = -1;
+        return false;
+        }
+
+      m_SQRingSize = params.sq_off.array + params.sq_entries*sizeof(__u32);
+      m_CQRingSize = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+      bool singleMapping = false;
+#if defined(IORING_FEAT_SINGLE_MMAP)
+      if ( params.features & IORING_FEAT_SINGLE_MMAP )
+        {
+        singleMapping = true;
+        m_SQRingSize = m_CQRingSize = ( m_SQRingSize > m_CQRingSize ) ? m_SQRingSize : m_CQRingSize;
+        }
+#endif
+      
+      m_SQRing = this->Map( m_SQRingSize, IORING_OFF_SQ_RING );
+      if ( !m_SQRing )
+        {
+        this->Release();
+        return false;
+        }
+      if ( singleMapping )
+        {
+        m_CQRing = m_SQRing;
+        }
+      else if ( !( m_CQRing = this->Map( m_CQRingSize, IORING_OFF_CQ_RING ) ) )
+        {
+        this->Release();
+        return false;
+        }
+      m_SQEntriesSize = params.sq_entries*sizeof(struct io_uring_sqe);
+      void *sqes = this->Map( m_SQEntriesSize, IORING_OFF_SQES );
+      if ( !sqes )
+        {
+        this->Release();
+        return false;
+        }
+      m_SQEntries = static_cast<struct io_uring_sqe *>( sqes );
+
+      m_SQTail  = reinterpret_cast<unsigned int *>( m_SQRing + params.sq_off.tail );
+      m_SQMask  = reinterpret_cast<unsigned int *>( m_SQRing + params.sq_off.ring_mask );
+      m_SQArray = reinterpret_cast<unsigned int *>( m_SQRing + params.sq_off.array );
+      m_CQHead  = reinterpret_cast<unsigned int *>( m_CQRing + params.cq_off.head );
+      m_CQTail  = reinterpret_cast<unsigned int *>( m_CQRing + params.cq_off.tail );
+      m_CQMask  = reinterpret_cast<unsigned int *>( m_CQRing + params.cq_off.ring_mask );
+      m_CQEntries = reinterpret_cast<struct io_uring_cqe *>( m_CQRing + params.cq_off.cqes );
+      
+      m_NumberOfEntries = params.sq_entries;
+      return true;
+    }
+  
+  unsigned int GetNumberOfEntries( void ) const { return m_NumberOfEntries; }
+
+  // Queues a read or write of one io vector at offset in the file, the
+  // io vector must remain valid until the operation completes
+  void Queue( bool write, int fd, struct iovec *iov, 
+              itk::ImageIOBase::SizeType offset, unsigned long userData )
+    {
+      // only this process advances the tail
+      const unsigned int tail = *m_SQTail;
+      const unsigned int index = tail & *m_SQMask;
+      
+      struct io_uring_sqe *sqe = &m_SQEntries[index];
+      memset( sqe, 0, sizeof(*sqe) );
+      sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+      sqe->fd = fd;
+      sqe->off = static_cast<__u64>( offset );
+      sqe->addr = reinterpret_cast<unsigned long>( iov );
+      sqe->len = 1;
+      sqe->user_data = userData;
+      
+      m_SQArray[index] = index;
+      __atomic_store_n( m_SQTail, tail + 1, __ATOMIC_RELEASE );
+      ++m_NumberToSubmit;
+    }
+
+  // Submits the queued entries and waits for minComplete completions,
+  // returns false on an error other than an interruption
+  bool Enter( unsigned int minComplete )
+    {
+      const int n = static_cast<int>( syscall( __NR_io_uring_enter, m_RingFileDescriptor, 
+                                               m_NumberToSubmit, minComplete,
+                                               minComplete ? IORING_ENTER_GETEVENTS : 0, 
+                                               NULL, 0 ) );
+      if ( n >= 0 )
+        {
+        m_NumberToSubmit -= n;
+        return true;
+        }
+      return errno == EINTR || errno == EAGAIN || errno == EBUSY;
+    }
+
+  // Pops the next completion, false is returned if there are none
+  bool PopCompletion( unsigned long &userData, int &result )
+    {
+      // only this process advances the head
+      const unsigned int head = *m_CQHead;
+      if ( head == __atomic_load_n( m_CQTail, __ATOMIC_ACQUIRE ) )
+        {
+        return false;
+        }
+      const struct io_uring_cqe *cqe = &m_CQEntries[head & *m_CQMask];
+      userData = static_cast<unsigned long>( cqe->user_data );
+      result = cqe->res;
+      __atomic_store_n( m_CQHead, head + 1, __ATOMIC_RELEASE );
+      return true;
+    }
+  
+private:
+  IOURingQueue(const IOURingQueue&); //purposely not implemented
+  void operator=(const IOURingQueue&); //purposely not implemented
+
+  char *Map( ::size_t length, unsigned long long offset )
+    {
+      void *p = mmap( 0, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+                      m_RingFileDescriptor, static_cast<off_t>( offset ) );
+      return ( p == MAP_FAILED ) ? 0 : static_cast<char *>( p );
+    }
+
+  void Release( void )
+    {
+      if ( m_SQEntries )
+        {
+        munmap( m_SQEntries, m_SQEntriesSize );
+        m_SQEntries = 0;
+        }
+      if ( m_CQRing && m_CQRing != m_SQRing )
+        {
+        munmap( m_CQRing, m_CQRingSize );
+        }
+      m_CQRing = 0;
+      if ( m_SQRing )
+        {
+        munmap( m_SQRing, m_SQRingSize );
+        m_SQRing = 0;
+        }
+      if ( m_RingFileDescriptor != -1 )
+        {
+        close( m_RingFileDescriptor );
+        m_RingFileDescriptor = -1;
+        }
+    }
+
+  int           m_RingFileDescriptor;
+  unsigned int  m_NumberOfEntries;
+  unsigned int  m_NumberToSubmit;
+
+  char         *m_SQRing;
+  ::size_t      m_SQRingSize;
+  char         *m_CQRing;
+  ::size_t      m_CQRingSize;
+  struct io_uring_sqe *m_SQEntries;
+  ::size_t      m_SQEntriesSize;
+
+  unsigned int *m_SQTail;
+  unsigned int *m_SQMask;
+  unsigned int *m_SQArray;
+  unsigned int *m_CQHead;
+  unsigned int *m_CQTail;
+  unsigned int *m_CQMask;
+  struct io_uring_cqe *m_CQEntries;
+};
+
+#endif
+
+#if defined(IJMRCIO_USE_LOCKED_POSITIONAL_IO)
+
+// open file description locks are owned by the descriptor, so they
+// also exclude other threads of this process, the process wide
+// record locks only exclude other processes
+#if defined(F_OFD_SETLKW)
+const int SetLockWaitCommand = F_OFD_SETLKW;
+const int SetLockCommand = F_OFD_SETLK;
+#else
+const int SetLockWaitCommand = F_SETLKW;
+const int SetLockCommand = F_SETLK;
+#endif
+
+// holds write locks on byte ranges of a file, which are released
+// when going out of scope
+class FileRangeLockGuard
+{
+public:
+  explicit FileRangeLockGuard( int fd ) : m_FileDescriptor( fd ) {}
+  ~FileRangeLockGuard()
+    {
+      for ( ::size_t i = 0; i < m_Ranges.size(); ++i )
+        {
+        this->SetLock( SetLockCommand, F_UNLCK, m_Ranges[i].first, m_Ranges[i].second );
+        }
+    }
+
+  // waits for the lock, returns false on error
+  bool Lock( off_t position, off_t size )
+    {
+      if ( this->SetLock( SetLockWaitCommand, F_WRLCK, position, size ) == -1 )
+        {
+        return false;
+        }
+      m_Ranges.push_back( std::make_pair( position, size ) );
+      return true;
+    }
+
+private:
+  int SetLock( int command, short type, off_t position, off_t size )
+    {
+      struct flock lock;
+      memset( &lock, 0, sizeof(lock) );
+      lock.l_type = type;
+      lock.l_whence = SEEK_SET;
+      lock.l_start = position;
+      lock.l_len = size;
+
+      int result;
+      do
+        {
+        result = fcntl( m_FileDescriptor, command, &lock );
+        }
+      while ( result == -1 && errno == EINTR );
+      return result;
+    }
+
+  int m_FileDescriptor;
+  std::vector< std::pair<off_t, off_t> > m_Ranges;
+};
+
+// writes all size bytes, returns false on error
+bool PositionalWriteAll( int fd, const char *buffer, ::size_t size, off_t position, 
+                         unsigned long &numberOfCalls )
+{
+  while ( size > 0 )
+    {
+    const ssize_t n = pwrite( fd, buffer, size, position );
+    ++numberOfCalls;
+    if ( n < 0 && errno == EINTR )
+      {
+      continue;
+      }
+    if ( n <= 0 )
+      {
+      return false;
+      }
+    buffer += n;
+    size -= n;
+    position += n;
+    }
+  return true;
+}
+
+#endif
+
+#if defined(IJMRCIO_USE_DIRECT_IO)
+
+// a block of memory aligned for direct IO
+class AlignedBuffer
+{
+public:
+  AlignedBuffer( ::size_t size, ::size_t alignment )
+    : m_Memory( size + alignment )
+    {
+      const ::size_t misalignment = reinterpret_cast< ::size_t >( &m_Memory[0] ) % alignment;
+      m_Data = &m_Memory[0] + ( alignment - misalignment ) % alignment;
+    }
+  char *GetPointer( void ) { return m_Data; }
+
+private:
+  std::vector<char>  m_Memory;
+  char              *m_Data;
+};
+
+// one positional read or write with direct IO, returns the number
+// of bytes transferred, which is short at the end of the file, or -1
+// on error
+ssize_t DirectTransfer( bool write, int fd, char *buffer, ::size_t size, off_t position,
+                        unsigned long &numberOfCalls )
+{
+  ssize_t n;
+  do
+    {
+    n = write ? pwrite( fd, buffer, size, position ) : pread( fd, buffer, size, position );
+    ++numberOfCalls;
+    }
+  while ( n < 0 && errno == EINTR );
+  return n;
+}
+
+#endif
+
+typedef itk::ImageIOBase::SizeType SizeType;
+
+// Adds the rows of a section of the file into the sums of the bins
+// of a binned section. Each row of rowLength pixels is added into the
+// bins starting at rowBinOffset, factor pixels to a bin.
+template <typename T>
+void SumSectionRows( const void *section, SizeType numberOfRows, SizeType rowLength, 
+                     unsigned int numberOfComponents, unsigned int factor,
+                     const SizeType *rowBinOffset, double *sums )
+{
+  const T *in = static_cast<const T *>( section );
+  for ( SizeType r = 0; r < numberOfRows; ++r )
+    {
+    double *bin = sums + rowBinOffset[r] * numberOfComponents;
+    unsigned int k = 0;
+    for ( SizeType x = 0; x < rowLength; ++x )
+      {
+      for ( unsigned int c = 0; c < numberOfComponents; ++c )
+        {
+        bin[c] += static_cast<double>( *in++ );
+        }
+      if ( ++k == factor )
+        {
+        k = 0;
+        bin += numberOfComponents;
+        }
+      }
+    }
+}
+
+// Converts the sums of numberOfBins bins into means in buffer, the
+// means are rounded and clamped for integer types
+template <typename T>
+void ConvertBinMeans( const double *sums, const double *binSizes, SizeType numberOfBins,
+                      unsigned int numberOfComponents, void *buffer )
+{
+  T *out = static_cast<T *>( buffer );
+  const bool isInteger = itk::NumericTraits<T>::is_integer;
+  const double minimum = static_cast<double>( itk::NumericTraits<T>::NonpositiveMin() );
+  const double maximum = static_cast<double>( itk::NumericTraits<T>::max() );
+  for ( SizeType i = 0; i < numberOfBins; ++i )
+    {
+    for ( unsigned int c = 0; c < numberOfComponents; ++c )
+      {
+      double v = *sums++ / binSizes[i];
+      if ( isInteger )
+        {
+        v = std::floor( v + 0.5 );
+        v = ( v < minimum ) ? minimum : ( ( v > maximum ) ? maximum : v );
+        }
+      *out++ = static_cast<T>( v );
+      }
+    }
+}
+
+}
+
 namespace itk
 {
 namespace Local
 {
 
 StreamingImageIOBase::StreamingImageIOBase() 
-  : ImageIOBase()
+  : ImageIOBase(),
+    m_UseMemoryMappedReading( false ),
+    m_MappedFileData( 0 ),
+    m_MappedFileLength( 0 ),
+    m_UsePositionalVectoredIO( false ),
+    m_VectoredIOBatchSize( 256 ),
+    m_VectoredIOMaximumGapSize( 16*1024 ),
+    m_NumberOfIOCalls( 0 ),
+    m_NumberOfIOThreads( 1 ),
+    m_MinimumBytesPerIOThread( 1024*1024 ),
+    m_UseAsynchronousIO( false ),
+    m_AsynchronousIOQueueDepth( 64 ),
+    m_UseReadAhead( false ),
+    m_NumberOfReadAheadRanges( 0 ),
+    m_UseFileCache( false ),
+    m_StagingBufferSize( 4*1024*1024 ),
+    m_PeakStagingMemory( 0 ),
+    m_FileAllocationPolicy( SparseAllocation ),
+    m_UseConcurrentPasting( false ),
+    m_ConcurrentFileDescriptor( -1 ),
+    m_UseDirectIO( false ),
+    m_DirectIOAlignment( 4096 ),
+    m_SeekCostInBytes( 0 ),
+    m_WritingMemoryLimit( 0 ),
+    m_UseSlabCache( false ),
+    m_ReadBinningFactor( 1 ),
+    m_ReadComponentType( UNKNOWNCOMPONENTTYPE ),
+    m_FileComponentType( UNKNOWNCOMPONENTTYPE )
+{
+}
+
+StreamingImageIOBase::~StreamingImageIOBase()
 {
+  this->UnmapFile();
+  this->CloseConcurrentFile();
 }
 
 
 void StreamingImageIOBase::PrintSelf(std::ostream& os, Indent indent) const
 {
   Superclass::PrintSelf(os, indent);
+  os << indent << "UseMemoryMappedReading: " << m_UseMemoryMappedReading << std::endl;
+  os << indent << "UsePositionalVectoredIO: " << m_UsePositionalVectoredIO << std::endl;
+  os << indent << "VectoredIOBatchSize: " << m_VectoredIOBatchSize << std::endl;
+  os << indent << "VectoredIOMaximumGapSize: " << m_VectoredIOMaximumGapSize << std::endl;
+  os << indent << "NumberOfIOCalls: " << m_NumberOfIOCalls << std::endl;
+  os << indent << "NumberOfIOThreads: " << m_NumberOfIOThreads << std::endl;
+  os << indent << "MinimumBytesPerIOThread: " << m_MinimumBytesPerIOThread << std::endl;
+  os << indent << "UseAsynchronousIO: " << m_UseAsynchronousIO << std::endl;
+  os << indent << "AsynchronousIOQueueDepth: " << m_AsynchronousIOQueueDepth << std::endl;
+  os << indent << "UseReadAhead: " << m_UseReadAhead << std::endl;
+  os << indent << "NumberOfReadAheadRanges: " << m_NumberOfReadAheadRanges << std::endl;
+  os << indent << "UseFileCache: " << m_UseFileCache << std::endl;
+  os << indent << "StagingBufferSize: " << m_StagingBufferSize << std::endl;
+  os << indent << "PeakStagingMemory: " << m_PeakStagingMemory << std::endl;
+  os << indent << "FileAllocationPolicy: " << m_FileAllocationPolicy << std::endl;
+  os << indent << "UseConcurrentPasting: " << m_UseConcurrentPasting << std::endl;
+  os << indent << "UseDirectIO: " << m_UseDirectIO << std::endl;
+  os << indent << "DirectIOAlignment: " << m_DirectIOAlignment << std::endl;
+  os << indent << "SeekCostInBytes: " << m_SeekCostInBytes << std::endl;
+  os << indent << "WritingMemoryLimit: " << m_WritingMemoryLimit << std::endl;
+  os << indent << "UseSlabCache: " << m_UseSlabCache << std::endl;
+  os << indent << "ReadBinningFactor: " << m_ReadBinningFactor << std::endl;
+  os << indent << "ReadComponentType: " << this->GetComponentTypeAsString( m_ReadComponentType ) << std::endl;
+}
+
+
+void StreamingImageIOBase
+::ComputeIORegionChunks( const ImageIORegion &region, IORegionChunkSequence &chunks ) const
+{
+  chunks.SetImageLayout( this, region, this->GetDataPosition(), this->GetPixelSize() );
 }
 
 
@@ -42,202 +639,1866 @@ bool StreamingImageIOBase
   itkDebugMacro( << "StreamingReadBufferAsBinary called" );
  
   char *buffer = static_cast<char*>(_buffer);
-  // Offset into file
-  std::streampos dataPos = this->GetDataPosition();
 
   std::streamsize sizeOfRegion = static_cast<std::streamsize>( m_IORegion.GetNumberOfPixels() )
     *this->GetPixelSize();
 
+  IORegionChunkSequence chunks;
+  this->ComputeIORegionChunks( chunks );
 
-  // compute the number of continuous bytes to be read
-  std::streamsize sizeOfChunk = 1;
-  unsigned int movingDirection = 0;
-  do 
+  std::streamsize gcount = 0;
+  SizeType asynchronousCount = 0;
+
+  if ( m_UseSlabCache && this->CachedReadChunks( file, buffer, chunks ) )
     {
-    sizeOfChunk *= m_IORegion.GetSize(movingDirection);
-    ++movingDirection;
-    } 
-  while ( movingDirection < m_IORegion.GetImageDimension() &&
-          m_IORegion.GetSize(movingDirection-1) == this->GetDimensions(movingDirection-1) );
-  sizeOfChunk *= this->GetPixelSize();
+    gcount = sizeOfRegion;
+    }
+  else if ( m_UseDirectIO && chunks.GetNumberOfChunks() == 1 && 
+            this->DirectReadBufferAsBinary( chunks.Begin()->filePosition, buffer, chunks.GetSizeOfRegion() ) )
+    {
+    // a single run is read without the page cache
+    gcount = chunks.GetSizeOfRegion();
+    }
+  else if ( m_UseMemoryMappedReading && this->MapFileForReading() )
+    {
+    // copy from the mapping of the file
+    for ( IORegionChunkIterator chunk = chunks.Begin(); !chunk.IsAtEnd(); ++chunk )
+      {
+      itkDebugMacro(<< "Copying " << chunk->size << " of " << sizeOfRegion << " bytes for " << m_FileName << " at " << chunk->filePosition << " position in file");
 
-  ImageIORegion::IndexType currentIndex = m_IORegion.GetIndex();
-  std::streamsize gcount = 0;
-  while ( m_IORegion.IsInside(currentIndex) )
+      if ( !this->ReadAndSwapMappedBufferAsBinary( chunk->filePosition, buffer + chunk->bufferOffset, chunk->size ) )
+        {
+        itkExceptionMacro(<<"Fail reading");
+        }
+      gcount += chunk->size;
+      }
+    }
+  else if ( m_UseAsynchronousIO && this->AsynchronousReadChunks( buffer, chunks, asynchronousCount ) )
+    {
+    gcount = asynchronousCount;
+    }
+  else if ( m_NumberOfIOThreads > 1 && this->CanUsePositionalVectoredIO() )
     {
-    // calculate the position to seek to in the file
-    std::streampos seekPos = 0;
-    size_t subDimensionQuantity = 1;
-    for ( unsigned int i = 0; i < m_IORegion.GetImageDimension(); ++i )
+    gcount = this->ThreadedReadChunks( buffer, chunks );
+    }
+  else if ( m_UsePositionalVectoredIO && this->CanUsePositionalVectoredIO() )
+    {
+    gcount = this->VectoredReadChunks( buffer, chunks );
+    }
+  else
+    {
+    for ( IORegionChunkIterator chunk = chunks.Begin(); !chunk.IsAtEnd(); ++chunk )
       {
-      seekPos += subDimensionQuantity*this->GetPixelSize()*currentIndex[i];
-      subDimensionQuantity *= this->GetDimensions(i);
+      itkDebugMacro(<< "Reading " << chunk->size << " of " << sizeOfRegion << " bytes for " << m_FileName << " at " << chunk->filePosition << " position in file");
+
+      // a swapped run is read in several blocks, so the count of the
+      // last read of the stream is not the size of the run
+      file.seekg( chunk->filePosition, std::ios::beg );
+      if ( !this->ReadAndSwapBufferAsBinary( file, buffer + chunk->bufferOffset, chunk->size ) )
+        {
+        itkExceptionMacro(<<"Fail reading");
+        }
+      m_NumberOfIOCalls += 2;
+      
+      gcount += chunk->size;
       }
-    
-    
-    itkDebugMacro(<< "Reading " << sizeOfChunk << " of " << sizeOfRegion << " bytes for " << m_FileName << " at " << dataPos+seekPos << " position in file");
+    }
 
-    file.seekg( dataPos+seekPos, std::ios::beg );
-    this->ReadBufferAsBinary( file, buffer, sizeOfChunk );
+  if ( gcount != sizeOfRegion )
+    {
+    itkExceptionMacro("Data not read completely. Expected = " << sizeOfRegion << ", but only read " <<  gcount <<  " bytes.");
+    }
 
-    // increment the buffer pointer
-    buffer += sizeOfChunk;
-    gcount += file.gcount();
-    
-    if ( file.fail() )
+  if ( m_UseReadAhead )
+    {
+    this->ReadAheadNextIORegion();
+    }
+  
+  return true;
+}
+
+void StreamingImageIOBase::BinImageInformation( void )
+{
+  m_UnbinnedDimensions.clear();
+  if ( m_ReadBinningFactor <= 1 )
+    {
+    return;
+    }
+
+  // the origin is the center of the first bin
+  const double factor = static_cast<double>( m_ReadBinningFactor );
+  for ( unsigned int i = 0; i < this->GetNumberOfDimensions(); ++i )
+    {
+    const SizeType dimension = this->GetDimensions( i );
+    m_UnbinnedDimensions.push_back( dimension );
+    this->SetDimensions( i, ( dimension + m_ReadBinningFactor - 1 ) / m_ReadBinningFactor );
+    this->SetOrigin( i, this->GetOrigin( i ) + this->GetSpacing( i ) * ( factor - 1.0 ) / 2.0 );
+    this->SetSpacing( i, this->GetSpacing( i ) * factor );
+    }
+}
+
+
+bool StreamingImageIOBase::BinnedStreamReadBufferAsBinary( std::istream& file, void *_buffer )
+{
+  itkDebugMacro( << "BinnedStreamReadBufferAsBinary called" );
+
+  char *buffer = static_cast<char*>(_buffer);
+  
+  const unsigned int factor = m_ReadBinningFactor;
+  const unsigned int numberOfDimensions = static_cast<unsigned int>( m_UnbinnedDimensions.size() );
+  const unsigned int numberOfComponents = this->GetNumberOfComponents();
+  const IOComponentType outputComponentType = this->GetComponentType();
+  const SizeType outputPixelSize = this->GetPixelSize();
+  const IOComponentType fileComponentType = this->IsReadConverted() ? m_FileComponentType : outputComponentType;
+  this->SetComponentType( fileComponentType );
+  const SizeType pixelSize = this->GetPixelSize();
+  this->SetComponentType( outputComponentType );
+
+  if ( numberOfDimensions == 0 )
+    {
+    itkExceptionMacro(<< "The image information was not binned");
+    }
+  
+  // the IORegion in the dimensions of the binned image, and the
+  // region of the file under it
+  ImageIORegion binnedRegion( numberOfDimensions );
+  ImageIORegion fileRegion( numberOfDimensions );
+  for ( unsigned int i = 0; i < numberOfDimensions; ++i )
+    {
+    const bool inRegion = i < m_IORegion.GetImageDimension();
+    binnedRegion.SetIndex( i, inRegion ? m_IORegion.GetIndex( i ) : 0 );
+    binnedRegion.SetSize( i, inRegion ? m_IORegion.GetSize( i ) : 1 );
+
+    const SizeType index = static_cast<SizeType>( binnedRegion.GetIndex( i ) ) * factor;
+    const SizeType size = static_cast<SizeType>( binnedRegion.GetSize( i ) ) * factor;
+    if ( binnedRegion.GetSize( i ) == 0 || index >= m_UnbinnedDimensions[i] )
       {
-      itkExceptionMacro(<<"Fail reading");
+      itkExceptionMacro(<< "IORegion is outside of the binned image: " << m_IORegion );
       }
+    fileRegion.SetIndex( i, index );
+    fileRegion.SetSize( i, vnl_math_min( size, m_UnbinnedDimensions[i] - index ) );
+    }
 
-    if (movingDirection == m_IORegion.GetImageDimension())
-      break;
-    
-    // increment index to next chunk
-    ++currentIndex[movingDirection];
-    for (unsigned int i = movingDirection; i < m_IORegion.GetImageDimension()-1; ++i) 
+  // the highest dimension is read one section of the file at a time,
+  // a one dimensional image is a single section
+  const unsigned int sectionDimension = ( numberOfDimensions > 1 ) ? numberOfDimensions - 1 : 1;
+  const SizeType numberOfSections = ( numberOfDimensions > 1 ) ? binnedRegion.GetSize( sectionDimension ) : 1;
+  const SizeType rowLength = fileRegion.GetSize( 0 );
+  SizeType numberOfRows = 1;
+  SizeType numberOfBins = binnedRegion.GetSize( 0 );
+  for ( unsigned int i = 1; i < sectionDimension; ++i )
+    {
+    numberOfRows *= fileRegion.GetSize( i );
+    numberOfBins *= binnedRegion.GetSize( i );
+    }
+
+  // the first bin of each row of the section, and the number of
+  // pixels of a section in each bin
+  std::vector<SizeType> rowBinOffset( numberOfRows );
+  for ( SizeType r = 0; r < numberOfRows; ++r )
+    {
+    SizeType offset = 0;
+    SizeType stride = binnedRegion.GetSize( 0 );
+    SizeType row = r;
+    for ( unsigned int i = 1; i < sectionDimension; ++i )
       {
-      // when reaching the end of the moving index dimension carry to
-      // higher dimensions
-      if (static_cast<ImageIORegion::SizeValueType>(currentIndex[i]  - m_IORegion.GetIndex(i)) >= m_IORegion.GetSize(i) )
-        {
-        currentIndex[i] = m_IORegion.GetIndex(i);
-        ++currentIndex[i+1];
-        }
+      offset += ( row % fileRegion.GetSize( i ) ) / factor * stride;
+      row /= fileRegion.GetSize( i );
+      stride *= binnedRegion.GetSize( i );
+      }
+    rowBinOffset[r] = offset;
+    }
+  
+  std::vector<double> binSizes( numberOfBins );
+  for ( SizeType b = 0; b < numberOfBins; ++b )
+    {
+    double binSize = 1.0;
+    SizeType bin = b;
+    for ( unsigned int i = 0; i < sectionDimension; ++i )
+      {
+      const SizeType first = ( bin % binnedRegion.GetSize( i ) ) * factor;
+      binSize *= static_cast<double>( vnl_math_min( SizeType( factor ), 
+                                                    static_cast<SizeType>( fileRegion.GetSize( i ) ) - first ) );
+      bin /= binnedRegion.GetSize( i );
       }
+    binSizes[b] = binSize;
     }
 
-  if ( gcount != sizeOfRegion )
+  itkDebugMacro(<< "Reading " << fileRegion << " binned by " << factor << " for " << m_FileName );
+
+  // the section of the file and the sums of the bins are the only
+  // buffers used
+  std::vector<char> section( numberOfRows * rowLength * pixelSize );
+  std::vector<double> sums( numberOfBins * numberOfComponents );
+  std::vector<double> sectionBinSizes( numberOfBins );
+  
+  // the file's dimensions and component type are used for reading
+  const ImageIORegion ioRegion = m_IORegion;
+  std::vector<SizeType> binnedDimensions( numberOfDimensions );
+  for ( unsigned int i = 0; i < numberOfDimensions; ++i )
+    {
+    binnedDimensions[i] = this->GetDimensions( i );
+    this->SetDimensions( i, m_UnbinnedDimensions[i] );
+    }
+  this->SetComponentType( fileComponentType );
+
+  try
+    {
+    ImageIORegion sectionRegion = fileRegion;
+    for ( SizeType z = 0; z < numberOfSections; ++z )
+      {
+      std::fill( sums.begin(), sums.end(), 0.0 );
+      
+      SizeType numberOfSectionsInSum = 0;
+      for ( SizeType k = z * factor; k < ( z + 1 ) * factor; ++k )
+        {
+        if ( numberOfDimensions > 1 )
+          {
+          if ( k >= static_cast<SizeType>( fileRegion.GetSize( sectionDimension ) ) )
+            {
+            break;
+            }
+          sectionRegion.SetIndex( sectionDimension, fileRegion.GetIndex( sectionDimension ) + k );
+          sectionRegion.SetSize( sectionDimension, 1 );
+          }
+        else if ( k > 0 )
+          {
+          break;
+          }
+        
+        m_IORegion = sectionRegion;
+        if ( !this->StreamReadBufferAsBinary( file, &section[0] ) )
+          {
+          itkExceptionMacro(<< "Fail reading");
+          }
+        ++numberOfSectionsInSum;
+        
+        switch ( fileComponentType )
+          {
+          case UCHAR:
+            SumSectionRows<unsigned char>( &section[0], numberOfRows, rowLength, numberOfComponents, factor, &rowBinOffset[0], &sums[0] );
+            break;
+          case CHAR:
+            SumSectionRows<char>( &section[0], numberOfRows, rowLength, numberOfComponents, factor, &rowBinOffset[0], &sums[0] );
+            break;
+          case USHORT:
+            SumSectionRows<unsigned short>( &section[0], numberOfRows, rowLength, numberOfComponents, factor, &rowBinOffset[0], &sums[0] );
+            break;
+          case SHORT:
+            SumSectionRows<short>( &section[0], numberOfRows, rowLength, numberOfComponents, factor, &rowBinOffset[0], &sums[0] );
+            break;
+          case UINT:
+            SumSectionRows<unsigned int>( &section[0], numberOfRows, rowLength, numberOfComponents, factor, &rowBinOffset[0], &sums[0] );
+            break;
+          case INT:
+            SumSectionRows<int>( &section[0], numberOfRows, rowLength, numberOfComponents, factor, &rowBinOffset[0], &sums[0] );
+            break;
+          case ULONG:
+            SumSectionRows<unsigned long>( &section[0], numberOfRows, rowLength, numberOfComponents, factor, &rowBinOffset[0], &sums[0] );
+            break;
+          case LONG:
+            SumSectionRows<long>( &section[0], numberOfRows, rowLength, numberOfComponents, factor, &rowBinOffset[0], &sums[0] );
+            break;
+          case FLOAT:
+            SumSectionRows<float>( &section[0], numberOfRows, rowLength, numberOfComponents, factor, &rowBinOffset[0], &sums[0] );
+            break;
+          case DOUBLE:
+            SumSectionRows<double>( &section[0], numberOfRows, rowLength, numberOfComponents, factor, &rowBinOffset[0], &sums[0] );
+            break;
+          default:
+            itkExceptionMacro(<< "Unknown component type: " << this->GetComponentType() );
+          }
+        }
+
+      for ( SizeType b = 0; b < numberOfBins; ++b )
+        {
+        sectionBinSizes[b] = binSizes[b] * numberOfSectionsInSum;
+        }
+
+      char *out = buffer + z * numberOfBins * outputPixelSize;
+      switch ( outputComponentType )
+        {
+        case UCHAR:
+          ConvertBinMeans<unsigned char>( &sums[0], &sectionBinSizes[0], numberOfBins, numberOfComponents, out );
+          break;
+        case CHAR:
+          ConvertBinMeans<char>( &sums[0], &sectionBinSizes[0], numberOfBins, numberOfComponents, out );
+          break;
+        case USHORT:
+          ConvertBinMeans<unsigned short>( &sums[0], &sectionBinSizes[0], numberOfBins, numberOfComponents, out );
+          break;
+        case SHORT:
+          ConvertBinMeans<short>( &sums[0], &sectionBinSizes[0], numberOfBins, numberOfComponents, out );
+          break;
+        case UINT:
+          ConvertBinMeans<unsigned int>( &sums[0], &sectionBinSizes[0], numberOfBins, numberOfComponents, out );
+          break;
+        case INT:
+          ConvertBinMeans<int>( &sums[0], &sectionBinSizes[0], numberOfBins, numberOfComponents, out );
+          break;
+        case ULONG:
+          ConvertBinMeans<unsigned long>( &sums[0], &sectionBinSizes[0], numberOfBins, numberOfComponents, out );
+          break;
+        case LONG:
+          ConvertBinMeans<long>( &sums[0], &sectionBinSizes[0], numberOfBins, numberOfComponents, out );
+          break;
+        case FLOAT:
+          ConvertBinMeans<float>( &sums[0], &sectionBinSizes[0], numberOfBins, numberOfComponents, out );
+          break;
+        case DOUBLE:
+          ConvertBinMeans<double>( &sums[0], &sectionBinSizes[0], numberOfBins, numberOfComponents, out );
+          break;
+        default:
+          break;
+        }
+      }
+    }
+  catch (...)
+    {
+    m_IORegion = ioRegion;
+    for ( unsigned int i = 0; i < numberOfDimensions; ++i )
+      {
+      this->SetDimensions( i, binnedDimensions[i] );
+      }
+    this->SetComponentType( outputComponentType );
+    throw;
+    }
+  
+  m_IORegion = ioRegion;
+  for ( unsigned int i = 0; i < numberOfDimensions; ++i )
+    {
+    this->SetDimensions( i, binnedDimensions[i] );
+    }
+  this->SetComponentType( outputComponentType );
+
+  return true;
+}
+
+
+void StreamingImageIOBase::ConvertImageInformation( void )
+{
+  m_FileComponentType = UNKNOWNCOMPONENTTYPE;
+  if ( m_ReadComponentType == UNKNOWNCOMPONENTTYPE || 
+       m_ReadComponentType == this->GetComponentType() )
+    {
+    return;
+    }
+
+  if ( !SIMDPixelConverter::CanConvert( this->GetComponentType(), m_ReadComponentType ) )
+    {
+    itkExceptionMacro(<< "Can not convert " << this->GetComponentTypeAsString( this->GetComponentType() ) 
+                      << " to " << this->GetComponentTypeAsString( m_ReadComponentType ) );
+    }
+
+  m_FileComponentType = this->GetComponentType();
+  this->SetComponentType( m_ReadComponentType );
+}
+
+
+bool StreamingImageIOBase::ConvertedStreamReadBufferAsBinary( std::istream& file, void *_buffer )
+{
+  itkDebugMacro( << "ConvertedStreamReadBufferAsBinary called" );
+
+  char *buffer = static_cast<char*>(_buffer);
+
+  const IOComponentType outputComponentType = this->GetComponentType();
+  const SizeType outputComponentSize = this->GetComponentSize();
+  const SizeType numberOfComponents = this->GetNumberOfComponents();
+
+  // the IORegion is read in pieces of continuous rows, sections or
+  // slabs which fit in the staging buffer, in the order of the buffer
+  const ImageIORegion ioRegion = m_IORegion;
+  const unsigned int numberOfDimensions = ioRegion.GetImageDimension();
+
+  this->SetComponentType( m_FileComponentType );
+  const SizeType filePixelSize = this->GetPixelSize();
+
+  unsigned int splitDimension = numberOfDimensions;
+  SizeType piecePixels = 1;
+  while ( splitDimension > 0 )
+    {
+    SizeType lowerPixels = 1;
+    for ( unsigned int i = 0; i + 1 < splitDimension; ++i )
+      {
+      lowerPixels *= ioRegion.GetSize( i );
+      }
+    piecePixels = lowerPixels;
+    --splitDimension;
+    if ( lowerPixels * filePixelSize <= m_StagingBufferSize )
+      {
+      break;
+      }
+    }
+  const SizeType splitSize = numberOfDimensions > 0 ? ioRegion.GetSize( splitDimension ) : 1;
+  const SizeType piecesPerSplit = vnl_math_max( SizeType( 1 ), 
+                                                vnl_math_min( splitSize, m_StagingBufferSize / ( piecePixels * filePixelSize ) ) );
+
+  std::vector<char> staging( piecesPerSplit * piecePixels * filePixelSize );
+  m_PeakStagingMemory = vnl_math_max( m_PeakStagingMemory, static_cast<SizeType>( staging.size() ) );
+
+  itkDebugMacro(<< "Reading " << ioRegion << " converted from " << this->GetComponentTypeAsString( m_FileComponentType )
+                << " in pieces of " << staging.size() << " bytes for " << m_FileName );
+
+  try
+    {
+    const SizeType numberOfPixels = static_cast<SizeType>( ioRegion.GetNumberOfPixels() );
+    ImageIORegion piece = ioRegion;
+    ImageIORegion::IndexType index = ioRegion.GetIndex();
+    SizeType bufferPixel = 0;
+    while ( bufferPixel < numberOfPixels )
+      {
+      // the piece is whole in the lower dimensions, and one index in
+      // the higher
+      SizeType size = 1;
+      for ( unsigned int i = 0; i < numberOfDimensions; ++i )
+        {
+        if ( i == splitDimension )
+          {
+          size = vnl_math_min( piecesPerSplit, 
+                               static_cast<SizeType>( ioRegion.GetIndex( i ) + ioRegion.GetSize( i ) - index[i] ) );
+          piece.SetIndex( i, index[i] );
+          piece.SetSize( i, size );
+          }
+        else if ( i > splitDimension )
+          {
+          piece.SetIndex( i, index[i] );
+          piece.SetSize( i, 1 );
+          }
+        }
+
+      m_IORegion = piece;
+      if ( !this->StreamReadBufferAsBinary( file, &staging[0] ) )
+        {
+        itkExceptionMacro(<< "Fail reading");
+        }
+
+      const SizeType pixels = size * piecePixels;
+      SIMDPixelConverter::Convert( &staging[0], m_FileComponentType, 
+                                   buffer + bufferPixel * numberOfComponents * outputComponentSize,
+                                   outputComponentType, pixels * numberOfComponents );
+      bufferPixel += pixels;
+
+      // the index of the next piece
+      if ( numberOfDimensions == 0 )
+        {
+        break;
+        }
+      index[splitDimension] += size;
+      for ( unsigned int i = splitDimension; i + 1 < numberOfDimensions; ++i )
+        {
+        if ( index[i] < static_cast<ImageIORegion::IndexValueType>( ioRegion.GetIndex( i ) + ioRegion.GetSize( i ) ) )
+          {
+          break;
+          }
+        index[i] = ioRegion.GetIndex( i );
+        ++index[i+1];
+        }
+      }
+    }
+  catch (...)
+    {
+    m_IORegion = ioRegion;
+    this->SetComponentType( outputComponentType );
+    throw;
+    }
+
+  m_IORegion = ioRegion;
+  this->SetComponentType( outputComponentType );
+
+  return true;
+}
+
+
+StreamingImageIOBase::SizeType StreamingImageIOBase::GetCacheSlabSize( void ) const
+{
+  SizeType slabSize = this->GetPixelSize();
+  for ( unsigned int i = 0; i + 1 < this->GetNumberOfDimensions(); ++i )
+    {
+    slabSize *= this->GetDimensions( i );
+    }
+  return slabSize;
+}
+
+
+bool StreamingImageIOBase::CachedReadChunks( std::istream &file, char *buffer, const IORegionChunkSequence &chunks )
+{
+  const SizeType slabSize = this->GetCacheSlabSize();
+  FileIdentity identity;
+  if ( slabSize == 0 || slabSize > SlabCache::GetMaximumSize() || 
+       !GetFileIdentity( this->GetDataFileName(), identity ) )
+    {
+    return false;
+    }
+
+  // the slabs are removed by the name of the file written, the
+  // identity is that of the data file read
+  SlabCache::KeyType key;
+  key.FileName = m_FileName;
+  key.Inode = identity.inode;
+  key.FileLength = identity.length;
+  key.ModifiedTime = identity.modifiedTime;
+  key.ModifiedTimeNanoseconds = identity.modifiedTimeNanoseconds;
+
+  const SizeType dataPos = this->GetDataPosition();
+
+  // the chunks are in file order, so each slab is looked up once
+  SlabCache::Slab::ConstPointer slab;
+  SizeType slabIndex = 0;
+  for ( IORegionChunkIterator chunk = chunks.Begin(); !chunk.IsAtEnd(); ++chunk )
+    {
+    SizeType offset = 0;
+    while ( offset < chunk->size )
+      {
+      const SizeType dataOffset = chunk->filePosition + offset - dataPos;
+      if ( slab.IsNull() || dataOffset / slabSize != slabIndex )
+        {
+        slabIndex = dataOffset / slabSize;
+        key.Position = dataPos + slabIndex * slabSize;
+        slab = SlabCache::Find( key );
+        if ( slab.IsNull() || slab->GetSize() != slabSize )
+          {
+          itkDebugMacro(<< "Reading slab of " << slabSize << " bytes at " << key.Position << " into the cache");
+
+          SlabCache::Slab::Pointer newSlab = SlabCache::Slab::New();
+          newSlab->Allocate( slabSize );
+          
+          file.seekg( key.Position, std::ios::beg );
+          const bool slabRead = this->ReadAndSwapBufferAsBinary( file, newSlab->GetBuffer(), slabSize );
+          m_NumberOfIOCalls += 2;
+          if ( !slabRead )
+            {
+            itkExceptionMacro(<<"Fail reading");
+            }
+
+          SlabCache::Insert( key, newSlab );
+          slab = newSlab.GetPointer();
+          }
+        }
+
+      const SizeType slabOffset = dataOffset - slabIndex * slabSize;
+      const SizeType size = vnl_math_min( chunk->size - offset, slabSize - slabOffset );
+      memcpy( buffer + chunk->bufferOffset + offset, slab->GetBuffer() + slabOffset, 
+              static_cast< ::size_t >( size ) );
+      offset += size;
+      }
+    }
+
+  return true;
+}
+
+
+bool StreamingImageIOBase::PredictNextIORegion( ImageIORegion &next ) const
+{
+  const unsigned int dimension = m_IORegion.GetImageDimension();
+
+  // the direction the regions are advancing in, from the previous
+  // region when it is adjacent to the current one
+  int direction = -1;
+  if ( m_ReadAheadFileName == this->GetDataFileName() && 
+       m_ReadAheadPreviousRegion.GetImageDimension() == dimension )
+    {
+    for ( unsigned int i = 0; i < dimension && direction == -1; ++i )
+      {
+      bool adjacent = ( m_ReadAheadPreviousRegion.GetIndex(i) + 
+                        static_cast<ImageIORegion::IndexValueType>( m_ReadAheadPreviousRegion.GetSize(i) ) 
+                        == m_IORegion.GetIndex(i) );
+      for ( unsigned int j = 0; j < dimension && adjacent; ++j )
+        {
+        if ( j != i && ( m_ReadAheadPreviousRegion.GetIndex(j) != m_IORegion.GetIndex(j) ||
+                         m_ReadAheadPreviousRegion.GetSize(j) != m_IORegion.GetSize(j) ) )
+          {
+          adjacent = false;
+          }
+        }
+      if ( adjacent )
+        {
+        direction = i;
+        }
+      }
+    }
+
+  // otherwise assume the splitting is along the highest dimension
+  // which is not the whole image
+  for ( int i = dimension - 1; i >= 0 && direction == -1; --i )
+    {
+    if ( m_IORegion.GetSize(i) < this->GetDimensions(i) )
+      {
+      direction = i;
+      }
+    }
+  
+  if ( direction == -1 )
+    {
+    return false;
+    }
+
+  const ImageIORegion::IndexValueType start = m_IORegion.GetIndex(direction) + 
+    static_cast<ImageIORegion::IndexValueType>( m_IORegion.GetSize(direction) );
+  const ImageIORegion::IndexValueType end = this->GetDimensions(direction);
+  if ( start >= end )
+    {
+    return false;
+    }
+
+  next = m_IORegion;
+  next.SetIndex( direction, start );
+  next.SetSize( direction, vnl_math_min( m_IORegion.GetSize(direction), 
+                                         static_cast<ImageIORegion::SizeValueType>( end - start ) ) );
+  return true;
+}
+
+
+void StreamingImageIOBase::ReadAheadNextIORegion( void )
+{
+  ImageIORegion next;
+  const bool predicted = this->PredictNextIORegion( next );
+
+  m_ReadAheadPreviousRegion = m_IORegion;
+  m_ReadAheadFileName = this->GetDataFileName();
+
+  if ( !predicted )
+    {
+    return;
+    }
+
+#if defined(IJMRCIO_USE_READ_AHEAD)
+  IORegionChunkSequence chunks;
+  this->ComputeIORegionChunks( next, chunks );
+  if ( chunks.GetNumberOfChunks() == 0 )
+    {
+    return;
+    }
+
+  const int fd = open( m_ReadAheadFileName.c_str(), O_RDONLY );
+  if ( fd == -1 )
+    {
+    return;
+    }
+  
+  itkDebugMacro(<< "Reading ahead " << chunks.GetNumberOfChunks() << " chunks for " << m_ReadAheadFileName );
+  
+  // advise the kernel of the ranges of the file, chunks which are
+  // close together are merged to reduce the number of calls
+  const SizeType maxGap = 64*1024;
+  IORegionChunkIterator chunk = chunks.Begin();
+  while ( !chunk.IsAtEnd() )
+    {
+    const SizeType rangePosition = chunk->filePosition;
+    SizeType rangeEnd = chunk->filePosition + chunk->size;
+    for ( ++chunk; !chunk.IsAtEnd() && chunk->filePosition - rangeEnd <= maxGap; ++chunk )
+      {
+      rangeEnd = chunk->filePosition + chunk->size;
+      }
+    
+    // this is only advice, so errors are ignored
+    if ( posix_fadvise( fd, static_cast<off_t>( rangePosition ), 
+                        static_cast<off_t>( rangeEnd - rangePosition ), POSIX_FADV_WILLNEED ) == 0 )
+      {
+      ++m_NumberOfReadAheadRanges;
+      }
+    ++m_NumberOfIOCalls;
+    }
+  
+  close( fd );
+#endif
+}
+
+
+bool StreamingImageIOBase::ReadBufferAsBinary( std::istream& is, void *buffer, StreamingImageIOBase::SizeType num ) 
+{
+  
+  // some systems have a limit of 2GB to be read at once
+  const SizeType maxChunk = 1024*1024*1024;
+  
+  std::streamsize bytesRemaining = static_cast<std::streamsize>( num );
+  
+  while (bytesRemaining) 
+    {
+    
+    std::streamsize bytesToRead = bytesRemaining > maxChunk ? maxChunk : bytesRemaining;
+    
+    itkDebugMacro(<< "Reading " << bytesToRead << " of " << bytesRemaining << " bytes for " << m_FileName);
+    
+    is.read( static_cast<char *>( buffer ) ,  bytesToRead );
+    
+    if ( (is.gcount() != bytesToRead) || is.fail() )
+      {
+      return false;
+      }
+    buffer =  static_cast<char *>( buffer ) + bytesToRead;
+    bytesRemaining -= bytesToRead;
+    }
+  
+  return true;
+}  
+
+
+bool StreamingImageIOBase::WriteBufferAsBinary( std::ostream& os, const void *buffer, StreamingImageIOBase::SizeType num ) 
+{
+  // some systems have a limit of 2GB to be written at once  
+  const SizeType maxChunk = 1024*1024*1024;
+
+  std::streamsize bytesRemaining = num;
+  while (bytesRemaining) 
+    {
+    
+    SizeType bytesToWrite = bytesRemaining > maxChunk ? maxChunk : bytesRemaining;
+    
+    itkDebugMacro(<< "Writing " << bytesToWrite << " of " << bytesRemaining << " bytes for " << m_FileName);
+    
+    os.write(static_cast<const char*>(buffer) , bytesToWrite);
+    if ( os.fail() )
+      {
+      return false;
+      }
+    
+    buffer =  static_cast<const char *>( buffer ) + bytesToWrite;
+    bytesRemaining -= bytesToWrite;
+    }
+ 
+  return true;
+}
+
+
+// the block written by the thread of WriteAndSwapBufferAsBinary
+struct StreamingImageIOBase::StagedWriteStruct
+{
+  StreamingImageIOBase *IO;
+  std::ostream         *Stream;
+  const char           *Data;
+  SizeType              Size;
+  bool                  Failed;
+};
+
+
+ITK_THREAD_RETURN_TYPE StreamingImageIOBase::StagedWriteCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  StagedWriteStruct *str = static_cast<StagedWriteStruct *>( info->UserData );
+
+  if ( !str->IO->WriteBufferAsBinary( *str->Stream, str->Data, str->Size ) )
+    {
+    str->Failed = true;
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+bool StreamingImageIOBase::WriteAndSwapBufferAsBinary( std::ostream& os, const void *buffer, SizeType num )
+{
+  const unsigned int swapSize = this->GetFileByteSwapSize();
+  if ( swapSize <= 1 )
+    {
+    return this->WriteBufferAsBinary( os, buffer, num );
+    }
+
+  // the staging buffers hold whole components
+  const SizeType blockSize = vnl_math_min( vnl_math_max( m_StagingBufferSize / swapSize, SizeType(1) ) * swapSize, 
+                                           num );
+  const ::size_t numberOfStagingBuffers = ( blockSize < num ) ? 2 : 1;
+  
+  std::vector<char> staging[2];
+  for ( ::size_t i = 0; i < numberOfStagingBuffers; ++i )
+    {
+    staging[i].resize( static_cast< ::size_t >( blockSize ) );
+    }
+  m_PeakStagingMemory = vnl_math_max( m_PeakStagingMemory, 
+                                      static_cast<SizeType>( numberOfStagingBuffers ) * blockSize );
+
+  itkDebugMacro(<< "Writing " << num << " bytes through " << numberOfStagingBuffers << " staging buffers of " << blockSize << " bytes");
+
+  // the next block is swapped while the previous one is written by
+  // another thread
+  MultiThreader::Pointer threader = MultiThreader::New();
+  int writingThread = -1;
+
+  StagedWriteStruct str;
+  str.IO = this;
+  str.Stream = &os;
+  str.Failed = false;
+
+  const char *source = static_cast<const char *>( buffer );
+  // str.Failed may be written by the writing thread, it is only read
+  // after the thread is terminated
+  for ( SizeType offset = 0, n = 0; offset < num; offset += blockSize, ++n )
+    {
+    const SizeType size = vnl_math_min( blockSize, num - offset );
+    char *stage = &staging[n % numberOfStagingBuffers][0];
+
+    SIMDByteSwapper::SwapRangeCopy( source + offset, stage, static_cast<size_t>( size / swapSize ), swapSize );
+
+    if ( writingThread != -1 )
+      {
+      threader->TerminateThread( writingThread );
+      writingThread = -1;
+      }
+    if ( str.Failed )
+      {
+      break;
+      }
+
+    str.Data = stage;
+    str.Size = size;
+    if ( numberOfStagingBuffers == 1 )
+      {
+      // there is nothing to overlap with
+      str.Failed = !this->WriteBufferAsBinary( os, stage, size );
+      }
+    else
+      {
+      writingThread = threader->SpawnThread( StagedWriteCallback, &str );
+      }
+    }
+
+  if ( writingThread != -1 )
+    {
+    threader->TerminateThread( writingThread );
+    }
+  
+  return !str.Failed;
+}
+
+
+bool StreamingImageIOBase::StreamWriteBufferAsBinary(std::ostream& file, const void *_buffer)
+{
+  itkDebugMacro( << "StreamingWriteBufferAsBinary called" );
+
+  const char *buffer = static_cast< const char* >( _buffer );
+
+  IORegionChunkSequence chunks;
+  this->ComputeIORegionChunks( chunks );
+
+  if ( m_UseDirectIO && chunks.GetNumberOfChunks() == 1 )
+    {
+    // a single run is written without the page cache, after the data
+    // written through the stream
+    file.flush();
+    if ( this->DirectWriteBufferAsBinary( chunks.Begin()->filePosition, buffer, chunks.GetSizeOfRegion() ) )
+      {
+      return true;
+      }
+    }
+
+  const unsigned int swapSize = this->GetFileByteSwapSize();
+  if ( swapSize > 1 )
+    {
+    this->StagedStreamWriteChunks( file, buffer, chunks, swapSize );
+    return true;
+    }
+
+  if ( m_UseAsynchronousIO || m_UsePositionalVectoredIO )
+    {
+    // the data written through the stream must reach the file first
+    file.flush();
+    }
+
+  if ( m_UseAsynchronousIO && this->AsynchronousWriteChunks( buffer, chunks ) )
+    {
+    return true;
+    }
+
+  if ( m_UsePositionalVectoredIO && this->CanUsePositionalVectoredIO() )
+    {
+    this->VectoredWriteChunks( buffer, chunks );
+    return true;
+    }
+
+  for ( IORegionChunkIterator chunk = chunks.Begin(); !chunk.IsAtEnd(); ++chunk )
+    {
+    file.seekp( chunk->filePosition, std::ios::beg );
+    this->WriteBufferAsBinary( file, buffer + chunk->bufferOffset, chunk->size );
+    m_NumberOfIOCalls += 2;
+    
+    itkDebugMacro(<< "Writing " << chunk->size << " of " <<  " ?? bytes for " << m_FileName << " at " << chunk->filePosition << " position in file");
+
+    if ( file.fail() )
+      {
+      itkExceptionMacro(<<"Fail writing");
+      }
+    }
+  
+  return true;
+}
+
+
+void StreamingImageIOBase::ConcurrentWriteBufferAsBinary( const void *buffer )
+{
+  IORegionChunkSequence chunks;
+  this->ComputeIORegionChunks( chunks );
+  
+  this->ConcurrentWriteChunks( static_cast<const char *>( buffer ), chunks, 
+                               this->GetFileByteSwapSize() );
+}
+
+
+void StreamingImageIOBase::ConcurrentWriteChunks( const char *buffer, 
+                                                  const IORegionChunkSequence &chunks,
+                                                  unsigned int swapSize )
+{
+  if ( chunks.GetNumberOfChunks() == 0 )
+    {
+    return;
+    }
+
+#if defined(IJMRCIO_USE_LOCKED_POSITIONAL_IO)
+  this->OpenConcurrentFile();
+  const int fd = m_ConcurrentFileDescriptor;
+  
+  // lock the ranges of adjacent chunks, in file order
+  FileRangeLockGuard locks( fd );
+  IORegionChunkIterator chunk = chunks.Begin();
+  while ( !chunk.IsAtEnd() )
+    {
+    const SizeType rangePosition = chunk->filePosition;
+    SizeType rangeEnd = chunk->filePosition + chunk->size;
+    for ( ++chunk; !chunk.IsAtEnd() && chunk->filePosition == rangeEnd; ++chunk )
+      {
+      rangeEnd += chunk->size;
+      }
+    
+    if ( !locks.Lock( static_cast<off_t>( rangePosition ), static_cast<off_t>( rangeEnd - rangePosition ) ) )
+      {
+      itkExceptionMacro(<< "Could not lock file for writing: " << m_FileName);
+      }
+    }
+
+  // the staging buffer holds a whole number of swapped components
+  std::vector<char> staging;
+  if ( swapSize > 1 )
+    {
+    staging.resize( vnl_math_min( vnl_math_max( m_StagingBufferSize / swapSize, SizeType(1) ) * swapSize,
+                                  chunks.GetLargestChunkSize() ) );
+    m_PeakStagingMemory = vnl_math_max( m_PeakStagingMemory, static_cast<SizeType>( staging.size() ) );
+    }
+
+  for ( chunk = chunks.Begin(); !chunk.IsAtEnd(); ++chunk )
+    {
+    bool written = true;
+    if ( swapSize > 1 )
+      {
+      for ( SizeType offset = 0; written && offset < chunk->size; offset += staging.size() )
+        {
+        const SizeType size = vnl_math_min( static_cast<SizeType>( staging.size() ), chunk->size - offset );
+        SIMDByteSwapper::SwapRangeCopy( buffer + chunk->bufferOffset + offset, &staging[0], 
+                                        static_cast<size_t>( size / swapSize ), swapSize );
+        written = PositionalWriteAll( fd, &staging[0], static_cast< ::size_t >( size ), 
+                                      static_cast<off_t>( chunk->filePosition + offset ), 
+                                      m_NumberOfIOCalls );
+        }
+      }
+    else
+      {
+      written = PositionalWriteAll( fd, buffer + chunk->bufferOffset, static_cast< ::size_t >( chunk->size ), 
+                                    static_cast<off_t>( chunk->filePosition ), 
+                                    m_NumberOfIOCalls );
+      }
+
+    if ( !written )
+      {
+      itkExceptionMacro(<< "Could not write file: " << m_FileName);
+      }
+    }
+#else
+  std::ofstream file;
+  this->OpenFileForWriting( file, m_FileName.c_str(), false );
+  if ( swapSize > 1 )
+    {
+    this->StagedStreamWriteChunks( file, buffer, chunks, swapSize );
+    return;
+    }
+  
+  for ( IORegionChunkIterator chunk = chunks.Begin(); !chunk.IsAtEnd(); ++chunk )
+    {
+    file.seekp( chunk->filePosition, std::ios::beg );
+    this->WriteBufferAsBinary( file, buffer + chunk->bufferOffset, chunk->size );
+    m_NumberOfIOCalls += 2;
+    }
+  
+  if ( file.fail() )
+    {
+    itkExceptionMacro(<< "Could not write file: " << m_FileName);
+    }
+#endif
+}
+
+
+bool StreamingImageIOBase::IsConcurrentFileCurrent( void ) const
+{
+  FileIdentity identity;
+  return m_ConcurrentFileDescriptor != -1 &&
+    GetFileIdentity( m_FileName, identity ) &&
+    identity.name == m_ConcurrentFileIdentity.name &&
+    identity.inode == m_ConcurrentFileIdentity.inode;
+}
+
+
+void StreamingImageIOBase::OpenConcurrentFile( void )
+{
+#if defined(IJMRCIO_USE_LOCKED_POSITIONAL_IO)
+  if ( this->IsConcurrentFileCurrent() )
+    {
+    return;
+    }
+  
+  this->CloseConcurrentFile();
+  
+  m_ConcurrentFileDescriptor = open( m_FileName.c_str(), O_RDWR );
+  if ( m_ConcurrentFileDescriptor == -1 )
+    {
+    itkExceptionMacro(<< "Could not open file for writing: " << m_FileName);
+    }
+  GetFileIdentity( m_FileName, m_ConcurrentFileIdentity );
+#endif
+}
+
+
+void StreamingImageIOBase::CloseConcurrentFile( void )
+{
+#if defined(IJMRCIO_USE_LOCKED_POSITIONAL_IO)
+  if ( m_ConcurrentFileDescriptor != -1 )
+    {
+    close( m_ConcurrentFileDescriptor );
+    }
+#endif
+  m_ConcurrentFileDescriptor = -1;
+  m_ConcurrentFileIdentity = FileIdentity();
+}
+
+
+void StreamingImageIOBase::AllocateFile( std::ofstream &file, SizeType size )
+{
+  if ( size == 0 )
+    {
+    return;
+    }
+  
+#if defined(IJMRCIO_USE_FALLOCATE)
+  if ( m_FileAllocationPolicy != SparseAllocation )
+    {
+    // the header may still be buffered in the stream
+    file.flush();
+    
+    int result = -1;
+    const int fd = open( m_FileName.c_str(), O_WRONLY );
+    if ( fd != -1 )
+      {
+#if defined(IJMRCIO_HAVE_POSIX_FALLOCATE)
+      if ( m_FileAllocationPolicy == ContiguousAllocation )
+        {
+        // the error is returned, errno is not set
+        result = posix_fallocate( fd, 0, static_cast<off_t>( size ) );
+        }
+#endif
+#if defined(IJMRCIO_HAVE_FALLOCATE_KEEP_SIZE)
+      if ( m_FileAllocationPolicy == KeepSizeAllocation )
+        {
+        result = fallocate( fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>( size ) );
+        }
+#endif
+      close( fd );
+      }
+    
+    if ( result != 0 )
+      {
+      itkDebugMacro(<< "Unable to preallocate " << m_FileName << ", the blocks are allocated as they are written" );
+      }
+    else if ( m_FileAllocationPolicy == ContiguousAllocation )
+      {
+      // the size of the file has been set too
+      return;
+      }
+    }
+#endif
+
+  if ( m_FileAllocationPolicy == KeepSizeAllocation )
+    {
+    // the file grows as the data is written
+    return;
+    }
+  
+  // write one byte at the end of the file to allocate (this is a
+  // nifty trick which should not write the entire size of the file
+  // just allocate it, if the system supports sparse files)
+  file.seekp( static_cast<std::streampos>( size - 1 ), std::ios::beg );
+  file.write( "\0", 1 );
+  file.seekp( 0 );
+}
+
+
+long StreamingImageIOBase::GetNumberOfFileExtents( void ) const
+{
+#if defined(IJMRCIO_USE_FIEMAP)
+  const int fd = open( m_FileName.c_str(), O_RDONLY );
+  if ( fd == -1 )
+    {
+    return -1;
+    }
+  
+  // when no extents are requested only the number is returned,
+  // delayed allocations are flushed so that they are counted
+  struct fiemap map;
+  memset( &map, 0, sizeof(map) );
+  map.fm_start = 0;
+  map.fm_length = FIEMAP_MAX_OFFSET;
+  map.fm_flags = FIEMAP_FLAG_SYNC;
+  map.fm_extent_count = 0;
+  
+  const int result = ioctl( fd, FS_IOC_FIEMAP, &map );
+  close( fd );
+  
+  return ( result == -1 ) ? -1 : static_cast<long>( map.fm_mapped_extents );
+#else
+  return -1;
+#endif
+}
+
+
+bool StreamingImageIOBase::DirectReadBufferAsBinary( SizeType pos, void *_buffer, SizeType num )
+{
+#if defined(IJMRCIO_USE_DIRECT_IO)
+  const SizeType alignment = m_DirectIOAlignment;
+  if ( num == 0 || ( alignment & ( alignment - 1 ) ) != 0 )
+    {
+    return false;
+    }
+
+  const std::string fileName = this->GetDataFileName();
+  const int fd = open( fileName.c_str(), O_RDONLY | O_DIRECT );
+  if ( fd == -1 )
+    {
+    itkDebugMacro(<< "Unable to open " << fileName << " for direct IO" );
+    return false;
+    }
+
+  char *buffer = static_cast<char *>( _buffer );
+  const unsigned int swapSize = this->GetFileByteSwapSize();
+
+  // the blocks are a multiple of the alignment, so they hold whole
+  // components, and with the unaligned head and tail fit in the
+  // bounce buffer
+  const SizeType blockSize = vnl_math_min( vnl_math_max( m_StagingBufferSize / alignment, SizeType(1) ) * alignment,
+                                           ( ( num + alignment - 1 ) / alignment ) * alignment );
+  AlignedBuffer bounce( static_cast< ::size_t >( blockSize + alignment ), static_cast< ::size_t >( alignment ) );
+  m_PeakStagingMemory = vnl_math_max( m_PeakStagingMemory, blockSize + 2*alignment );
+  
+  itkDebugMacro(<< "Reading " << num << " bytes at " << pos << " with direct IO in blocks of " << blockSize << " bytes");
+
+  SizeType bytesRead = 0;
+  int error = 0;
+  while ( bytesRead < num )
+    {
+    const SizeType size = vnl_math_min( blockSize, num - bytesRead );
+    const SizeType position = pos + bytesRead;
+    const SizeType alignedPosition = position - position % alignment;
+    const SizeType head = position - alignedPosition;
+    const SizeType alignedSize = ( ( head + size + alignment - 1 ) / alignment ) * alignment;
+    char *destination = buffer + bytesRead;
+
+    ssize_t n;
+    if ( head == 0 && alignedSize == size && reinterpret_cast< ::size_t >( destination ) % alignment == 0 )
+      {
+      // the data and the buffer are aligned, so it is read in place
+      n = DirectTransfer( false, fd, destination, static_cast< ::size_t >( size ), 
+                          static_cast<off_t>( position ), m_NumberOfIOCalls );
+      if ( n == static_cast<ssize_t>( size ) && swapSize > 1 )
+        {
+        SIMDByteSwapper::SwapRange( destination, static_cast<size_t>( size / swapSize ), swapSize );
+        }
+      }
+    else
+      {
+      n = DirectTransfer( false, fd, bounce.GetPointer(), static_cast< ::size_t >( alignedSize ), 
+                          static_cast<off_t>( alignedPosition ), m_NumberOfIOCalls );
+      if ( n >= 0 && static_cast<SizeType>( n ) >= head + size )
+        {
+        if ( swapSize > 1 )
+          {
+          SIMDByteSwapper::SwapRangeCopy( bounce.GetPointer() + head, destination, 
+                                          static_cast<size_t>( size / swapSize ), swapSize );
+          }
+        else
+          {
+          memcpy( destination, bounce.GetPointer() + head, static_cast< ::size_t >( size ) );
+          }
+        n = static_cast<ssize_t>( size );
+        }
+      }
+
+    if ( n != static_cast<ssize_t>( size ) )
+      {
+      error = ( n < 0 ) ? errno : 0;
+      break;
+      }
+    bytesRead += size;
+    }
+  close( fd );
+
+  if ( bytesRead == 0 && error == EINVAL )
+    {
+    // the file system does not support direct IO with this alignment
+    itkDebugMacro(<< "Direct IO is not supported for " << m_FileName );
+    return false;
+    }
+
+  if ( bytesRead != num )
+    {
+    itkExceptionMacro("Data not read completely with direct IO. Expected = " << num << ", but only read " << bytesRead << " bytes.");
+    }
+  
+  return true;
+#else
+  (void) pos;
+  (void) _buffer;
+  (void) num;
+  return false;
+#endif
+}
+
+
+bool StreamingImageIOBase::DirectWriteBufferAsBinary( SizeType pos, const void *_buffer, SizeType num )
+{
+#if defined(IJMRCIO_USE_DIRECT_IO)
+  const SizeType alignment = m_DirectIOAlignment;
+  if ( num == 0 || ( alignment & ( alignment - 1 ) ) != 0 )
+    {
+    return false;
+    }
+
+  const int fd = open( m_FileName.c_str(), O_RDWR | O_DIRECT );
+  struct stat fileStatus;
+  if ( fd == -1 || fstat( fd, &fileStatus ) == -1 )
+    {
+    itkDebugMacro(<< "Unable to open " << m_FileName << " for direct IO" );
+    if ( fd != -1 )
+      {
+      close( fd );
+      }
+    return false;
+    }
+
+  // whole aligned blocks are written, the file is truncated to this
+  // length after
+  const SizeType fileLength = vnl_math_max( static_cast<SizeType>( fileStatus.st_size ), pos + num );
+  SizeType writtenLength = 0;
+
+  const char *buffer = static_cast<const char *>( _buffer );
+  const unsigned int swapSize = this->GetFileByteSwapSize();
+
+  const SizeType blockSize = vnl_math_min( vnl_math_max( m_StagingBufferSize / alignment, SizeType(1) ) * alignment,
+                                           ( ( num + alignment - 1 ) / alignment ) * alignment );
+  AlignedBuffer bounce( static_cast< ::size_t >( blockSize + alignment ), static_cast< ::size_t >( alignment ) );
+  m_PeakStagingMemory = vnl_math_max( m_PeakStagingMemory, blockSize + 2*alignment );
+
+  itkDebugMacro(<< "Writing " << num << " bytes at " << pos << " with direct IO in blocks of " << blockSize << " bytes");
+
+  SizeType bytesWritten = 0;
+  int error = 0;
+  while ( bytesWritten < num )
+    {
+    const SizeType size = vnl_math_min( blockSize, num - bytesWritten );
+    const SizeType position = pos + bytesWritten;
+    const SizeType alignedPosition = position - position % alignment;
+    const SizeType head = position - alignedPosition;
+    const SizeType alignedSize = ( ( head + size + alignment - 1 ) / alignment ) * alignment;
+    const char *source = buffer + bytesWritten;
+
+    ssize_t n;
+    if ( head == 0 && alignedSize == size && swapSize <= 1 && 
+         reinterpret_cast< ::size_t >( source ) % alignment == 0 )
+      {
+      n = DirectTransfer( true, fd, const_cast<char *>( source ), static_cast< ::size_t >( size ), 
+                          static_cast<off_t>( position ), m_NumberOfIOCalls );
+      }
+    else
+      {
+      // the bytes of the file around the data in the first and last
+      // aligned blocks are kept, past the end of the file they are zero
+      char *block = bounce.GetPointer();
+      const SizeType lastBlock = alignedSize - alignment;
+      n = 0;
+      if ( head != 0 )
+        {
+        n = DirectTransfer( false, fd, block, static_cast< ::size_t >( alignment ), 
+                            static_cast<off_t>( alignedPosition ), m_NumberOfIOCalls );
+        if ( n >= 0 )
+          {
+          memset( block + n, 0, static_cast< ::size_t >( alignment - n ) );
+          }
+        }
+      if ( n >= 0 && head + size < alignedSize && ( head == 0 || lastBlock != 0 ) )
+        {
+        n = DirectTransfer( false, fd, block + lastBlock, static_cast< ::size_t >( alignment ), 
+                            static_cast<off_t>( alignedPosition + lastBlock ), m_NumberOfIOCalls );
+        if ( n >= 0 )
+          {
+          memset( block + lastBlock + n, 0, static_cast< ::size_t >( alignment - n ) );
+          }
+        }
+
+      if ( n >= 0 )
+        {
+        if ( swapSize > 1 )
+          {
+          SIMDByteSwapper::SwapRangeCopy( source, block + head, static_cast<size_t>( size / swapSize ), swapSize );
+          }
+        else
+          {
+          memcpy( block + head, source, static_cast< ::size_t >( size ) );
+          }
+        
+        n = DirectTransfer( true, fd, block, static_cast< ::size_t >( alignedSize ), 
+                            static_cast<off_t>( alignedPosition ), m_NumberOfIOCalls );
+        n = ( n == static_cast<ssize_t>( alignedSize ) ) ? static_cast<ssize_t>( size ) : -1;
+        }
+      }
+
+    if ( n != static_cast<ssize_t>( size ) )
+      {
+      error = ( n < 0 ) ? errno : 0;
+      break;
+      }
+    bytesWritten += size;
+    writtenLength = vnl_math_max( writtenLength, alignedPosition + alignedSize );
+    }
+
+  if ( bytesWritten == num && writtenLength > fileLength && 
+       ftruncate( fd, static_cast<off_t>( fileLength ) ) == -1 )
+    {
+    bytesWritten = 0;
+    }
+  close( fd );
+
+  if ( bytesWritten == 0 && error == EINVAL )
+    {
+    // the file system does not support direct IO with this alignment
+    itkDebugMacro(<< "Direct IO is not supported for " << m_FileName );
+    return false;
+    }
+
+  if ( bytesWritten != num )
+    {
+    itkExceptionMacro(<< "Could not write file with direct IO: " << m_FileName);
+    }
+  
+  return true;
+#else
+  (void) pos;
+  (void) _buffer;
+  (void) num;
+  return false;
+#endif
+}
+
+
+void StreamingImageIOBase::StagedStreamWriteChunks( std::ostream& file, const char *buffer, 
+                                                    const IORegionChunkSequence &chunks,
+                                                    unsigned int swapSize )
+{
+  // one staging buffer of whole components is reused for all the
+  // chunks, it is no larger then the largest chunk
+  const SizeType stagingSize = vnl_math_min( vnl_math_max( m_StagingBufferSize / swapSize, SizeType(1) ) * swapSize, 
+                                             chunks.GetLargestChunkSize() );
+  if ( stagingSize <= 0 )
+    {
+    return;
+    }
+  
+  std::vector<char> staging( static_cast< ::size_t >( stagingSize ) );
+  m_PeakStagingMemory = vnl_math_max( m_PeakStagingMemory, stagingSize );
+
+  for ( IORegionChunkIterator chunk = chunks.Begin(); !chunk.IsAtEnd(); ++chunk )
+    {
+    itkDebugMacro(<< "Writing " << chunk->size << " swapped bytes for " << m_FileName << " at " << chunk->filePosition << " position in file");
+
+    file.seekp( chunk->filePosition, std::ios::beg );
+    ++m_NumberOfIOCalls;
+
+    for ( SizeType offset = 0; offset < chunk->size; offset += stagingSize )
+      {
+      const SizeType size = vnl_math_min( stagingSize, chunk->size - offset );
+      SIMDByteSwapper::SwapRangeCopy( buffer + chunk->bufferOffset + offset, &staging[0], 
+                                      static_cast<size_t>( size / swapSize ), swapSize );
+      this->WriteBufferAsBinary( file, &staging[0], size );
+      ++m_NumberOfIOCalls;
+      }
+
+    if ( file.fail() )
+      {
+      itkExceptionMacro(<<"Fail writing");
+      }
+    }
+}
+
+
+bool StreamingImageIOBase::CanUsePositionalVectoredIO( void ) const
+{
+#if defined(IJMRCIO_USE_VECTORED_IO)
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+bool StreamingImageIOBase
+::AsynchronousReadChunks( char *buffer, const IORegionChunkSequence &chunks, SizeType &bytesRead )
+{
+  return this->AsynchronousTransferChunks( false, buffer, chunks, bytesRead );
+}
+
+
+bool StreamingImageIOBase
+::AsynchronousWriteChunks( const char *buffer, const IORegionChunkSequence &chunks )
+{
+  SizeType bytesWritten = 0;
+  if ( !this->AsynchronousTransferChunks( true, const_cast<char *>( buffer ), chunks, bytesWritten ) )
+    {
+    return false;
+    }
+
+  if ( bytesWritten != chunks.GetSizeOfRegion() )
+    {
+    itkExceptionMacro(<<"Fail writing");
+    }
+  return true;
+}
+
+
+bool StreamingImageIOBase
+::AsynchronousTransferChunks( bool write, char *buffer, 
+                              const IORegionChunkSequence &chunks, 
+                              SizeType &bytesTransferred )
+{
+  bytesTransferred = 0;
+
+#if defined(IJMRCIO_USE_IO_URING)
+  if ( chunks.GetNumberOfChunks() == 0 )
+    {
+    return true;
+    }
+
+  IOURingQueue ring;
+  if ( !ring.Initialize( vnl_math_min( m_AsynchronousIOQueueDepth, 
+                                       static_cast<unsigned int>( vnl_math_min( chunks.GetNumberOfChunks(), SizeType(4096) ) ) ) ) )
+    {
+    itkDebugMacro(<< "io_uring is not available, falling back to synchronous IO");
+    return false;
+    }
+
+  const std::string fileName = write ? m_FileName : this->GetDataFileName();
+  FileDescriptorGuard fd( open( fileName.c_str(), write ? O_RDWR : O_RDONLY ) );
+  if ( fd.Get() == -1 )
+    {
+    itkExceptionMacro(<< "Could not open file for " << ( write ? "writing" : "reading" ) << ": " << fileName);
+    }
+
+  itkDebugMacro(<< "Queuing " << chunks.GetNumberOfChunks() << " chunks with a depth of " << ring.GetNumberOfEntries() << " for " << fileName );
+
+  // each entry of the queue is a slot, which holds a chunk and the
+  // remaining part of it, a partial transfer is queued again for the
+  // remainder
+  const unsigned int numberOfSlots = ring.GetNumberOfEntries();
+  std::vector<IORegionChunk> slotChunks( numberOfSlots );
+  std::vector<struct iovec> remaining( numberOfSlots );
+  std::vector<SizeType> positions( numberOfSlots );
+  std::vector< ::size_t > freeSlots;
+  std::vector< ::size_t > requeued;
+  freeSlots.reserve( numberOfSlots );
+  requeued.reserve( numberOfSlots );
+  for ( unsigned int i = numberOfSlots; i > 0; --i )
+    {
+    freeSlots.push_back( i - 1 );
+    }
+  const unsigned int swapSize = this->GetFileByteSwapSize();
+
+  IORegionChunkIterator chunk = chunks.Begin();
+  unsigned int inFlight = 0;
+  bool failed = false;
+  while ( inFlight > 0 || ( !failed && ( !chunk.IsAtEnd() || !requeued.empty() ) ) )
+    {
+    // keep the queue full
+    while ( !failed && inFlight < numberOfSlots && ( !chunk.IsAtEnd() || !requeued.empty() ) )
+      {
+      ::size_t i;
+      if ( !requeued.empty() )
+        {
+        i = requeued.back();
+        requeued.pop_back();
+        }
+      else
+        {
+        i = freeSlots.back();
+        freeSlots.pop_back();
+        slotChunks[i] = *chunk;
+        remaining[i].iov_base = buffer + chunk->bufferOffset;
+        remaining[i].iov_len = static_cast< ::size_t >( chunk->size );
+        positions[i] = chunk->filePosition;
+        ++chunk;
+        }
+      ring.Queue( write, fd.Get(), &remaining[i], positions[i], i );
+      ++inFlight;
+      }
+
+    if ( !ring.Enter( 1 ) )
+      {
+      // the operations in flight can not be waited for
+      itkExceptionMacro(<< "io_uring failed for " << m_FileName << ": " << strerror( errno ) );
+      }
+    ++m_NumberOfIOCalls;
+
+    unsigned long i;
+    int result;
+    while ( ring.PopCompletion( i, result ) )
+      {
+      --inFlight;
+      if ( result == -EINTR || result == -EAGAIN )
+        {
+        requeued.push_back( i );
+        }
+      else if ( result <= 0 )
+        {
+        // an error or the end of the file
+        failed = true;
+        freeSlots.push_back( i );
+        }
+      else
+        {
+        bytesTransferred += result;
+        positions[i] += result;
+        remaining[i].iov_base = static_cast<char *>( remaining[i].iov_base ) + result;
+        remaining[i].iov_len -= result;
+        if ( remaining[i].iov_len > 0 )
+          {
+          requeued.push_back( i );
+          continue;
+          }
+        if ( !write && swapSize > 1 )
+          {
+          // swap the chunk while it is still in the cache
+          SIMDByteSwapper::SwapRange( buffer + slotChunks[i].bufferOffset, 
+                                      static_cast<size_t>( slotChunks[i].size / swapSize ), swapSize );
+          }
+        freeSlots.push_back( i );
+        }
+      }
+    }
+
+  return true;
+#else
+  (void) write;
+  (void) buffer;
+  (void) chunks;
+  itkDebugMacro(<< "io_uring is not supported on this platform, falling back to synchronous IO");
+  return false;
+#endif
+}
+
+
+StreamingImageIOBase::SizeType StreamingImageIOBase
+::PositionalReadChunks( int fd, char *buffer, IORegionChunkIterator chunk,
+                        unsigned int maxVectors, SizeType maxGap,
+                        unsigned int swapSize, unsigned long &numberOfCalls )
+{
+#if defined(IJMRCIO_USE_VECTORED_IO)
+  // the bytes between chunks are read into this buffer and discarded
+  std::vector<char> gapBuffer( maxGap > 0 ? maxGap : 1 );
+  std::vector<struct iovec> iov;
+  iov.reserve( maxVectors );
+
+  SizeType bytesRead = 0;
+  while ( !chunk.IsAtEnd() )
+    {
+    iov.clear();
+    
+    // gather chunks which are separated by small gaps into one call
+    const IORegionChunkIterator batchBegin = chunk;
+    const SizeType batchPosition = chunk->filePosition;
+    SizeType batchEnd = batchPosition;
+    SizeType batchChunkBytes = 0;
+    while ( !chunk.IsAtEnd() && ( iov.empty() || iov.size() + 2 <= maxVectors ) )
+      {
+      const SizeType gap = chunk->filePosition - batchEnd;
+      if ( !iov.empty() )
+        {
+        if ( gap < 0 || gap > maxGap )
+          {
+          break;
+          }
+        if ( gap > 0 )
+          {
+          struct iovec v;
+          v.iov_base = &gapBuffer[0];
+          v.iov_len = static_cast< ::size_t >( gap );
+          iov.push_back( v );
+          }
+        }
+      
+      struct iovec v;
+      v.iov_base = buffer + chunk->bufferOffset;
+      v.iov_len = static_cast< ::size_t >( chunk->size );
+      iov.push_back( v );
+      
+      batchEnd = chunk->filePosition + chunk->size;
+      batchChunkBytes += chunk->size;
+      ++chunk;
+      }
+
+    if ( CompletePositionalVectoredIO( false, fd, &iov[0], iov.size(), batchPosition, numberOfCalls ) 
+         != batchEnd - batchPosition )
+      {
+      break;
+      }
+    bytesRead += batchChunkBytes;
+
+    // swap the batch while it is still in the cache
+    for ( IORegionChunkIterator c = batchBegin; swapSize > 1 && c != chunk; ++c )
+      {
+      SIMDByteSwapper::SwapRange( buffer + c->bufferOffset, static_cast<size_t>( c->size / swapSize ), swapSize );
+      }
+    }
+
+  return bytesRead;
+#else
+  (void) fd;
+  (void) buffer;
+  (void) chunk;
+  (void) maxVectors;
+  (void) maxGap;
+  (void) swapSize;
+  (void) numberOfCalls;
+  return 0;
+#endif
+}
+
+
+StreamingImageIOBase::SizeType StreamingImageIOBase
+::VectoredReadChunks( char *buffer, const IORegionChunkSequence &chunks )
+{
+#if defined(IJMRCIO_USE_VECTORED_IO)
+  const std::string fileName = this->GetDataFileName();
+  FileDescriptorGuard fd( open( fileName.c_str(), O_RDONLY ) );
+  if ( fd.Get() == -1 )
+    {
+    itkExceptionMacro(<< "Could not open file for reading: " << fileName);
+    }
+
+  itkDebugMacro(<< "Reading " << chunks.GetNumberOfChunks() << " chunks with vectors of " << m_VectoredIOBatchSize << " for " << fileName );
+
+  return PositionalReadChunks( fd.Get(), buffer, chunks.Begin(), 
+                               m_VectoredIOBatchSize, m_VectoredIOMaximumGapSize, 
+                               this->GetFileByteSwapSize(), m_NumberOfIOCalls );
+#else
+  (void) buffer;
+  (void) chunks;
+  itkExceptionMacro(<< "Positional vectored IO is not supported on this platform");
+#endif
+}
+
+
+// the data passed to each thread of ThreadedReadChunks
+struct StreamingImageIOBase::ThreadedReadStruct
+{
+  int                                  FileDescriptor;
+  char                                *Buffer;
+  const IORegionChunkSequence         *Chunks;
+  unsigned int                         NumberOfSlices;
+  SizeType                             BytesPerSlice;
+  SizeType                             SizeOfRegion;
+  unsigned int                         MaxVectors;
+  SizeType                             MaxGap;
+  unsigned int                         SwapSize;
+  std::vector<SizeType>                BytesRead;
+  std::vector<unsigned long>           NumberOfCalls;
+};
+
+
+ITK_THREAD_RETURN_TYPE StreamingImageIOBase::ThreadedReadCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  ThreadedReadStruct *str = static_cast<ThreadedReadStruct *>( info->UserData );
+
+  // each slice of the buffer is read by only one thread, the chunks
+  // are cut at its ends
+  for ( unsigned int i = info->ThreadID; i < str->NumberOfSlices; i += info->NumberOfThreads )
     {
-    itkExceptionMacro("Data not read completely. Expected = " << sizeOfRegion << ", but only read " <<  gcount <<  " bytes.");
+    const SizeType sliceBegin = i * str->BytesPerSlice;
+    const SizeType sliceEnd = vnl_math_min( sliceBegin + str->BytesPerSlice, str->SizeOfRegion );
+    str->BytesRead[i] = PositionalReadChunks( str->FileDescriptor, str->Buffer, 
+                                              str->Chunks->Begin( sliceBegin, sliceEnd ),
+                                              str->MaxVectors, str->MaxGap, str->SwapSize,
+                                              str->NumberOfCalls[i] );
     }
-  
-  return true;
+
+  return ITK_THREAD_RETURN_VALUE;
 }
 
-bool StreamingImageIOBase::ReadBufferAsBinary( std::istream& is, void *buffer, StreamingImageIOBase::SizeType num ) 
+
+StreamingImageIOBase::SizeType StreamingImageIOBase
+::ThreadedReadChunks( char *buffer, const IORegionChunkSequence &chunks )
 {
+#if defined(IJMRCIO_USE_VECTORED_IO)
+  if ( chunks.GetNumberOfChunks() == 0 )
+    {
+    return 0;
+    }
+
+  const SizeType sizeOfRegion = chunks.GetSizeOfRegion();
   
-  // some systems have a limit of 2GB to be read at once
-  const SizeType maxChunk = 1024*1024*1024;
-  
-  std::streamsize bytesRemaining = static_cast<std::streamsize>( num );
+  MultiThreader::Pointer threader = MultiThreader::New();
+  SizeType numberOfSlices = vnl_math_min( static_cast<SizeType>( m_NumberOfIOThreads ), 
+                                          sizeOfRegion / vnl_math_max( m_MinimumBytesPerIOThread, SizeType(1) ) );
+  threader->SetNumberOfThreads( static_cast<int>( vnl_math_max( numberOfSlices, SizeType(1) ) ) );
+  numberOfSlices = threader->GetNumberOfThreads();
   
-  while (bytesRemaining) 
+  const std::string fileName = this->GetDataFileName();
+  FileDescriptorGuard fd( open( fileName.c_str(), O_RDONLY ) );
+  if ( fd.Get() == -1 )
     {
-    
-    std::streamsize bytesToRead = bytesRemaining > maxChunk ? maxChunk : bytesRemaining;
-    
-    itkDebugMacro(<< "Reading " << bytesToRead << " of " << bytesRemaining << " bytes for " << m_FileName);
-    
-    is.read( static_cast<char *>( buffer ) ,  bytesToRead );
-    
-    if ( (is.gcount() != bytesToRead) || is.fail() )
-      {
-      return false;
-      }
-    buffer =  static_cast<char *>( buffer ) + bytesToRead;
-    bytesRemaining -= bytesToRead;
+    itkExceptionMacro(<< "Could not open file for reading: " << fileName);
     }
-  
-  return true;
-}  
 
+  // divide the buffer into continuous slices of equal size, whose
+  // boundaries are on pixels
+  const SizeType pixelSize = this->GetPixelSize();
+  const SizeType bytesPerSlice = ( ( sizeOfRegion + numberOfSlices - 1 ) / numberOfSlices + pixelSize - 1 ) 
+    / pixelSize * pixelSize;
 
-bool StreamingImageIOBase::WriteBufferAsBinary( std::ostream& os, const void *buffer, StreamingImageIOBase::SizeType num ) 
-{
-  // some systems have a limit of 2GB to be written at once  
-  const SizeType maxChunk = 1024*1024*1024;
+  ThreadedReadStruct str;
+  str.FileDescriptor = fd.Get();
+  str.Buffer = buffer;
+  str.Chunks = &chunks;
+  str.NumberOfSlices = static_cast<unsigned int>( numberOfSlices );
+  str.BytesPerSlice = bytesPerSlice;
+  str.SizeOfRegion = sizeOfRegion;
+  str.MaxVectors = m_UsePositionalVectoredIO ? m_VectoredIOBatchSize : 1;
+  str.MaxGap = m_UsePositionalVectoredIO ? m_VectoredIOMaximumGapSize : 0;
+  str.SwapSize = this->GetFileByteSwapSize();
+  str.BytesRead.resize( numberOfSlices, 0 );
+  str.NumberOfCalls.resize( numberOfSlices, 0 );
 
-  std::streamsize bytesRemaining = num;
-  while (bytesRemaining) 
+  itkDebugMacro(<< "Reading " << sizeOfRegion << " bytes with " << numberOfSlices << " threads for " << m_FileName );
+
+  threader->SetSingleMethod( ThreadedReadCallback, &str );
+  threader->SingleMethodExecute();
+
+  SizeType bytesRead = 0;
+  for ( unsigned int i = 0; i < numberOfSlices; ++i )
     {
-    
-    SizeType bytesToWrite = bytesRemaining > maxChunk ? maxChunk : bytesRemaining;
-    
-    itkDebugMacro(<< "Writing " << bytesToWrite << " of " << bytesRemaining << " bytes for " << m_FileName);
-    
-    os.write(static_cast<const char*>(buffer) , bytesToWrite);
-    if ( os.fail() )
-      {
-      return false;
-      }
-    
-    buffer =  static_cast<const char *>( buffer ) + bytesToWrite;
-    bytesRemaining -= bytesToWrite;
+    bytesRead += str.BytesRead[i];
+    m_NumberOfIOCalls += str.NumberOfCalls[i];
     }
- 
-  return true;
+  
+  return bytesRead;
+#else
+  (void) buffer;
+  (void) chunks;
+  itkExceptionMacro(<< "Positional IO is not supported on this platform");
+#endif
 }
 
 
-bool StreamingImageIOBase::StreamWriteBufferAsBinary(std::ostream& file, const void *_buffer)
+void StreamingImageIOBase
+::VectoredWriteChunks( const char *buffer, const IORegionChunkSequence &chunks )
 {
-  itkDebugMacro( << "StreamingWriteBufferAsBinary called" );
-
-  const char *buffer = static_cast< const char* >( _buffer );
-  // Offset into file
-  std::streampos dataPos = this->GetDataPosition();
-  
-  // compute the number of continuous bytes to be written
-  std::streamsize sizeOfChunk = 1;
-  unsigned int movingDirection = 0;
-  do 
+#if defined(IJMRCIO_USE_VECTORED_IO)
+  FileDescriptorGuard fd( open( m_FileName.c_str(), O_RDWR ) );
+  if ( fd.Get() == -1 )
     {
-    sizeOfChunk *= m_IORegion.GetSize(movingDirection);
-    ++movingDirection;
-    } 
-  while ( movingDirection < m_IORegion.GetImageDimension() &&
-          m_IORegion.GetSize(movingDirection-1) == this->GetDimensions(movingDirection-1) );
-  sizeOfChunk *= this->GetPixelSize();
+    itkExceptionMacro(<< "Could not open file for writing: " << m_FileName);
+    }
+
+  const SizeType maxGap = m_VectoredIOMaximumGapSize;
 
+  // The bytes between chunks must be rewritten with their current
+  // contents. They are read into gapBuffer, while the chunks are read
+  // into discardBuffer, so the size of the chunks in a batch with
+  // gaps is limited to the maximum gap size.
+  std::vector<char> discardBuffer( maxGap > 0 ? maxGap : 1 );
+  std::vector<char> gapBuffer;
+  std::vector<struct iovec> readIOV;
+  std::vector<struct iovec> writeIOV;
+  readIOV.reserve( m_VectoredIOBatchSize );
+  writeIOV.reserve( m_VectoredIOBatchSize );
 
-  ImageIORegion::IndexType currentIndex = m_IORegion.GetIndex();
-  while ( m_IORegion.IsInside(currentIndex) )
+  IORegionChunkIterator chunk = chunks.Begin();
+  while ( !chunk.IsAtEnd() )
     {
-    // calculate the position to seek to in the file
-    std::streampos seekPos = 0;
-    size_t subDimensionQuantity = 1;
-    for ( unsigned int i = 0; i < m_IORegion.GetImageDimension(); ++i )
+    // find the chunks of this batch
+    const IORegionChunkIterator batchBegin = chunk;
+    const SizeType batchPosition = chunk->filePosition;
+    SizeType batchEnd = chunk->filePosition + chunk->size;
+    SizeType maxChunkSize = chunk->size;
+    SizeType totalGap = 0;
+    unsigned int numberOfVectors = 1;
+    ++chunk;
+    while ( !chunk.IsAtEnd() && numberOfVectors + 2 <= m_VectoredIOBatchSize )
       {
-      seekPos += subDimensionQuantity*this->GetPixelSize()*currentIndex[i];
-      subDimensionQuantity *= this->GetDimensions(i);
+      const SizeType gap = chunk->filePosition - batchEnd;
+      const SizeType chunkSize = vnl_math_max( maxChunkSize, chunk->size );
+      if ( gap < 0 || gap > maxGap || 
+           ( totalGap + gap > 0 && chunkSize > maxGap ) )
+        {
+        break;
+        }
+      
+      numberOfVectors += ( gap > 0 ) ? 2 : 1;
+      totalGap += gap;
+      maxChunkSize = chunkSize;
+      batchEnd = chunk->filePosition + chunk->size;
+      ++chunk;
       }
+    const IORegionChunkIterator batchEndChunk = chunk;
 
-    file.seekp( dataPos+seekPos, std::ios::beg );
-    this->WriteBufferAsBinary( file, buffer, sizeOfChunk );
-
-    // increment the buffer pointer
-    buffer += sizeOfChunk;
-    
+    // bytes past the end of the file are written as zeros
+    gapBuffer.assign( totalGap > 0 ? totalGap : 1, 0 );
+    readIOV.clear();
+    writeIOV.clear();
     
-    itkDebugMacro(<< "Writing " << sizeOfChunk << " of " <<  " ?? bytes for " << m_FileName << " at " << dataPos+seekPos << " position in file");
+    SizeType gapOffset = 0;
+    SizeType previousEnd = batchPosition;
+    for ( IORegionChunkIterator c = batchBegin; c != batchEndChunk; ++c )
+      {
+      const SizeType gap = c->filePosition - previousEnd;
+      if ( gap > 0 )
+        {
+        struct iovec v;
+        v.iov_base = &gapBuffer[gapOffset];
+        v.iov_len = static_cast< ::size_t >( gap );
+        readIOV.push_back( v );
+        writeIOV.push_back( v );
+        gapOffset += gap;
+        }
+      
+      struct iovec v;
+      v.iov_base = &discardBuffer[0];
+      v.iov_len = static_cast< ::size_t >( c->size );
+      readIOV.push_back( v );
 
+      v.iov_base = const_cast<char *>( buffer + c->bufferOffset );
+      writeIOV.push_back( v );
 
-    if ( file.fail() )
+      previousEnd = c->filePosition + c->size;
+      }
+
+    if ( totalGap > 0 )
       {
-      itkExceptionMacro(<<"Fail writing");
+      CompletePositionalVectoredIO( false, fd.Get(), &readIOV[0], readIOV.size(), batchPosition, m_NumberOfIOCalls );
       }
 
-    if (movingDirection == m_IORegion.GetImageDimension())
-      break;
+    itkDebugMacro(<< "Writing " << batchEnd - batchPosition - totalGap << " bytes in " << writeIOV.size() << " vectors for " << m_FileName << " at " << batchPosition << " position in file");
     
-    // increment index to next chunk
-    ++currentIndex[movingDirection];
-    for (unsigned int i = movingDirection; i < m_IORegion.GetImageDimension()-1; ++i) 
+    if ( CompletePositionalVectoredIO( true, fd.Get(), &writeIOV[0], writeIOV.size(), batchPosition, m_NumberOfIOCalls ) 
+         != batchEnd - batchPosition )
       {
-      // when reaching the end of the movingDirection dimension carry to
-      // higher dimensions
-      if ( static_cast<ImageIORegion::SizeValueType>(currentIndex[i] - m_IORegion.GetIndex(i)) 
-           >=  m_IORegion.GetSize(i) )
-        {
-        currentIndex[i] = m_IORegion.GetIndex(i);
-        ++currentIndex[i+1];
-        }
+      itkExceptionMacro(<<"Fail writing");
       }
     }
-
-  
-  return true;
+#else
+  (void) buffer;
+  (void) chunks;
+  itkExceptionMacro(<< "Positional vectored IO is not supported on this platform");
+#endif
 }
 
 
@@ -301,6 +2562,285 @@ void StreamingImageIOBase::OpenFileForWriting(std::ofstream& os, const char* fil
 
 }
 
+bool StreamingImageIOBase::FileIdentity::operator==( const FileIdentity &other ) const
+{
+  return name == other.name &&
+    length == other.length &&
+    modifiedTime == other.modifiedTime &&
+    modifiedTimeNanoseconds == other.modifiedTimeNanoseconds &&
+    inode == other.inode;
+}
+
+
+bool StreamingImageIOBase::GetFileIdentity( const std::string &filename, FileIdentity &identity )
+{
+  struct stat fileStat;
+  if ( stat( filename.c_str(), &fileStat ) != 0 )
+    {
+    return false;
+    }
+  identity.name = filename;
+  identity.length = static_cast<SizeType>( fileStat.st_size );
+  identity.modifiedTime = static_cast<long>( fileStat.st_mtime );
+#if defined(IJMRCIO_HAVE_STAT_MTIM)
+  identity.modifiedTimeNanoseconds = static_cast<long>( fileStat.st_mtim.tv_nsec );
+#else
+  identity.modifiedTimeNanoseconds = 0;
+#endif
+  identity.inode = static_cast<unsigned long>( fileStat.st_ino );
+  return true;
+}
+
+
+std::ifstream &StreamingImageIOBase::OpenCachedFileForReading( std::ifstream &file )
+{
+  const std::string fileName = this->GetDataFileName();
+  if ( !m_UseFileCache )
+    {
+    this->OpenFileForReading( file, fileName.c_str() );
+    return file;
+    }
+
+  // the open stream is still valid if the file has not been replaced
+  FileIdentity identity;
+  if ( m_CachedReadFile.is_open() && 
+       GetFileIdentity( fileName, identity ) && 
+       identity.name == m_CachedReadFileIdentity.name &&
+       identity.inode == m_CachedReadFileIdentity.inode )
+    {
+    // a previous read may have left the stream at the end of the file
+    m_CachedReadFile.clear();
+    return m_CachedReadFile;
+    }
+
+  this->OpenFileForReading( m_CachedReadFile, fileName.c_str() );
+  GetFileIdentity( fileName, m_CachedReadFileIdentity );
+  return m_CachedReadFile;
+}
+
+
+std::ofstream &StreamingImageIOBase::OpenCachedFileForWriting( std::ofstream &file )
+{
+  if ( !m_UseFileCache )
+    {
+    this->OpenFileForWriting( file, m_FileName.c_str(), false );
+    return file;
+    }
+
+  FileIdentity identity;
+  if ( m_CachedWriteFile.is_open() && 
+       GetFileIdentity( m_FileName, identity ) && 
+       identity.name == m_CachedWriteFileIdentity.name &&
+       identity.inode == m_CachedWriteFileIdentity.inode )
+    {
+    m_CachedWriteFile.clear();
+    return m_CachedWriteFile;
+    }
+
+  this->OpenFileForWriting( m_CachedWriteFile, m_FileName.c_str(), false );
+  GetFileIdentity( m_FileName, m_CachedWriteFileIdentity );
+  return m_CachedWriteFile;
+}
+
+
+void StreamingImageIOBase::CloseCachedFiles( void )
+{
+  if ( m_CachedReadFile.is_open() )
+    {
+    m_CachedReadFile.close();
+    }
+  if ( m_CachedWriteFile.is_open() )
+    {
+    m_CachedWriteFile.close();
+    }
+  m_CachedReadFileIdentity = FileIdentity();
+  m_CachedWriteFileIdentity = FileIdentity();
+  m_HeaderCacheIdentity = FileIdentity();
+  this->CloseConcurrentFile();
+}
+
+
+bool StreamingImageIOBase::IsHeaderCacheValid( void ) const
+{
+  FileIdentity identity;
+  return m_UseFileCache &&
+    !m_HeaderCacheIdentity.name.empty() &&
+    GetFileIdentity( m_FileName, identity ) &&
+    identity == m_HeaderCacheIdentity;
+}
+
+
+void StreamingImageIOBase::UpdateHeaderCache( void )
+{
+  this->UpdateHeaderCache( m_FileName );
+}
+
+
+void StreamingImageIOBase::UpdateHeaderCache( const std::string &fileName )
+{
+  if ( !m_UseFileCache || !GetFileIdentity( fileName, m_HeaderCacheIdentity ) )
+    {
+    m_HeaderCacheIdentity = FileIdentity();
+    }
+}
+
+
+bool StreamingImageIOBase::MapFileForReading( void )
+{
+#if defined(IJMRCIO_USE_MMAP)
+  const std::string fileName = this->GetDataFileName();
+  FileIdentity identity;
+  if ( fileName.empty() || !GetFileIdentity( fileName, identity ) )
+    {
+    this->UnmapFile();
+    return false;
+    }
+  
+  // reuse the current mapping if the file has not changed
+  if ( m_MappedFileData != 0 && m_MappedFileIdentity == identity )
+    {
+    return true;
+    }
+  
+  this->UnmapFile();
+
+  // the whole file must fit into the address space
+  const ::size_t length = static_cast< ::size_t >( identity.length );
+  if ( identity.length <= 0 || static_cast<SizeType>( length ) != identity.length )
+    {
+    return false;
+    }
+  
+  int fd = open( fileName.c_str(), O_RDONLY );
+  if ( fd == -1 )
+    {
+    return false;
+    }
+
+  itkDebugMacro(<< "Mapping " << length << " bytes of file " << fileName );
+  
+  void *data = mmap( 0, length, PROT_READ, MAP_SHARED, fd, 0 );
+
+  // the mapping remains valid after the descriptor is closed
+  close( fd );
+  
+  if ( data == MAP_FAILED )
+    {
+    itkDebugMacro(<< "Unable to map file " << fileName << ": " << strerror( errno ) );
+    return false;
+    }
+
+  m_MappedFileData = data;
+  m_MappedFileLength = static_cast<SizeType>( length );
+  m_MappedFileIdentity = identity;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void StreamingImageIOBase::UnmapFile( void )
+{
+#if defined(IJMRCIO_USE_MMAP)
+  if ( m_MappedFileData != 0 )
+    {
+    munmap( m_MappedFileData, static_cast< ::size_t >( m_MappedFileLength ) );
+    }
+#endif
+  m_MappedFileData = 0;
+  m_MappedFileLength = 0;
+  m_MappedFileIdentity = FileIdentity();
+}
+
+bool StreamingImageIOBase::ReadMappedBufferAsBinary( SizeType pos, void *buffer, SizeType num ) const
+{
+  if ( m_MappedFileData == 0 || 
+       pos < 0 || num < 0 ||
+       pos + num > m_MappedFileLength )
+    {
+    return false;
+    }
+
+  itkDebugMacro(<< "Copying " << num << " bytes from mapping of " << m_FileName << " at " << pos );
+  
+  memcpy( buffer, static_cast<const char *>( m_MappedFileData ) + pos, static_cast< ::size_t >( num ) );
+  return true;
+}
+
+bool StreamingImageIOBase::ReadAndSwapMappedBufferAsBinary( SizeType pos, void *buffer, SizeType num ) const
+{
+  const unsigned int swapSize = this->GetFileByteSwapSize();
+  if ( swapSize <= 1 )
+    {
+    return this->ReadMappedBufferAsBinary( pos, buffer, num );
+    }
+
+  if ( m_MappedFileData == 0 || 
+       pos < 0 || num < 0 ||
+       pos + num > m_MappedFileLength )
+    {
+    return false;
+    }
+
+  // the bytes are swapped while they are copied from the mapping
+  SIMDByteSwapper::SwapRangeCopy( static_cast<const char *>( m_MappedFileData ) + pos, buffer, 
+                                  static_cast<size_t>( num / swapSize ), swapSize );
+  return true;
+}
+
+unsigned int StreamingImageIOBase::GetFileByteSwapSize( void ) const
+{
+  const ByteOrder fileByteOrder = this->GetFileByteOrder();
+  if ( fileByteOrder != BigEndian && fileByteOrder != LittleEndian )
+    {
+    return 0;
+    }
+  
+  const bool systemIsBigEndian = ByteSwapper<uint16_t>::SystemIsBigEndian();
+  if ( ( fileByteOrder == BigEndian ) == systemIsBigEndian )
+    {
+    return 0;
+    }
+
+  const unsigned int size = this->GetComponentSize();
+  return ( size > 1 ) ? size : 0;
+}
+
+void StreamingImageIOBase::SwapFileBytes( void *buffer, SizeType num ) const
+{
+  const unsigned int swapSize = this->GetFileByteSwapSize();
+  if ( swapSize > 1 )
+    {
+    SIMDByteSwapper::SwapRange( buffer, static_cast<size_t>( num / swapSize ), swapSize );
+    }
+}
+
+bool StreamingImageIOBase::ReadAndSwapBufferAsBinary( std::istream& is, void *buffer, SizeType num )
+{
+  const unsigned int swapSize = this->GetFileByteSwapSize();
+  if ( swapSize <= 1 )
+    {
+    return this->ReadBufferAsBinary( is, buffer, num );
+    }
+
+  // read a block at a time so that the bytes are swapped while they
+  // are still in the cache
+  const SizeType blockSize = 256*1024;
+  char *p = static_cast<char *>( buffer );
+  while ( num > 0 )
+    {
+    const SizeType bytesToRead = vnl_math_min( num, blockSize );
+    if ( !this->ReadBufferAsBinary( is, p, bytesToRead ) )
+      {
+      return false;
+      }
+    this->SwapFileBytes( p, bytesToRead );
+    p += bytesToRead;
+    num -= bytesToRead;
+    }
+  return true;
+}
+
 bool StreamingImageIOBase::CanStreamRead( void )
 {
   return true;
@@ -317,6 +2857,14 @@ StreamingImageIOBase::GetActualNumberOfSplitsForWriting(unsigned int numberOfReq
                                                const ImageIORegion &pasteRegion,
                                                const ImageIORegion &largestPossibleRegion) 
 {
+  // the memory limit may turn a single write into a streamed one,
+  // which must not reuse the header of an existing file
+  if ( m_WritingMemoryLimit > 0 )
+    {
+    numberOfRequestedSplits = vnl_math_max( numberOfRequestedSplits, 
+                                            this->ComputeNumberOfSplitsForMemoryLimit( pasteRegion ) );
+    }
+
   if (!itksys::SystemTools::FileExists( m_FileName.c_str() )) 
     {
     // file doesn't exits so we don't have potential problems
@@ -415,6 +2963,43 @@ StreamingImageIOBase::GetActualNumberOfSplitsForWriting(unsigned int numberOfReq
 }
 
 
+unsigned int StreamingImageIOBase::ComputeNumberOfSplitsForMemoryLimit( const ImageIORegion &pasteRegion ) const
+{
+  if ( m_WritingMemoryLimit == 0 || pasteRegion.GetImageDimension() == 0 )
+    {
+    return 1;
+    }
+
+  // the region is split on the outermost dimension which is not one
+  unsigned int splitAxis = pasteRegion.GetImageDimension() - 1;
+  while ( splitAxis > 0 && pasteRegion.GetSize( splitAxis ) == 1 )
+    {
+    --splitAxis;
+    }
+  
+  SizeType sectionSize = this->GetPixelSize();
+  for ( unsigned int i = 0; i < splitAxis; ++i )
+    {
+    sectionSize *= pasteRegion.GetSize( i );
+    }
+  
+  const SizeType numberOfSections = pasteRegion.GetSize( splitAxis );
+  const SizeType sectionsPerSplit = vnl_math_max( m_WritingMemoryLimit / vnl_math_max( sectionSize, SizeType(1) ), 
+                                                  SizeType(1) );
+  if ( sectionSize > m_WritingMemoryLimit )
+    {
+    itkWarningMacro(<< "A section of " << sectionSize << " bytes is larger than the WritingMemoryLimit of " 
+                    << m_WritingMemoryLimit << " bytes");
+    }
+
+  const SizeType numberOfSplits = ( numberOfSections + sectionsPerSplit - 1 ) / sectionsPerSplit;
+  itkDebugMacro(<< "Splitting " << numberOfSections << " sections of " << sectionSize << " bytes into " 
+                << numberOfSplits << " splits for a memory limit of " << m_WritingMemoryLimit << " bytes");
+
+  return static_cast<unsigned int>( numberOfSplits );
+}
+
+
 ImageIORegion StreamingImageIOBase::GenerateStreamableReadRegionFromRequestedRegion( const ImageIORegion & requestedRegion ) const
 {
   // This implementation returns the requestedRegion if
@@ -432,10 +3017,61 @@ ImageIORegion StreamingImageIOBase::GenerateStreamableReadRegionFromRequestedReg
   else
     {
     streamableRegion = requestedRegion;
+
+    if ( m_SeekCostInBytes > 0 )
+      {
+      // widen the lower dimensions to the whole image, one at a time,
+      // and keep the region which is cheapest to read
+      const unsigned int numberOfDimensions = vnl_math_min( requestedRegion.GetImageDimension(), 
+                                                            this->m_NumberOfDimensions );
+      SizeType streamableCost = this->EstimateReadCost( streamableRegion );
+      
+      ImageIORegion widenedRegion = requestedRegion;
+      for ( unsigned int i = 0; i < numberOfDimensions; ++i )
+        {
+        widenedRegion.SetIndex( i, 0 );
+        widenedRegion.SetSize( i, this->m_Dimensions[i] );
+        
+        const SizeType widenedCost = this->EstimateReadCost( widenedRegion );
+        if ( widenedCost < streamableCost )
+          {
+          streamableRegion = widenedRegion;
+          streamableCost = widenedCost;
+          }
+        }
+
+      itkDebugMacro(<< "Streamable region " << streamableRegion << " with estimated cost " << streamableCost 
+                    << " for requested region " << requestedRegion );
+      }
     }
   
   return streamableRegion;
 }
+
+
+StreamingImageIOBase::SizeType StreamingImageIOBase::EstimateReadCost( const ImageIORegion &region ) const
+{
+  const SizeType numberOfPixels = static_cast<SizeType>( region.GetNumberOfPixels() );
+  if ( numberOfPixels == 0 )
+    {
+    return 0;
+    }
+  
+  // the pixels are continuous in the file while the lower
+  // dimensions are whole, as in ComputeIORegionChunks
+  SizeType pixelsPerRun = 1;
+  unsigned int movingDirection = 0;
+  do 
+    {
+    pixelsPerRun *= region.GetSize(movingDirection);
+    ++movingDirection;
+    } 
+  while ( movingDirection < region.GetImageDimension() &&
+          region.GetSize(movingDirection-1) == this->GetDimensions(movingDirection-1) );
+
+  const SizeType numberOfRuns = numberOfPixels / pixelsPerRun;
+  return numberOfRuns * m_SeekCostInBytes + numberOfPixels * this->GetPixelSize();
+}
   
 
 
@@ -18,8 +18,12 @@
 #define __itkStreamingImageIOBase_h
 
 #include "itkImageIOBase.h"
+#include "itkIJMRCIOConfigure.h"
+#include "itkIORegionChunkSequence.h"
+#include "itkMultiThreader.h"
 
 #include <fstream>
+#include <vector>
 
 namespace itk
 {
@@ -42,6 +46,89 @@ namespace Local
  * Additionaly low level IO methods are provided to read and write an IORegion from
  * a file. 
  * \sa StreamReadBufferAsBinary StreamWriteBufferAsBinary
+ *
+ * When UseMemoryMappedReading is enabled, and the platform supports
+ * it, the file is memory mapped and the IORegion is copied directly
+ * from the mapping. The mapping is kept between calls to Read, so
+ * that repeated reads of sub-regions from the same file are served
+ * from the page cache without an intermediate stream buffer.
+ * \sa SetUseMemoryMappedReading
+ *
+ * When UsePositionalVectoredIO is enabled, and the platform supports
+ * preadv and pwritev, the continuous runs of bytes of the IORegion
+ * are gathered into batches of io vectors so that a single system
+ * call transfers many runs. The runs of a batch are separated by no
+ * more than VectoredIOMaximumGapSize bytes, which are transferred
+ * too. The number of calls issued to the file is counted for
+ * verification.
+ * \sa SetUsePositionalVectoredIO GetNumberOfIOCalls
+ *
+ * When NumberOfIOThreads is greater than one, the IORegion's buffer
+ * is divided into continuous slices which are read in parallel with
+ * positional reads on a shared file descriptor. This keeps multiple
+ * requests in flight for devices which benefit from queue depth.
+ * \sa SetNumberOfIOThreads
+ *
+ * With UseAsynchronousIO on Linux, all the chunks of an IORegion are
+ * queued on an io_uring with up to AsynchronousIOQueueDepth
+ * operations in flight, instead of a seek and read for each chunk.
+ * When the kernel does not support io_uring, the synchronous methods
+ * are used.
+ * \sa SetUseAsynchronousIO
+ *
+ * With UseReadAhead, after a streamed IORegion is read the next
+ * region is predicted and the kernel is advised to start reading it
+ * into the page cache, so that the IO overlaps with the processing of
+ * the current region.
+ * \sa SetUseReadAhead PredictNextIORegion
+ *
+ * With UseFileCache, the file streams are kept open between calls to
+ * Read and Write, and derived classes may skip parsing the header
+ * again while the file is unchanged.
+ * \sa SetUseFileCache IsHeaderCacheValid
+ *
+ * The FileAllocationPolicy selects if a new file is allocated sparse
+ * or with contiguous extents before the regions are streamed into
+ * it, and GetNumberOfFileExtents measures the resulting
+ * fragmentation.
+ * \sa SetFileAllocationPolicy
+ *
+ * With UseConcurrentPasting, many threads or processes may paste
+ * regions into one existing file, with locked positional writes.
+ * \sa SetUseConcurrentPasting
+ *
+ * With UseDirectIO, whole images and IORegions which are one run of
+ * bytes are transferred with O_DIRECT, so a pass over a huge file
+ * does not evict the page cache.
+ * \sa SetUseDirectIO
+ *
+ * With SeekCostInBytes, a narrow requested region is widened to
+ * whole rows or sections when the extra bytes are cheaper to read
+ * than the seeks they save.
+ * \sa SetSeekCostInBytes EstimateReadCost
+ *
+ * With WritingMemoryLimit, the number of splits for streamed writing
+ * is computed from a byte budget, as slabs of whole sections.
+ * \sa SetWritingMemoryLimit
+ *
+ * With UseSlabCache, streamed IORegions are assembled from whole
+ * sections of the file, which are kept in a process wide least
+ * recently used cache for repeated reads of overlapping regions.
+ * \sa SetUseSlabCache SlabCache
+ *
+ * With ReadBinningFactor, the image is read binned: the information
+ * describes the image with each dimension divided by the factor, and
+ * each pixel read is the mean of a block of pixels of the file. The
+ * sections of the region are read one at a time and their rows are
+ * averaged into the buffer as they stream in, so the full resolution
+ * region is never held in memory.
+ * \sa SetReadBinningFactor BinnedStreamReadBufferAsBinary
+ *
+ * With ReadComponentType, the components are converted from the type
+ * of the file as they are read, in pieces which fit in the staging
+ * buffer, straight into the buffer of the reader. The ImageFileReader
+ * then needs no second buffer to convert the pixels.
+ * \sa SetReadComponentType SIMDPixelConverter
  * 
  * \sa itk::ImageFileReader itk::ImageFileWriter
  * \ingroup IOFilters
@@ -70,20 +157,297 @@ public:
   // see super class for documentation
   //
   // If UseStreamedReading is true, then returned region is the
-  // requested region parameter. 
+  // requested region parameter. When SeekCostInBytes is greater than
+  // zero, the lower dimensions of the region may be widened to the
+  // whole image to reduce the number of seeks. The ImageFileReader
+  // then buffers the larger region, from which downstream filters use
+  // the requested one.
   virtual ImageIORegion GenerateStreamableReadRegionFromRequestedRegion( const ImageIORegion & requested ) const;
 
   // see super class for documentation
   //
   // Verifies the set file name meets the pasting requirements, then calls
-  // GetActualNumberOfSplitsForWritingCanStreamWrite 
+  // GetActualNumberOfSplitsForWritingCanStreamWrite. When
+  // WritingMemoryLimit is set, at least enough splits are used for
+  // each to fit in the limit.
   virtual unsigned int GetActualNumberOfSplitsForWriting( unsigned int numberOfRequestedSplits,
                                                           const ImageIORegion &pasteRegion,
                                                           const ImageIORegion &largestPossibleRegion );
+
+  /** \brief Set/Get if binary data should be read through a memory
+   * mapping of the file
+   *
+   * If the file can not be mapped, then the data is read with the
+   * stream methods. The default is off.
+   */
+  itkSetMacro( UseMemoryMappedReading, bool );
+  itkGetConstMacro( UseMemoryMappedReading, bool );
+  itkBooleanMacro( UseMemoryMappedReading );
+
+  /** \brief Set/Get if the streamed IO methods should use positional
+   * vectored IO 
+   *
+   * If preadv and pwritev are not available, then the stream methods
+   * are used. The default is off.
+   */
+  itkSetMacro( UsePositionalVectoredIO, bool );
+  itkGetConstMacro( UsePositionalVectoredIO, bool );
+  itkBooleanMacro( UsePositionalVectoredIO );
+
+  /** \brief Set/Get the maximum number of io vectors passed to one
+   * positional vectored IO call. The default is 256.
+   */
+  itkSetClampMacro( VectoredIOBatchSize, unsigned int, 2, 1024 );
+  itkGetConstMacro( VectoredIOBatchSize, unsigned int );
+
+  /** \brief Set/Get the maximum number of bytes between two runs of
+   * the IORegion for them to be transferred in the same positional
+   * vectored IO call
+   *
+   * When writing, the bytes in the gap are read and written back, and
+   * only runs no larger then this are batched together with gaps. The
+   * default is 16KB.
+   */
+  itkSetMacro( VectoredIOMaximumGapSize, SizeType );
+  itkGetConstMacro( VectoredIOMaximumGapSize, SizeType );
+
+  /** \brief Get the number of seek, read and write calls issued to
+   * the file by the streamed IO methods
+   *
+   * Reads from a memory mapping are not counted.
+   */
+  itkGetConstMacro( NumberOfIOCalls, unsigned long );
+  void ResetNumberOfIOCalls( void ) { m_NumberOfIOCalls = 0; }
+
+  /** \brief Set/Get the number of threads used to read a streamed
+   * IORegion
+   *
+   * Regions smaller then MinimumBytesPerIOThread per thread use
+   * fewer threads. If positional IO is not available, then the region
+   * is read with the stream methods. The default is 1.
+   */
+  itkSetClampMacro( NumberOfIOThreads, unsigned int, 1, ITK_MAX_THREADS );
+  itkGetConstMacro( NumberOfIOThreads, unsigned int );
+
+  /** \brief Set/Get the smallest slice of a streamed IORegion read by
+   * each thread
+   *
+   * The default is 1MB, 0 is taken as 1.
+   */
+  itkSetMacro( MinimumBytesPerIOThread, SizeType );
+  itkGetConstMacro( MinimumBytesPerIOThread, SizeType );
+
+  /** \brief Set/Get reading and writing streamed IORegions with
+   * io_uring
+   *
+   * This takes precedence over the threaded and vectored methods, but
+   * not memory mapped reading. The default is off.
+   */
+  itkSetMacro( UseAsynchronousIO, bool );
+  itkGetConstMacro( UseAsynchronousIO, bool );
+  itkBooleanMacro( UseAsynchronousIO );
+
+  /** \brief Set/Get the maximum number of asynchronous operations in
+   * flight, the default is 64 */
+  itkSetClampMacro( AsynchronousIOQueueDepth, unsigned int, 1, 4096 );
+  itkGetConstMacro( AsynchronousIOQueueDepth, unsigned int );
+
+  /** \brief Set/Get advising the kernel to read ahead the next
+   * streamed IORegion, the default is off */
+  itkSetMacro( UseReadAhead, bool );
+  itkGetConstMacro( UseReadAhead, bool );
+  itkBooleanMacro( UseReadAhead );
+
+  /** \brief Returns the number of ranges of the file the kernel was
+   * advised to read ahead, since the last reset
+   *
+   * Only advice which the kernel accepted is counted.
+   */
+  itkGetConstMacro( NumberOfReadAheadRanges, unsigned long );
+  void ResetNumberOfReadAheadRanges( void ) { m_NumberOfReadAheadRanges = 0; }
+
+  /** \brief Set/Get keeping the file open and the header information
+   * cached between calls to Read and Write
+   *
+   * The cached streams are reopened when the file name changes or the
+   * file is replaced, the cached header when the file is modified by
+   * another writer. The default is off.
+   */
+  itkSetMacro( UseFileCache, bool );
+  itkGetConstMacro( UseFileCache, bool );
+  itkBooleanMacro( UseFileCache );
+
+  /** \brief Closes the cached files and forgets the cached header */
+  void CloseCachedFiles( void );
+
+  /** \brief Set/Get the size of the buffers used to swap the bytes
+   * of the image when writing
+   *
+   * Two staging buffers are used so that a block is swapped while
+   * the previous one is written. The default is 4MB.
+   */
+  itkSetClampMacro( StagingBufferSize, SizeType, 4096, 1024*1024*1024 );
+  itkGetConstMacro( StagingBufferSize, SizeType );
+
+  /** \brief Get the largest number of bytes which have been
+   * allocated for staging buffers by this object */
+  itkGetConstMacro( PeakStagingMemory, SizeType );
+
+  /** The policies for allocating a new file before its IORegions
+   * are streamed into it */
+  typedef enum {SparseAllocation, ContiguousAllocation, KeepSizeAllocation} FileAllocationPolicyType;
+
+  /** \brief Set/Get how a new file is allocated before it is
+   * streamed into
+   *
+   * SparseAllocation writes the last byte of the file, so blocks are
+   * only allocated as they are written, which fragments the file when
+   * the regions are written out of order. ContiguousAllocation
+   * allocates all the blocks with posix_fallocate, which sets the
+   * length of the file too. KeepSizeAllocation reserves the blocks
+   * with fallocate and FALLOC_FL_KEEP_SIZE without changing the
+   * length, so the file grows as the regions are written. Until the
+   * region at the end of the image is written, a reader finds the
+   * file shorter than its header says, and reading the data past its
+   * end fails. If the policy is not supported by the platform or file
+   * system, the blocks are allocated as they are written, and only
+   * KeepSizeAllocation leaves the length of the file to the data. The
+   * default is SparseAllocation.
+   */
+  itkSetMacro( FileAllocationPolicy, FileAllocationPolicyType );
+  itkGetConstMacro( FileAllocationPolicy, FileAllocationPolicyType );
+  void SetFileAllocationPolicyToSparse( void ) { this->SetFileAllocationPolicy( SparseAllocation ); }
+  void SetFileAllocationPolicyToContiguous( void ) { this->SetFileAllocationPolicy( ContiguousAllocation ); }
+  void SetFileAllocationPolicyToKeepSize( void ) { this->SetFileAllocationPolicy( KeepSizeAllocation ); }
+
+  /** \brief Returns the number of extents of the file on disk, or -1
+   * if it can not be determined
+   *
+   * The file's pending writes are flushed first. This measures the
+   * fragmentation of the file, on file systems supporting the FIEMAP
+   * ioctl such as XFS and ext4.
+   */
+  long GetNumberOfFileExtents( void ) const;
+
+  /** \brief Set/Get pasting into an existing file concurrently with
+   * other threads or processes
+   *
+   * Each pasted IORegion is written with positional writes on a file
+   * descriptor which is kept open between calls, and the header is
+   * only read when the descriptor is opened. The byte ranges of the
+   * region are locked while they are written, so only writers with
+   * overlapping regions wait for each other. The vectored and
+   * asynchronous methods are not used, as vectored writes rewrite the
+   * bytes between the runs of a region. The header is not updated by
+   * the writers, a derived class may provide a method to commit it
+   * once all have finished. The file must exist before the writers
+   * start. The default is off.
+   */
+  itkSetMacro( UseConcurrentPasting, bool );
+  itkGetConstMacro( UseConcurrentPasting, bool );
+  itkBooleanMacro( UseConcurrentPasting );
+
+  /** \brief Set/Get transferring large sequential runs of data
+   * directly between memory and the device, bypassing the page cache
+   *
+   * This is used for reading and writing whole images, and IORegions
+   * which are a single run of bytes in the file. The file positions
+   * and sizes are aligned to DirectIOAlignment, the unaligned head
+   * and tail of the data are transferred through an aligned bounce
+   * buffer of StagingBufferSize. Where the data and the buffer are
+   * both aligned it is transferred in place. If O_DIRECT is not
+   * supported by the platform or file system, the other methods are
+   * used. The default is off.
+   */
+  itkSetMacro( UseDirectIO, bool );
+  itkGetConstMacro( UseDirectIO, bool );
+  itkBooleanMacro( UseDirectIO );
+
+  /** \brief Set/Get the cost of a seek, as the number of bytes which
+   * could be read in the same time
+   *
+   * This is the seek time multiplied by the bandwidth of the device,
+   * around 1MB for spinning disks and network file systems. When
+   * greater than zero, the streamable region is widened to whole rows
+   * or sections of the image, when the extra bytes cost less than the
+   * seeks they save. The default is 0, where the requested region is
+   * read as is.
+   * \sa EstimateReadCost
+   */
+  itkSetMacro( SeekCostInBytes, SizeType );
+  itkGetConstMacro( SeekCostInBytes, SizeType );
+
+  /** \brief Set/Get the number of bytes of the image which may be
+   * written in one split, when streaming
+   *
+   * The number of splits is computed from the limit, the pixel size
+   * and the size of the pasted region, so that each split is a slab
+   * of whole sections in the highest dimension of the region. If the
+   * user requested more splits, those are used. A section larger than
+   * the limit is still written whole. The default is 0, where only
+   * the requested number of splits is used.
+   * \sa ComputeNumberOfSplitsForMemoryLimit
+   */
+  itkSetMacro( WritingMemoryLimit, SizeType );
+  itkGetConstMacro( WritingMemoryLimit, SizeType );
+
+  /** \brief Set/Get reading streamed IORegions through the process
+   * wide SlabCache
+   *
+   * The sections of the highest dimension which contain the region
+   * are read whole, in the system byte order, and cached by the
+   * identity of the file, so later regions of the same sections are
+   * copied from memory. Sections larger than the maximum size of the
+   * cache are read as usual. The slabs of a file are removed when it
+   * is written by an ImageIO of this process, modifications by other
+   * processes are detected by the size and modification time of the
+   * file. The default is off.
+   * \sa SlabCache::SetMaximumSize
+   */
+  itkSetMacro( UseSlabCache, bool );
+  itkGetConstMacro( UseSlabCache, bool );
+  itkBooleanMacro( UseSlabCache );
+
+  /** \brief Set/Get the alignment of the file positions, sizes and
+   * memory for direct IO
+   *
+   * This must be a power of two and a multiple of the logical block
+   * size of the device. The default is 4096.
+   */
+  itkSetClampMacro( DirectIOAlignment, SizeType, 512, 1024*1024 );
+  itkGetConstMacro( DirectIOAlignment, SizeType );
+
+  /** \brief Set/Get the factor by which the image is binned when it
+   * is read
+   *
+   * Each pixel read is the mean of a block of factor pixels in each
+   * dimension of the file, rounded for integer types. The dimensions
+   * of the image are the dimensions of the file divided by the factor
+   * and rounded up, the blocks at the far edges have the pixels
+   * present. The spacing is multiplied by the factor, and the origin
+   * is the center of the first block. The factor must be set before
+   * ReadImageInformation. The default is 1, where the image is read
+   * as is.
+   */
+  itkSetClampMacro( ReadBinningFactor, unsigned int, 1, 1024 );
+  itkGetConstMacro( ReadBinningFactor, unsigned int );
+
+  /** \brief Set/Get the component type the image is read as
+   *
+   * When set, ReadImageInformation reports this component type, and
+   * the components of the file are converted with static_cast as they
+   * are read. Set it to the component type of the pixels of the
+   * ImageFileReader, so the reader uses the buffer of its output
+   * directly. It must be set before ReadImageInformation. The default
+   * is UNKNOWNCOMPONENTTYPE, where the component type of the file is
+   * used.
+   */
+  itkSetMacro( ReadComponentType, IOComponentType );
+  itkGetConstMacro( ReadComponentType, IOComponentType );
     
 protected:
   StreamingImageIOBase();
-  // virtual ~StreamingImageIOBase(); not needed
+  virtual ~StreamingImageIOBase();
   virtual void PrintSelf(std::ostream& os, Indent indent) const;
 
   
@@ -95,6 +459,10 @@ protected:
    * images represent the same region then false is returned.
    */
   virtual bool RequestedToStream( void ) const;
+
+  /** \brief Adds calls issued to the file by a derived class to
+   * NumberOfIOCalls */
+  void AddNumberOfIOCalls( unsigned long numberOfCalls ) { m_NumberOfIOCalls += numberOfCalls; }
   
 
   /** \brief Reimplemented from super class to get around 2GB
@@ -113,6 +481,58 @@ protected:
   virtual bool WriteBufferAsBinary( std::ostream& is, const void *buffer, SizeType num );
 
   
+  /** \brief A continuous run of bytes of the IORegion in the file */
+  typedef IORegionChunkSequence::Chunk          IORegionChunk;
+  typedef IORegionChunkSequence::ChunkContainer IORegionChunkContainer;
+  typedef IORegionChunkSequence::ConstIterator  IORegionChunkIterator;
+
+  /** \brief Computes the continuous runs of bytes in the file which
+   * make up region, in increasing order of file position
+   *
+   * This methods relies on GetDataPosition to determin where the
+   * data is located in the file, the runs are then generated as they
+   * are iterated. A file with another layout may overload it to set
+   * a list of the chunks, their buffer offsets need not then be
+   * increasing.
+   */
+  virtual void ComputeIORegionChunks( const ImageIORegion &region, IORegionChunkSequence &chunks ) const;
+
+  /** \brief Computes the chunks of m_IORegion */
+  void ComputeIORegionChunks( IORegionChunkSequence &chunks ) const
+    { this->ComputeIORegionChunks( m_IORegion, chunks ); }
+
+  /** \brief Returns the number of splits of pasteRegion needed for
+   * each to fit in WritingMemoryLimit
+   *
+   * The region is split in its highest dimension which is not one,
+   * as by GetSplitRegionForWriting, so each split holds whole
+   * sections of the lower dimensions.
+   */
+  virtual unsigned int ComputeNumberOfSplitsForMemoryLimit( const ImageIORegion &pasteRegion ) const;
+
+  /** \brief Returns the number of bytes of the slabs in which the
+   * data of the file is cached
+   *
+   * The default is a section of the highest dimension.
+   * \sa SetUseSlabCache
+   */
+  virtual SizeType GetCacheSlabSize( void ) const;
+
+  /** \brief Reads the chunks into buffer from the slabs of the
+   * SlabCache, reading missing slabs from file
+   *
+   * Returns false without reading if the slabs can not be cached. An
+   * exception is thrown on failure.
+   */
+  virtual bool CachedReadChunks( std::istream &file, char *buffer, const IORegionChunkSequence &chunks );
+
+  /** \brief Estimates the cost of reading region, in bytes
+   *
+   * The cost is the number of bytes read plus SeekCostInBytes for
+   * each continuous run of bytes in the file.
+   */
+  virtual SizeType EstimateReadCost( const ImageIORegion &region ) const;
+
   /** \brief Reads the set IORegion from os into buffer
    *
    * \param os is an istream presumed to be opened for reading in binary
@@ -122,12 +542,16 @@ protected:
    *
    * This methods relies on GetDataPosition to determin where the
    * data is located in the file. It uses m_IORegion to determin the
-   * requested region to read.  
+   * requested region to read. The data is returned in the system
+   * byte order, see GetFileByteSwapSize.
    *
    * The files data is assumed to be unpadded and continuous in the
    * file for the size of the image in the dimensions of the
    * m_IORegion. This means that the image file could be broken into
    * slices, but not blocks for this methods to be used.
+   *
+   * If UseMemoryMappedReading is enabled and the file can be mapped,
+   * then the data is copied from the mapping and os is not used.
    */
   virtual bool StreamReadBufferAsBinary(std::istream& os, void *buffer);
   
@@ -140,10 +564,63 @@ protected:
    *
    * This methods relies on GetDataPosition to determin where the data
    * is located in the file. It usesy m_IORegion determin the requested
-   * region to written.  
+   * region to written. The data is converted to the file byte order,
+   * see GetFileByteOrder.
    */
   virtual bool StreamWriteBufferAsBinary(std::ostream& os, const void *buffer);
 
+  /** \brief Changes the image information read from the file to
+   * that of the binned image
+   *
+   * Derived classes call this at the end of ReadImageInformation,
+   * after the dimensions, spacing and origin of the file have been
+   * set. The dimensions of the file are kept for reading.
+   * \sa SetReadBinningFactor
+   */
+  void BinImageInformation( void );
+
+  /** \brief Returns true if the image information is of a binned
+   * image, so that Read must use BinnedStreamReadBufferAsBinary */
+  bool IsReadBinned( void ) const { return !m_UnbinnedDimensions.empty(); }
+
+  /** \brief Reads the set IORegion of the binned image from os into
+   * buffer
+   *
+   * The region of the file under each section of the IORegion is read
+   * one section of the file at a time with StreamReadBufferAsBinary,
+   * and its rows are summed into a section of means, which is
+   * converted into buffer. Only one section of the file is held in
+   * memory.
+   */
+  virtual bool BinnedStreamReadBufferAsBinary( std::istream& os, void *buffer );
+
+  /** \brief Changes the component type read from the file to
+   * ReadComponentType
+   *
+   * Derived classes call this at the end of ReadImageInformation,
+   * after the component type of the file has been set. The component
+   * type of the file is kept for reading. An exception is thrown if
+   * the types can not be converted.
+   * \sa SetReadComponentType
+   */
+  void ConvertImageInformation( void );
+
+  /** \brief Returns true if the component type of the image
+   * information is not that of the file, so that Read must use
+   * ConvertedStreamReadBufferAsBinary or
+   * BinnedStreamReadBufferAsBinary */
+  bool IsReadConverted( void ) const { return m_FileComponentType != UNKNOWNCOMPONENTTYPE; }
+
+  /** \brief Reads the set IORegion from os into buffer, converting
+   * the components from the type of the file
+   *
+   * The IORegion is read with StreamReadBufferAsBinary in pieces of
+   * whole rows, sections or slabs of at most StagingBufferSize bytes,
+   * and each piece is converted into its place in buffer while it is
+   * in the cache.
+   */
+  virtual bool ConvertedStreamReadBufferAsBinary( std::istream& os, void *buffer );
+
 
   /** \brief Returns the size of the header in the file */
   virtual SizeType GetHeaderSize(void ) const = 0;
@@ -154,6 +631,13 @@ protected:
    */
   virtual SizeType GetDataPosition( void ) const { return this->GetHeaderSize(); };
 
+  /** \brief Returns the name of the file the data is read from
+   *
+   * The default implementation is to return m_FileName. The file
+   * written is always m_FileName.
+   */
+  virtual std::string GetDataFileName( void ) const { return m_FileName; };
+
   
   /** \brief Opens a file for reading and random access
    *
@@ -171,10 +655,310 @@ protected:
    */
   virtual void OpenFileForWriting(std::ofstream& os, const char* filename, bool truncate);
 
+
+  /** \brief The identity of a file on disk, used to detect when a
+   * cached resource no longer matches the file
+   *
+   * The modification time has the nanoseconds where the platform
+   * records them, so a file rewritten with the same length within a
+   * second is distinguished.
+   */
+  struct FileIdentity
+  {
+    FileIdentity() : length( 0 ), modifiedTime( 0 ), modifiedTimeNanoseconds( 0 ), inode( 0 ) {}
+    bool operator==( const FileIdentity &other ) const;
+    
+    std::string   name;
+    SizeType      length;
+    long          modifiedTime;
+    long          modifiedTimeNanoseconds;
+    unsigned long inode;
+  };
+
+  /** \brief Gets the identity of the file, returns false if the file
+   * does not exist */
+  static bool GetFileIdentity( const std::string &filename, FileIdentity &identity );
+
+  /** \brief Returns a stream open for reading the data file
+   *
+   * With UseFileCache the stream kept by this object is returned,
+   * otherwise file is opened and returned.
+   */
+  std::ifstream &OpenCachedFileForReading( std::ifstream &file );
+
+  /** \brief Returns a stream open for writing m_FileName without
+   * truncation
+   *
+   * With UseFileCache the stream kept by this object is returned,
+   * otherwise file is opened and returned. The stream must be flushed
+   * after writing.
+   */
+  std::ofstream &OpenCachedFileForWriting( std::ofstream &file );
+
+  /** \brief Returns true if UseFileCache is on and the file has not
+   * been modified since UpdateHeaderCache was called */
+  bool IsHeaderCacheValid( void ) const;
+
+  /** \brief Records that the header information is current for the
+   * file as it is now */
+  void UpdateHeaderCache( void );
+
+  /** \brief Records that the header information was read from
+   * fileName, it is only current for m_FileName if it is that file */
+  void UpdateHeaderCache( const std::string &fileName );
+
+  /** \brief Returns the byte order of the data on disk
+   *
+   * This is the policy of the file format, used for both reading and
+   * writing. The default is OrderNotApplicable, for which the data is
+   * never swapped.
+   */
+  virtual ByteOrder GetFileByteOrder( void ) const { return OrderNotApplicable; }
+
+  /** \brief Returns the size of the components whose bytes must be
+   * swapped between the file and the system byte order, or 0 if no
+   * swapping is needed
+   *
+   * This is determined from GetFileByteOrder. The stream read and
+   * write methods and the ReadAndSwap methods swap the bytes as each
+   * run is transferred, so there is no second pass over the buffer.
+   */
+  virtual unsigned int GetFileByteSwapSize( void ) const;
+
+  /** \brief Swaps num bytes of buffer between the file and the
+   * system byte order */
+  void SwapFileBytes( void *buffer, SizeType num ) const;
+
+  /** \brief Writes the IORegion of buffer to m_FileName for
+   * concurrent pasting
+   *
+   * The data is converted to the file's byte order. An exception is
+   * thrown on failure.
+   * \sa SetUseConcurrentPasting
+   */
+  void ConcurrentWriteBufferAsBinary( const void *buffer );
+
+  /** \brief Writes the chunks of buffer with positional writes,
+   * while holding write locks on their byte ranges
+   *
+   * The ranges are locked in file order, so writers of overlapping
+   * regions can not deadlock. Where positional writes or locks are
+   * not supported the chunks are written through a stream without
+   * locking.
+   */
+  void ConcurrentWriteChunks( const char *buffer, 
+                              const IORegionChunkSequence &chunks,
+                              unsigned int swapSize );
+
+  /** \brief Returns true if the descriptor used for concurrent
+   * pasting is open on m_FileName, and so the header information
+   * read when it was opened is still valid */
+  bool IsConcurrentFileCurrent( void ) const;
+
+  /** \brief Reads num bytes at pos in m_FileName into buffer with
+   * direct IO, in the system byte order
+   *
+   * Returns false without reading if direct IO is not supported for
+   * the file, an exception is thrown on failure.
+   * \sa SetUseDirectIO
+   */
+  virtual bool DirectReadBufferAsBinary( SizeType pos, void *buffer, SizeType num );
+
+  /** \brief Writes num bytes of buffer at pos in m_FileName with
+   * direct IO, in the file byte order
+   *
+   * The bytes of the file around the data in the aligned blocks at
+   * the ends are preserved, and the file is not extended past the
+   * data. Returns false without writing if direct IO is not supported
+   * for the file, an exception is thrown on failure. Data buffered in
+   * streams of the file must have been flushed.
+   * \sa SetUseDirectIO
+   */
+  virtual bool DirectWriteBufferAsBinary( SizeType pos, const void *buffer, SizeType num );
+
+  /** \brief Allocates size bytes for a new file, which is open for
+   * writing as file, according to the FileAllocationPolicy */
+  void AllocateFile( std::ofstream &file, SizeType size );
+
+  /** \brief Writes the chunks of buffer to file, swapping each
+   * through a staging buffer of at most StagingBufferSize bytes
+   *
+   * This is used by StreamWriteBufferAsBinary when the data must be
+   * swapped, instead of the positional or asynchronous methods. An
+   * exception is thrown on failure.
+   */
+  virtual void StagedStreamWriteChunks( std::ostream& file, const char *buffer, 
+                                        const IORegionChunkSequence &chunks,
+                                        unsigned int swapSize );
+
+  /** \brief Writes num bytes of buffer to os in the file byte order
+   *
+   * When swapping is needed, the data is swapped into two staging
+   * buffers of StagingBufferSize, while the previous block is
+   * written on another thread. The buffer is not modified.
+   */
+  bool WriteAndSwapBufferAsBinary( std::ostream& os, const void *buffer, SizeType num );
+
+  /** \brief Reads num bytes into buffer in the system byte order
+   *
+   * The data is read and swapped in blocks which fit in the cache.
+   */
+  bool ReadAndSwapBufferAsBinary( std::istream& is, void *buffer, SizeType num );
+
+  /** \brief Copies num bytes from pos in the mapped file into buffer
+   * in the system byte order */
+  bool ReadAndSwapMappedBufferAsBinary( SizeType pos, void *buffer, SizeType num ) const;
+
+  /** \brief Memory maps m_FileName for reading
+   *
+   * An existing mapping is reused if it is of the same file, and the
+   * file's size and modification time have not changed. Returns
+   * false if the file could not be mapped, or if memory mapping is
+   * not supported on this platform.
+   */
+  virtual bool MapFileForReading( void );
+
+  /** \brief Releases the memory mapping of the file if there is one */
+  virtual void UnmapFile( void );
+
+  /** \brief Copies num bytes starting at pos in the mapped file into
+   * buffer
+   *
+   * MapFileForReading must have been successfully called. Returns
+   * false if the requested bytes are not contained in the file.
+   */
+  virtual bool ReadMappedBufferAsBinary( SizeType pos, void *buffer, SizeType num ) const;
+
+  /** \brief Returns true if positional vectored IO is supported on
+   * this platform */
+  virtual bool CanUsePositionalVectoredIO( void ) const;
+
+  /** \brief Reads the chunks into buffer with positional vectored
+   * IO, returns the number of bytes of the chunks read */
+  virtual SizeType VectoredReadChunks( char *buffer, const IORegionChunkSequence &chunks );
+
+  /** \brief Predicts the IORegion which will be read after the
+   * current one
+   *
+   * The direction of streaming is taken from the previously read
+   * region when it is adjacent to the current one, otherwise the
+   * highest dimension which is not the whole image is used. Returns
+   * false if there is no next region.
+   */
+  virtual bool PredictNextIORegion( ImageIORegion &next ) const;
+
+  /** \brief Advises the kernel to read the predicted next IORegion,
+   * and records the current one */
+  virtual void ReadAheadNextIORegion( void );
+
+  /** \brief Reads the chunks into buffer with io_uring 
+   *
+   * Returns false without reading if io_uring is not available,
+   * otherwise bytesRead is set to the number of bytes of the chunks
+   * read.
+   */
+  virtual bool AsynchronousReadChunks( char *buffer, const IORegionChunkSequence &chunks, SizeType &bytesRead );
+
+  /** \brief Writes the chunks from buffer with io_uring
+   *
+   * Returns false without writing if io_uring is not available, an
+   * exception is thrown on failure.
+   */
+  virtual bool AsynchronousWriteChunks( const char *buffer, const IORegionChunkSequence &chunks );
+
+  /** \brief Reads the chunks into buffer in parallel with
+   * NumberOfIOThreads threads, returns the number of bytes of the
+   * chunks read */
+  virtual SizeType ThreadedReadChunks( char *buffer, const IORegionChunkSequence &chunks );
+
+  /** \brief Reads the chunks into buffer with positional reads on
+   * the file descriptor 
+   *
+   * The chunks from chunk to its end are read. Chunks separated by no
+   * more than maxGap bytes are gathered into calls of up to
+   * maxVectors io vectors. If swapSize is greater then one, the bytes
+   * of each batch are swapped after it is read. The number of bytes
+   * of the chunks read is returned, and stops short on an error.
+   */
+  static SizeType PositionalReadChunks( int fd, char *buffer, IORegionChunkIterator chunk,
+                                        unsigned int maxVectors, SizeType maxGap,
+                                        unsigned int swapSize, unsigned long &numberOfCalls );
+
+  /** \brief Writes the chunks from buffer with positional vectored
+   * IO, an exception is thrown on failure */
+  virtual void VectoredWriteChunks( const char *buffer, const IORegionChunkSequence &chunks );
+
 private:
   StreamingImageIOBase(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
+  bool         m_UseMemoryMappedReading;
+
+  // the current memory mapping of the file, and the identity of the
+  // file when it was mapped
+  void        *m_MappedFileData;
+  SizeType     m_MappedFileLength;
+  FileIdentity m_MappedFileIdentity;
+
+  bool          m_UsePositionalVectoredIO;
+  unsigned int  m_VectoredIOBatchSize;
+  SizeType      m_VectoredIOMaximumGapSize;
+  unsigned long m_NumberOfIOCalls;
+
+  unsigned int  m_NumberOfIOThreads;
+  SizeType      m_MinimumBytesPerIOThread;
+
+  bool          m_UseAsynchronousIO;
+  unsigned int  m_AsynchronousIOQueueDepth;
+
+  bool          m_UseReadAhead;
+  ImageIORegion m_ReadAheadPreviousRegion;
+  unsigned long m_NumberOfReadAheadRanges;
+  std::string   m_ReadAheadFileName;
+
+  bool          m_UseFileCache;
+  std::ifstream m_CachedReadFile;
+  FileIdentity  m_CachedReadFileIdentity;
+  std::ofstream m_CachedWriteFile;
+  FileIdentity  m_CachedWriteFileIdentity;
+  FileIdentity  m_HeaderCacheIdentity;
+
+  SizeType      m_StagingBufferSize;
+  SizeType      m_PeakStagingMemory;
+
+  FileAllocationPolicyType m_FileAllocationPolicy;
+
+  bool          m_UseConcurrentPasting;
+  int           m_ConcurrentFileDescriptor;
+  FileIdentity  m_ConcurrentFileIdentity;
+
+  bool          m_UseDirectIO;
+  SizeType      m_DirectIOAlignment;
+
+  SizeType      m_SeekCostInBytes;
+
+  SizeType      m_WritingMemoryLimit;
+
+  bool          m_UseSlabCache;
+
+  unsigned int          m_ReadBinningFactor;
+  std::vector<SizeType> m_UnbinnedDimensions;
+
+  IOComponentType       m_ReadComponentType;
+  IOComponentType       m_FileComponentType;
+
+  void OpenConcurrentFile( void );
+  void CloseConcurrentFile( void );
+
+  struct StagedWriteStruct;
+  static ITK_THREAD_RETURN_TYPE StagedWriteCallback( void *arg );
+
+  bool AsynchronousTransferChunks( bool write, char *buffer, 
+                                   const IORegionChunkSequence &chunks, 
+                                   SizeType &bytesTransferred );
+
+  struct ThreadedReadStruct;
+  static ITK_THREAD_RETURN_TYPE ThreadedReadCallback( void *arg );
 
 };
 
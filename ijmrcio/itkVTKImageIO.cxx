@@ -17,6 +17,7 @@
 
 #include "itkVTKImageIO.h"
 #include "itkByteSwapper.h"
+#include "itkSlabCache.h"
 
 #include <itksys/ios/sstream>
 #include <itksys/SystemTools.hxx>
@@ -330,7 +331,8 @@ void VTKImageIO::InternalReadImageInformation(std::ifstream& file)
   
   // set the header size based on how much we just read
   this->m_HeaderSize = static_cast<SizeType>( file.tellg() );
-  
+
+  this->UpdateHeaderCache();
 }
 
 
@@ -386,71 +388,101 @@ void VTKImageIO::ReadHeaderSize(std::ifstream& file)
   
   // set the header size based on how much we just read
   this->m_HeaderSize = static_cast<SizeType>( file.tellg() );
-  
+
+  this->UpdateHeaderCache();
 }
 
 void VTKImageIO::Read(void* buffer)
 {
   std::ifstream file;
 
-  if( this->RequestedToStream() )
+  if ( this->IsReadBinned() )
+    {
+
+    itkAssertOrThrowMacro( m_FileType != ASCII, "Can not read binned with ASCII type files" );
+
+    // the sections of the file are averaged into the buffer
+    std::ifstream &in = this->OpenCachedFileForReading( file );
+    this->BinnedStreamReadBufferAsBinary( in, buffer );
+    
+    }
+  else if ( this->IsReadConverted() )
+    {
+
+    itkAssertOrThrowMacro( m_FileType != ASCII, "Can not read converted with ASCII type files" );
+
+    // the pieces of the file are converted into the buffer
+    std::ifstream &in = this->OpenCachedFileForReading( file );
+    this->ConvertedStreamReadBufferAsBinary( in, buffer );
+    
+    }
+  else if( this->RequestedToStream() )
     {
     
     itkAssertOrThrowMacro( m_FileType != ASCII, "Can not stream with ASCII type files" );
 
-    // open and stream read
-    this->OpenFileForReading(file, this->m_FileName.c_str());
+    // open and stream read, the bytes are swapped as they are read
+    std::ifstream &in = this->OpenCachedFileForReading( file );
     
     itkAssertOrThrowMacro( this->GetHeaderSize() != 0, "Header size is unknown when it shouldn't be!");
-    this->StreamReadBufferAsBinary(file, buffer);
+    this->StreamReadBufferAsBinary( in, buffer );
     
     }
   else 
     {
 
-    // open the file
-    this->OpenFileForReading(file, this->m_FileName.c_str());
-      
     itkAssertOrThrowMacro( this->GetHeaderSize() != 0, "Header size is unknown when it shouldn't be!");
-      
-      
-    if ( file.fail() )
+
+    // binary data may be read without the page cache
+    if ( m_FileType != ASCII && this->GetUseDirectIO() && 
+         this->DirectReadBufferAsBinary( this->GetHeaderSize(), buffer, this->GetImageSizeInBytes() ) )
       {
-      itkExceptionMacro(<<"Failed seeking to data position");
+      return;
       }
+
+    // ASCII data is always read through the stream
+    const bool useMapping = m_FileType != ASCII && 
+      this->GetUseMemoryMappedReading() && this->MapFileForReading();
+
+    std::ifstream *in = &file;
+    if ( !useMapping )
+      {
+      // open the file
+      in = &this->OpenCachedFileForReading( file );
       
-    // seek pass the header
-    std::streampos dataPos = static_cast<std::streampos>( this->GetHeaderSize() );
-    file.seekg( dataPos, std::ios::beg );
+      if ( in->fail() )
+        {
+        itkExceptionMacro(<<"Failed seeking to data position");
+        }
+      
+      // seek pass the header
+      std::streampos dataPos = static_cast<std::streampos>( this->GetHeaderSize() );
+      in->seekg( dataPos, std::ios::beg );
+      }
       
     //We are positioned at the data. The data is read depending on whether 
     //it is ASCII or binary.
     if ( m_FileType == ASCII )
       {
-      this->ReadBufferAsASCII(file, buffer, this->GetComponentType(),
+      this->ReadBufferAsASCII(*in, buffer, this->GetComponentType(),
                               this->GetImageSizeInComponents());
       }
     else
       {
-      // read the image
-      this->ReadBufferAsBinary( file, buffer, this->GetImageSizeInBytes() );
-     
-      int size = this->GetComponentSize();
-      switch( size )
+      // read the image, swapping the bytes as it is read
+      if ( useMapping )
         {
-        case 1:
-          break;
-        case 2:
-          ByteSwapper<uint16_t>::SwapRangeFromSystemToBigEndian((uint16_t *)buffer, this->GetImageSizeInComponents() );
-          break;
-        case 4:
-          ByteSwapper<uint32_t>::SwapRangeFromSystemToBigEndian((uint32_t *)buffer, this->GetImageSizeInComponents() );
-          break;
-        case 8:
-          ByteSwapper<uint64_t>::SwapRangeFromSystemToBigEndian((uint64_t *)buffer, this->GetImageSizeInComponents() );
-          break;
-        default:
-          itkExceptionMacro(<< "Unknown component size");
+        if ( !this->ReadAndSwapMappedBufferAsBinary( this->GetHeaderSize(), buffer, this->GetImageSizeInBytes() ) )
+          {
+          itkExceptionMacro(<<"Data not read completely from mapping of file: " << m_FileName);
+          }
+        }
+      else
+        {
+        if ( !this->ReadAndSwapBufferAsBinary( *in, buffer, this->GetImageSizeInBytes() ) )
+          {
+          itkExceptionMacro(<<"Data not read completely from file: " << m_FileName);
+          }
         }
       }
     }
@@ -458,10 +490,19 @@ void VTKImageIO::Read(void* buffer)
 }
 
 
+VTKImageIO::ByteOrder VTKImageIO::GetFileByteOrder( void ) const
+{
+  // binary data is always big endian
+  return ( m_FileType == ASCII ) ? OrderNotApplicable : BigEndian;
+}
+
+
 void VTKImageIO::ReadImageInformation()
 {
   std::ifstream file;
   this->InternalReadImageInformation(file);
+  this->BinImageInformation();
+  this->ConvertImageInformation();
 }
 
 bool VTKImageIO::CanWriteFile( const char* name )
@@ -566,9 +607,30 @@ void VTKImageIO::WriteImageInformation(const void* buffer)
 
 void VTKImageIO::Write(const void* buffer)
 {
-
+  // the cached slabs of the file will be out of date, including
+  // those read while it is written
+  const SlabCache::RemoveFileScope removeCachedSlabs( m_FileName );
   
-  if( this->RequestedToStream() )
+  if( this->RequestedToStream() && 
+      this->GetUseConcurrentPasting() && 
+      itksys::SystemTools::FileExists( m_FileName.c_str() ) )
+    {
+    itkAssertOrThrowMacro( m_FileType != ASCII, "Can not stream with ASCII type files" );
+    
+    // other writers may be pasting into the file, so the header size
+    // is only read when the file is opened
+    if ( this->GetHeaderSize() == 0 || !this->IsConcurrentFileCurrent() )
+      {
+      std::ifstream ifile;
+      this->ReadHeaderSize( ifile );
+      }
+    
+    itkAssertOrThrowMacro( this->GetHeaderSize() != 0, "Header size is unknown when it shouldn't be!");
+    
+    this->ConcurrentWriteBufferAsBinary( buffer );
+    }
+
+  else if( this->RequestedToStream() )
     {
       
     itkAssertOrThrowMacro( m_FileType != ASCII, "Can not stream with ASCII type files" );
@@ -584,33 +646,34 @@ void VTKImageIO::Write(const void* buffer)
       
       this->WriteImageInformation( buffer );
       
-      // open and stream write
+      // open to allocate the file
       this->OpenFileForWriting(file, this->m_FileName.c_str(), false);
-      
-      // write one byte at the end of the file to allocate (this is a
-      // nifty trick which should not write the entire size of the file
-      // just allocate it, if the system supports sparse files)
-      std::streampos seekPos = this->GetImageSizeInBytes() + this->GetHeaderSize() - 1;
-      file.seekp( seekPos, std::ios::cur );
-      file.write("\0", 1);
-      file.seekp( 0 );
+      this->AllocateFile( file, this->GetImageSizeInBytes() + this->GetHeaderSize() );
+      file.close();
       }
     else
       {
 
       
-      // must always recheck the header size incase something has changed
-      std::ifstream ifile;
-      this->ReadHeaderSize( ifile );
+      // recheck the header size incase something has changed,
+      // unless the file is unmodified since it was last read
+      if ( !this->IsHeaderCacheValid() )
+        {
+        std::ifstream ifile;
+        this->ReadHeaderSize( ifile );
+        }
 
       itkAssertOrThrowMacro( this->GetHeaderSize() != 0, "Header size is unknown when it shouldn't be!");
 
-      // open and stream write
-      this->OpenFileForWriting(file, this->m_FileName.c_str(), false);
-      
       }
     
-    this->StreamWriteBufferAsBinary(file, buffer);
+    // open and stream write
+    std::ofstream &out = this->OpenCachedFileForWriting( file );
+    this->StreamWriteBufferAsBinary( out, buffer );
+
+    // the header is unchanged by writing the data
+    out.flush();
+    this->UpdateHeaderCache();
     
     }
 
@@ -625,6 +688,13 @@ void VTKImageIO::Write(const void* buffer)
     this->OpenFileForWriting(file, this->m_FileName.c_str(), false);
     
     itkAssertOrThrowMacro( this->GetHeaderSize() != 0, "Header size is unknown when it shouldn't be!");
+
+    // binary data may be written without the page cache
+    if ( m_FileType != ASCII && this->GetUseDirectIO() && 
+         this->DirectWriteBufferAsBinary( this->GetHeaderSize(), buffer, this->GetImageSizeInBytes() ) )
+      {
+      return;
+      }
     
     // seek pass the header
     std::streampos dataPos = static_cast<std::streampos>( this->GetHeaderSize() );
@@ -644,43 +714,11 @@ void VTKImageIO::Write(const void* buffer)
       }
     else //binary
       {
-      // the binary data must be written in big endian format
-      if ( ! ByteSwapper<uint16_t>::SystemIsBigEndian() )
+      // the binary data must be written in big endian format, it
+      // is swapped through bounded staging buffers when needed
+      if (!this->WriteAndSwapBufferAsBinary( file, buffer, this->GetImageSizeInBytes() )) 
         {
-        // only swap  when needed 
-        typedef ::size_t   BufferSizeType;
-        const BufferSizeType numbytes = static_cast<BufferSizeType>( this->GetImageSizeInBytes() );
-        char * tempmemory = new char[numbytes];        
-        memcpy(tempmemory,buffer,numbytes);
-        switch(  this->GetComponentSize() )
-          {
-          case 1:
-            break;
-          case 2:
-            ByteSwapper<uint16_t>::SwapRangeFromSystemToBigEndian((uint16_t *)(tempmemory), static_cast<BufferSizeType>(this->GetImageSizeInComponents()) );
-            break;
-          case 4:
-            ByteSwapper<uint32_t>::SwapRangeFromSystemToBigEndian((uint32_t *)(tempmemory), static_cast<BufferSizeType>(this->GetImageSizeInComponents()) );
-            break;
-          case 8:
-            ByteSwapper<uint64_t>::SwapRangeFromSystemToBigEndian((uint64_t *)(tempmemory), static_cast<BufferSizeType>(this->GetImageSizeInComponents()) );
-            break;
-          }
-                
-        // write the image
-        if (!this->WriteBufferAsBinary( file, tempmemory, this->GetImageSizeInBytes() )) 
-          {
-          itkExceptionMacro(<< "Could not write file: " << m_FileName);
-          }
-        delete [] tempmemory;
-        }
-      else 
-        {
-        // write the image
-        if (!this->WriteBufferAsBinary( file, buffer, this->GetImageSizeInBytes() )) 
-          {
-          itkExceptionMacro(<< "Could not write file: " << m_FileName);
-          }
+        itkExceptionMacro(<< "Could not write file: " << m_FileName);
         }
       }
     }
@@ -94,6 +94,9 @@ protected:
   void WriteImageInformation(const void* buffer);
   
   void ReadHeaderSize( std::ifstream& file );
+
+  /** Overloaded to return big endian for binary files. */
+  virtual ByteOrder GetFileByteOrder( void ) const;
   
 private:
   VTKImageIO(const Self&); //purposely not implemented
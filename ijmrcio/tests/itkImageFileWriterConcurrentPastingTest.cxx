@@ -0,0 +1,304 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageDuplicator.h"
+#include "itkImageRegionIterator.h"
+#include "itkMetaDataObject.h"
+#include "itkMultiThreader.h"
+
+#include "itkLocalFactory.h"
+#include "itkMRCImageIO.h"
+#include "itkVTKImageIO.h"
+#include "itktfRegression.h"
+
+#include <itksys/SystemTools.hxx>
+
+#include <cmath>
+#include <vector>
+
+// This test pastes slabs of an image into one file from several
+// threads with UseConcurrentPasting. Each writer pastes values of its
+// own into its slab, except for the slice it shares with the next
+// slab, which both write with the values of the image. The file is
+// compared to the expected image, and for MRC the statistics
+// committed to the header to those of the expected image.
+class ImageFileWriterConcurrentPastingTest:
+  public itk::Regression
+{
+protected:
+
+  typedef float                                   PixelType;
+  typedef itk::Image<PixelType,3>                 ImageType;
+  typedef itk::ImageFileReader<ImageType>         ReaderType;
+  typedef itk::ImageFileWriter<ImageType>         WriterType;
+  typedef itk::Local::StreamingImageIOBase        StreamingImageIOType;
+  typedef itk::Local::MRCImageIO                  MRCImageIOType;
+  typedef itk::Local::MRCHeaderObject             MRCHeaderObjectType;
+
+  struct PasteStruct
+  {
+    std::string                        FileName;
+    std::vector<ImageType::Pointer>    Images;
+    std::vector<ImageType::RegionType> Regions;
+    std::vector<int>                   Failed;
+  };
+
+
+  static StreamingImageIOType::Pointer CreateImageIO( const std::string &filename )
+  {
+    if ( itksys::SystemTools::GetFilenameLastExtension( filename ) == ".vtk" )
+      {
+      return itk::Local::VTKImageIO::New().GetPointer();
+      }
+    return itk::Local::MRCImageIO::New().GetPointer();
+  }
+
+
+  // the value pasted by writer, which differs between the writers
+  static PixelType WriterValue( PixelType value, unsigned int writer )
+  {
+    return value + 1000.0f * ( writer + 1 );
+  }
+
+
+  // a copy of the image with the values of the writer in its region,
+  // except for the shared slices which keep the values of the image
+  static ImageType::Pointer MakeWriterImage( const ImageType *image, const ImageType::RegionType &region,
+                                             unsigned int writer, const std::vector<bool> &shared )
+  {
+    typedef itk::ImageDuplicator<ImageType> DuplicatorType;
+    DuplicatorType::Pointer duplicator = DuplicatorType::New();
+    duplicator->SetInputImage( image );
+    duplicator->Update();
+    ImageType::Pointer writerImage = duplicator->GetOutput();
+
+    const unsigned int last = ImageType::ImageDimension - 1;
+    itk::ImageRegionIterator<ImageType> it( writerImage, region );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+      {
+      const unsigned long slice = it.GetIndex()[last] - image->GetLargestPossibleRegion().GetIndex()[last];
+      if ( !shared[slice] )
+        {
+        it.Set( WriterValue( it.Get(), writer ) );
+        }
+      }
+    return writerImage;
+  }
+
+
+  static bool IsClose( double a, double b )
+  {
+    return std::fabs( a - b ) <= 1e-4 * ( 1.0 + std::fabs( a ) + std::fabs( b ) );
+  }
+
+
+  // compares the statistics in the header of the file to those of
+  // the image, returns the number of differences
+  unsigned long CompareHeaderStatistics( const std::string &filename, const ImageType *image )
+  {
+    double minimum = 0.0;
+    double maximum = 0.0;
+    double sum = 0.0;
+    unsigned long count = 0;
+    itk::ImageRegionConstIterator<ImageType> it( image, image->GetLargestPossibleRegion() );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it, ++count )
+      {
+      const double v = it.Get();
+      minimum = ( count == 0 || v < minimum ) ? v : minimum;
+      maximum = ( count == 0 || v > maximum ) ? v : maximum;
+      sum += v;
+      }
+    const double mean = sum / count;
+
+    double sumOfSquaredDeviations = 0.0;
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+      {
+      sumOfSquaredDeviations += ( it.Get() - mean ) * ( it.Get() - mean );
+      }
+    const double rms = std::sqrt( sumOfSquaredDeviations / count );
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( filename );
+    reader->SetImageIO( MRCImageIOType::New() );
+    reader->UpdateOutputInformation();
+
+    MRCHeaderObjectType::ConstPointer header;
+    if ( !itk::ExposeMetaData<MRCHeaderObjectType::ConstPointer>( reader->GetImageIO()->GetMetaDataDictionary(),
+                                                                  MRCImageIOType::MetaDataHeaderName, header ) )
+      {
+      std::cerr << "Missing MRC header in: " << filename << std::endl;
+      return 1;
+      }
+
+    std::cout << "header min: " << header->header.amin << " max: " << header->header.amax
+              << " mean: " << header->header.amean << " rms: " << header->header.rms << std::endl;
+    std::cout << "pixels min: " << minimum << " max: " << maximum
+              << " mean: " << mean << " rms: " << rms << std::endl;
+
+    unsigned long numberOfDifferences = 0;
+    numberOfDifferences += !IsClose( header->header.amin, minimum );
+    numberOfDifferences += !IsClose( header->header.amax, maximum );
+    numberOfDifferences += !IsClose( header->header.amean, mean );
+    numberOfDifferences += !IsClose( header->header.rms, rms );
+    return numberOfDifferences;
+  }
+
+
+  static ITK_THREAD_RETURN_TYPE PasteCallback( void *arg )
+  {
+    itk::MultiThreader::ThreadInfoStruct *info = static_cast<itk::MultiThreader::ThreadInfoStruct *>( arg );
+    PasteStruct *str = static_cast<PasteStruct *>( info->UserData );
+    const int i = info->ThreadID;
+
+    try
+      {
+      StreamingImageIOType::Pointer io = CreateImageIO( str->FileName );
+      io->UseConcurrentPastingOn();
+
+      itk::ImageIORegion ioRegion( ImageType::ImageDimension );
+      for ( unsigned int d = 0; d < ImageType::ImageDimension; ++d )
+        {
+        ioRegion.SetIndex( d, str->Regions[i].GetIndex()[d] );
+        ioRegion.SetSize( d, str->Regions[i].GetSize()[d] );
+        }
+
+      WriterType::Pointer writer = WriterType::New();
+      writer->SetInput( str->Images[i] );
+      writer->SetFileName( str->FileName );
+      writer->SetImageIO( io );
+      writer->SetIORegion( ioRegion );
+      writer->Update();
+      }
+    catch ( itk::ExceptionObject &e )
+      {
+      std::cerr << e << std::endl;
+      str->Failed[i] = 1;
+      }
+
+    return ITK_THREAD_RETURN_VALUE;
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    if( argc < 3 )
+      {
+      std::cerr << "Usage: " << argv[0] << " inputFile outputFile [numberOfWriters]" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const std::string inputFilename = argv[1];
+    const std::string outputFilename = argv[2];
+    const unsigned int numberOfWriters = ( argc > 3 ) ? atoi( argv[3] ) : 4;
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( inputFilename );
+    reader->Update();
+
+    ImageType::Pointer image = reader->GetOutput();
+    image->DisconnectPipeline();
+    const ImageType::RegionType largestRegion = image->GetLargestPossibleRegion();
+
+    ////////////////////////////////////////////////
+    // the pasted file must exist before the writers start
+    ImageType::Pointer blank = ImageType::New();
+    blank->CopyInformation( image );
+    blank->SetRegions( largestRegion );
+    blank->Allocate();
+    blank->FillBuffer( 0 );
+
+    WriterType::Pointer writer = WriterType::New();
+    writer->SetInput( blank );
+    writer->SetFileName( outputFilename );
+    writer->SetImageIO( CreateImageIO( outputFilename ) );
+    writer->Update();
+
+    ////////////////////////////////////////////////
+    // each writer pastes a slab, which overlaps the next by a slice,
+    // from its own copy of the image with its own values
+    PasteStruct str;
+    str.FileName = outputFilename;
+    str.Failed.resize( numberOfWriters, 0 );
+
+    const unsigned int last = ImageType::ImageDimension - 1;
+    const unsigned long numberOfSlices = largestRegion.GetSize()[last];
+
+    // the first slice of each slab after the first is shared
+    std::vector<bool> shared( numberOfSlices, false );
+    for ( unsigned int i = 1; i < numberOfWriters; ++i )
+      {
+      shared[numberOfSlices * i / numberOfWriters] = true;
+      }
+
+    // every slice of the expected image is replaced by those of a
+    // writer
+    ImageType::Pointer expected = MakeWriterImage( image, largestRegion, 0, shared );
+    for ( unsigned int i = 0; i < numberOfWriters; ++i )
+      {
+      const unsigned long begin = numberOfSlices * i / numberOfWriters;
+      const unsigned long end = vnl_math_min( numberOfSlices * ( i + 1 ) / numberOfWriters + 1, numberOfSlices );
+
+      ImageType::RegionType region = largestRegion;
+      region.SetIndex( last, largestRegion.GetIndex()[last] + begin );
+      region.SetSize( last, end - begin );
+      str.Regions.push_back( region );
+      str.Images.push_back( MakeWriterImage( image, region, i, shared ) );
+
+      // the writers paste the same values into the shared slices
+      itk::ImageRegionConstIterator<ImageType> in( str.Images[i], region );
+      itk::ImageRegionIterator<ImageType> out( expected, region );
+      for ( ; !in.IsAtEnd(); ++in, ++out )
+        {
+        out.Set( in.Get() );
+        }
+      }
+
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    threader->SetNumberOfThreads( numberOfWriters );
+    threader->SetSingleMethod( PasteCallback, &str );
+    threader->SingleMethodExecute();
+
+    for ( unsigned int i = 0; i < numberOfWriters; ++i )
+      {
+      if ( str.Failed[i] )
+        {
+        std::cerr << "Writer " << i << " failed" << std::endl;
+        return EXIT_FAILURE;
+        }
+      }
+
+    ReaderType::Pointer outputReader = ReaderType::New();
+    outputReader->SetFileName( outputFilename );
+    outputReader->Update();
+
+    const unsigned long numberOfDifferences =
+      this->CompareImage<ImageType>( outputReader->GetOutput(), expected );
+    this->MeasurementNumericInteger( numberOfDifferences, "Number Of Pixels Different" );
+
+    // the single header update after the writers finish
+    unsigned long numberOfStatisticsDifferences = 0;
+    if ( itksys::SystemTools::GetFilenameLastExtension( outputFilename ) != ".vtk" )
+      {
+      MRCImageIOType::Pointer mrcIO = MRCImageIOType::New();
+      mrcIO->SetFileName( outputFilename.c_str() );
+      mrcIO->CommitHeaderStatistics();
+
+      numberOfStatisticsDifferences = this->CompareHeaderStatistics( outputFilename, expected );
+      this->MeasurementNumericInteger( numberOfStatisticsDifferences, "Number Of Statistics Different" );
+      }
+
+    return ( numberOfDifferences == 0 && numberOfStatisticsDifferences == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkImageFileWriterConcurrentPastingTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  ImageFileWriterConcurrentPastingTest test;
+  return test.Main(argc, argv);
+}
@@ -0,0 +1,330 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkByteSwapper.h"
+#include "itkIntTypes.h"
+
+#include "itkLocalFactory.h"
+#include "itkMRCImageIO.h"
+#include "itkMRCHeaderObject.h"
+#include "itktfRegression.h"
+
+#include <itksys/SystemTools.hxx>
+
+#include <fstream>
+#include <vector>
+#include <string.h>
+
+// This test reads the FEI extended header of a tilt series one section
+// at a time. Then files with SerialEM and Agard extended headers are
+// made from a file without one, in the byte order of its header, and
+// their entries are decoded and their images compared to the original.
+// An extended header is not read after its file is rewritten.
+class MRCHeaderObjectExtendedHeaderTest:
+  public itk::Regression
+{
+protected:
+
+  typedef itk::Image<unsigned char,3>             ImageType;
+  typedef itk::ImageFileReader<ImageType>         ReaderType;
+  typedef itk::Local::MRCImageIO                  MRCImageIOType;
+  typedef itk::Local::MRCHeaderObject             MRCHeaderObjectType;
+
+
+  static MRCHeaderObjectType::ConstPointer ReadHeader( ReaderType *reader )
+  {
+    MRCHeaderObjectType::ConstPointer header;
+    itk::ExposeMetaData<MRCHeaderObjectType::ConstPointer>( reader->GetImageIO()->GetMetaDataDictionary(),
+                                                            MRCImageIOType::MetaDataHeaderName, header );
+    return header;
+  }
+
+
+  // swaps values from the system byte order to that of the header
+  template <typename T>
+  static void SwapToHeader( const MRCHeaderObjectType *header, T *values, unsigned long count )
+  {
+    if ( header->IsOriginalHeaderBigEndian() )
+      {
+      itk::ByteSwapper<T>::SwapRangeFromSystemToBigEndian( values, count );
+      }
+    else
+      {
+      itk::ByteSwapper<T>::SwapRangeFromSystemToLittleEndian( values, count );
+      }
+  }
+
+
+  unsigned long TestFei( const std::string &filename )
+  {
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( filename );
+    reader->SetImageIO( MRCImageIOType::New() );
+    reader->UpdateOutputInformation();
+
+    MRCHeaderObjectType::ConstPointer header = ReadHeader( reader );
+    if ( !header || header->GetExtendedHeaderFormat() != MRCHeaderObjectType::MRCHEADER_EXTENDED_FEI )
+      {
+      std::cerr << "The FEI extended header was not recognized" << std::endl;
+      return 1;
+      }
+
+    unsigned long numberOfErrors = 0;
+    const unsigned int numberOfSections = header->GetNumberOfExtendedHeaderSections();
+    this->MeasurementNumericInteger( numberOfSections, "Number Of FEI Sections" );
+    if ( numberOfSections != static_cast<unsigned int>( header->header.nz ) )
+      {
+      ++numberOfErrors;
+      }
+
+    // the tilt angles increase by about a degree from -70
+    MRCHeaderObjectType::FeiExtendedHeader entry;
+    for ( unsigned int z = 0; z < numberOfSections; ++z )
+      {
+      if ( !header->GetFeiExtendedHeader( z, entry ) ||
+           vnl_math_abs( entry.atilt - ( -70.0f + z ) ) > 0.1 ||
+           entry.magnification != 34000.0f )
+        {
+        std::cerr << "The FEI entry of section " << z << " is incorrect" << std::endl;
+        ++numberOfErrors;
+        }
+      }
+    if ( header->GetFeiExtendedHeader( numberOfSections, entry ) )
+      {
+      std::cerr << "An FEI entry was decoded past the last section" << std::endl;
+      ++numberOfErrors;
+      }
+
+#if !defined(ITK_LEGACY_REMOVE)
+    // the deprecated extendedFeiHeader decodes the same entries
+    header->GetFeiExtendedHeader( 1, entry );
+    if ( !header->extendedFeiHeader ||
+         header->extendedFeiHeader[1].atilt != entry.atilt ||
+         header->extendedFeiHeader[numberOfSections].atilt != 0.0f )
+      {
+      std::cerr << "The deprecated extendedFeiHeader is incorrect" << std::endl;
+      ++numberOfErrors;
+      }
+#endif
+    return numberOfErrors;
+  }
+
+
+  // writes the header of the input file with the extended header
+  // fields changed, the extended header and the data of the input
+  void WriteWithExtendedHeader( const std::string &inputFilename, const std::string &outputFilename,
+                                itk::int16_t nint, itk::int16_t nreal, const std::vector<char> &extendedHeader )
+  {
+    std::ifstream in( inputFilename.c_str(), std::ios::in | std::ios::binary );
+    std::vector<char> buffer( itksys::SystemTools::FileLength( inputFilename.c_str() ) );
+    in.read( &buffer[0], buffer.size() );
+
+    MRCHeaderObjectType::Pointer header = MRCHeaderObjectType::New();
+    header->SetHeader( reinterpret_cast<const MRCHeaderObjectType::Header *>( &buffer[0] ) );
+    const unsigned long dataPosition = header->GetHeaderSize() + header->GetExtendedHeaderSize();
+    header->header.next = static_cast<itk::int32_t>( extendedHeader.size() );
+    header->header.nint = nint;
+    header->header.nreal = nreal;
+
+    MRCHeaderObjectType::Header rawHeader;
+    header->GetHeader( &rawHeader );
+
+    std::ofstream out( outputFilename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+    out.write( reinterpret_cast<const char *>( &rawHeader ), sizeof( rawHeader ) );
+    out.write( &extendedHeader[0], extendedHeader.size() );
+    out.write( &buffer[dataPosition], buffer.size() - dataPosition );
+  }
+
+
+  unsigned long CompareImages( const std::string &inputFilename, ReaderType *reader )
+  {
+    ReaderType::Pointer baselineReader = ReaderType::New();
+    baselineReader->SetFileName( inputFilename );
+    baselineReader->Update();
+
+    reader->Update();
+    return this->CompareImage<ImageType>( reader->GetOutput(), baselineReader->GetOutput() );
+  }
+
+
+  unsigned long TestSerialEM( const std::string &inputFilename, const std::string &outputFilename )
+  {
+    ReaderType::Pointer inputReader = ReaderType::New();
+    inputReader->SetFileName( inputFilename );
+    inputReader->SetImageIO( MRCImageIOType::New() );
+    inputReader->UpdateOutputInformation();
+    MRCHeaderObjectType::ConstPointer inputHeader = ReadHeader( inputReader );
+    const unsigned int nz = inputHeader->header.nz;
+
+    // tilt angle, piece coordinates, magnification and dose, with a
+    // reserved item between them
+    const itk::int16_t flags = 1 | 2 | 8 | 32 | 64;
+    const unsigned int entrySize = MRCHeaderObjectType::GetSerialEMSectionSize( flags );
+    std::vector<char> extendedHeader( entrySize * nz );
+    for ( unsigned int z = 0; z < nz; ++z )
+      {
+      // the dose of 3 * 256^2 is packed with a mantissa of 3 * 256
+      // and an exponent of 8
+      itk::int16_t items[8] = { static_cast<itk::int16_t>( z * 100 - 2000 ),
+                                static_cast<itk::int16_t>( z ), 7, static_cast<itk::int16_t>( -z ),
+                                340,
+                                3, 8 * 256,
+                                -1 };
+      SwapToHeader( inputHeader.GetPointer(), items, 8 );
+      memcpy( &extendedHeader[z * entrySize], items, entrySize );
+      }
+    this->WriteWithExtendedHeader( inputFilename, outputFilename, entrySize, flags, extendedHeader );
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( outputFilename );
+    reader->SetImageIO( MRCImageIOType::New() );
+    reader->UpdateOutputInformation();
+
+    MRCHeaderObjectType::ConstPointer header = ReadHeader( reader );
+    if ( !header || header->GetExtendedHeaderFormat() != MRCHeaderObjectType::MRCHEADER_EXTENDED_SERIALEM )
+      {
+      std::cerr << "The SerialEM extended header was not recognized" << std::endl;
+      return 1;
+      }
+
+    unsigned long numberOfErrors = 0;
+    MRCHeaderObjectType::SerialEMExtendedHeader entry;
+    for ( unsigned int z = 0; z < nz; ++z )
+      {
+      if ( !header->GetSerialEMExtendedHeader( z, entry ) ||
+           vnl_math_abs( entry.tiltAngle - ( z - 20.0f ) ) > 1e-4 ||
+           entry.pieceCoordinates[0] != static_cast<itk::int16_t>( z ) ||
+           entry.pieceCoordinates[1] != 7 ||
+           entry.pieceCoordinates[2] != -static_cast<itk::int16_t>( z ) ||
+           entry.magnification != 34000.0f ||
+           entry.exposureDose != 3.0f * 256.0f * 256.0f ||
+           entry.xstage != 0.0f )
+        {
+        std::cerr << "The SerialEM entry of section " << z << " is incorrect" << std::endl;
+        ++numberOfErrors;
+        }
+      }
+
+    return numberOfErrors + this->CompareImages( inputFilename, reader );
+  }
+
+
+  unsigned long TestAgard( const std::string &inputFilename, const std::string &outputFilename )
+  {
+    ReaderType::Pointer inputReader = ReaderType::New();
+    inputReader->SetFileName( inputFilename );
+    inputReader->SetImageIO( MRCImageIOType::New() );
+    inputReader->UpdateOutputInformation();
+    MRCHeaderObjectType::ConstPointer inputHeader = ReadHeader( inputReader );
+    const unsigned int nz = inputHeader->header.nz;
+
+    const itk::int16_t nint = 2;
+    const itk::int16_t nreal = 3;
+    std::vector<char> extendedHeader( 4 * ( nint + nreal ) * nz );
+    for ( unsigned int z = 0; z < nz; ++z )
+      {
+      itk::int32_t integers[nint] = { static_cast<itk::int32_t>( z ), -1 };
+      float reals[nreal] = { 0.5f * z, 1.0f, -2.0f };
+      SwapToHeader( inputHeader.GetPointer(), integers, nint );
+      SwapToHeader( inputHeader.GetPointer(), reals, nreal );
+      memcpy( &extendedHeader[4 * ( nint + nreal ) * z], integers, 4 * nint );
+      memcpy( &extendedHeader[4 * ( nint + nreal ) * z + 4 * nint], reals, 4 * nreal );
+      }
+    this->WriteWithExtendedHeader( inputFilename, outputFilename, nint, nreal, extendedHeader );
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( outputFilename );
+    reader->SetImageIO( MRCImageIOType::New() );
+    reader->UpdateOutputInformation();
+
+    MRCHeaderObjectType::ConstPointer header = ReadHeader( reader );
+    if ( !header || header->GetExtendedHeaderFormat() != MRCHeaderObjectType::MRCHEADER_EXTENDED_AGARD )
+      {
+      std::cerr << "The Agard extended header was not recognized" << std::endl;
+      return 1;
+      }
+
+    unsigned long numberOfErrors = 0;
+    std::vector<itk::int32_t> integers;
+    std::vector<float> reals;
+    // the sections are decoded in reverse, each independently
+    for ( unsigned int z = nz; z-- > 0; )
+      {
+      if ( !header->GetAgardExtendedHeader( z, integers, reals ) ||
+           integers.size() != static_cast<size_t>( nint ) || reals.size() != static_cast<size_t>( nreal ) ||
+           integers[0] != static_cast<itk::int32_t>( z ) || integers[1] != -1 ||
+           reals[0] != 0.5f * z || reals[1] != 1.0f || reals[2] != -2.0f )
+        {
+        std::cerr << "The Agard entry of section " << z << " is incorrect" << std::endl;
+        ++numberOfErrors;
+        }
+      }
+
+    return numberOfErrors + this->CompareImages( inputFilename, reader );
+  }
+
+
+  // the header of the Agard file is read, then the file is rewritten
+  // with a longer extended header before its entries are accessed
+  unsigned long TestChangedFile( const std::string &inputFilename, const std::string &outputFilename )
+  {
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( outputFilename );
+    reader->SetImageIO( MRCImageIOType::New() );
+    reader->UpdateOutputInformation();
+    MRCHeaderObjectType::ConstPointer header = ReadHeader( reader );
+    if ( !header )
+      {
+      return 1;
+      }
+
+    const unsigned int entrySize = 4 * ( header->header.nint + header->header.nreal );
+    const std::vector<char> extendedHeader( entrySize * ( header->header.nz + 1 ), 0 );
+    this->WriteWithExtendedHeader( inputFilename, outputFilename, header->header.nint, header->header.nreal, extendedHeader );
+
+    std::vector<itk::int32_t> integers;
+    std::vector<float> reals;
+    if ( header->GetAgardExtendedHeader( 0, integers, reals ) )
+      {
+      std::cerr << "The extended header was read from the rewritten file" << std::endl;
+      return 1;
+      }
+    return 0;
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    if( argc < 5 )
+      {
+      std::cerr << "Usage: " << argv[0] << " feiInputFile inputFile outputSerialEMFile outputAgardFile" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const unsigned long feiErrors = this->TestFei( argv[1] );
+    this->MeasurementNumericInteger( feiErrors, "Number Of FEI Errors" );
+
+    const unsigned long serialEMErrors = this->TestSerialEM( argv[2], argv[3] );
+    this->MeasurementNumericInteger( serialEMErrors, "Number Of SerialEM Errors" );
+
+    const unsigned long agardErrors = this->TestAgard( argv[2], argv[4] );
+    this->MeasurementNumericInteger( agardErrors, "Number Of Agard Errors" );
+
+    const unsigned long changedFileErrors = this->TestChangedFile( argv[2], argv[4] );
+    this->MeasurementNumericInteger( changedFileErrors, "Number Of Changed File Errors" );
+
+    return ( feiErrors == 0 && serialEMErrors == 0 && agardErrors == 0 && changedFileErrors == 0 ) ? 
+      EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkMRCHeaderObjectExtendedHeaderTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  MRCHeaderObjectExtendedHeaderTest test;
+  return test.Main(argc, argv);
+}
@@ -0,0 +1,132 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkExtractImageFilter.h"
+
+#include "itkLocalFactory.h"
+#include "itkMRCImageIO.h"
+#include "itktfRegression.h"
+
+#include <itksys/SystemTools.hxx>
+
+#include <sstream>
+
+// This test streams an image into a new MRC file in the bricked
+// layout, and compares the whole image and orthogonal slices in each
+// direction read from it to the original. With a codec the bricks are
+// compressed, and the image is written in one piece.
+class MRCImageIOBrickedTest:
+  public itk::Regression
+{
+protected:
+
+  typedef float                                   PixelType;
+  typedef itk::Image<PixelType,3>                 ImageType;
+  typedef itk::ImageFileReader<ImageType>         ReaderType;
+  typedef itk::ImageFileWriter<ImageType>         WriterType;
+
+
+  unsigned long CompareRegion( ReaderType *reader,
+                               ImageType::ConstPointer baselineImage,
+                               const ImageType::RegionType &region,
+                               const std::string &name )
+  {
+    typedef itk::ExtractImageFilter<ImageType, ImageType> ExtractImageFilter;
+    ExtractImageFilter::Pointer extractor = ExtractImageFilter::New();
+    extractor->SetInput( reader->GetOutput() );
+    extractor->SetExtractionRegion( region );
+
+    std::cout << "=== Updating " << name << " IORegion ==" << std::endl;
+    extractor->UpdateLargestPossibleRegion();
+
+    return this->CompareImage<ImageType>( extractor->GetOutput(), baselineImage, region );
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    if( argc < 3 )
+      {
+      std::cerr << "Usage: " << argv[0] << " inputFile outputFile [brickSize] [zlib|lz]" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const std::string inputFilename = argv[1];
+    const std::string outputFilename = argv[2];
+    const unsigned int brickSize = ( argc > 3 ) ? atoi( argv[3] ) : 16;
+    const std::string codec = ( argc > 4 ) ? argv[4] : "";
+
+    itksys::SystemTools::RemoveFile( outputFilename.c_str() );
+
+    ReaderType::Pointer baselineReader = ReaderType::New();
+    baselineReader->SetFileName( inputFilename );
+    baselineReader->UpdateLargestPossibleRegion();
+
+    ImageType::ConstPointer baselineImage = baselineReader->GetOutput();
+    const ImageType::RegionType largestRegion = baselineImage->GetLargestPossibleRegion();
+
+    ////////////////////////////////////////////////
+    // stream the bricked file, the splits do not fall on the bricks
+    itk::Local::MRCImageIO::Pointer writerIO = itk::Local::MRCImageIO::New();
+    writerIO->SetBrickSize( brickSize );
+    if ( !codec.empty() )
+      {
+      writerIO->SetCompressionCodec( codec == "lz" ? 
+                                     itk::Local::ChunkCompressor::LZCompression :
+                                     itk::Local::ChunkCompressor::ZlibCompression );
+      }
+
+    WriterType::Pointer writer = WriterType::New();
+    writer->SetInput( baselineImage );
+    writer->SetFileName( outputFilename );
+    writer->SetImageIO( writerIO );
+    writer->SetNumberOfStreamDivisions( 3 );
+    writer->SetUseCompression( !codec.empty() );
+    writer->Update();
+
+    itk::Local::MRCImageIO::Pointer io = itk::Local::MRCImageIO::New();
+    io->SetFileName( outputFilename.c_str() );
+    io->ReadImageInformation();
+    this->MeasurementNumericBoolean( io->IsBricked(), "MRCImageIO::IsBricked" );
+    this->MeasurementNumericBoolean( io->IsCompressed(), "MRCImageIO::IsCompressed" );
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( outputFilename );
+    reader->SetImageIO( io );
+    reader->UseStreamingOn();
+
+    unsigned long numberOfDifferences = 0;
+
+    numberOfDifferences += this->CompareRegion( reader, baselineImage, largestRegion, "full" );
+
+    ////////////////////////////////////////////////
+    // a slice normal to each direction
+    for ( unsigned int i = 0; i < ImageType::ImageDimension; ++i )
+      {
+      ImageType::RegionType slice = largestRegion;
+      slice.SetIndex( i, largestRegion.GetIndex()[i] + largestRegion.GetSize()[i]/2 + 1 );
+      slice.SetSize( i, 1 );
+
+      std::ostringstream name;
+      name << "slice" << i;
+      numberOfDifferences += this->CompareRegion( reader, baselineImage, slice, name.str() );
+      }
+
+    this->MeasurementNumericInteger( numberOfDifferences, "Number Of Pixels Different" );
+
+    const bool layout = io->IsBricked() && io->IsCompressed() == !codec.empty();
+    return ( numberOfDifferences == 0 && layout ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkMRCImageIOBrickedTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  MRCImageIOBrickedTest test;
+  return test.Main(argc, argv);
+}
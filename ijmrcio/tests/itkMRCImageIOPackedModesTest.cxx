@@ -0,0 +1,223 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkIntTypes.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+#include "itkStreamingImageFilter.h"
+
+#include "itkLocalFactory.h"
+#include "itkMRCImageIO.h"
+#include "itkSIMDPixelConverter.h"
+#include "itktfRegression.h"
+
+#include <itksys/SystemTools.hxx>
+
+#include <fstream>
+#include <vector>
+#include <string.h>
+
+// This test streams an image into a mode 12 file of half precision
+// values, and compares it read in pieces to the values rounded to
+// half precision. Then a mode 101 file of 4-bit values with rows of
+// an odd width is made from a mode 0 file, and regions beginning at
+// both nibbles are compared to the values written.
+class MRCImageIOPackedModesTest:
+  public itk::Regression
+{
+protected:
+
+  typedef itk::Image<float,3>                     FloatImageType;
+  typedef itk::Image<unsigned char,3>             ByteImageType;
+  typedef itk::ImageFileReader<FloatImageType>    FloatReaderType;
+  typedef itk::ImageFileWriter<FloatImageType>    FloatWriterType;
+  typedef itk::ImageFileReader<ByteImageType>     ByteReaderType;
+  typedef itk::ImageFileWriter<ByteImageType>     ByteWriterType;
+
+
+  static float RoundToHalf( float value )
+  {
+    unsigned short half;
+    itk::Local::SIMDPixelConverter::FloatToHalf( &value, &half, 1 );
+    itk::Local::SIMDPixelConverter::HalfToFloat( &half, &value, 1 );
+    return value;
+  }
+
+
+  unsigned long TestHalfFloat( const std::string &inputFilename, const std::string &outputFilename )
+  {
+    itksys::SystemTools::RemoveFile( outputFilename.c_str() );
+
+    FloatReaderType::Pointer baselineReader = FloatReaderType::New();
+    baselineReader->SetFileName( inputFilename );
+    baselineReader->UpdateLargestPossibleRegion();
+
+    FloatImageType::ConstPointer baselineImage = baselineReader->GetOutput();
+
+    itk::Local::MRCImageIO::Pointer writerIO = itk::Local::MRCImageIO::New();
+    writerIO->UseHalfFloatOn();
+
+    FloatWriterType::Pointer writer = FloatWriterType::New();
+    writer->SetInput( baselineImage );
+    writer->SetFileName( outputFilename );
+    writer->SetImageIO( writerIO );
+    writer->SetNumberOfStreamDivisions( 3 );
+    writer->Update();
+
+    FloatReaderType::Pointer reader = FloatReaderType::New();
+    reader->SetFileName( outputFilename );
+    reader->SetImageIO( itk::Local::MRCImageIO::New() );
+    reader->UseStreamingOn();
+
+    typedef itk::StreamingImageFilter<FloatImageType, FloatImageType> StreamingFilter;
+    StreamingFilter::Pointer streamer = StreamingFilter::New();
+    streamer->SetInput( reader->GetOutput() );
+    streamer->SetNumberOfStreamDivisions( 4 );
+    streamer->UpdateLargestPossibleRegion();
+
+    unsigned long numberOfDifferences = 0;
+    itk::ImageRegionConstIterator<FloatImageType> bit( baselineImage, baselineImage->GetLargestPossibleRegion() );
+    itk::ImageRegionConstIterator<FloatImageType> it( streamer->GetOutput(), streamer->GetOutput()->GetLargestPossibleRegion() );
+    for ( bit.GoToBegin(), it.GoToBegin(); !bit.IsAtEnd() && !it.IsAtEnd(); ++bit, ++it )
+      {
+      if ( it.Get() != RoundToHalf( bit.Get() ) )
+        {
+        ++numberOfDifferences;
+        }
+      }
+    if ( !bit.IsAtEnd() || !it.IsAtEnd() )
+      {
+      std::cerr << "The mode 12 file does not have the size of the image" << std::endl;
+      ++numberOfDifferences;
+      }
+
+    this->MeasurementNumericInteger( itksys::SystemTools::FileLength( outputFilename.c_str() ), "Mode 12 File Length" );
+    return numberOfDifferences;
+  }
+
+
+  unsigned long TestPackedNibbles( const std::string &outputFilename )
+  {
+    // an image with rows of an odd number of 4-bit values
+    ByteImageType::SizeType size;
+    size[0] = 37;
+    size[1] = 11;
+    size[2] = 5;
+    ByteImageType::RegionType largestRegion( size );
+
+    ByteImageType::Pointer image = ByteImageType::New();
+    image->SetRegions( largestRegion );
+    image->Allocate();
+
+    unsigned long i = 0;
+    itk::ImageRegionIterator<ByteImageType> iit( image, largestRegion );
+    for ( iit.GoToBegin(); !iit.IsAtEnd(); ++iit, ++i )
+      {
+      iit.Set( static_cast<unsigned char>( ( i * 7 + i / 37 ) % 16 ) );
+      }
+
+    itksys::SystemTools::RemoveFile( outputFilename.c_str() );
+
+    ByteWriterType::Pointer writer = ByteWriterType::New();
+    writer->SetInput( image );
+    writer->SetFileName( outputFilename );
+    writer->SetImageIO( itk::Local::MRCImageIO::New() );
+    writer->Update();
+
+    // the mode 0 file is rewritten in mode 101, the first value of
+    // each byte in its low nibble and each row padded to whole bytes
+    const unsigned long headerSize = 1024;
+    const unsigned long rowBytes = ( size[0] + 1 ) / 2;
+    std::vector<char> header( headerSize );
+    std::vector<unsigned char> values( size[0] * size[1] * size[2] );
+    {
+    std::ifstream in( outputFilename.c_str(), std::ios::in | std::ios::binary );
+    in.read( &header[0], headerSize );
+    in.read( reinterpret_cast<char *>( &values[0] ), values.size() );
+    }
+    const itk::int32_t mode = itk::Local::MRCHeaderObject::MRCHEADER_MODE_UINT4;
+    memcpy( &header[12], &mode, 4 );
+
+    std::vector<unsigned char> packed( rowBytes * size[1] * size[2], 0 );
+    for ( unsigned long r = 0; r < size[1] * size[2]; ++r )
+      {
+      for ( unsigned long x = 0; x < size[0]; ++x )
+        {
+        packed[r * rowBytes + x / 2] |= values[r * size[0] + x] << ( 4 * ( x % 2 ) );
+        }
+      }
+    {
+    std::ofstream out( outputFilename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+    out.write( &header[0], headerSize );
+    out.write( reinterpret_cast<char *>( &packed[0] ), packed.size() );
+    }
+
+    // regions beginning at even and odd values, of even and odd widths
+    unsigned long numberOfDifferences = 0;
+    const long regions[4][6] = { { 0, 0, 0, 37, 11, 5 },
+                                 { 1, 2, 1, 36, 7, 3 },
+                                 { 3, 0, 2, 4, 11, 1 },
+                                 { 36, 10, 4, 1, 1, 1 } };
+    for ( unsigned int r = 0; r < 4; ++r )
+      {
+      ByteImageType::RegionType region;
+      for ( unsigned int d = 0; d < 3; ++d )
+        {
+        region.SetIndex( d, regions[r][d] );
+        region.SetSize( d, regions[r][d+3] );
+        }
+
+      ByteReaderType::Pointer reader = ByteReaderType::New();
+      reader->SetFileName( outputFilename );
+      reader->SetImageIO( itk::Local::MRCImageIO::New() );
+      reader->UseStreamingOn();
+      reader->UpdateOutputInformation();
+      reader->GetOutput()->SetRequestedRegion( region );
+      reader->Update();
+
+      itk::ImageRegionConstIterator<ByteImageType> it( reader->GetOutput(), region );
+      itk::ImageRegionConstIterator<ByteImageType> bit( image, region );
+      for ( it.GoToBegin(), bit.GoToBegin(); !it.IsAtEnd(); ++it, ++bit )
+        {
+        if ( it.Get() != bit.Get() )
+          {
+          ++numberOfDifferences;
+          }
+        }
+      }
+
+    return numberOfDifferences;
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    if( argc < 4 )
+      {
+      std::cerr << "Usage: " << argv[0] << " inputFile outputHalfFile outputNibbleFile" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    std::cout << "Kernel: " << itk::Local::SIMDPixelConverter::GetKernelName() << std::endl;
+
+    const unsigned long halfDifferences = this->TestHalfFloat( argv[1], argv[2] );
+    this->MeasurementNumericInteger( halfDifferences, "Number Of Mode 12 Pixels Different" );
+
+    const unsigned long nibbleDifferences = this->TestPackedNibbles( argv[3] );
+    this->MeasurementNumericInteger( nibbleDifferences, "Number Of Mode 101 Pixels Different" );
+
+    return ( halfDifferences == 0 && nibbleDifferences == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkMRCImageIOPackedModesTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  MRCImageIOPackedModesTest test;
+  return test.Main(argc, argv);
+}
@@ -0,0 +1,163 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageRegionConstIterator.h"
+
+#include "itkLocalFactory.h"
+#include "itkMRCImageIO.h"
+#include "itktfRegression.h"
+
+#include <itksys/SystemTools.hxx>
+
+#include <sstream>
+#include <vector>
+
+// This test streams an image into a new MRC file with pyramid levels,
+// and compares each level read with LevelOfDetail to the means of
+// 2x2x2 blocks of the level before, computed here.
+class MRCImageIOPyramidTest:
+  public itk::Regression
+{
+protected:
+
+  typedef unsigned char                           PixelType;
+  typedef itk::Image<PixelType,3>                 ImageType;
+  typedef itk::ImageFileReader<ImageType>         ReaderType;
+  typedef itk::ImageFileWriter<ImageType>         WriterType;
+
+
+  // bins the values of an image of size by 2, into binnedSize
+  static std::vector<double> Bin( const std::vector<double> &values, const unsigned long size[3],
+                                  unsigned long binnedSize[3] )
+  {
+    for ( unsigned int i = 0; i < 3; ++i )
+      {
+      binnedSize[i] = ( size[i] + 1 ) / 2;
+      }
+    std::vector<double> binned( binnedSize[0] * binnedSize[1] * binnedSize[2], 0.0 );
+    std::vector<unsigned int> count( binned.size(), 0 );
+    for ( unsigned long z = 0; z < size[2]; ++z )
+      {
+      for ( unsigned long y = 0; y < size[1]; ++y )
+        {
+        for ( unsigned long x = 0; x < size[0]; ++x )
+          {
+          const unsigned long b = ( ( z/2 ) * binnedSize[1] + y/2 ) * binnedSize[0] + x/2;
+          binned[b] += values[ ( z * size[1] + y ) * size[0] + x ];
+          ++count[b];
+          }
+        }
+      }
+    for ( unsigned long i = 0; i < binned.size(); ++i )
+      {
+      binned[i] /= count[i];
+      }
+    return binned;
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    if( argc < 3 )
+      {
+      std::cerr << "Usage: " << argv[0] << " inputFile outputFile [numberOfLevels]" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const std::string inputFilename = argv[1];
+    const std::string outputFilename = argv[2];
+    const unsigned int numberOfLevels = ( argc > 3 ) ? atoi( argv[3] ) : 2;
+
+    itksys::SystemTools::RemoveFile( outputFilename.c_str() );
+
+    ReaderType::Pointer baselineReader = ReaderType::New();
+    baselineReader->SetFileName( inputFilename );
+    baselineReader->UpdateLargestPossibleRegion();
+
+    ImageType::ConstPointer baselineImage = baselineReader->GetOutput();
+
+    ////////////////////////////////////////////////
+    // stream the file, the levels are built as the sections are written
+    itk::Local::MRCImageIO::Pointer writerIO = itk::Local::MRCImageIO::New();
+    writerIO->SetNumberOfPyramidLevels( numberOfLevels );
+
+    WriterType::Pointer writer = WriterType::New();
+    writer->SetInput( baselineImage );
+    writer->SetFileName( outputFilename );
+    writer->SetImageIO( writerIO );
+    writer->SetNumberOfStreamDivisions( 3 );
+    writer->Update();
+
+    this->MeasurementNumericInteger( itk::Local::MRCImageIO::GetNumberOfPyramidLevelsOfFile( outputFilename ),
+                                     "Number Of Pyramid Levels" );
+
+    // the values of the full resolution image
+    unsigned long size[3];
+    for ( unsigned int i = 0; i < 3; ++i )
+      {
+      size[i] = baselineImage->GetLargestPossibleRegion().GetSize()[i];
+      }
+    std::vector<double> values;
+    itk::ImageRegionConstIterator<ImageType> it( baselineImage, baselineImage->GetLargestPossibleRegion() );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+      {
+      values.push_back( it.Get() );
+      }
+
+    unsigned long numberOfDifferences = 0;
+    for ( unsigned int level = 1; level <= numberOfLevels; ++level )
+      {
+      unsigned long binnedSize[3];
+      values = Bin( values, size, binnedSize );
+
+      itk::Local::MRCImageIO::Pointer io = itk::Local::MRCImageIO::New();
+      io->SetLevelOfDetail( level );
+
+      ReaderType::Pointer reader = ReaderType::New();
+      reader->SetFileName( outputFilename );
+      reader->SetImageIO( io );
+      reader->UpdateLargestPossibleRegion();
+
+      std::ostringstream name;
+      name << "Level " << level;
+      this->MeasurementInsightSize( reader->GetOutput()->GetLargestPossibleRegion().GetSize(), name.str() + " Size" );
+
+      // the means are rounded to the pixel type
+      unsigned long i = 0;
+      itk::ImageRegionConstIterator<ImageType> lit( reader->GetOutput(), reader->GetOutput()->GetLargestPossibleRegion() );
+      for ( lit.GoToBegin(); !lit.IsAtEnd() && i < values.size(); ++lit, ++i )
+        {
+        if ( vnl_math_abs( lit.Get() - values[i] ) > 0.5 + 1e-6 )
+          {
+          ++numberOfDifferences;
+          }
+        }
+      if ( i != values.size() || !lit.IsAtEnd() )
+        {
+        std::cerr << name.str() << " does not have the binned size" << std::endl;
+        ++numberOfDifferences;
+        }
+
+      for ( unsigned int d = 0; d < 3; ++d )
+        {
+        size[d] = binnedSize[d];
+        }
+      }
+
+    this->MeasurementNumericInteger( numberOfDifferences, "Number Of Pixels Different" );
+
+    return ( numberOfDifferences == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkMRCImageIOPyramidTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  MRCImageIOPyramidTest test;
+  return test.Main(argc, argv);
+}
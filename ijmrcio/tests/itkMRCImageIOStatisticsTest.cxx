@@ -0,0 +1,298 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageRegionIterator.h"
+#include "itkMetaDataObject.h"
+#include "itkRGBPixel.h"
+
+#include "itkLocalFactory.h"
+#include "itkMRCImageIO.h"
+#include "itktfRegression.h"
+
+#include <cmath>
+#include <complex>
+#include <vector>
+
+// This test streams an image into a new MRC file, then pastes a
+// region into it, and verifies that the min, max, mean and rms in
+// the header describe all the pixels in the file. The statistics of
+// streamed files of values with a large mean, of complex pixels and
+// of RGB pixels are verified too.
+class MRCImageIOStatisticsTest:
+  public itk::Regression
+{
+protected:
+
+  typedef float                                   PixelType;
+  typedef itk::Image<PixelType,3>                 ImageType;
+  typedef itk::ImageFileReader<ImageType>         ReaderType;
+  typedef itk::ImageFileWriter<ImageType>         WriterType;
+  typedef itk::Local::MRCImageIO                  MRCImageIOType;
+  typedef itk::Local::MRCHeaderObject             MRCHeaderObjectType;
+
+  typedef std::complex<float>                     ComplexPixelType;
+  typedef itk::Image<ComplexPixelType,3>          ComplexImageType;
+  typedef itk::RGBPixel<unsigned char>            RGBPixelType;
+  typedef itk::Image<RGBPixelType,3>              RGBImageType;
+
+
+  static bool IsClose( double a, double b )
+  {
+    return std::fabs( a - b ) <= 1e-4 * ( 1.0 + std::fabs( a ) + std::fabs( b ) );
+  }
+
+
+  // the values of a pixel in the statistics of the header: the
+  // magnitude of a complex pixel, and each component of an RGB pixel
+  static void AppendValues( float pixel, std::vector<double> &values )
+  {
+    values.push_back( pixel );
+  }
+  static void AppendValues( const std::complex<float> &pixel, std::vector<double> &values )
+  {
+    values.push_back( std::abs( std::complex<double>( pixel.real(), pixel.imag() ) ) );
+  }
+  static void AppendValues( const itk::RGBPixel<unsigned char> &pixel, std::vector<double> &values )
+  {
+    for ( unsigned int i = 0; i < 3; ++i )
+      {
+      values.push_back( pixel[i] );
+      }
+  }
+
+
+  // compares the statistics in the header of the file to those
+  // of the pixels in the file, returns the number of differences. If
+  // the minimum is not exact, the header's only needs to bound it.
+  template <typename TImage>
+  unsigned long CompareHeaderStatistics( const std::string &filename, const std::string &name,
+                                         bool exactMinimum = true )
+  {
+    typedef itk::ImageFileReader<TImage> ImageReaderType;
+    typename ImageReaderType::Pointer reader = ImageReaderType::New();
+    reader->SetFileName( filename );
+    reader->Update();
+
+    typename TImage::ConstPointer image = reader->GetOutput();
+
+    std::vector<double> values;
+    itk::ImageRegionConstIterator<TImage> it( image, image->GetBufferedRegion() );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+      {
+      AppendValues( it.Get(), values );
+      }
+
+    // the deviations are summed in a second pass, so that the
+    // reference does not lose precision when the mean is large
+    double minimum = values[0];
+    double maximum = values[0];
+    double sum = 0.0;
+    for ( unsigned long i = 0; i < values.size(); ++i )
+      {
+      minimum = vnl_math_min( minimum, values[i] );
+      maximum = vnl_math_max( maximum, values[i] );
+      sum += values[i];
+      }
+    const double mean = sum / values.size();
+
+    double sumOfSquaredDeviations = 0.0;
+    for ( unsigned long i = 0; i < values.size(); ++i )
+      {
+      sumOfSquaredDeviations += ( values[i] - mean ) * ( values[i] - mean );
+      }
+    const double rms = std::sqrt( sumOfSquaredDeviations / values.size() );
+
+    MRCHeaderObjectType::ConstPointer header;
+    if ( !itk::ExposeMetaData<MRCHeaderObjectType::ConstPointer>( reader->GetImageIO()->GetMetaDataDictionary(),
+                                                                  MRCImageIOType::MetaDataHeaderName, header ) )
+      {
+      std::cerr << "Missing MRC header in: " << filename << std::endl;
+      return 1;
+      }
+
+    std::cout << name << " header min: " << header->header.amin << " max: " << header->header.amax
+              << " mean: " << header->header.amean << " rms: " << header->header.rms << std::endl;
+    std::cout << name << " pixels min: " << minimum << " max: " << maximum
+              << " mean: " << mean << " rms: " << rms << std::endl;
+
+    unsigned long numberOfDifferences = 0;
+    if ( exactMinimum )
+      {
+      numberOfDifferences += !IsClose( header->header.amin, minimum );
+      }
+    else
+      {
+      numberOfDifferences += ( header->header.amin > minimum );
+      }
+    numberOfDifferences += !IsClose( header->header.amax, maximum );
+    numberOfDifferences += !IsClose( header->header.amean, mean );
+    numberOfDifferences += !IsClose( header->header.rms, rms );
+    return numberOfDifferences;
+  }
+
+
+  // streams the image into a new file
+  template <typename TImage>
+  static void WriteStreamed( TImage *image, const std::string &filename )
+  {
+    typedef itk::ImageFileWriter<TImage> ImageWriterType;
+    typename ImageWriterType::Pointer writer = ImageWriterType::New();
+    writer->SetInput( image );
+    writer->SetFileName( filename );
+    writer->SetImageIO( MRCImageIOType::New() );
+    writer->SetNumberOfStreamDivisions( 5 );
+    writer->Update();
+  }
+
+
+  // an image of the values of the input, with a large offset which
+  // cancels the significant digits of the sum of squares
+  static ImageType::Pointer MakeOffsetImage( const ImageType *input )
+  {
+    ImageType::Pointer image = ImageType::New();
+    image->SetRegions( input->GetLargestPossibleRegion() );
+    image->Allocate();
+
+    itk::ImageRegionConstIterator<ImageType> in( input, input->GetLargestPossibleRegion() );
+    itk::ImageRegionIterator<ImageType> out( image, input->GetLargestPossibleRegion() );
+    for ( ; !in.IsAtEnd(); ++in, ++out )
+      {
+      out.Set( in.Get() + 1.0e6f );
+      }
+    return image;
+  }
+
+
+  static ComplexImageType::Pointer MakeComplexImage( const ImageType *input )
+  {
+    ComplexImageType::Pointer image = ComplexImageType::New();
+    image->SetRegions( input->GetLargestPossibleRegion() );
+    image->Allocate();
+
+    itk::ImageRegionConstIterator<ImageType> in( input, input->GetLargestPossibleRegion() );
+    itk::ImageRegionIterator<ComplexImageType> out( image, input->GetLargestPossibleRegion() );
+    for ( ; !in.IsAtEnd(); ++in, ++out )
+      {
+      out.Set( ComplexPixelType( in.Get() - 100.0f, 0.5f * in.Get() + 3.0f ) );
+      }
+    return image;
+  }
+
+
+  static RGBImageType::Pointer MakeRGBImage( const ImageType *input )
+  {
+    RGBImageType::Pointer image = RGBImageType::New();
+    image->SetRegions( input->GetLargestPossibleRegion() );
+    image->Allocate();
+
+    itk::ImageRegionConstIterator<ImageType> in( input, input->GetLargestPossibleRegion() );
+    itk::ImageRegionIterator<RGBImageType> out( image, input->GetLargestPossibleRegion() );
+    for ( ; !in.IsAtEnd(); ++in, ++out )
+      {
+      const unsigned int v = static_cast<unsigned int>( in.Get() );
+      RGBPixelType pixel;
+      pixel[0] = static_cast<unsigned char>( v );
+      pixel[1] = static_cast<unsigned char>( 255 - v );
+      pixel[2] = static_cast<unsigned char>( ( v * 7 ) % 256 );
+      out.Set( pixel );
+      }
+    return image;
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    if( argc < 5 )
+      {
+      std::cerr << "Usage: " << argv[0] << " inputFile outputFile outputComplexFile outputRGBFile" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const std::string inputFilename = argv[1];
+    const std::string outputFilename = argv[2];
+    const std::string outputComplexFilename = argv[3];
+    const std::string outputRGBFilename = argv[4];
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( inputFilename );
+    reader->Update();
+
+    ImageType::Pointer image = reader->GetOutput();
+    image->DisconnectPipeline();
+
+    unsigned long numberOfDifferences = 0;
+
+    ////////////////////////////////////////////////
+    // the magnitude of complex pixels, and the components of RGB
+    // pixels
+    WriteStreamed<ComplexImageType>( MakeComplexImage( image ), outputComplexFilename );
+    numberOfDifferences += this->CompareHeaderStatistics<ComplexImageType>( outputComplexFilename, "complex" );
+
+    WriteStreamed<RGBImageType>( MakeRGBImage( image ), outputRGBFilename );
+    numberOfDifferences += this->CompareHeaderStatistics<RGBImageType>( outputRGBFilename, "rgb" );
+
+    ////////////////////////////////////////////////
+    // values with a mean much larger than their deviation
+    WriteStreamed<ImageType>( MakeOffsetImage( image ), outputFilename );
+    numberOfDifferences += this->CompareHeaderStatistics<ImageType>( outputFilename, "offset" );
+
+    ////////////////////////////////////////////////
+    // stream the image into a new file
+    WriteStreamed<ImageType>( image, outputFilename );
+    numberOfDifferences += this->CompareHeaderStatistics<ImageType>( outputFilename, "streamed" );
+
+    ////////////////////////////////////////////////
+    // paste a region of brighter pixels into the file
+    const ImageType::RegionType largestRegion = image->GetLargestPossibleRegion();
+    ImageType::RegionType pasteRegion = largestRegion;
+    for ( unsigned int i = 0; i < ImageType::ImageDimension; ++i )
+      {
+      pasteRegion.SetIndex( i, largestRegion.GetIndex()[i] + largestRegion.GetSize()[i]/4 );
+      pasteRegion.SetSize( i, largestRegion.GetSize()[i]/2 );
+      }
+
+    itk::ImageRegionIterator<ImageType> it( image, pasteRegion );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+      {
+      it.Set( it.Get() + 100.0f );
+      }
+    image->Modified();
+
+    MRCImageIOType::Pointer pasteIO = MRCImageIOType::New();
+    pasteIO->UpdateStatisticsWhenPastingOn();
+
+    itk::ImageIORegion ioRegion( ImageType::ImageDimension );
+    for ( unsigned int i = 0; i < ImageType::ImageDimension; ++i )
+      {
+      ioRegion.SetIndex( i, pasteRegion.GetIndex()[i] );
+      ioRegion.SetSize( i, pasteRegion.GetSize()[i] );
+      }
+
+    WriterType::Pointer paster = WriterType::New();
+    paster->SetInput( image );
+    paster->SetFileName( outputFilename );
+    paster->SetImageIO( pasteIO );
+    paster->SetIORegion( ioRegion );
+    paster->Update();
+
+    // the pasted pixels only increased, so the maximum is exact, but
+    // the minimum may have been in the pasted region
+    numberOfDifferences += this->CompareHeaderStatistics<ImageType>( outputFilename, "pasted", false );
+
+    this->MeasurementNumericInteger( numberOfDifferences, "Number Of Statistics Different" );
+
+    return ( numberOfDifferences == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkMRCImageIOStatisticsTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  MRCImageIOStatisticsTest test;
+  return test.Main(argc, argv);
+}
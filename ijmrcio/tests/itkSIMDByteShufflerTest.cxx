@@ -0,0 +1,206 @@
+#include "itkSIMDByteShuffler.h"
+#include "itkChunkCompressor.h"
+#include "itkMRCImageIO.h"
+#include "itkIntTypes.h"
+#include "itkTimeProbe.h"
+#include "itktfRegression.h"
+
+#include <itksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+#include <string.h>
+
+// This test compares the shuffling of the SIMDByteShuffler to a
+// simple transpose for several component sizes, lengths and
+// alignments, and checks the inverses. Then the sections of each MRC
+// file, converted to 16-bit integers and floats, are compressed with
+// and without the shuffle, to report the compression and the speed
+// of the shuffle.
+class SIMDByteShufflerTest:
+  public itk::Regression
+{
+protected:
+
+  unsigned long CompareShuffle( unsigned int componentSize )
+  {
+    unsigned long numberOfDifferences = 0;
+
+    for ( size_t count = 0; count < 67; ++count )
+      {
+      for ( size_t offset = 0; offset < componentSize; ++offset )
+        {
+        const size_t numberOfBytes = count*componentSize;
+        std::vector<char> source( numberOfBytes + offset + 1 );
+        for ( size_t i = 0; i < source.size(); ++i )
+          {
+          source[i] = static_cast<char>( i*7 + count );
+          }
+
+        // the expected planes, and the components with their bytes reversed
+        std::vector<char> expected( numberOfBytes + 1 );
+        std::vector<char> expectedSwapped( numberOfBytes + 1 );
+        for ( size_t i = 0; i < count; ++i )
+          {
+          for ( unsigned int b = 0; b < componentSize; ++b )
+            {
+            expected[b*count + i] = source[offset + i*componentSize + b];
+            expectedSwapped[i*componentSize + b] = source[offset + i*componentSize + componentSize - 1 - b];
+            }
+          }
+
+        std::vector<char> shuffled( source.size() );
+        std::vector<char> unshuffled( source.size() );
+        std::vector<char> swapped( source.size() );
+        itk::Local::SIMDByteShuffler::Shuffle( &source[offset], &shuffled[offset], count, componentSize );
+        itk::Local::SIMDByteShuffler::Unshuffle( &shuffled[offset], &unshuffled[offset], count, componentSize );
+        itk::Local::SIMDByteShuffler::UnshuffleAndSwap( &shuffled[offset], &swapped[offset], count, componentSize );
+
+        if ( memcmp( &expected[0], &shuffled[offset], numberOfBytes ) != 0 ||
+             memcmp( &source[offset], &unshuffled[offset], numberOfBytes ) != 0 ||
+             memcmp( &expectedSwapped[0], &swapped[offset], numberOfBytes ) != 0 )
+          {
+          std::cerr << "Shuffling " << count << " components of size " << componentSize
+                    << " at offset " << offset << " failed" << std::endl;
+          ++numberOfDifferences;
+          }
+        }
+      }
+    return numberOfDifferences;
+  }
+
+
+  // compresses the sections of the image with and without the
+  // shuffle, returns the number of sections which did not round trip
+  template <typename T>
+  unsigned long CompressSections( const std::vector<unsigned char> &image, size_t sectionSize,
+                                  double scale, double shift, const std::string &name )
+  {
+    typedef itk::Local::ChunkCompressor ChunkCompressor;
+
+    std::vector<T> pixels( image.size() );
+    for ( size_t i = 0; i < image.size(); ++i )
+      {
+      pixels[i] = static_cast<T>( image[i]*scale + shift );
+      }
+    const size_t sectionBytes = sectionSize*sizeof(T);
+    const size_t numberOfSections = image.size() / sectionSize;
+
+    unsigned long numberOfFailures = 0;
+    const ChunkCompressor::CodecType codecs[2] = { ChunkCompressor::ZlibCompression, ChunkCompressor::LZCompression };
+    for ( unsigned int c = 0; c < 2; ++c )
+      {
+      for ( unsigned int shuffle = 0; shuffle < 2; ++shuffle )
+        {
+        std::vector<char> shuffled( sectionBytes );
+        std::vector<char> compressed( ChunkCompressor::GetCompressBound( codecs[c], sectionBytes ) );
+        std::vector<char> decompressed( sectionBytes );
+        std::vector<T> section( sectionSize );
+
+        itk::TimeProbe shuffleTime;
+        itk::TimeProbe unshuffleTime;
+        double compressedSize = 0.0;
+
+        for ( size_t s = 0; s < numberOfSections; ++s )
+          {
+          const char *data = reinterpret_cast<const char *>( &pixels[s*sectionSize] );
+          if ( shuffle )
+            {
+            shuffleTime.Start();
+            itk::Local::SIMDByteShuffler::Shuffle( data, &shuffled[0], sectionSize, sizeof(T) );
+            shuffleTime.Stop();
+            data = &shuffled[0];
+            }
+
+          ChunkCompressor::SizeType size = ChunkCompressor::Compress( codecs[c], data, sectionBytes,
+                                                                      &compressed[0], compressed.size() );
+          if ( size == 0 )
+            {
+            size = sectionBytes;
+            memcpy( &decompressed[0], data, sectionBytes );
+            }
+          else if ( !ChunkCompressor::Decompress( codecs[c], &compressed[0], size, &decompressed[0], sectionBytes ) )
+            {
+            ++numberOfFailures;
+            continue;
+            }
+          compressedSize += size;
+
+          if ( shuffle )
+            {
+            unshuffleTime.Start();
+            itk::Local::SIMDByteShuffler::Unshuffle( &decompressed[0], &section[0], sectionSize, sizeof(T) );
+            unshuffleTime.Stop();
+            }
+          else
+            {
+            memcpy( &section[0], &decompressed[0], sectionBytes );
+            }
+          if ( memcmp( &section[0], &pixels[s*sectionSize], sectionBytes ) != 0 )
+            {
+            ++numberOfFailures;
+            }
+          }
+
+        std::ostringstream label;
+        label << name << " " << ChunkCompressor::GetCodecName( codecs[c] )
+              << ( shuffle ? " Shuffled" : "" ) << " Compression Ratio";
+        this->MeasurementNumericDouble( pixels.size()*sizeof(T) / compressedSize, label.str(), true );
+        if ( shuffle )
+          {
+          const double megabytes = pixels.size()*sizeof(T) / ( 1024.0*1024.0 );
+          std::cout << name << " shuffle " << megabytes / std::max( shuffleTime.GetTotal(), 1e-9 )
+                    << " MB/s, unshuffle " << megabytes / std::max( unshuffleTime.GetTotal(), 1e-9 )
+                    << " MB/s" << std::endl;
+          }
+        }
+      }
+    return numberOfFailures;
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    std::cout << "Kernel: " << itk::Local::SIMDByteShuffler::GetKernelName() << std::endl;
+
+    unsigned long numberOfDifferences = 0;
+    for ( unsigned int componentSize = 1; componentSize <= 8; ++componentSize )
+      {
+      numberOfDifferences += this->CompareShuffle( componentSize );
+      }
+    this->MeasurementNumericInteger( numberOfDifferences, "Number Of Shuffles Different" );
+
+    // the MRC files of the test data
+    unsigned long numberOfFailures = 0;
+    for ( int i = 1; i < argc; ++i )
+      {
+      itk::Local::MRCImageIO::Pointer io = itk::Local::MRCImageIO::New();
+      io->SetFileName( argv[i] );
+      io->ReadImageInformation();
+      if ( io->GetComponentType() != itk::ImageIOBase::UCHAR || io->GetNumberOfDimensions() < 2 )
+        {
+        std::cerr << "Expected an 8-bit MRC file: " << argv[i] << std::endl;
+        return EXIT_FAILURE;
+        }
+
+      std::vector<unsigned char> image( io->GetImageSizeInBytes() );
+      io->Read( &image[0] );
+
+      const size_t sectionSize = io->GetDimensions( 0 ) * io->GetDimensions( 1 );
+      const std::string name = itksys::SystemTools::GetFilenameName( argv[i] );
+      numberOfFailures += this->CompressSections<itk::int16_t>( image, sectionSize, 37.0, -4000.0, name + " int16" );
+      numberOfFailures += this->CompressSections<float>( image, sectionSize, 0.0137, -1.5, name + " float" );
+      }
+    this->MeasurementNumericInteger( numberOfFailures, "Number Of Sections Different" );
+
+    return ( numberOfDifferences == 0 && numberOfFailures == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkSIMDByteShufflerTest(int argc, char* argv[])
+{
+  SIMDByteShufflerTest test;
+  return test.Main(argc, argv);
+}
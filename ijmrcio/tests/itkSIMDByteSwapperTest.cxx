@@ -0,0 +1,80 @@
+#include "itkSIMDByteSwapper.h"
+#include "itkByteSwapper.h"
+#include "itkIntTypes.h"
+#include "itktfRegression.h"
+
+#include <vector>
+#include <string.h>
+
+// This test compares the swapping of the SIMDByteSwapper to the
+// ByteSwapper for each component size, for lengths and alignments
+// which exercise the vector loops and the scalar remainder.
+class SIMDByteSwapperTest:
+  public itk::Regression
+{
+protected:
+
+  template <typename T>
+  unsigned long CompareSwap( void )
+  {
+    unsigned long numberOfDifferences = 0;
+
+    for ( size_t count = 0; count < 67; ++count )
+      {
+      for ( size_t offset = 0; offset < sizeof(T); ++offset )
+        {
+        std::vector<char> source( count*sizeof(T) + offset + 1 );
+        for ( size_t i = 0; i < source.size(); ++i )
+          {
+          source[i] = static_cast<char>( i*7 + count );
+          }
+
+        // the expected result
+        std::vector<T> expected( count + 1 );
+        memcpy( &expected[0], &source[offset], count*sizeof(T) );
+        if ( itk::ByteSwapper<T>::SystemIsBigEndian() )
+          {
+          itk::ByteSwapper<T>::SwapRangeFromSystemToLittleEndian( &expected[0], count );
+          }
+        else
+          {
+          itk::ByteSwapper<T>::SwapRangeFromSystemToBigEndian( &expected[0], count );
+          }
+
+        std::vector<char> copy( source.size() );
+        itk::Local::SIMDByteSwapper::SwapRangeCopy( &source[offset], &copy[offset], count, sizeof(T) );
+        itk::Local::SIMDByteSwapper::SwapRange( &source[offset], count, sizeof(T) );
+
+        if ( memcmp( &expected[0], &source[offset], count*sizeof(T) ) != 0 ||
+             memcmp( &expected[0], &copy[offset], count*sizeof(T) ) != 0 )
+          {
+          std::cerr << "Swapping " << count << " components of size " << sizeof(T) 
+                    << " at offset " << offset << " failed" << std::endl;
+          ++numberOfDifferences;
+          }
+        }
+      }
+    return numberOfDifferences;
+  }
+
+  virtual int Test(int , char* [] )
+  {
+    std::cout << "Kernel: " << itk::Local::SIMDByteSwapper::GetKernelName() << std::endl;
+
+    unsigned long numberOfDifferences = 0;
+    numberOfDifferences += this->CompareSwap<itk::uint16_t>();
+    numberOfDifferences += this->CompareSwap<itk::uint32_t>();
+    numberOfDifferences += this->CompareSwap<itk::uint64_t>();
+
+    this->MeasurementNumericInteger( numberOfDifferences, "Number Of Swaps Different" );
+
+    return ( numberOfDifferences == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkSIMDByteSwapperTest(int argc, char* argv[])
+{
+  SIMDByteSwapperTest test;
+  return test.Main(argc, argv);
+}
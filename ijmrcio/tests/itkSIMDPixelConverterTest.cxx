@@ -0,0 +1,346 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageRegionIterator.h"
+#include "itkStreamingImageFilter.h"
+#include "itkTimeProbe.h"
+
+#include "itkLocalFactory.h"
+#include "itkMRCImageIO.h"
+#include "itkVTKImageIO.h"
+#include "itkSIMDPixelConverter.h"
+#include "itktfRegression.h"
+
+#include <itksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <string.h>
+
+// This test compares the conversions of the SIMDPixelConverter to
+// static_cast for lengths and alignments which exercise the vector
+// loops and the scalar remainder. Then each file is read as float by
+// the ImageFileReader, with the ReadComponentType of the ImageIO and
+// with the conversion of the reader, and the images and times are
+// compared. The ImageIO converts through the smallest staging buffer,
+// whole and streamed in pieces. A big endian short VTK file is
+// written first, so the components are swapped as they are converted.
+//
+// The half precision conversions are compared between the F16C
+// kernel, which converts 8 values at a time, and the scalar code,
+// which converts the remainder, for every half and for floats which
+// round to ties, subnormals, infinity and NaN.
+class SIMDPixelConverterTest:
+  public itk::Regression
+{
+protected:
+
+  typedef itk::ImageIOBase::IOComponentType              ComponentType;
+  typedef itk::Image<float,3>                            ImageType;
+  typedef itk::ImageFileReader<ImageType>                ReaderType;
+  typedef itk::StreamingImageFilter<ImageType,ImageType> StreamingFilter;
+  typedef itk::Image<short,3>                            ShortImageType;
+  typedef itk::ImageFileWriter<ShortImageType>           ShortWriterType;
+
+
+  // the values are in the range of every destination type, the
+  // conversion of out of range floats to integers is undefined
+  static int Value( size_t i )
+  {
+    return static_cast<int>( i*37 % 251 ) - 100 + static_cast<int>( i*1000 % 30000 );
+  }
+
+
+  template <typename TIn, typename TOut>
+  unsigned long CompareConvert( ComponentType sourceType, ComponentType destinationType )
+  {
+    unsigned long numberOfDifferences = 0;
+
+    for ( size_t count = 0; count < 67; ++count )
+      {
+      for ( size_t offset = 0; offset < 3; ++offset )
+        {
+        // a component past the end, so that no vector is empty
+        std::vector<TIn> source( count + offset + 1 );
+        for ( size_t i = 0; i < source.size(); ++i )
+          {
+          source[i] = static_cast<TIn>( Value( i ) );
+          }
+
+        // the component past the end must not be written
+        std::vector<TOut> destination( count + offset + 1, TOut( 77 ) );
+        itk::Local::SIMDPixelConverter::Convert( &source[offset], sourceType,
+                                                 &destination[offset], destinationType, count );
+
+        bool same = destination[offset + count] == TOut( 77 );
+        for ( size_t i = 0; i < count; ++i )
+          {
+          same = same && destination[offset + i] == static_cast<TOut>( source[offset + i] );
+          }
+        if ( !same )
+          {
+          std::cerr << "Converting " << count << " components from " << sourceType << " to "
+                    << destinationType << " at offset " << offset << " failed" << std::endl;
+          ++numberOfDifferences;
+          }
+        }
+      }
+    return numberOfDifferences;
+  }
+
+
+  static float FloatFromBits( unsigned int bits )
+  {
+    float value;
+    memcpy( &value, &bits, sizeof(value) );
+    return value;
+  }
+
+
+  static unsigned int BitsOfFloat( float value )
+  {
+    unsigned int bits;
+    memcpy( &bits, &value, sizeof(bits) );
+    return bits;
+  }
+
+
+  // converts every half to float, 8 at a time and one at a time, and
+  // the floats back to the halves
+  static unsigned long CompareAllHalves( void )
+  {
+    typedef itk::Local::SIMDPixelConverter Converter;
+
+    std::vector<unsigned short> halves( 65536 );
+    for ( size_t i = 0; i < halves.size(); ++i )
+      {
+      halves[i] = static_cast<unsigned short>( i );
+      }
+    std::vector<float> floats( halves.size() );
+    Converter::HalfToFloat( &halves[0], &floats[0], halves.size() );
+    std::vector<unsigned short> roundTrip( halves.size() );
+    Converter::FloatToHalf( &floats[0], &roundTrip[0], floats.size() );
+
+    unsigned long numberOfDifferences = 0;
+    for ( size_t i = 0; i < halves.size(); ++i )
+      {
+      float value;
+      Converter::HalfToFloat( &halves[i], &value, 1 );
+      unsigned short half;
+      Converter::FloatToHalf( &value, &half, 1 );
+
+      // a NaN becomes quiet, the other values are exact
+      const bool isNaN = ( halves[i] & 0x7c00u ) == 0x7c00u && ( halves[i] & 0x3ffu ) != 0;
+      const unsigned short expected = static_cast<unsigned short>( isNaN ? halves[i] | 0x200u : halves[i] );
+
+      // the values which are not NaN are also computed from the fields
+      const int exponent = ( halves[i] >> 10 ) & 0x1f;
+      const double magnitude = ( exponent == 0 ) ? std::ldexp( static_cast<double>( halves[i] & 0x3ffu ), -24 ) :
+        std::ldexp( static_cast<double>( ( halves[i] & 0x3ffu ) | 0x400u ), exponent - 25 );
+      const double reference = ( halves[i] & 0x8000u ) ? -magnitude : magnitude;
+
+      if ( BitsOfFloat( value ) != BitsOfFloat( floats[i] ) ||
+           ( exponent != 0x1f && value != reference ) ||
+           half != expected || roundTrip[i] != expected )
+        {
+        std::cerr << "Converting the half " << std::hex << halves[i] << " to " << BitsOfFloat( floats[i] )
+                  << " and " << BitsOfFloat( value ) << ", and back to " << roundTrip[i] << " and " << half
+                  << std::dec << " failed" << std::endl;
+        ++numberOfDifferences;
+        }
+      }
+    return numberOfDifferences;
+  }
+
+
+  // converts a float to half 8 at a time and alone
+  static unsigned long CompareFloatToHalf( float value, unsigned short expected )
+  {
+    typedef itk::Local::SIMDPixelConverter Converter;
+
+    const std::vector<float> floats( 8, value );
+    std::vector<unsigned short> halves( floats.size() + 1, 0 );
+    Converter::FloatToHalf( &floats[0], &halves[0], floats.size() );
+    Converter::FloatToHalf( &floats[0], &halves[floats.size()], 1 );
+
+    if ( std::count( halves.begin(), halves.end(), expected ) != static_cast<long>( halves.size() ) )
+      {
+      std::cerr << "Converting the float " << std::hex << BitsOfFloat( value ) << " to half gave "
+                << halves[0] << " and " << halves[floats.size()] << " instead of " << expected
+                << std::dec << std::endl;
+      return 1;
+      }
+    return 0;
+  }
+
+
+  static unsigned long CompareHalfConversions( void )
+  {
+    unsigned long numberOfDifferences = CompareAllHalves();
+
+    // ties round to the even half
+    numberOfDifferences += CompareFloatToHalf( 1.0f + std::ldexp( 1.0f, -11 ), 0x3c00 );
+    numberOfDifferences += CompareFloatToHalf( 1.0f + 3.0f * std::ldexp( 1.0f, -11 ), 0x3c02 );
+    numberOfDifferences += CompareFloatToHalf( 1.0f + std::ldexp( 1.0f, -11 ) + std::ldexp( 1.0f, -20 ), 0x3c01 );
+    numberOfDifferences += CompareFloatToHalf( -1.0f - std::ldexp( 1.0f, -11 ), 0xbc00 );
+
+    // subnormals, the smallest half and the ties below it and above
+    // the largest subnormal
+    numberOfDifferences += CompareFloatToHalf( std::ldexp( 1.0f, -24 ), 0x0001 );
+    numberOfDifferences += CompareFloatToHalf( std::ldexp( 1.0f, -25 ), 0x0000 );
+    numberOfDifferences += CompareFloatToHalf( 1.5f * std::ldexp( 1.0f, -25 ), 0x0001 );
+    numberOfDifferences += CompareFloatToHalf( 3.0f * std::ldexp( 1.0f, -25 ), 0x0002 );
+    numberOfDifferences += CompareFloatToHalf( std::ldexp( 1.0f, -14 ) - std::ldexp( 1.0f, -25 ), 0x0400 );
+    numberOfDifferences += CompareFloatToHalf( -std::ldexp( 1.0f, -30 ), 0x8000 );
+
+    // the largest half, and 65520, the tie above it, which overflows
+    numberOfDifferences += CompareFloatToHalf( 65504.0f, 0x7bff );
+    numberOfDifferences += CompareFloatToHalf( 65519.0f, 0x7bff );
+    numberOfDifferences += CompareFloatToHalf( 65520.0f, 0x7c00 );
+    numberOfDifferences += CompareFloatToHalf( -65520.0f, 0xfc00 );
+    numberOfDifferences += CompareFloatToHalf( 1e10f, 0x7c00 );
+    numberOfDifferences += CompareFloatToHalf( FloatFromBits( 0xff800000u ), 0xfc00 );
+
+    // NaN stays NaN, with the high bits of its payload
+    numberOfDifferences += CompareFloatToHalf( FloatFromBits( 0x7fc00000u ), 0x7e00 );
+    numberOfDifferences += CompareFloatToHalf( FloatFromBits( 0x7fa00000u ), 0x7f00 );
+    numberOfDifferences += CompareFloatToHalf( FloatFromBits( 0xffc02000u ), 0xfe01 );
+
+    return numberOfDifferences;
+  }
+
+
+  // writes a short VTK file, which is big endian, with values which
+  // use both bytes of the components
+  static void WriteBigEndianFile( const std::string &filename )
+  {
+    ShortImageType::SizeType size;
+    size[0] = 67;
+    size[1] = 45;
+    size[2] = 13;
+
+    ShortImageType::Pointer image = ShortImageType::New();
+    image->SetRegions( size );
+    image->Allocate();
+
+    unsigned long i = 0;
+    itk::ImageRegionIterator<ShortImageType> it( image, image->GetLargestPossibleRegion() );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it, ++i )
+      {
+      it.Set( static_cast<short>( static_cast<long>( ( i * 7919 ) % 65536 ) - 32768 ) );
+      }
+
+    itk::Local::VTKImageIO::Pointer io = itk::Local::VTKImageIO::New();
+    io->SetFileTypeToBinary();
+
+    itksys::SystemTools::RemoveFile( filename.c_str() );
+    ShortWriterType::Pointer writer = ShortWriterType::New();
+    writer->SetFileName( filename );
+    writer->SetInput( image );
+    writer->SetImageIO( io );
+    writer->Update();
+  }
+
+
+  // an ImageIO for the file, which converts to float through the
+  // smallest staging buffer
+  static itk::Local::StreamingImageIOBase::Pointer CreateConvertingIO( const std::string &filename )
+  {
+    itk::Local::StreamingImageIOBase::Pointer io;
+    if ( itksys::SystemTools::GetFilenameLastExtension( filename ) == ".vtk" )
+      {
+      io = itk::Local::VTKImageIO::New().GetPointer();
+      }
+    else
+      {
+      io = itk::Local::MRCImageIO::New().GetPointer();
+      }
+    io->SetReadComponentType( itk::ImageIOBase::FLOAT );
+    io->SetStagingBufferSize( 4096 );
+    return io;
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    typedef itk::ImageIOBase IOBase;
+
+    if( argc < 2 )
+      {
+      std::cerr << "Usage: " << argv[0] << " outputBigEndianFile [inputFile ...]" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    std::cout << "Kernel: " << itk::Local::SIMDPixelConverter::GetKernelName() << std::endl;
+
+    unsigned long numberOfDifferences = 0;
+    numberOfDifferences += this->CompareConvert<unsigned char, float>( IOBase::UCHAR, IOBase::FLOAT );
+    numberOfDifferences += this->CompareConvert<char, float>( IOBase::CHAR, IOBase::FLOAT );
+    numberOfDifferences += this->CompareConvert<unsigned short, float>( IOBase::USHORT, IOBase::FLOAT );
+    numberOfDifferences += this->CompareConvert<short, float>( IOBase::SHORT, IOBase::FLOAT );
+    numberOfDifferences += this->CompareConvert<float, double>( IOBase::FLOAT, IOBase::DOUBLE );
+    numberOfDifferences += this->CompareConvert<unsigned char, double>( IOBase::UCHAR, IOBase::DOUBLE );
+    numberOfDifferences += this->CompareConvert<short, double>( IOBase::SHORT, IOBase::DOUBLE );
+    numberOfDifferences += this->CompareConvert<float, short>( IOBase::FLOAT, IOBase::SHORT );
+    numberOfDifferences += this->CompareConvert<int, unsigned char>( IOBase::INT, IOBase::UCHAR );
+    numberOfDifferences += CompareHalfConversions();
+    this->MeasurementNumericInteger( numberOfDifferences, "Number Of Conversions Different" );
+
+    WriteBigEndianFile( argv[1] );
+
+    // the files are read as float, converted by the ImageIO and by the reader
+    unsigned long numberOfPixelsDifferent = 0;
+    for ( int i = 1; i < argc; ++i )
+      {
+      const std::string filename = argv[i];
+
+      itk::TimeProbe readerTime;
+      ReaderType::Pointer baselineReader = ReaderType::New();
+      baselineReader->SetFileName( filename );
+      readerTime.Start();
+      baselineReader->UpdateLargestPossibleRegion();
+      readerTime.Stop();
+
+      itk::TimeProbe ioTime;
+      ReaderType::Pointer reader = ReaderType::New();
+      reader->SetFileName( filename );
+      reader->SetImageIO( CreateConvertingIO( filename ) );
+      ioTime.Start();
+      reader->UpdateLargestPossibleRegion();
+      ioTime.Stop();
+
+      std::cout << itksys::SystemTools::GetFilenameName( filename ) << " converted by the reader in "
+                << readerTime.GetTotal() << " s, by the ImageIO in " << ioTime.GetTotal() << " s" << std::endl;
+
+      numberOfPixelsDifferent += this->CompareImage<ImageType>( reader->GetOutput(), baselineReader->GetOutput() );
+
+      // streamed in pieces, each converted through the staging buffer
+      ReaderType::Pointer streamingReader = ReaderType::New();
+      streamingReader->SetFileName( filename );
+      streamingReader->SetImageIO( CreateConvertingIO( filename ) );
+      streamingReader->UseStreamingOn();
+
+      StreamingFilter::Pointer streamer = StreamingFilter::New();
+      streamer->SetInput( streamingReader->GetOutput() );
+      streamer->SetNumberOfStreamDivisions( 4 );
+      streamer->UpdateLargestPossibleRegion();
+      numberOfPixelsDifferent += this->CompareImage<ImageType>( streamer->GetOutput(), baselineReader->GetOutput() );
+      }
+    this->MeasurementNumericInteger( numberOfPixelsDifferent, "Number Of Pixels Different" );
+
+    return ( numberOfDifferences == 0 && numberOfPixelsDifferent == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkSIMDPixelConverterTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  SIMDPixelConverterTest test;
+  return test.Main(argc, argv);
+}
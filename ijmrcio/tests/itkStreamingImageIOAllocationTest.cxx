@@ -0,0 +1,196 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+
+#include "itkLocalFactory.h"
+#include "itkMRCImageIO.h"
+#include "itkVTKImageIO.h"
+#include "itktfRegression.h"
+
+#include <itksys/SystemTools.hxx>
+
+// the allocated blocks of a file can be measured where they can be
+// preallocated
+#if defined(IJMRCIO_HAVE_POSIX_FALLOCATE) || defined(IJMRCIO_HAVE_FALLOCATE_KEEP_SIZE)
+#include <sys/types.h>
+#include <sys/stat.h>
+#define ITK_LOCAL_HAVE_ALLOCATED_BLOCKS
+#endif
+
+// This test pastes the first half of an image into a new file, which
+// is allocated with one of the FileAllocationPolicies of the
+// StreamingImageIOBase, and checks the length of the file and the
+// bytes of its allocated blocks. Then the rest of the image is
+// streamed into the file, and the written file is compared to the
+// input. The number of extents of the file is reported.
+class StreamingImageIOAllocationTest:
+  public itk::Regression
+{
+protected:
+
+  typedef unsigned char                           PixelType;
+  typedef itk::Image<PixelType,3>                 ImageType;
+  typedef itk::ImageFileReader<ImageType>         ReaderType;
+  typedef itk::ImageFileWriter<ImageType>         WriterType;
+  typedef itk::Local::StreamingImageIOBase        StreamingImageIOType;
+
+
+  // returns the number of bytes of the allocated blocks of the file,
+  // or -1 if they can not be measured
+  static long GetAllocatedBytes( const std::string &filename )
+  {
+#if defined(ITK_LOCAL_HAVE_ALLOCATED_BLOCKS)
+    struct stat fileStatus;
+    if ( stat( filename.c_str(), &fileStatus ) == 0 )
+      {
+      return static_cast<long>( fileStatus.st_blocks ) * 512;
+      }
+#endif
+    (void) filename;
+    return -1;
+  }
+
+
+  void WriteRegion( const std::string &inputFilename, const std::string &outputFilename, 
+                    StreamingImageIOType *io, const ImageType::RegionType &region,
+                    unsigned int numberOfStreamDivisions )
+  {
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( inputFilename );
+    reader->UseStreamingOn();
+
+    itk::ImageIORegion ioregion( 3 );
+    for ( unsigned int i = 0; i < 3; ++i )
+      {
+      ioregion.SetIndex( i, region.GetIndex()[i] );
+      ioregion.SetSize( i, region.GetSize()[i] );
+      }
+
+    WriterType::Pointer writer = WriterType::New();
+    writer->SetInput( reader->GetOutput() );
+    writer->SetFileName( outputFilename );
+    writer->SetImageIO( io );
+    writer->SetIORegion( ioregion );
+    writer->SetNumberOfStreamDivisions( numberOfStreamDivisions );
+    writer->Update();
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    if( argc < 4 )
+      {
+      std::cerr << "Usage: " << argv[0] << " inputFile outputFile sparse|contiguous|keepsize" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const std::string inputFilename = argv[1];
+    const std::string outputFilename = argv[2];
+    const std::string policy = argv[3];
+
+    StreamingImageIOType::Pointer io;
+    if ( itksys::SystemTools::GetFilenameLastExtension( outputFilename ) == ".vtk" )
+      {
+      io = itk::Local::VTKImageIO::New().GetPointer();
+      }
+    else
+      {
+      io = itk::Local::MRCImageIO::New().GetPointer();
+      }
+
+    if ( policy == "sparse" )
+      {
+      io->SetFileAllocationPolicyToSparse();
+      }
+    else if ( policy == "contiguous" )
+      {
+      io->SetFileAllocationPolicyToContiguous();
+      }
+    else if ( policy == "keepsize" )
+      {
+      io->SetFileAllocationPolicyToKeepSize();
+      }
+    else
+      {
+      std::cerr << "Unknown allocation policy: " << policy << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( inputFilename );
+    reader->UpdateOutputInformation();
+
+    // the first and second halves of the sections
+    const ImageType::RegionType largestRegion = reader->GetOutput()->GetLargestPossibleRegion();
+    ImageType::RegionType firstRegion = largestRegion;
+    firstRegion.SetSize( 2, largestRegion.GetSize()[2] / 2 );
+    ImageType::RegionType secondRegion = largestRegion;
+    secondRegion.SetIndex( 2, firstRegion.GetSize()[2] );
+    secondRegion.SetSize( 2, largestRegion.GetSize()[2] - firstRegion.GetSize()[2] );
+
+    itksys::SystemTools::RemoveFile( outputFilename.c_str() );
+    this->WriteRegion( inputFilename, outputFilename, io, firstRegion, 2 );
+    const unsigned long firstLength = itksys::SystemTools::FileLength( outputFilename.c_str() );
+    const long firstAllocatedBytes = GetAllocatedBytes( outputFilename );
+
+    this->WriteRegion( inputFilename, outputFilename, io, secondRegion, 2 );
+    const unsigned long length = itksys::SystemTools::FileLength( outputFilename.c_str() );
+    const unsigned long secondBytes = secondRegion.GetNumberOfPixels() * sizeof( PixelType );
+
+    std::cout << "Length of the first half: " << firstLength << " of " << length << std::endl;
+    std::cout << "Allocated bytes of the first half: " << firstAllocatedBytes << std::endl;
+    std::cout << "Number of file extents: " << io->GetNumberOfFileExtents() << std::endl;
+
+    // only KeepSizeAllocation leaves the length to the data written
+    unsigned long numberOfAllocationErrors = 0;
+    const unsigned long expectedLength = ( policy == "keepsize" ) ? length - secondBytes : length;
+    if ( firstLength != expectedLength )
+      {
+      std::cerr << "The length of the first half is " << firstLength << " instead of " << expectedLength << std::endl;
+      ++numberOfAllocationErrors;
+      }
+
+    // the blocks of a sparse file are allocated as they are written,
+    // otherwise all of them are allocated with the first half
+    if ( firstAllocatedBytes != -1 )
+      {
+      bool preallocated = false;
+#if defined(IJMRCIO_HAVE_POSIX_FALLOCATE)
+      preallocated = preallocated || policy == "contiguous";
+#endif
+#if defined(IJMRCIO_HAVE_FALLOCATE_KEEP_SIZE)
+      preallocated = preallocated || policy == "keepsize";
+#endif
+      if ( preallocated && firstAllocatedBytes < static_cast<long>( length ) )
+        {
+        std::cerr << "Only " << firstAllocatedBytes << " bytes were preallocated" << std::endl;
+        ++numberOfAllocationErrors;
+        }
+      if ( policy == "sparse" && firstAllocatedBytes >= static_cast<long>( length ) )
+        {
+        std::cerr << "All " << firstAllocatedBytes << " bytes of the sparse file were allocated" << std::endl;
+        ++numberOfAllocationErrors;
+        }
+      }
+    this->MeasurementNumericInteger( numberOfAllocationErrors, "Number Of Allocation Errors" );
+
+    const unsigned long numberOfDifferences =
+      this->CompareImage<ImageType>( outputFilename, inputFilename );
+
+    this->MeasurementNumericInteger( numberOfDifferences, "Number Of Pixels Different" );
+
+    return ( numberOfDifferences == 0 && numberOfAllocationErrors == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkStreamingImageIOAllocationTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  StreamingImageIOAllocationTest test;
+  return test.Main(argc, argv);
+}
@@ -0,0 +1,144 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkStreamingImageFilter.h"
+
+#include "itkLocalFactory.h"
+#include "itkMRCImageIO.h"
+#include "itkVTKImageIO.h"
+#include "itktfRegression.h"
+
+#include <itksys/SystemTools.hxx>
+
+#include <vector>
+
+// This test reads an image binned with the ReadBinningFactor of the
+// StreamingImageIOBase, streamed in pieces, and compares it to the
+// means of the blocks of the image read at full resolution, computed
+// here.
+class StreamingImageIOBinningTest:
+  public itk::Regression
+{
+protected:
+
+  typedef unsigned char                           PixelType;
+  typedef itk::Image<PixelType,3>                 ImageType;
+  typedef itk::ImageFileReader<ImageType>         ReaderType;
+  typedef itk::Local::StreamingImageIOBase        StreamingImageIOType;
+
+
+  // the means of the blocks of factor pixels of the image, the blocks
+  // at the far edges have the pixels present
+  static std::vector<double> Bin( const ImageType *image, unsigned int factor, unsigned long binnedSize[3] )
+  {
+    unsigned long size[3];
+    for ( unsigned int i = 0; i < 3; ++i )
+      {
+      size[i] = image->GetLargestPossibleRegion().GetSize()[i];
+      binnedSize[i] = ( size[i] + factor - 1 ) / factor;
+      }
+    std::vector<double> binned( binnedSize[0] * binnedSize[1] * binnedSize[2], 0.0 );
+    std::vector<unsigned int> count( binned.size(), 0 );
+
+    itk::ImageRegionConstIterator<ImageType> it( image, image->GetLargestPossibleRegion() );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+      {
+      const ImageType::IndexType index = it.GetIndex();
+      const unsigned long b = ( ( index[2]/factor ) * binnedSize[1] + index[1]/factor ) * binnedSize[0] + index[0]/factor;
+      binned[b] += it.Get();
+      ++count[b];
+      }
+    for ( unsigned long i = 0; i < binned.size(); ++i )
+      {
+      binned[i] /= count[i];
+      }
+    return binned;
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    if( argc < 3 )
+      {
+      std::cerr << "Usage: " << argv[0] << " inputFile binningFactor" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const std::string filename = argv[1];
+    const unsigned int factor = atoi( argv[2] );
+
+    StreamingImageIOType::Pointer io;
+    if ( itksys::SystemTools::GetFilenameLastExtension( filename ) == ".vtk" )
+      {
+      io = itk::Local::VTKImageIO::New().GetPointer();
+      }
+    else
+      {
+      io = itk::Local::MRCImageIO::New().GetPointer();
+      }
+    io->SetReadBinningFactor( factor );
+
+    ReaderType::Pointer baselineReader = ReaderType::New();
+    baselineReader->SetFileName( filename );
+    baselineReader->UpdateLargestPossibleRegion();
+
+    ImageType::ConstPointer baselineImage = baselineReader->GetOutput();
+
+    unsigned long binnedSize[3];
+    const std::vector<double> values = Bin( baselineImage, factor, binnedSize );
+
+    ////////////////////////////////////////////////
+    // read the binned image streamed in pieces
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( filename );
+    reader->SetImageIO( io );
+    reader->UseStreamingOn();
+
+    typedef itk::StreamingImageFilter<ImageType, ImageType> StreamingFilter;
+    StreamingFilter::Pointer streamer = StreamingFilter::New();
+    streamer->SetInput( reader->GetOutput() );
+    streamer->SetNumberOfStreamDivisions( 4 );
+    streamer->UpdateLargestPossibleRegion();
+
+    const ImageType *image = streamer->GetOutput();
+    this->MeasurementInsightSize( image->GetLargestPossibleRegion().GetSize(), "Binned Size" );
+
+    unsigned long numberOfDifferences = 0;
+    for ( unsigned int i = 0; i < 3; ++i )
+      {
+      if ( image->GetLargestPossibleRegion().GetSize()[i] != binnedSize[i] ||
+           vnl_math_abs( image->GetSpacing()[i] - baselineImage->GetSpacing()[i] * factor ) > 1e-6 )
+        {
+        std::cerr << "The binned image information is incorrect in dimension " << i << std::endl;
+        ++numberOfDifferences;
+        }
+      }
+
+    // the means are rounded to the pixel type
+    unsigned long i = 0;
+    itk::ImageRegionConstIterator<ImageType> it( image, image->GetLargestPossibleRegion() );
+    for ( it.GoToBegin(); !it.IsAtEnd() && i < values.size(); ++it, ++i )
+      {
+      if ( vnl_math_abs( it.Get() - values[i] ) > 0.5 + 1e-6 )
+        {
+        ++numberOfDifferences;
+        }
+      }
+
+    this->MeasurementNumericInteger( numberOfDifferences, "Number Of Pixels Different" );
+
+    return ( numberOfDifferences == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkStreamingImageIOBinningTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  StreamingImageIOBinningTest test;
+  return test.Main(argc, argv);
+}
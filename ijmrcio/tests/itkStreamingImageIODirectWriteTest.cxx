@@ -0,0 +1,243 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageRegionIterator.h"
+#include "itkMetaDataObject.h"
+
+#include "itkLocalFactory.h"
+#include "itkMRCImageIO.h"
+#include "itkMRCHeaderObject.h"
+#include "itktfRegression.h"
+
+#include <itksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+// This test writes MRC files with UseDirectIO, through the bounce
+// buffer with a small alignment. A region of whole sections is pasted
+// as a single run into a file whose extended header leaves the data
+// unaligned, and the bytes of the file before and after the region
+// must be unchanged. Then an image is written whole and streamed into
+// new files, which must be exactly the length of the header and data.
+class StreamingImageIODirectWriteTest:
+  public itk::Regression
+{
+protected:
+
+  typedef unsigned char                           PixelType;
+  typedef itk::Image<PixelType,3>                 ImageType;
+  typedef itk::ImageFileReader<ImageType>         ReaderType;
+  typedef itk::ImageFileWriter<ImageType>         WriterType;
+  typedef itk::Local::MRCImageIO                  MRCImageIOType;
+  typedef itk::Local::MRCHeaderObject             MRCHeaderObjectType;
+
+
+  static std::vector<char> ReadFile( const std::string &filename )
+  {
+    std::vector<char> bytes( itksys::SystemTools::FileLength( filename.c_str() ) );
+    std::ifstream file( filename.c_str(), std::ios::in | std::ios::binary );
+    if ( !bytes.empty() )
+      {
+      file.read( &bytes[0], bytes.size() );
+      }
+    return bytes;
+  }
+
+
+  static void WriteFile( const std::string &filename, const std::vector<char> &bytes )
+  {
+    std::ofstream file( filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+    file.write( &bytes[0], bytes.size() );
+  }
+
+
+  static MRCImageIOType::Pointer CreateDirectIO( void )
+  {
+    // the small alignment and staging buffer write the data in many
+    // blocks, with unaligned ends
+    MRCImageIOType::Pointer io = MRCImageIOType::New();
+    io->UseDirectIOOn();
+    io->SetDirectIOAlignment( 512 );
+    io->SetStagingBufferSize( 4096 );
+    return io;
+  }
+
+
+  // compares the bytes of the file to the expected bytes, returns
+  // the number of differences
+  static unsigned long CompareFile( const std::string &filename, const std::vector<char> &expected )
+  {
+    const std::vector<char> bytes = ReadFile( filename );
+    if ( bytes.size() != expected.size() )
+      {
+      std::cerr << filename << " is " << bytes.size() << " bytes instead of " << expected.size() << std::endl;
+      return 1;
+      }
+
+    unsigned long numberOfDifferences = 0;
+    for ( unsigned long i = 0; i < bytes.size(); ++i )
+      {
+      if ( bytes[i] != expected[i] )
+        {
+        ++numberOfDifferences;
+        }
+      }
+    if ( numberOfDifferences )
+      {
+      std::cerr << numberOfDifferences << " bytes of " << filename << " are different" << std::endl;
+      }
+    return numberOfDifferences;
+  }
+
+
+  // the file bytes of the pixels of region, in the order they are
+  // in the file
+  static std::vector<char> RegionData( const ImageType *image, const ImageType::RegionType &region )
+  {
+    std::vector<char> data;
+    itk::ImageRegionConstIterator<ImageType> it( image, region );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it )
+      {
+      data.push_back( static_cast<char>( it.Get() ) );
+      }
+    return data;
+  }
+
+
+  unsigned long TestPaste( const std::string &inputFilename, const std::string &outputFilename )
+  {
+    // the header size of the file is not aligned
+    std::vector<char> expected = ReadFile( inputFilename );
+    WriteFile( outputFilename, expected );
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( outputFilename );
+    reader->SetImageIO( MRCImageIOType::New() );
+    reader->Update();
+
+    ImageType::Pointer image = reader->GetOutput();
+    image->DisconnectPipeline();
+
+    MRCHeaderObjectType::ConstPointer header;
+    if ( !itk::ExposeMetaData<MRCHeaderObjectType::ConstPointer>( reader->GetImageIO()->GetMetaDataDictionary(),
+                                                                  MRCImageIOType::MetaDataHeaderName, header ) )
+      {
+      std::cerr << "Missing MRC header in: " << inputFilename << std::endl;
+      return 1;
+      }
+    const unsigned long headerSize = header->GetHeaderSize() + header->GetExtendedHeaderSize();
+    std::cout << "The header of " << inputFilename << " is " << headerSize << " bytes" << std::endl;
+
+    // whole sections are one run of bytes, which neither begins or
+    // ends on an aligned position
+    const ImageType::RegionType largestRegion = image->GetLargestPossibleRegion();
+    ImageType::RegionType pasteRegion = largestRegion;
+    pasteRegion.SetIndex( 2, 3 );
+    pasteRegion.SetSize( 2, 7 );
+
+    unsigned long i = 0;
+    itk::ImageRegionIterator<ImageType> it( image, pasteRegion );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it, ++i )
+      {
+      it.Set( static_cast<PixelType>( ( it.Get() + 13 * i + 7 ) % 256 ) );
+      }
+    image->Modified();
+
+    itk::ImageIORegion ioRegion( 3 );
+    for ( unsigned int d = 0; d < 3; ++d )
+      {
+      ioRegion.SetIndex( d, pasteRegion.GetIndex()[d] );
+      ioRegion.SetSize( d, pasteRegion.GetSize()[d] );
+      }
+
+    MRCImageIOType::Pointer io = CreateDirectIO();
+    WriterType::Pointer writer = WriterType::New();
+    writer->SetInput( image );
+    writer->SetFileName( outputFilename );
+    writer->SetImageIO( io );
+    writer->SetIORegion( ioRegion );
+    writer->Update();
+
+    // without direct IO support the stream methods are used
+    std::cout << "The peak staging memory of the pasting is " << io->GetPeakStagingMemory() << std::endl;
+
+    const unsigned long sectionSize = largestRegion.GetSize()[0] * largestRegion.GetSize()[1];
+    const std::vector<char> data = RegionData( image, pasteRegion );
+    std::copy( data.begin(), data.end(), expected.begin() + headerSize + pasteRegion.GetIndex()[2] * sectionSize );
+
+    return CompareFile( outputFilename, expected );
+  }
+
+
+  unsigned long TestNewFile( const std::string &inputFilename, const std::string &outputFilename,
+                             unsigned int numberOfStreamDivisions )
+  {
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( inputFilename );
+    reader->Update();
+
+    ImageType::Pointer image = reader->GetOutput();
+    image->DisconnectPipeline();
+
+    itksys::SystemTools::RemoveFile( outputFilename.c_str() );
+    MRCImageIOType::Pointer io = CreateDirectIO();
+    WriterType::Pointer writer = WriterType::New();
+    writer->SetInput( image );
+    writer->SetFileName( outputFilename );
+    writer->SetImageIO( io );
+    writer->SetNumberOfStreamDivisions( numberOfStreamDivisions );
+    writer->Update();
+
+    std::cout << "The peak staging memory of " << numberOfStreamDivisions << " divisions is "
+              << io->GetPeakStagingMemory() << std::endl;
+
+    // the header, without an extended header, is not compared, and
+    // the data ends the file
+    std::vector<char> expected = ReadFile( outputFilename );
+    const std::vector<char> data = RegionData( image, image->GetLargestPossibleRegion() );
+    expected.resize( sizeof( MRCHeaderObjectType::Header ) );
+    expected.insert( expected.end(), data.begin(), data.end() );
+
+    unsigned long numberOfDifferences = CompareFile( outputFilename, expected );
+
+    ReaderType::Pointer outputReader = ReaderType::New();
+    outputReader->SetFileName( outputFilename );
+    outputReader->Update();
+    numberOfDifferences += this->CompareImage<ImageType>( outputReader->GetOutput(), image );
+
+    return numberOfDifferences;
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    if( argc < 4 )
+      {
+      std::cerr << "Usage: " << argv[0] << " inputExtendedHeaderFile outputPastedFile outputFile" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const unsigned long pasteDifferences = this->TestPaste( argv[1], argv[2] );
+    this->MeasurementNumericInteger( pasteDifferences, "Number Of Pasted Bytes Different" );
+
+    unsigned long newFileDifferences = this->TestNewFile( argv[2], argv[3], 1 );
+    newFileDifferences += this->TestNewFile( argv[2], argv[3], 3 );
+    this->MeasurementNumericInteger( newFileDifferences, "Number Of Written Bytes Different" );
+
+    return ( pasteDifferences == 0 && newFileDifferences == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkStreamingImageIODirectWriteTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  StreamingImageIODirectWriteTest test;
+  return test.Main(argc, argv);
+}
@@ -0,0 +1,165 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkPipelineMonitorImageFilter.h"
+
+#include "itkLocalFactory.h"
+#include "itkMRCImageIO.h"
+#include "itkVTKImageIO.h"
+#include "itktfRegression.h"
+
+#include <itksys/SystemTools.hxx>
+
+// This test streams an image into a new file with a
+// WritingMemoryLimit of a few sections, and verifies that the
+// pipeline was split into slabs of whole sections which fit in the
+// limit. Then the image is written again over a larger file of
+// another pixel type, which must be replaced and not pasted into.
+class StreamingImageIOMemoryLimitTest:
+  public itk::Regression
+{
+protected:
+
+  typedef unsigned char                           PixelType;
+  typedef itk::Image<PixelType,3>                 ImageType;
+  typedef itk::ImageFileReader<ImageType>         ReaderType;
+  typedef itk::ImageFileWriter<ImageType>         WriterType;
+  typedef itk::Local::StreamingImageIOBase        StreamingImageIOType;
+
+
+  static StreamingImageIOType::Pointer CreateImageIO( const std::string &filename )
+  {
+    if ( itksys::SystemTools::GetFilenameLastExtension( filename ) == ".vtk" )
+      {
+      return itk::Local::VTKImageIO::New().GetPointer();
+      }
+    return itk::Local::MRCImageIO::New().GetPointer();
+  }
+
+
+  // writes a float image larger than the input image, so that a
+  // header or data left from it would be found
+  static void WriteOtherImage( const std::string &filename, const ImageType::RegionType &largestRegion )
+  {
+    typedef itk::Image<float,3>                  OtherImageType;
+    typedef itk::ImageFileWriter<OtherImageType> OtherWriterType;
+
+    OtherImageType::SizeType size = largestRegion.GetSize();
+    size[0] += 7;
+    size[2] += 2;
+
+    OtherImageType::Pointer image = OtherImageType::New();
+    image->SetRegions( size );
+    image->Allocate();
+    image->FillBuffer( 3.5f );
+
+    OtherWriterType::Pointer writer = OtherWriterType::New();
+    writer->SetInput( image );
+    writer->SetFileName( filename );
+    writer->SetImageIO( CreateImageIO( filename ) );
+    writer->Update();
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    if( argc < 3 )
+      {
+      std::cerr << "Usage: " << argv[0] << " inputFile outputFile [sectionsPerSplit]" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const std::string inputFilename = argv[1];
+    const std::string outputFilename = argv[2];
+    const unsigned long sectionsPerSplit = ( argc > 3 ) ? atoi( argv[3] ) : 3;
+
+    itksys::SystemTools::RemoveFile( outputFilename.c_str() );
+
+    int result = this->TestWrite( inputFilename, outputFilename, sectionsPerSplit );
+    const unsigned long fileLength = itksys::SystemTools::FileLength( outputFilename.c_str() );
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( inputFilename );
+    reader->UpdateOutputInformation();
+    WriteOtherImage( outputFilename, reader->GetOutput()->GetLargestPossibleRegion() );
+
+    if ( this->TestWrite( inputFilename, outputFilename, sectionsPerSplit ) != EXIT_SUCCESS )
+      {
+      result = EXIT_FAILURE;
+      }
+
+    const unsigned long overwrittenFileLength = itksys::SystemTools::FileLength( outputFilename.c_str() );
+    if ( overwrittenFileLength != fileLength )
+      {
+      std::cerr << "The overwritten file is " << overwrittenFileLength << " bytes instead of " << fileLength << std::endl;
+      result = EXIT_FAILURE;
+      }
+
+    return result;
+  }
+
+
+  int TestWrite( const std::string &inputFilename, const std::string &outputFilename, unsigned long sectionsPerSplit )
+  {
+    StreamingImageIOType::Pointer io = CreateImageIO( outputFilename );
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( inputFilename );
+    reader->UseStreamingOn();
+    reader->UpdateOutputInformation();
+
+    const ImageType::RegionType largestRegion = reader->GetOutput()->GetLargestPossibleRegion();
+    const unsigned long sectionSize = largestRegion.GetSize()[0] * largestRegion.GetSize()[1] * sizeof( PixelType );
+    const unsigned long numberOfSections = largestRegion.GetSize()[2];
+
+    // a little more than the sections, which must not make room for
+    // part of another
+    io->SetWritingMemoryLimit( sectionsPerSplit * sectionSize + sectionSize/2 );
+
+    typedef itk::Local::PipelineMonitorImageFilter<ImageType> MonitorFilter;
+    MonitorFilter::Pointer monitor = MonitorFilter::New();
+    monitor->SetInput( reader->GetOutput() );
+
+    WriterType::Pointer writer = WriterType::New();
+    writer->SetInput( monitor->GetOutput() );
+    writer->SetFileName( outputFilename );
+    writer->SetImageIO( io );
+    writer->Update();
+
+    const int expectedNumberOfSplits = static_cast<int>( ( numberOfSections + sectionsPerSplit - 1 ) / sectionsPerSplit );
+    this->MeasurementNumericBoolean( monitor->VerifyAllInputCanStream( expectedNumberOfSplits ), "Monitor::VerifyAllInputCanStream" );
+
+    unsigned long numberOfLargeSplits = 0;
+    const MonitorFilter::RegionVectorType regions = monitor->GetUpdatedRequestedRegions();
+    for ( unsigned int i = 0; i < regions.size(); ++i )
+      {
+      if ( regions[i].GetNumberOfPixels() * sizeof( PixelType ) > io->GetWritingMemoryLimit() ||
+           regions[i].GetSize()[0] != largestRegion.GetSize()[0] ||
+           regions[i].GetSize()[1] != largestRegion.GetSize()[1] )
+        {
+        std::cerr << "Split " << i << " is not whole sections within the limit: " << regions[i] << std::endl;
+        ++numberOfLargeSplits;
+        }
+      }
+
+    const unsigned long numberOfDifferences =
+      this->CompareImage<ImageType>( outputFilename, inputFilename );
+
+    this->MeasurementNumericInteger( numberOfDifferences, "Number Of Pixels Different" );
+
+    return ( numberOfDifferences == 0 && numberOfLargeSplits == 0 &&
+             monitor->VerifyAllInputCanStream( expectedNumberOfSplits ) ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkStreamingImageIOMemoryLimitTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  StreamingImageIOMemoryLimitTest test;
+  return test.Main(argc, argv);
+}
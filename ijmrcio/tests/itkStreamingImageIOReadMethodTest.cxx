@@ -0,0 +1,366 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkExtractImageFilter.h"
+#include "itkStreamingImageFilter.h"
+
+#include "itkLocalFactory.h"
+#include "itkMRCImageIO.h"
+#include "itkVTKImageIO.h"
+#include "itkSlabCache.h"
+#include "itktfRegression.h"
+
+#include <itksys/SystemTools.hxx>
+
+// This test reads an image with one of the alternate low level read
+// methods of the StreamingImageIOBase, and compares the streamed
+// regions to the image read with the default stream methods.
+class StreamingImageIOReadMethodTest:
+  public itk::Regression
+{
+protected:
+
+  typedef unsigned char                           PixelType;
+  typedef itk::Image<PixelType,3>                 ImageType;
+  typedef itk::ImageFileReader<ImageType>         ReaderType;
+  typedef itk::Local::StreamingImageIOBase        StreamingImageIOType;
+
+
+  static StreamingImageIOType::Pointer CreateImageIO( const std::string &filename )
+  {
+    if ( itksys::SystemTools::GetFilenameLastExtension( filename ) == ".vtk" )
+      {
+      return itk::Local::VTKImageIO::New().GetPointer();
+      }
+    return itk::Local::MRCImageIO::New().GetPointer();
+  }
+
+
+  // enables the read method on the ImageIO, returns false if the
+  // method is unknown
+  bool SetReadMethod( StreamingImageIOType *io, const std::string &method )
+  {
+    if ( method == "stream" )
+      {
+      // the default
+      }
+    else if ( method == "mmap" )
+      {
+      io->UseMemoryMappedReadingOn();
+      }
+    else if ( method == "preadv" )
+      {
+      io->UsePositionalVectoredIOOn();
+      io->SetVectoredIOBatchSize( 8 );
+      }
+    else if ( method == "threads" )
+      {
+      // the small slices divide even the test images between the
+      // threads
+      io->SetNumberOfIOThreads( 4 );
+      io->SetMinimumBytesPerIOThread( 1024 );
+      }
+    else if ( method == "uring" )
+      {
+      // falls back to the stream methods without io_uring
+      io->UseAsynchronousIOOn();
+      io->SetAsynchronousIOQueueDepth( 16 );
+      }
+    else if ( method == "readahead" )
+      {
+      io->UseReadAheadOn();
+      }
+    else if ( method == "cache" )
+      {
+      io->UseFileCacheOn();
+      }
+    else if ( method == "widen" )
+      {
+      // the regions are widened to whole rows and sections, and
+      // cropped by the reader
+      io->SetSeekCostInBytes( 1024*1024 );
+      }
+    else if ( method == "slabcache" )
+      {
+      // the overlapping regions are assembled from cached sections
+      io->UseSlabCacheOn();
+      itk::Local::SlabCache::Clear();
+      itk::Local::SlabCache::ResetCounters();
+      }
+    else if ( method == "direct" )
+      {
+      // the small alignment and staging buffer divide the image into
+      // many unaligned blocks
+      io->UseDirectIOOn();
+      io->SetDirectIOAlignment( 512 );
+      io->SetStagingBufferSize( 4096 );
+      }
+    else
+      {
+      return false;
+      }
+    return true;
+  }
+
+
+  unsigned long CompareRegion( ReaderType *reader,
+                               ImageType::ConstPointer baselineImage,
+                               const ImageType::RegionType &region,
+                               const std::string &name )
+  {
+    typedef itk::ExtractImageFilter<ImageType, ImageType> ExtractImageFilter;
+    ExtractImageFilter::Pointer extractor = ExtractImageFilter::New();
+    extractor->SetInput( reader->GetOutput() );
+    extractor->SetExtractionRegion( region );
+
+    std::cout << "=== Updating " << name << " IORegion ==" << std::endl;
+    extractor->UpdateLargestPossibleRegion();
+
+    return this->CompareImage<ImageType>( extractor->GetOutput(), baselineImage, region );
+  }
+
+
+  // With a seek cost the streamable region of a narrow region is
+  // widened to contain it, without one it is the requested region.
+  // Returns the number of errors.
+  unsigned long CompareStreamableRegion( StreamingImageIOType *io,
+                                         const ImageType::RegionType &region,
+                                         const std::string &name )
+  {
+    itk::ImageIORegion requested( ImageType::ImageDimension );
+    for ( unsigned int i = 0; i < ImageType::ImageDimension; ++i )
+      {
+      requested.SetIndex( i, region.GetIndex()[i] );
+      requested.SetSize( i, region.GetSize()[i] );
+      }
+
+    const itk::ImageIORegion streamable = io->GenerateStreamableReadRegionFromRequestedRegion( requested );
+
+    bool contains = true;
+    bool equal = true;
+    for ( unsigned int i = 0; i < ImageType::ImageDimension; ++i )
+      {
+      contains = contains && streamable.GetIndex( i ) <= requested.GetIndex( i ) &&
+        streamable.GetIndex( i ) + streamable.GetSize( i ) >= requested.GetIndex( i ) + requested.GetSize( i );
+      equal = equal && streamable.GetIndex( i ) == requested.GetIndex( i ) &&
+        streamable.GetSize( i ) == requested.GetSize( i );
+      }
+
+    std::cout << "The streamable region of " << name << " with a seek cost of " << io->GetSeekCostInBytes() 
+              << " bytes has " << streamable.GetNumberOfPixels() << " pixels for " 
+              << requested.GetNumberOfPixels() << " requested" << std::endl;
+
+    if ( !contains || ( io->GetSeekCostInBytes() > 0 ) == equal )
+      {
+      std::cerr << "The streamable region of " << name << " is incorrect" << std::endl;
+      return 1;
+      }
+    return 0;
+  }
+
+
+  static void PrintSlabCacheCounters( const std::string &name )
+  {
+    std::cout << name << " slab cache hits: " << itk::Local::SlabCache::GetNumberOfHits() 
+              << " misses: " << itk::Local::SlabCache::GetNumberOfMisses() 
+              << " evictions: " << itk::Local::SlabCache::GetNumberOfEvictions() << std::endl;
+  }
+
+
+  // reads the image again through the sections cached by the first
+  // reads, then streamed through a cache too small to hold it
+  unsigned long TestSlabCache( const std::string &filename, ImageType::ConstPointer baselineImage )
+  {
+    typedef itk::Local::SlabCache SlabCacheType;
+
+    const ImageType::RegionType largestRegion = baselineImage->GetLargestPossibleRegion();
+    unsigned long numberOfDifferences = 0;
+
+    // the sections of the fullx3x3 region were all read before
+    SlabCacheType::ResetCounters();
+    ImageType::RegionType ioregion = largestRegion;
+    ioregion.SetIndex(1, largestRegion.GetIndex()[1]+largestRegion.GetSize()[1]/2 + 1);
+    ioregion.SetIndex(2, largestRegion.GetIndex()[2]+largestRegion.GetSize()[2]/2 + 1);
+    ioregion.SetSize(1, 3);
+    ioregion.SetSize(2, 3);
+
+    StreamingImageIOType::Pointer io = CreateImageIO( filename );
+    io->UseSlabCacheOn();
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( filename );
+    reader->SetImageIO( io );
+    reader->UseStreamingOn();
+    numberOfDifferences += this->CompareRegion( reader, baselineImage, ioregion, "cached fullx3x3" );
+
+    PrintSlabCacheCounters( "Second read" );
+    if ( SlabCacheType::GetNumberOfHits() == 0 )
+      {
+      std::cerr << "The second read did not find the cached sections" << std::endl;
+      ++numberOfDifferences;
+      }
+
+    // the cache holds a few sections, which are evicted as the
+    // pieces are streamed
+    io = CreateImageIO( filename );
+    io->UseSlabCacheOn();
+    reader = ReaderType::New();
+    reader->SetFileName( filename );
+    reader->SetImageIO( io );
+    reader->UseStreamingOn();
+    reader->UpdateOutputInformation();
+
+    const SlabCacheType::SizeType maximumSize = SlabCacheType::GetMaximumSize();
+    SlabCacheType::SetMaximumSize( 4 * largestRegion.GetSize()[0] * largestRegion.GetSize()[1] * io->GetPixelSize() );
+    SlabCacheType::Clear();
+    SlabCacheType::ResetCounters();
+
+    typedef itk::StreamingImageFilter<ImageType, ImageType> StreamingFilter;
+    StreamingFilter::Pointer streamer = StreamingFilter::New();
+    streamer->SetInput( reader->GetOutput() );
+    streamer->SetNumberOfStreamDivisions( 4 );
+    streamer->UpdateLargestPossibleRegion();
+    numberOfDifferences += this->CompareImage<ImageType>( streamer->GetOutput(), baselineImage );
+
+    PrintSlabCacheCounters( "Small cache" );
+    if ( SlabCacheType::GetNumberOfEvictions() == 0 || 
+         SlabCacheType::GetSize() > SlabCacheType::GetMaximumSize() )
+      {
+      std::cerr << "The small cache did not evict sections" << std::endl;
+      ++numberOfDifferences;
+      }
+
+    SlabCacheType::SetMaximumSize( maximumSize );
+    SlabCacheType::Clear();
+
+    return numberOfDifferences;
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    if( argc < 3 )
+      {
+      std::cerr << "Usage: " << argv[0] << " inputFile readMethod" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const std::string filename = argv[1];
+    const std::string method = argv[2];
+
+    StreamingImageIOType::Pointer io = CreateImageIO( filename );
+
+    if ( !this->SetReadMethod( io, method ) )
+      {
+      std::cerr << "Unknown read method: " << method << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    ReaderType::Pointer baselineReader = ReaderType::New();
+    baselineReader->SetFileName( filename );
+    baselineReader->UpdateLargestPossibleRegion();
+
+    ImageType::ConstPointer baselineImage = baselineReader->GetOutput();
+    const ImageType::RegionType largestRegion = baselineImage->GetLargestPossibleRegion();
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( filename );
+    reader->SetImageIO( io );
+    reader->UseStreamingOn();
+
+    unsigned long numberOfDifferences = 0;
+
+    ////////////////////////////////////////////////
+    // test whole image, not streamed
+    numberOfDifferences += this->CompareRegion( reader, baselineImage, largestRegion, "full" );
+
+    ImageType::RegionType ioregion = largestRegion;
+
+    ////////////////////////////////////////////////
+    // test fullx3x3
+    ioregion.SetIndex(0, largestRegion.GetIndex()[0]);
+    ioregion.SetIndex(1, largestRegion.GetIndex()[1]+largestRegion.GetSize()[1]/2 + 1);
+    ioregion.SetIndex(2, largestRegion.GetIndex()[2]+largestRegion.GetSize()[2]/2 + 1);
+    ioregion.SetSize(0, largestRegion.GetSize()[0]);
+    ioregion.SetSize(1, 3);
+    ioregion.SetSize(2, 3);
+    numberOfDifferences += this->CompareRegion( reader, baselineImage, ioregion, "fullx3x3" );
+
+    ////////////////////////////////////////////////
+    // test 3xfullx3
+    ioregion.SetIndex(0, largestRegion.GetIndex()[0]+largestRegion.GetSize()[0]/2 + 1);
+    ioregion.SetIndex(1, largestRegion.GetIndex()[1]);
+    ioregion.SetIndex(2, largestRegion.GetIndex()[2]+largestRegion.GetSize()[2]/2 + 1);
+    ioregion.SetSize(0, 3);
+    ioregion.SetSize(1, largestRegion.GetSize()[1]);
+    ioregion.SetSize(2, 3);
+    numberOfDifferences += this->CompareRegion( reader, baselineImage, ioregion, "3xfullx3" );
+
+    ////////////////////////////////////////////////
+    // test 3x3xfull
+    ioregion.SetIndex(0, largestRegion.GetIndex()[0]+largestRegion.GetSize()[0]/2 + 1);
+    ioregion.SetIndex(1, largestRegion.GetIndex()[1]+largestRegion.GetSize()[1]/2 + 1);
+    ioregion.SetIndex(2, largestRegion.GetIndex()[2]);
+    ioregion.SetSize(0, 3);
+    ioregion.SetSize(1, 3);
+    ioregion.SetSize(2, largestRegion.GetSize()[2]);
+    numberOfDifferences += this->CompareRegion( reader, baselineImage, ioregion, "3x3xfull" );
+
+    ////////////////////////////////////////////////
+    // the runs of the 3x3xfull region are short, so it is widened
+    // when the seeks are expensive
+    numberOfDifferences += this->CompareStreamableRegion( io, ioregion, "3x3xfull" );
+    if ( io->GetSeekCostInBytes() > 0 )
+      {
+      const StreamingImageIOType::SizeType seekCost = io->GetSeekCostInBytes();
+      io->SetSeekCostInBytes( 0 );
+      numberOfDifferences += this->CompareStreamableRegion( io, ioregion, "3x3xfull" );
+      io->SetSeekCostInBytes( seekCost );
+      }
+
+    ////////////////////////////////////////////////
+    // test whole image streamed in pieces
+    typedef itk::StreamingImageFilter<ImageType, ImageType> StreamingFilter;
+    StreamingFilter::Pointer streamer = StreamingFilter::New();
+    streamer->SetInput( reader->GetOutput() );
+    streamer->SetNumberOfStreamDivisions( 4 );
+
+    std::cout << "=== Updating streamed full IORegion ==" << std::endl;
+    streamer->UpdateLargestPossibleRegion();
+    numberOfDifferences += this->CompareImage<ImageType>( streamer->GetOutput(), baselineImage );
+
+    this->MeasurementNumericInteger( numberOfDifferences, "Number Of Pixels Different" );
+
+    std::cout << "Number of IO calls: " << io->GetNumberOfIOCalls() << std::endl;
+
+#if defined(IJMRCIO_HAVE_POSIX_FADVISE)
+    // the streamed pieces after the first are predicted
+    if ( io->GetUseReadAhead() )
+      {
+      std::cout << "Read ahead ranges: " << io->GetNumberOfReadAheadRanges() << std::endl;
+      if ( io->GetNumberOfReadAheadRanges() == 0 )
+        {
+        std::cerr << "No read ahead was advised" << std::endl;
+        ++numberOfDifferences;
+        }
+      }
+#endif
+
+    if ( io->GetUseSlabCache() )
+      {
+      numberOfDifferences += this->TestSlabCache( filename, baselineImage );
+      }
+
+    return ( numberOfDifferences == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkStreamingImageIOReadMethodTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  StreamingImageIOReadMethodTest test;
+  return test.Main(argc, argv);
+}
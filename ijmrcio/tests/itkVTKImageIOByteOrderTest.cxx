@@ -0,0 +1,349 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+#include "itkExtractImageFilter.h"
+#include "itkStreamingImageFilter.h"
+#include "itkByteSwapper.h"
+
+#include "itkLocalFactory.h"
+#include "itktfRegression.h"
+
+#include "../itkVTKImageIO.h"
+
+#include <itksys/SystemTools.hxx>
+
+#include <fstream>
+#include <vector>
+
+// This test reads big endian short and float VTK files, written here
+// byte by byte, with the VTKImageIO whole and streamed in pieces, and
+// compares the pixels to the values written. Then the images are
+// written by the VTKImageIO through small staging buffers, whole,
+// streamed in pieces and pasted into the streamed file, and the bytes
+// of the files are compared to those written by hand. Last a float
+// image with slices larger than the blocks in which the bytes are
+// swapped is streamed in slices.
+class VTKImageIOByteOrderTest:
+  public itk::Regression
+{
+protected:
+
+  // the values of the test image, which use all the bytes of the
+  // components
+  static short Value( unsigned long i, short * )
+  {
+    return static_cast<short>( static_cast<long>( ( i * 7919 ) % 65536 ) - 32768 );
+  }
+  static float Value( unsigned long i, float * )
+  {
+    return static_cast<float>( i ) * 0.37f - 1000.5f;
+  }
+
+
+  template <typename TPixel>
+  static typename itk::Image<TPixel,3>::Pointer MakeImage( unsigned long sizeX = 37,
+                                                           unsigned long sizeY = 23,
+                                                           unsigned long sizeZ = 11 )
+  {
+    typedef itk::Image<TPixel,3> ImageType;
+    typename ImageType::SizeType size;
+    size[0] = sizeX;
+    size[1] = sizeY;
+    size[2] = sizeZ;
+
+    typename ImageType::Pointer image = ImageType::New();
+    image->SetRegions( size );
+    image->Allocate();
+
+    unsigned long i = 0;
+    itk::ImageRegionIterator<ImageType> it( image, image->GetLargestPossibleRegion() );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it, ++i )
+      {
+      it.Set( Value( i, static_cast<TPixel *>( 0 ) ) );
+      }
+    return image;
+  }
+
+
+  // the image as the big endian bytes of a VTK file
+  template <typename TPixel>
+  static std::vector<char> BigEndianData( const itk::Image<TPixel,3> *image )
+  {
+    const unsigned long numberOfPixels = image->GetLargestPossibleRegion().GetNumberOfPixels();
+    std::vector<TPixel> values( image->GetBufferPointer(), image->GetBufferPointer() + numberOfPixels );
+    itk::ByteSwapper<TPixel>::SwapRangeFromSystemToBigEndian( &values[0], numberOfPixels );
+
+    const char *bytes = reinterpret_cast<const char *>( &values[0] );
+    return std::vector<char>( bytes, bytes + numberOfPixels * sizeof( TPixel ) );
+  }
+
+
+  template <typename TPixel>
+  static void WriteByHand( const itk::Image<TPixel,3> *image, const std::string &filename, const char *typeName )
+  {
+    const typename itk::Image<TPixel,3>::SizeType size = image->GetLargestPossibleRegion().GetSize();
+    const std::vector<char> data = BigEndianData<TPixel>( image );
+
+    std::ofstream file( filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+    file << "# vtk DataFile Version 3.0\n"
+         << "VTK File\n"
+         << "BINARY\n"
+         << "DATASET STRUCTURED_POINTS\n"
+         << "DIMENSIONS " << size[0] << " " << size[1] << " " << size[2] << "\n"
+         << "SPACING 1 1 1\n"
+         << "ORIGIN 0 0 0\n"
+         << "POINT_DATA " << image->GetLargestPossibleRegion().GetNumberOfPixels() << "\n"
+         << "SCALARS scalars " << typeName << " 1\n"
+         << "LOOKUP_TABLE default\n";
+    file.write( &data[0], data.size() );
+  }
+
+
+  template <typename TPixel>
+  unsigned long CompareRead( const std::string &filename, const itk::Image<TPixel,3> *image )
+  {
+    typedef itk::Image<TPixel,3>                           ImageType;
+    typedef itk::ImageFileReader<ImageType>                ReaderType;
+    typedef itk::StreamingImageFilter<ImageType,ImageType> StreamingFilter;
+    typedef itk::ExtractImageFilter<ImageType,ImageType>   ExtractImageFilter;
+
+    unsigned long numberOfDifferences = 0;
+
+    // the whole image
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( filename );
+    reader->SetImageIO( itk::Local::VTKImageIO::New() );
+    reader->Update();
+    numberOfDifferences += this->CompareImage<ImageType>( reader->GetOutput(), image );
+
+    // streamed in pieces, with the smallest staging buffer
+    itk::Local::VTKImageIO::Pointer io = itk::Local::VTKImageIO::New();
+    io->SetStagingBufferSize( 4096 );
+    typename ReaderType::Pointer streamingReader = ReaderType::New();
+    streamingReader->SetFileName( filename );
+    streamingReader->SetImageIO( io );
+    streamingReader->UseStreamingOn();
+
+    typename StreamingFilter::Pointer streamer = StreamingFilter::New();
+    streamer->SetInput( streamingReader->GetOutput() );
+    streamer->SetNumberOfStreamDivisions( 4 );
+    streamer->UpdateLargestPossibleRegion();
+    numberOfDifferences += this->CompareImage<ImageType>( streamer->GetOutput(), image );
+
+    // a region of short runs
+    typename ImageType::RegionType region = image->GetLargestPossibleRegion();
+    region.SetIndex( 0, 5 );
+    region.SetSize( 0, 3 );
+    region.SetIndex( 2, 2 );
+    region.SetSize( 2, 7 );
+    typename ExtractImageFilter::Pointer extractor = ExtractImageFilter::New();
+    extractor->SetInput( streamingReader->GetOutput() );
+    extractor->SetExtractionRegion( region );
+    extractor->UpdateLargestPossibleRegion();
+    numberOfDifferences += this->CompareImage<ImageType>( extractor->GetOutput(), image, region );
+
+    return numberOfDifferences;
+  }
+
+
+  // compares the data at the end of the file to the big endian bytes
+  // of the image
+  template <typename TPixel>
+  static unsigned long CompareData( const std::string &filename, const itk::Image<TPixel,3> *image )
+  {
+    const std::vector<char> data = BigEndianData<TPixel>( image );
+    const unsigned long fileLength = itksys::SystemTools::FileLength( filename.c_str() );
+    if ( fileLength < data.size() )
+      {
+      std::cerr << filename << " is too short" << std::endl;
+      return 1;
+      }
+
+    std::vector<char> fileData( data.size() );
+    std::ifstream file( filename.c_str(), std::ios::in | std::ios::binary );
+    file.seekg( fileLength - data.size(), std::ios::beg );
+    file.read( &fileData[0], fileData.size() );
+
+    unsigned long numberOfDifferences = 0;
+    for ( unsigned long i = 0; i < data.size(); ++i )
+      {
+      if ( data[i] != fileData[i] )
+        {
+        ++numberOfDifferences;
+        }
+      }
+    if ( numberOfDifferences )
+      {
+      std::cerr << numberOfDifferences << " bytes of " << filename << " are different" << std::endl;
+      }
+    return numberOfDifferences;
+  }
+
+
+  template <typename TPixel>
+  unsigned long CompareWrite( const std::string &filename, const itk::Image<TPixel,3> *image )
+  {
+    typedef itk::Image<TPixel,3>            ImageType;
+    typedef itk::ImageFileWriter<ImageType> WriterType;
+
+    // the smallest staging buffer, so that the two buffers alternate
+    // several times
+    itk::Local::VTKImageIO::Pointer io = itk::Local::VTKImageIO::New();
+    io->SetFileTypeToBinary();
+    io->SetStagingBufferSize( 4096 );
+
+    itksys::SystemTools::RemoveFile( filename.c_str() );
+    typename WriterType::Pointer writer = WriterType::New();
+    writer->SetFileName( filename );
+    writer->SetInput( image );
+    writer->SetImageIO( io );
+    writer->Update();
+
+    unsigned long numberOfDifferences = CompareData<TPixel>( filename, image );
+    if ( io->GetPeakStagingMemory() != 2*4096 )
+      {
+      std::cerr << "The peak staging memory is " << io->GetPeakStagingMemory() << std::endl;
+      ++numberOfDifferences;
+      }
+    return numberOfDifferences + this->CompareRead<TPixel>( filename, image );
+  }
+
+
+  template <typename TPixel>
+  unsigned long CompareStreamedWrite( const std::string &filename, const itk::Image<TPixel,3> *image )
+  {
+    typedef itk::Image<TPixel,3>            ImageType;
+    typedef itk::ImageFileWriter<ImageType> WriterType;
+
+    unsigned long numberOfDifferences = 0;
+
+    // streamed into a new file, the pieces are larger than the
+    // staging buffer
+    itksys::SystemTools::RemoveFile( filename.c_str() );
+    {
+    itk::Local::VTKImageIO::Pointer io = itk::Local::VTKImageIO::New();
+    io->SetFileTypeToBinary();
+    io->SetStagingBufferSize( 4096 );
+
+    typename WriterType::Pointer writer = WriterType::New();
+    writer->SetFileName( filename );
+    writer->SetInput( image );
+    writer->SetImageIO( io );
+    writer->SetNumberOfStreamDivisions( 3 );
+    writer->Update();
+    }
+    numberOfDifferences += CompareData<TPixel>( filename, image );
+
+    // a region of short runs of other values is pasted into the file
+    typename ImageType::RegionType pasteRegion = image->GetLargestPossibleRegion();
+    pasteRegion.SetIndex( 0, 5 );
+    pasteRegion.SetSize( 0, 3 );
+    pasteRegion.SetIndex( 1, 4 );
+    pasteRegion.SetSize( 1, 15 );
+    pasteRegion.SetIndex( 2, 2 );
+    pasteRegion.SetSize( 2, 7 );
+
+    typename ImageType::Pointer pastedImage = MakeImage<TPixel>();
+    unsigned long i = 0;
+    itk::ImageRegionIterator<ImageType> it( pastedImage, pasteRegion );
+    for ( it.GoToBegin(); !it.IsAtEnd(); ++it, ++i )
+      {
+      it.Set( Value( 100003 + i, static_cast<TPixel *>( 0 ) ) );
+      }
+
+    itk::ImageIORegion ioregion( 3 );
+    for ( unsigned int d = 0; d < 3; ++d )
+      {
+      ioregion.SetIndex( d, pasteRegion.GetIndex()[d] );
+      ioregion.SetSize( d, pasteRegion.GetSize()[d] );
+      }
+    {
+    itk::Local::VTKImageIO::Pointer io = itk::Local::VTKImageIO::New();
+    io->SetFileTypeToBinary();
+    io->SetStagingBufferSize( 4096 );
+
+    typename WriterType::Pointer writer = WriterType::New();
+    writer->SetFileName( filename );
+    writer->SetInput( pastedImage );
+    writer->SetImageIO( io );
+    writer->SetIORegion( ioregion );
+    writer->Update();
+    }
+    numberOfDifferences += CompareData<TPixel>( filename, pastedImage );
+
+    return numberOfDifferences + this->CompareRead<TPixel>( filename, pastedImage );
+  }
+
+
+  template <typename TPixel>
+  unsigned long TestPixelType( const std::string &filename, const char *typeName )
+  {
+    typedef itk::Image<TPixel,3> ImageType;
+    typename ImageType::Pointer image = MakeImage<TPixel>();
+
+    WriteByHand<TPixel>( image, filename, typeName );
+    unsigned long numberOfDifferences = this->CompareRead<TPixel>( filename, image );
+    numberOfDifferences += this->CompareWrite<TPixel>( filename, image );
+    numberOfDifferences += this->CompareStreamedWrite<TPixel>( filename, image );
+    return numberOfDifferences;
+  }
+
+
+  // each of the pieces is one run of 720000 bytes, which is read
+  // through the stream in several blocks
+  unsigned long TestLargeRuns( const std::string &filename )
+  {
+    typedef itk::Image<float,3>                            ImageType;
+    typedef itk::ImageFileReader<ImageType>                ReaderType;
+    typedef itk::StreamingImageFilter<ImageType,ImageType> StreamingFilter;
+
+    ImageType::Pointer image = MakeImage<float>( 300, 300, 4 );
+    WriteByHand<float>( image, filename, "float" );
+
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( filename );
+    reader->SetImageIO( itk::Local::VTKImageIO::New() );
+    reader->UseStreamingOn();
+
+    StreamingFilter::Pointer streamer = StreamingFilter::New();
+    streamer->SetInput( reader->GetOutput() );
+    streamer->SetNumberOfStreamDivisions( 2 );
+    streamer->UpdateLargestPossibleRegion();
+    return this->CompareImage<ImageType>( streamer->GetOutput(), image );
+  }
+
+
+  virtual int Test(int argc, char* argv[] )
+  {
+    if( argc < 4 )
+      {
+      std::cerr << "Usage: " << argv[0] << " outputShortFile outputFloatFile outputLargeFloatFile" << std::endl;
+      return EXIT_FAILURE;
+      }
+
+    const unsigned long shortDifferences = this->TestPixelType<short>( argv[1], "short" );
+    this->MeasurementNumericInteger( shortDifferences, "Number Of Short Pixels Different" );
+
+    const unsigned long floatDifferences = this->TestPixelType<float>( argv[2], "float" );
+    this->MeasurementNumericInteger( floatDifferences, "Number Of Float Pixels Different" );
+
+    const unsigned long largeDifferences = this->TestLargeRuns( argv[3] );
+    this->MeasurementNumericInteger( largeDifferences, "Number Of Large Run Pixels Different" );
+
+    return ( shortDifferences == 0 && floatDifferences == 0 && largeDifferences == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+
+int itkVTKImageIOByteOrderTest(int argc, char* argv[])
+{
+  itk::Local::LocalFactory::RegisterOneFactory();
+
+  VTKImageIOByteOrderTest test;
+  return test.Main(argc, argv);
+}